@@ -0,0 +1,151 @@
+// copyright defined in LICENSE.txt
+
+// Measures the converter work fill-pg does for each row: to_sql_values(), and append_sql_values() into text and binary COPY
+// rows, with and without compiled row encoders. Each case reports rows/s, input and output bytes/s, and heap allocations per
+// row. Pass a case name's prefix to run only the matching cases.
+
+#include "test_fixture.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+
+static std::atomic<uint64_t> num_allocations{0};
+
+void* operator new(std::size_t size) {
+    ++num_allocations;
+    if (auto* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc{};
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+struct bench_case {
+    std::string                   name;
+    std::vector<char>             row; // the row's binary form, as it comes from state history
+    std::function<size_t(size_t)> run; // converts the row n times; returns the bytes produced
+};
+
+static void report(const bench_case& c) {
+    using clock = std::chrono::steady_clock;
+    c.run(100); // warm up: buffers reach their steady sizes
+
+    uint64_t rows = 0, out_bytes = 0, batch = 1000;
+    auto     allocations = num_allocations.load();
+    auto     start       = clock::now();
+    auto     elapsed     = clock::duration{};
+    do {
+        out_bytes += c.run(batch);
+        rows += batch;
+        elapsed = clock::now() - start;
+    } while (elapsed < std::chrono::seconds(1));
+    allocations = num_allocations.load() - allocations;
+
+    double secs = std::chrono::duration<double>(elapsed).count();
+    printf("%-44s %12.0f rows/s %9.1f MB/s in %9.1f MB/s out %8.2f allocs/row\n", c.name.c_str(), rows / secs,
+           rows * c.row.size() / secs / 1e6, out_bytes / secs / 1e6, (double)allocations / rows);
+}
+
+struct bench_fixture : test_fixture_t {
+    std::vector<bench_case> cases;
+
+    // adds the cases for one table's row type
+    template <typename T>
+    void add_table(const std::string& table, const eosio::abi_type& type, const T& value, bool binary) {
+        auto row = eosio::convert_to_bin(value);
+        auto append = [this, &type, row](bool binary_format, bool encoder) {
+            return [this, &type, row, binary_format, encoder, out = std::string{}](size_t n) mutable {
+                converter.binary_format = binary_format;
+                converter.reset_row_encoders();
+                if (encoder)
+                    converter.compile_row_encoder(type);
+                size_t bytes = 0;
+                for (size_t i = 0; i < n; ++i) {
+                    // fill-pg appends many rows into one COPY buffer, which it clears once it's sent
+                    if (out.size() > (1 << 20))
+                        out.clear();
+                    auto                before = out.size();
+                    eosio::input_stream bin{row};
+                    if (type.as_struct())
+                        converter.append_sql_values(out, bin, *type.as_struct());
+                    else
+                        converter.append_sql_values(out, bin, type.name, *type.as_variant());
+                    bytes += out.size() - before;
+                }
+                return bytes;
+            };
+        };
+
+        cases.push_back({table + " to_sql_values", row, [this, &type, row, values = std::vector<std::string>{}](size_t n) mutable {
+                             converter.binary_format = false;
+                             converter.reset_row_encoders();
+                             size_t bytes = 0;
+                             for (size_t i = 0; i < n; ++i) {
+                                 values.clear();
+                                 eosio::input_stream bin{row};
+                                 if (type.as_struct())
+                                     converter.to_sql_values(bin, *type.as_struct(), values);
+                                 else
+                                     converter.to_sql_values(bin, type.name, *type.as_variant(), values);
+                                 for (auto& v : values)
+                                     bytes += v.size() + 1;
+                             }
+                             return bytes;
+                         }});
+        cases.push_back({table + " append_sql_values text", row, append(false, false)});
+        cases.push_back({table + " append_sql_values text encoder", row, append(false, true)});
+        // binary composite values need the oids of the schema's types, which only a database has
+        if (binary) {
+            cases.push_back({table + " append_sql_values binary", row, append(true, false)});
+            cases.push_back({table + " append_sql_values binary encoder", row, append(true, true)});
+        }
+    }
+
+    bench_fixture() {
+        using namespace eosio::literals;
+        abi.add_type<test_protocol::global_property>();
+
+        auto& chain_config_abi = *abi.get_type(get_type_name((test_protocol::chain_config*)nullptr));
+        add_table(
+            "chain_config", chain_config_abi,
+            test_protocol::chain_config{test_protocol::chain_config_v0{10001, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17}},
+            true);
+
+        test_protocol::authority auth{1,
+                                      {{eosio::public_key_from_string("PUB_K1_6Uaww2itj2Ne7ADEdyqpHbsg42rtNQGSNyomEoREdxAHvShLZq"), 1}},
+                                      {{{"eosio.prods"_n, "active"_n}, 1}},
+                                      {}};
+        add_table(
+            "permission", *abi.add_type<test_protocol::permission>(),
+            test_protocol::permission{test_protocol::permission_v0{"eosio"_n, "active"_n, ""_n, eosio::time_point{}, auth}}, false);
+
+        test_protocol::transaction_trace_v0   transaction;
+        test_protocol::partial_transaction_v1 pt_v1;
+        pt_v1.prunable_data.emplace();
+        transaction.partial.emplace(pt_v1);
+        for (uint32_t i = 0; i < 4; ++i) {
+            test_protocol::action_trace_v1 action;
+            action.action_ordinal.value = i + 1;
+            action.receiver             = "eosio.token"_n;
+            action.act.account          = "eosio.token"_n;
+            action.act.name             = "transfer"_n;
+            action.act.authorization.push_back({"alice"_n, "active"_n});
+            action.console = "transfer done";
+            transaction.action_traces.push_back(test_protocol::action_trace{action});
+        }
+        add_table("transaction_trace", *abi.add_type<test_protocol::transaction_trace>(), test_protocol::transaction_trace{transaction},
+                  false);
+    }
+};
+
+int main(int argc, char** argv) {
+    bench_fixture fixture;
+    for (auto& c : fixture.cases)
+        if (argc < 2 || !strncmp(c.name.c_str(), argv[1], strlen(argv[1])))
+            report(c);
+}
@@ -0,0 +1,244 @@
+// copyright defined in LICENSE.txt
+
+// Replays query requests recorded by wasm-ql's --wql-request-log against a running wasm-ql, over a number of keep-alive
+// connections which each have one request in flight. Reports QPS, latency percentiles overall and by target, and, given the
+// server's --metrics-listen endpoint, the time the server spent loading modules, running wasms and in query_database.
+
+#include "request_log.hpp"
+
+#include <boost/asio/connect.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <thread>
+
+namespace beast = boost::beast;
+namespace http  = beast::http;
+namespace net   = boost::asio;
+namespace bpo   = boost::program_options;
+using tcp       = net::ip::tcp;
+using steady    = std::chrono::steady_clock;
+
+struct endpoint {
+    std::string host;
+    std::string port;
+};
+
+static endpoint parse_endpoint(const std::string& s) {
+    auto colon = s.rfind(':');
+    if (colon == std::string::npos)
+        throw std::runtime_error("expected host:port, got " + s);
+    return {s.substr(0, colon), s.substr(colon + 1)};
+}
+
+/// one keep-alive connection; reconnects when the server closes it
+struct client {
+    net::io_context                   ioc;
+    endpoint                          target;
+    std::optional<beast::tcp_stream>  stream;
+    beast::flat_buffer                buffer;
+    http::response<http::string_body> res;
+
+    explicit client(endpoint target)
+        : target(std::move(target)) {}
+
+    void connect() {
+        tcp::resolver resolver{ioc};
+        stream.emplace(ioc);
+        stream->connect(resolver.resolve(target.host, target.port));
+        stream->socket().set_option(tcp::no_delay(true));
+    }
+
+    /// returns the status, or 0 if the request failed
+    unsigned request(http::verb verb, const std::string& path, const std::vector<char>& body) {
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            try {
+                if (!stream)
+                    connect();
+                http::request<http::string_body> req{verb, path, 11};
+                req.set(http::field::host, target.host);
+                req.set(http::field::content_type, "application/octet-stream");
+                req.body().assign(body.begin(), body.end());
+                req.prepare_payload();
+                http::write(*stream, req);
+                res = {};
+                http::read(*stream, buffer, res);
+                if (!res.keep_alive())
+                    stream.reset();
+                return res.result_int();
+            } catch (const std::exception&) {
+                stream.reset();
+                buffer.clear();
+            }
+        }
+        return 0;
+    }
+};
+
+struct thread_results {
+    std::vector<double>                        latencies; // in milliseconds
+    std::map<std::string, std::vector<double>> by_target;
+    std::map<unsigned, uint64_t>               statuses;
+};
+
+static double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty())
+        return 0;
+    return sorted[std::min(sorted.size() - 1, size_t(p / 100 * sorted.size()))];
+}
+
+/// the _sum and _count of the server's wasmql histograms
+static std::map<std::string, double> scrape(const endpoint& metrics) {
+    client                        c{metrics};
+    std::map<std::string, double> result;
+    if (c.request(http::verb::get, "/metrics", {}) != 200)
+        throw std::runtime_error("can't fetch /metrics from " + metrics.host + ":" + metrics.port);
+    std::istringstream in{c.res.body()};
+    std::string        line;
+    while (std::getline(in, line)) {
+        auto space = line.rfind(' ');
+        if (line.rfind("wasmql_", 0) != 0 || space == std::string::npos || line.find('{') != std::string::npos)
+            continue;
+        auto name      = line.substr(0, space);
+        auto ends_with = [&](const std::string& suffix) {
+            return name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+        };
+        if (ends_with("_sum") || ends_with("_count"))
+            result[name] = std::stod(line.substr(space + 1));
+    }
+    return result;
+}
+
+static void report_latencies(const char* label, std::vector<double>& latencies, double secs) {
+    std::sort(latencies.begin(), latencies.end());
+    printf("%-32s %9zu req %9.1f req/s   p50 %8.2f  p90 %8.2f  p99 %8.2f  p99.9 %8.2f  max %8.2f ms\n", label, latencies.size(),
+           latencies.size() / secs, percentile(latencies, 50), percentile(latencies, 90), percentile(latencies, 99),
+           percentile(latencies, 99.9), latencies.empty() ? 0 : latencies.back());
+}
+
+int main(int argc, char** argv) {
+    bpo::options_description desc{"wasm-ql-load options"};
+    auto                     op = desc.add_options();
+    op("help,h", "Show this help");
+    op("log", bpo::value<std::string>()->required(), "Request log written by --wql-request-log");
+    op("target", bpo::value<std::string>()->default_value("127.0.0.1:8880"), "wasm-ql's --wql-listen endpoint");
+    op("metrics", bpo::value<std::string>(), "wasm-ql's --metrics-listen endpoint, for the server-side breakdown");
+    op("concurrency,c", bpo::value<uint32_t>()->default_value(8), "Number of connections, each with one request in flight");
+    op("duration,d", bpo::value<uint32_t>()->default_value(30), "Seconds to run");
+    op("requests,n", bpo::value<uint64_t>()->default_value(0), "Stop after this many requests (0: only --duration limits the run)");
+    op("warmup", bpo::value<uint32_t>()->default_value(0), "Requests to send before measuring, e.g. to fill caches");
+
+    bpo::variables_map vm;
+    try {
+        bpo::store(bpo::parse_command_line(argc, argv, desc), vm);
+        if (vm.count("help")) {
+            std::ostringstream help;
+            help << desc;
+            printf("%s", help.str().c_str());
+            return 0;
+        }
+        bpo::notify(vm);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    try {
+        auto records = request_log::read(vm["log"].as<std::string>());
+        if (records.empty())
+            throw std::runtime_error("the request log has no records");
+        auto target       = parse_endpoint(vm["target"].as<std::string>());
+        auto concurrency  = std::max(vm["concurrency"].as<uint32_t>(), 1u);
+        auto duration     = std::chrono::seconds(vm["duration"].as<uint32_t>());
+        auto max_requests = vm["requests"].as<uint64_t>();
+        auto warmup       = vm["warmup"].as<uint32_t>();
+
+        if (warmup) {
+            client c{target};
+            for (uint32_t i = 0; i < warmup; ++i)
+                c.request(http::verb::post, records[i % records.size()].target, records[i % records.size()].body);
+        }
+
+        std::optional<endpoint>       metrics;
+        std::map<std::string, double> before;
+        if (vm.count("metrics")) {
+            metrics = parse_endpoint(vm["metrics"].as<std::string>());
+            before  = scrape(*metrics);
+        }
+
+        // the connections take records in the log's order, so the mix and its repetitions match the recording
+        std::atomic<uint64_t>       next{0};
+        std::vector<thread_results> results(concurrency);
+        std::vector<std::thread>    threads;
+        auto                        start    = steady::now();
+        auto                        deadline = start + duration;
+        for (uint32_t t = 0; t < concurrency; ++t) {
+            threads.emplace_back([&, t] {
+                client c{target};
+                auto&  r = results[t];
+                while (steady::now() < deadline) {
+                    auto i = next++;
+                    if (max_requests && i >= max_requests)
+                        break;
+                    auto& record = records[i % records.size()];
+                    auto  begin  = steady::now();
+                    auto  status = c.request(http::verb::post, record.target, record.body);
+                    auto  ms     = std::chrono::duration<double, std::milli>(steady::now() - begin).count();
+                    ++r.statuses[status];
+                    if (status == 200) {
+                        r.latencies.push_back(ms);
+                        r.by_target[record.target].push_back(ms);
+                    }
+                }
+            });
+        }
+        for (auto& t : threads)
+            t.join();
+        double secs = std::chrono::duration<double>(steady::now() - start).count();
+
+        thread_results all;
+        for (auto& r : results) {
+            all.latencies.insert(all.latencies.end(), r.latencies.begin(), r.latencies.end());
+            for (auto& [t, l] : r.by_target)
+                all.by_target[t].insert(all.by_target[t].end(), l.begin(), l.end());
+            for (auto& [s, n] : r.statuses)
+                all.statuses[s] += n;
+        }
+
+        printf("%u connections, %.1f s, %zu recorded requests\n", concurrency, secs, records.size());
+        for (auto& [s, n] : all.statuses)
+            printf("  status %-4s %10llu\n", s ? std::to_string(s).c_str() : "fail", (unsigned long long)n);
+        report_latencies("all (status 200)", all.latencies, secs);
+        for (auto& [t, l] : all.by_target)
+            report_latencies(t.c_str(), l, secs);
+
+        if (metrics) {
+            auto after = scrape(*metrics);
+            auto delta = [&](const std::string& name) { return after[name] - before[name]; };
+            auto ok    = std::max<double>(all.latencies.size(), 1);
+            printf("server time per request (ms), from %s:%s/metrics:\n", metrics->host.c_str(), metrics->port.c_str());
+            for (auto* h : {"wasmql_queue_wait_seconds", "wasmql_module_load_seconds", "wasmql_execution_seconds", "wasmql_database_seconds",
+                            "wasmql_cache_lock_wait_seconds"}) {
+                auto name = std::string{h};
+                if (!after.count(name + "_sum"))
+                    continue;
+                printf("  %-32s %10.3f  (%llu samples)\n", h, delta(name + "_sum") * 1000 / ok,
+                       (unsigned long long)delta(name + "_count"));
+            }
+            printf("  (execution includes database time; responses served from --wql-cache-size run no wasm)\n");
+        }
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -19,6 +19,7 @@
 /// block_select make_absolute_block(int32_t i);
 ///
 /// uint32_t get_block_num(const block_select& sel, const database_status& status);
+/// uint32_t get_block_num(const block_select& sel);
 /// ```
 /// `block_select` identifies blocks. This appears in JSON as one of the following:
 /// ```
@@ -36,6 +37,12 @@
 /// uint32_t get_block_num(const block_select& sel, const database_status& status);
 /// ```
 /// Returns the block that `sel` references.
+///
+/// ```c++
+/// uint32_t get_block_num(const block_select& sel);
+/// ```
+/// Returns the block that `sel` references, calling `get_database_status` only if `sel` is relative to head or
+/// irreversible. wasm-ql only caches replies from wasms which didn't read the status.
 
 /// \exclude
 namespace eosio {
@@ -62,4 +69,10 @@ inline uint32_t get_block_num(const block_select& sel, const database_status& st
     }
 }
 
+inline uint32_t get_block_num(const block_select& sel) {
+    if (sel.value.index() == 0)
+        return std::max((int32_t)0, std::get<0>(sel.value));
+    return get_block_num(sel, get_database_status());
+}
+
 } // namespace eosio
@@ -188,6 +188,15 @@ STRUCT_REFLECT(account) {
     STRUCT_MEMBER(account, abi)
 }
 
+/// An `account` which stays serialized in a query result; see `for_each_query_result_view`
+struct account_view : serialized_view {
+    uint32_t                block_num() const { return read<uint32_t>(0); }
+    bool                    present() const { return read<bool>(4); }
+    eosio::name             name() const { return eosio::name{read<uint64_t>(5)}; }
+    block_timestamp_type    creation_date() const { return block_timestamp_type{read<uint32_t>(13)}; }
+    datastream<const char*> abi() const { return read_bytes(17); }
+};
+
 /// Key for looking up code
 struct code_key {
     uint8_t     vm_type    = {};
@@ -318,6 +327,33 @@ struct contract_secondary_index_with_row {
     shared_memory<datastream<const char*>> row_value     = {};
 };
 
+/// A `contract_row` which stays serialized in a query result; see `for_each_query_result_view`
+struct contract_row_view : serialized_view {
+    uint32_t                block_num() const { return read<uint32_t>(0); }
+    bool                    present() const { return read<bool>(4); }
+    name                    code() const { return name{read<uint64_t>(5)}; }
+    name                    scope() const { return name{read<uint64_t>(13)}; }
+    name                    table() const { return name{read<uint64_t>(21)}; }
+    uint64_t                primary_key() const { return read<uint64_t>(29); }
+    name                    payer() const { return name{read<uint64_t>(37)}; }
+    datastream<const char*> value() const { return read_bytes(45); }
+};
+
+/// A `contract_secondary_index_with_row` which stays serialized in a query result; see `for_each_query_result_view`.
+/// `T` must have a fixed size.
+template <typename T>
+struct contract_secondary_index_with_row_view : contract_row_view {
+    static constexpr uint32_t row_offset = 45 + sizeof(T);
+
+    T                       secondary_key() const { return read<T>(45); }
+    uint32_t                row_block_num() const { return read<uint32_t>(row_offset); }
+    bool                    row_present() const { return read<bool>(row_offset + 4); }
+    name                    row_payer() const { return name{read<uint64_t>(row_offset + 5)}; }
+    datastream<const char*> row_value() const { return read_bytes(row_offset + 13); }
+
+    datastream<const char*> value() const = delete; // the secondary index record has no value; use row_value()
+};
+
 /// \output_section Queries
 /// Pass this to `query_database` to get `block_info` for a range of block indexes.
 /// The query results are sorted by `block_num`. Every record has a different block_num.
@@ -649,6 +685,16 @@ struct query_contract_row_range_code_table_scope_pk {
                 .primary_key = data.primary_key,
             };
         }
+
+        // Extract the key from `data`
+        static key from_data(const contract_row_view& data) {
+            return {
+                .code        = data.code(),
+                .table       = data.table(),
+                .scope       = data.scope(),
+                .primary_key = data.primary_key(),
+            };
+        }
     };
 
     /// Identifies query type. Do not modify this field.
@@ -764,6 +810,17 @@ struct query_contract_index64_range_code_table_scope_sk_pk {
                 .primary_key   = data.primary_key,
             };
         }
+
+        // Extract the key from `data`
+        static key from_data(const contract_secondary_index_with_row_view<uint64_t>& data) {
+            return {
+                .code          = data.code(),
+                .table         = data.table(),
+                .scope         = data.scope(),
+                .secondary_key = data.secondary_key(),
+                .primary_key   = data.primary_key(),
+            };
+        }
     };
 
     /// Identifies query type. Do not modify this field.
@@ -868,6 +925,61 @@ bool for_each_query_result(const std::vector<char>& bytes, F f) {
     return true;
 }
 
+/// Like `for_each_query_result`, but call `f(view)` with each record still serialized. `View` is a `serialized_view` type
+/// such as `contract_row_view`; it decodes only the members `f` reads.
+template <typename View, typename F>
+bool for_each_query_result_view(const std::vector<char>& bytes, F f) {
+    datastream<const char*> ds(bytes.data(), bytes.size());
+    unsigned_int            size;
+    ds >> size;
+    for (uint32_t i = 0; i < size.value; ++i) {
+        shared_memory<datastream<const char*>> record{};
+        ds >> record;
+        View v;
+        v.pos  = record->pos();
+        v.size = record->remaining();
+        if (!f(v))
+            return false;
+    }
+    return true;
+}
+
+/// \exclude
+extern "C" uint32_t query_database_open(void* req_begin, void* req_end);
+
+/// \exclude
+extern "C" void query_database_next(uint32_t cursor, uint32_t max_rows, void* cb_alloc_data,
+                                    void* (*cb_alloc)(void* cb_alloc_data, size_t size));
+
+/// \exclude
+extern "C" void query_database_close(uint32_t cursor);
+
+/// Query the database like `query_database`, but fetch the results `batch_size` records at a time. Only one batch is in
+/// memory at once. Unpack each record and call `f(record)`; stop early if `f` returns false. `T` is the record type.
+template <typename T, typename Q, typename F>
+bool for_each_streamed_query_result(const Q& request, uint32_t batch_size, F f) {
+    auto req_data = pack(request);
+    auto cursor   = query_database_open(req_data.data(), req_data.data() + req_data.size());
+
+    std::vector<char> batch;
+    bool              result = true;
+    while (result) {
+        query_database_next(cursor, batch_size, &batch, [](void* cb_alloc_data, size_t size) -> void* {
+            auto& batch = *reinterpret_cast<std::vector<char>*>(cb_alloc_data);
+            batch.resize(size);
+            return batch.data();
+        });
+        datastream<const char*> ds(batch.data(), batch.size());
+        unsigned_int            size;
+        ds >> size;
+        if (!size.value)
+            break;
+        result = for_each_query_result<T>(batch, f);
+    }
+    query_database_close(cursor);
+    return result;
+}
+
 /// Use with `query_contract_row_*`. Unpack each row of a query result and call
 /// `f(row, data)`. `row` is an instance of `contract_row`. `data` is the unpacked
 /// contract-specific data. `T` identifies the type of `data`.
@@ -888,6 +1000,26 @@ bool for_each_contract_row(const std::vector<char>& bytes, F f) {
     });
 }
 
+/// \exclude
+extern "C" bool contract_row_to_json(uint64_t account, uint32_t abi_block, const char* abi_begin, const char* abi_end, uint64_t table,
+                                     const char* row_begin, const char* row_end, void* cb_alloc_data,
+                                     void* (*cb_alloc)(void* cb_alloc_data, size_t size));
+
+/// Convert a row of `account`'s `table` to JSON using the serialized `abi`. The server keeps the parsed ABI between queries;
+/// `abi_block` (`account::block_num` of the row `abi` came from) tells it when the cached copy is stale. Returns false if the
+/// ABI or row doesn't decode.
+inline bool contract_row_to_json(name account, uint32_t abi_block, const datastream<const char*>& abi, name table,
+                                 const datastream<const char*>& row, std::string& json) {
+    auto alloc_fn = [&](size_t size) -> void* {
+        json.resize(size);
+        return json.data();
+    };
+    return contract_row_to_json(account.value, abi_block, abi.pos(), abi.pos() + abi.remaining(), table.value, row.pos(),
+                                row.pos() + row.remaining(), &alloc_fn, [](void* cb_alloc_data, size_t size) -> void* {
+                                    return (*reinterpret_cast<decltype(alloc_fn)*>(cb_alloc_data))(size);
+                                });
+}
+
 /// \exclude
 extern "C" void query_database(void* req_begin, void* req_end, void* cb_alloc_data, void* (*cb_alloc)(void* cb_alloc_data, size_t size));
 
@@ -3,7 +3,9 @@
 #pragma once
 
 #include <eosio/print.hpp>
+#include <deque>
 #include <eosio/rope.hpp>
+#include <string>
 #include <string_view>
 #include <vector>
 
@@ -47,4 +49,27 @@ inline void set_output_data(const std::string_view& v) { set_output_data(v.data(
 /// Set the wasm's output data
 inline void set_output_data(rope v) { return set_output_data(v.sv()); }
 
+/// \exclude
+extern "C" void set_output_pieces(const std::string_view* begin, const std::string_view* end);
+
+/// Output assembled from pieces. The server concatenates them straight into its reply, so the wasm never builds one
+/// contiguous copy. Views must outlive the call to `set_output_data`; strings are moved into `storage`.
+struct output_pieces {
+    std::vector<std::string_view> pieces  = {};
+    std::deque<std::string>       storage = {}; // deque: growing it doesn't move the strings pieces point into
+
+    output_pieces& operator+=(std::string_view sv) {
+        if (!sv.empty())
+            pieces.push_back(sv);
+        return *this;
+    }
+
+    output_pieces& operator+=(const char* s) { return *this += std::string_view{s}; }
+
+    output_pieces& operator+=(std::string&& s) { return *this += std::string_view{storage.emplace_back(std::move(s))}; }
+};
+
+/// Set the wasm's output data to the concatenation of `v.pieces`
+inline void set_output_data(const output_pieces& v) { set_output_pieces(v.pieces.data(), v.pieces.data() + v.pieces.size()); }
+
 } // namespace eosio
@@ -1,6 +1,7 @@
 // copyright defined in LICENSE.txt
 
 #pragma once
+#include <cstring>
 #include <eosio/asset.hpp>
 #include <eosio/fixed_bytes.hpp>
 #include <eosio/shared_memory.hpp>
@@ -31,10 +32,9 @@ __attribute__((noinline)) inline void parse_json(T& result, const char*& pos, co
 __attribute__((noinline)) inline void parse_json(std::string_view& result, const char*& pos, const char* end) {
     check(pos != end && *pos++ == '"', "expected string");
     auto begin = pos;
-    while (pos != end && *pos != '"')
-        ++pos;
-    auto e = pos;
-    check(pos != end && *pos++ == '"', "expected end of string");
+    auto e     = (const char*)memchr(pos, '"', end - pos);
+    check(e, "expected end of string");
+    pos    = e + 1;
     result = std::string_view(begin, e - begin);
 }
 
@@ -82,6 +82,7 @@ __attribute__((noinline)) inline void parse_json(uint64_t& result, const char*&
 __attribute__((noinline)) inline void parse_json(int32_t& result, const char*& pos, const char* end) {
     bool in_str = false;
     if (pos != end && *pos == '"') {
+        ++pos;
         in_str = true;
         parse_json_skip_space(pos, end);
     }
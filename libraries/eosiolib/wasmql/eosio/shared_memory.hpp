@@ -1,6 +1,8 @@
 // copyright defined in LICENSE.txt
 
 #pragma once
+#include <cstring>
+#include <eosio/check.hpp>
 #include <eosio/datastream.hpp>
 #include <string_view>
 
@@ -63,4 +65,30 @@ inline datastream<Stream>& operator<<(datastream<Stream>& ds, const shared_memor
     return ds;
 }
 
+/// A serialized object which stays in its source memory. Derived views decode a member only when it's read, from a
+/// constant offset when the members before it have fixed sizes. Like `shared_memory`, views require the source memory isn't
+/// freed and remains untouched.
+struct serialized_view {
+    const char* pos  = nullptr;
+    uint32_t    size = 0;
+
+    /// Read a fixed-size member at `offset`
+    template <typename T>
+    T read(uint32_t offset) const {
+        check(offset + sizeof(T) <= size, "serialized_view: read past end");
+        T result;
+        memcpy(&result, pos + offset, sizeof(T));
+        return result;
+    }
+
+    /// Read a size-prefixed member at `offset` without copying it
+    datastream<const char*> read_bytes(uint32_t offset) const {
+        check(offset <= size, "serialized_view: read past end");
+        datastream<const char*>                ds{pos + offset, size - offset};
+        shared_memory<datastream<const char*>> result;
+        ds >> result;
+        return *result;
+    }
+};
+
 }; // namespace eosio
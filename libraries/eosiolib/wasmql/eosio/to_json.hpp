@@ -43,6 +43,45 @@ struct rope_buffer {
 
 inline constexpr char hex_digits[] = "0123456789ABCDEF";
 
+inline constexpr char digit_pairs[] = "0001020304050607080910111213141516171819"
+                                      "2021222324252627282930313233343536373839"
+                                      "4041424344454647484950515253545556575859"
+                                      "6061626364656667686970717273747576777879"
+                                      "8081828384858687888990919293949596979899";
+
+// characters which to_json(std::string_view) escapes
+inline constexpr struct json_escape_table {
+    bool needs_escape[256] = {};
+
+    constexpr json_escape_table() {
+        for (int i = 0; i < 32; ++i)
+            needs_escape[i] = true;
+        needs_escape['"']  = true;
+        needs_escape['\\'] = true;
+        needs_escape[127]  = true;
+    }
+} json_escapes{};
+
+// Writes `value`'s decimal digits, two at a time, so they end just before `end`. Returns the first digit.
+template <typename T>
+char* write_digits_backward(char* end, T value) {
+    static_assert(std::is_unsigned_v<T>);
+    while (value >= 100) {
+        auto i = unsigned(value % 100) * 2;
+        value /= 100;
+        *--end = digit_pairs[i + 1];
+        *--end = digit_pairs[i];
+    }
+    if (value >= 10) {
+        auto i = unsigned(value) * 2;
+        *--end = digit_pairs[i + 1];
+        *--end = digit_pairs[i];
+    } else {
+        *--end = '0' + unsigned(value);
+    }
+    return end;
+}
+
 } // namespace internal_use_do_not_use
 
 /// \exclude
@@ -54,37 +93,40 @@ rope to_json(const T& obj);
 /// Convert objects to JSON. These overloads handle specified types.
 __attribute__((noinline)) inline rope to_json(std::string_view sv) {
     using namespace internal_use_do_not_use;
-    rope result = "\"";
-    auto begin  = sv.begin();
-    auto end    = sv.end();
-    while (begin != end) {
-        auto pos = begin;
-        while (pos != end && *pos != '"' && *pos != '\\' && (unsigned char)(*pos) >= 32 && *pos != 127)
-            ++pos;
-        if (begin != pos) {
-            result += std::string_view{begin, size_t(pos - begin)};
-            begin = pos;
-        }
-        if (begin != end) {
-            if (*begin == '"')
-                result += "\\\"";
-            else if (*begin == '\\')
-                result += "\\\\";
-            else {
-                rope_buffer b(6);
-                *b.pos++ = '\\';
-                *b.pos++ = 'u';
-                *b.pos++ = '0';
-                *b.pos++ = '0';
-                *b.pos++ = hex_digits[(unsigned char)(*begin) >> 4];
-                *b.pos++ = hex_digits[(unsigned char)(*begin) & 15];
-                result += b;
-            }
-            ++begin;
+    auto begin = sv.begin();
+    auto end   = sv.end();
+    auto pos   = begin;
+    while (pos != end && !json_escapes.needs_escape[(unsigned char)(*pos)])
+        ++pos;
+    if (pos == end)
+        return rope{"\""} + sv + "\"";
+
+    // copy runs of safe characters in one step; each escape is at most 6 characters
+    rope_buffer b(sv.size() * 6 + 2);
+    *b.pos++ = '"';
+    while (true) {
+        memcpy(b.pos, begin, pos - begin);
+        b.pos += pos - begin;
+        if (pos == end)
+            break;
+        auto ch = (unsigned char)(*pos++);
+        if (ch == '"' || ch == '\\') {
+            *b.pos++ = '\\';
+            *b.pos++ = ch;
+        } else {
+            *b.pos++ = '\\';
+            *b.pos++ = 'u';
+            *b.pos++ = '0';
+            *b.pos++ = '0';
+            *b.pos++ = hex_digits[ch >> 4];
+            *b.pos++ = hex_digits[ch & 15];
         }
+        begin = pos;
+        while (pos != end && !json_escapes.needs_escape[(unsigned char)(*pos)])
+            ++pos;
     }
-    result += "\"";
-    return result;
+    *b.pos++ = '"';
+    return b;
 }
 
 /// \group to_json_explicit
@@ -109,22 +151,21 @@ __attribute__((noinline)) inline rope to_json(bool value) {
 template <typename T>
 __attribute__((noinline)) inline rope int_to_json(T value) {
     using namespace internal_use_do_not_use;
-    auto        uvalue = std::make_unsigned_t<T>(value);
-    rope_buffer b(std::numeric_limits<T>::digits10 + 4);
-    bool        neg = value < 0;
-    if (neg)
-        uvalue = -uvalue;
+    using U = std::make_unsigned_t<T>;
+
+    char        digits[std::numeric_limits<U>::digits10 + 1];
+    bool        neg   = value < 0;
+    auto        end   = digits + sizeof(digits);
+    auto        begin = write_digits_backward(end, neg ? U(-U(value)) : U(value));
+    rope_buffer b(end - begin + 3);
     if (sizeof(T) > 4)
         *b.pos++ = '"';
-    do {
-        *b.pos++ = '0' + (uvalue % 10);
-        uvalue /= 10;
-    } while (uvalue);
     if (neg)
         *b.pos++ = '-';
+    memcpy(b.pos, begin, end - begin);
+    b.pos += end - begin;
     if (sizeof(T) > 4)
         *b.pos++ = '"';
-    b.reverse();
     return b;
 }
 
@@ -181,6 +222,9 @@ __attribute__((noinline)) inline rope to_json(uint32_t value) { return int_to_js
 /// \group to_json_explicit
 __attribute__((noinline)) inline rope to_json(uint64_t value) { return int_to_json(value); }
 
+/// \group to_json_explicit
+__attribute__((noinline)) inline rope to_json(uint128_t value) { return int_to_json(value); }
+
 /// \group to_json_explicit
 __attribute__((noinline)) inline rope to_json(unsigned_int value) { return int_to_json(value.value); }
 
@@ -196,6 +240,9 @@ __attribute__((noinline)) inline rope to_json(int32_t value) { return int_to_jso
 /// \group to_json_explicit
 __attribute__((noinline)) inline rope to_json(int64_t value) { return int_to_json(value); }
 
+/// \group to_json_explicit
+__attribute__((noinline)) inline rope to_json(int128_t value) { return int_to_json(value); }
+
 /// \group to_json_explicit
 __attribute__((noinline)) inline rope to_json(signed_int value) { return int_to_json(value.value); }
 
@@ -237,7 +284,29 @@ __attribute__((noinline)) inline rope to_json(asset value) {
            to_json(value.amount) +             //
            "}";
 #endif
-    return rope{"\"" + value.to_string() + "\""};
+    // formats like asset::to_string(), without its temporary strings
+    using namespace internal_use_do_not_use;
+    char     digits[24];
+    auto     end       = digits + sizeof(digits);
+    auto     amount    = value.amount < 0 ? -uint64_t(value.amount) : uint64_t(value.amount);
+    auto     begin     = write_digits_backward(end, amount);
+    unsigned precision = value.symbol.precision();
+    while (unsigned(end - begin) <= precision)
+        *--begin = '0';
+    auto        point = end - precision;
+    rope_buffer b{40};
+    *b.pos++ = '"';
+    if (value.amount < 0)
+        *b.pos++ = '-';
+    b.pos = std::copy(begin, point, b.pos);
+    if (precision) {
+        *b.pos++ = '.';
+        b.pos    = std::copy(point, end, b.pos);
+    }
+    *b.pos++ = ' ';
+    b.pos    = value.symbol.code().write_as_string(b.pos, b.end - 1);
+    *b.pos++ = '"';
+    return b;
 }
 
 /// \group to_json_explicit
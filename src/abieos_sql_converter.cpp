@@ -13,54 +13,82 @@ std::string quote_name(std::string x) { return "\"" + x + "\""; }
 
 inline constexpr char number_to_digit(int i) noexcept { return static_cast<char>(i + '0'); }
 
-std::string escape_table_field(const std::string& s) {
-    std::string result;
-    result.reserve(s.size() * 2 + 2);
-    for (auto c : s) {
-        switch (c) {
-        case '\b': result += "\\b"; break;  // Backspace
-        case '\f': result += "\\f"; break;  // Vertical tab
-        case '\n': result += "\\n"; break;  // Form feed
-        case '\r': result += "\\r"; break;  // Newline
-        case '\t': result += "\\t"; break;  // Tab
-        case '\v': result += "\\v"; break;  // Carriage return
-        case '\\': result += "\\\\"; break; // Backslash
+/// escapes out[pos, end) in place as a COPY text field
+void escape_table_field_at(std::string& out, std::size_t pos) {
+    std::size_t extra = 0;
+    for (auto i = pos; i < out.size(); ++i) {
+        switch (char c = out[i]) {
+        case '\b':
+        case '\f':
+        case '\n':
+        case '\r':
+        case '\t':
+        case '\v':
+        case '\\': extra += 1; break;
+        default:
+            if (c < ' ' or c > '~')
+                extra += 3;
+            break;
+        }
+    }
+    if (!extra)
+        return;
+
+    auto src = out.size();
+    out.resize(src + extra);
+    auto dst  = out.size();
+    auto put2 = [&](char c) {
+        out[--dst] = c;
+        out[--dst] = '\\';
+    };
+    while (src > pos) {
+        switch (char c = out[--src]) {
+        case '\b': put2('b'); break;
+        case '\f': put2('f'); break;
+        case '\n': put2('n'); break;
+        case '\r': put2('r'); break;
+        case '\t': put2('t'); break;
+        case '\v': put2('v'); break;
+        case '\\': put2('\\'); break;
         default:
             if (c < ' ' or c > '~') {
                 // Non-ASCII.  Escape as octal number.
-                result += "\\";
                 auto u{static_cast<unsigned char>(c)};
-                for (auto i = 2; i >= 0; --i)
-                    result += number_to_digit((u >> (3 * i)) & 0x07);
+                for (auto i = 0; i < 3; ++i)
+                    out[--dst] = number_to_digit((u >> (3 * i)) & 0x07);
+                out[--dst] = '\\';
             } else {
-                result += c;
+                out[--dst] = c;
             }
             break;
         }
     }
-    return result;
 }
 
-std::string escape_composite_field(std::string elem) {
-    std::string result;
-    result.resize(2 * elem.size() + 2);
-    auto here = result.begin();
-    *here++   = '"';
-    for (char const c : elem) {
+/// quotes out[pos, end) in place as an element of a composite or array value
+void escape_composite_field_at(std::string& out, std::size_t pos) {
+    std::size_t extra = 2;
+    for (auto i = pos; i < out.size(); ++i)
+        extra += out[i] == '\\' or out[i] == '"';
+
+    auto src = out.size();
+    out.resize(src + extra);
+    auto dst   = out.size();
+    out[--dst] = '"';
+    while (src > pos) {
+        char c     = out[--src];
+        out[--dst] = c;
         if (c == '\\' or c == '"')
-            *here++ = '\\';
-        *here++ = c;
+            out[--dst] = '\\';
     }
-    *here++ = '"';
-    result.erase(here, result.end());
-    return result;
+    out[--dst] = '"';
 }
 
-std::string escape_field(std::string elem, abieos_sql_converter::field_kind_t field_kind) {
+void escape_field_at(std::string& out, std::size_t pos, abieos_sql_converter::field_kind_t field_kind) {
     if (field_kind == abieos_sql_converter::table_field)
-        return escape_table_field(elem);
+        escape_table_field_at(out, pos);
     else
-        return escape_composite_field(elem);
+        escape_composite_field_at(out, pos);
 }
 
 abieos_sql_converter::field_def
@@ -202,29 +230,35 @@ std::string abieos_sql_converter::create_sql_type(
     return sql_type;
 }
 
+std::vector<abieos_sql_converter::field_def> abieos_sql_converter::table_fields(const eosio::abi_type& type) {
+    if (type.as_struct())
+        return get_field_defs(schema_name, type.as_struct(), basic_converters);
+    if (type.as_variant())
+        return variant_union_fields.try_emplace(type.name, schema_name, *type.as_variant(), basic_converters).first->second;
+    return {};
+}
+
 void abieos_sql_converter::create_table(
     std::string table_name, const eosio::abi_type& type, std::string fields_prefix, const std::vector<std::string>& keys,
     const std::function<void(std::string)>& exec) {
     std::string fields = fields_prefix;
     if (type.as_struct()) {
-        for (auto& field : type.as_struct()->fields) {
+        for (auto& field : type.as_struct()->fields)
             create_sql_type(field.type, exec, false);
-            auto f_def = get_field_def(schema_name, field, basic_converters);
-            fields += ", " + quote_name(f_def.name) + " " + f_def.type;
-        }
     } else if (type.as_variant()) {
         for (auto& elem : *type.as_variant()) {
             create_sql_type(elem.type, exec, true);
         }
-
-        auto union_fields = variant_union_fields.try_emplace(type.name, schema_name, *type.as_variant(), basic_converters).first->second;
-
-        for (auto& field : union_fields) {
-            fields += ", " + quote_name(field.name) + " " + field.type;
-        }
     }
-    std::string query = "create table " + schema_name + "." + quote_name(table_name) + " (" + fields + ", primary key(" +
-                        pqxx::separated_list(",", keys.begin(), keys.end(), [](auto x) { return quote_name(*x); }) + "))";
+    for (auto& field : table_fields(type))
+        fields += ", " + quote_name(field.name) + " " + field.type;
+    std::string query = std::string("create ") + (unlogged ? "unlogged " : "") + "table " + schema_name + "." + quote_name(table_name) +
+                        " (" + fields;
+    if (primary_keys)
+        query += ", primary key(" + pqxx::separated_list(",", keys.begin(), keys.end(), [](auto x) { return quote_name(*x); }) + ")";
+    query += ")";
+    if (partitioned)
+        query += " partition by range (block_num)";
     exec(query);
 }
 
@@ -235,94 +269,662 @@ bool is_numeric_type(std::string type_name) {
     return std::find(std::begin(numeric_types), e, type_name) != e;
 }
 
-std::string abieos_sql_converter::to_sql_value(eosio::input_stream& bin, const eosio::abi_type& type_ref, field_kind_t field_kind) {
-    const eosio::abi_type* type    = &type_ref;
-    bool                   present = true;
+inline bool ends_with(std::string const & value, std::string const & ending)
+{
+    if (ending.size() > value.size()) return false;
+    return std::equal(ending.rbegin(), ending.rend(), value.rbegin());
+}
+
+/// whether name is prefix + "_" + field
+inline bool is_prefixed_name(const std::string& name, const std::string& prefix, const std::string& field) {
+    return name.size() == prefix.size() + 1 + field.size() && name.compare(0, prefix.size(), prefix) == 0 && name[prefix.size()] == '_' &&
+           name.compare(prefix.size() + 1, field.size(), field) == 0;
+}
+
+std::string abieos_sql_converter::to_sql_value(eosio::input_stream& bin, const eosio::abi_type& type, field_kind_t field_kind) {
+    std::string result;
+    append_sql_value(result, bin, type, field_kind);
+    return result;
+}
+
+void abieos_sql_converter::to_sql_values(
+    eosio::input_stream& bin, const eosio::abi_type::struct_& struct_abi_type, std::vector<std::string>& values, field_kind_t field_kind) {
+    values.reserve(values.size() + struct_abi_type.fields.size());
+    for (auto& f : struct_abi_type.fields)
+        values.push_back(to_sql_value(bin, *f.type, field_kind));
+}
+
+void abieos_sql_converter::to_sql_values(
+    eosio::input_stream& bin, const std::string& type_name, const eosio::abi_type::variant& variant_abi_type,
+    std::vector<std::string>& values, field_kind_t field_kind) {
+    for_each_union_value(bin, type_name, variant_abi_type, [&](const field_def& field, const eosio::abi_type* type) {
+        auto& value = values.emplace_back();
+        if (type)
+            append_sql_value(value, bin, *type, field_kind);
+        else
+            append_missing_value(value, field, field_kind);
+    });
+}
+
+void abieos_sql_converter::append_sql_value(
+    std::string& out, eosio::input_stream& bin, const eosio::abi_type& type_ref, field_kind_t field_kind) {
+    const eosio::abi_type* type = &type_ref;
     if (type->optional_of()) {
+        bool present = true;
         bin.read_raw(present);
         type = type->optional_of();
         if (!present) {
-            if (field_kind == abieos_sql_converter::table_field)
-                return "\\N";
-            return "";
+            if (field_kind == table_field)
+                out += "\\N";
+            return;
         }
     }
 
-    std::vector<std::string> values;
-
-    if (type->as_struct()) {
-        to_sql_values(bin, *type->as_struct(), values, composite_field);
-        if (values.size() > 1)
-            return escape_field("(" + pqxx::separated_list(",", values.begin(), values.end()) + ")", field_kind);
-        return values[0];
-    } else if (type->as_variant()) {
-        to_sql_values(bin, type->name, *type->as_variant(), values, composite_field);
-        return escape_field("(" + pqxx::separated_list(",", values.begin(), values.end()) + ")", field_kind);
-    } else if (type->array_of()) {
+    auto pos = out.size();
+    if (auto struct_abi_type = type->as_struct()) {
+        if (struct_abi_type->fields.size() > 1) {
+            out += '(';
+            append_fields(out, bin, *struct_abi_type, composite_field, true);
+            out += ')';
+            escape_field_at(out, pos, field_kind);
+        } else if (!struct_abi_type->fields.empty()) {
+            append_sql_value(out, bin, *struct_abi_type->fields[0].type, composite_field);
+        }
+    } else if (auto variant_abi_type = type->as_variant()) {
+        out += '(';
+        append_fields(out, bin, type->name, *variant_abi_type, composite_field, true);
+        out += ')';
+        escape_field_at(out, pos, field_kind);
+    } else if (auto element_type = type->array_of()) {
         uint32_t n;
         varuint32_from_bin(n, bin);
-        values.reserve(n);
-        for (int i = 0; i < n; ++i) {
-            values.push_back(to_sql_value(bin, *type->array_of(), composite_field));
+        out += '{';
+        for (uint32_t i = 0; i < n; ++i) {
+            if (i)
+                out += ',';
+            append_sql_value(out, bin, *element_type, composite_field);
         }
-        return escape_field("{" + pqxx::separated_list(",", values.begin(), values.end()) + "}", field_kind);
+        out += '}';
+        escape_field_at(out, pos, field_kind);
     } else {
-        auto abi_type_name = type->name;
-        auto it            = basic_converters.find(abi_type_name);
-        if (it != basic_converters.end()) {
-            if (!it->second.bin_to_sql)
-                throw std::runtime_error("don't know how to process " + abi_type_name);
-            std::string r = it->second.bin_to_sql(bin);
-            auto& sql_type_name = it->second.name;
-            if (field_kind == composite_field) {
-                auto sql_type_name = it->second.name;
-                if ( strncmp(sql_type_name,"varchar", 7) == 0 || strcmp(sql_type_name,"bytea") == 0 )
-                    return escape_composite_field(r);
-            } else if (r.empty() && strcmp(sql_type_name, "timestamp") == 0) {
-                return "\\N";
-            }
-            return r;
+        auto it = basic_converters.find(type->name);
+        if (it == basic_converters.end() || !it->second.append_bin_to_sql)
+            throw std::runtime_error("don't know how to process " + type->name);
+        it->second.append_bin_to_sql(out, bin);
+        auto sql_type_name = it->second.name;
+        if (field_kind == composite_field) {
+            if (strncmp(sql_type_name, "varchar", 7) == 0 || strcmp(sql_type_name, "bytea") == 0)
+                escape_composite_field_at(out, pos);
+        } else if (out.size() == pos && strcmp(sql_type_name, "timestamp") == 0) {
+            out += "\\N";
         }
-        __builtin_unreachable();
     }
 }
 
-void abieos_sql_converter::to_sql_values(
-    eosio::input_stream& bin, const eosio::abi_type::struct_& struct_abi_type, std::vector<std::string>& values, field_kind_t field_kind) {
-    values.reserve(values.size() + struct_abi_type.fields.size());
-    for (auto& f : struct_abi_type.fields)
-        values.push_back(to_sql_value(bin, *f.type, field_kind));
+std::size_t abieos_sql_converter::append_sql_values(
+    std::string& out, eosio::input_stream& bin, const eosio::abi_type::struct_& struct_abi_type, field_kind_t field_kind) {
+    if (auto it = row_encoders.find(&struct_abi_type); it != row_encoders.end())
+        return it->second.append_values(out, bin, field_kind, binary_format && field_kind == table_field);
+    if (binary_format && field_kind == table_field)
+        return append_pg_binary_values(out, bin, struct_abi_type);
+    append_fields(out, bin, struct_abi_type, field_kind, false);
+    return struct_abi_type.fields.size();
 }
 
-inline bool ends_with(std::string const & value, std::string const & ending)
-{
-    if (ending.size() > value.size()) return false;
-    return std::equal(ending.rbegin(), ending.rend(), value.rbegin());
+std::size_t abieos_sql_converter::append_sql_values(
+    std::string& out, eosio::input_stream& bin, const std::string& type_name, const eosio::abi_type::variant& variant_abi_type,
+    field_kind_t field_kind) {
+    if (auto it = row_encoders.find(&variant_abi_type); it != row_encoders.end())
+        return it->second.append_values(out, bin, field_kind, binary_format && field_kind == table_field);
+    if (binary_format && field_kind == table_field)
+        return append_pg_binary_values(out, bin, type_name, variant_abi_type);
+    return append_fields(out, bin, type_name, variant_abi_type, field_kind, false);
 }
 
-void abieos_sql_converter::to_sql_values(
-    eosio::input_stream& bin, std::string type_name, const eosio::abi_type::variant& variant_abi_type, std::vector<std::string>& values,
-    field_kind_t field_kind) {
+std::size_t abieos_sql_converter::begin_row(std::string& out) const {
+    if (binary_format) {
+        auto pos = out.size();
+        out.append(2, '\0');
+        return pos;
+    }
+    if (!out.empty())
+        out += '\n';
+    return out.size();
+}
+
+void abieos_sql_converter::end_row(std::string& out, std::size_t row_begin, std::size_t num_columns) const {
+    if (binary_format) {
+        out[row_begin]     = char(uint8_t(num_columns >> 8));
+        out[row_begin + 1] = char(uint8_t(num_columns));
+    }
+}
+
+void abieos_sql_converter::append_column(std::string& out, std::size_t row_begin, eosio::input_stream& bin, const sql_type& type) const {
+    if (binary_format)
+        return type.append_bin_to_pg_binary(out, bin);
+    if (out.size() > row_begin)
+        out += '\t';
+    auto pos = out.size();
+    type.append_bin_to_sql(out, bin);
+    if (strncmp(type.name, "varchar", 7) == 0)
+        escape_table_field_at(out, pos);
+}
+
+void abieos_sql_converter::append_null_column(std::string& out, std::size_t row_begin) const {
+    if (binary_format)
+        return state_history::pg::append_pg_null(out);
+    if (out.size() > row_begin)
+        out += '\t';
+    out += "\\N";
+}
+
+template <typename F>
+void abieos_sql_converter::for_each_union_value(
+    eosio::input_stream& bin, const std::string& type_name, const eosio::abi_type::variant& variant_abi_type, F&& f) {
     uint32_t v;
     varuint32_from_bin(v, bin);
     auto&       alternative  = variant_abi_type.at(v);
     const auto& union_fields = variant_union_fields.try_emplace(type_name, schema_name, variant_abi_type, basic_converters).first->second;
     auto const& alternative_fields = alternative.type->as_struct()->fields;
     auto        field_itr          = alternative_fields.begin();
-    values.reserve(values.size() + union_fields.size());
     for (const auto& field : union_fields) {
-        auto fname = field.name;
-        if (field_itr != alternative_fields.end() && (fname == field_itr->name || fname == (alternative.name + "_" + field_itr->name))) {
-            values.push_back(to_sql_value(bin, *field_itr->type, field_kind));
+        if (field_itr != alternative_fields.end() &&
+            (field.name == field_itr->name || is_prefixed_name(field.name, alternative.name, field_itr->name))) {
+            f(field, field_itr->type);
             ++field_itr;
-        } else if (ends_with(field.type, "[]"))
-            values.emplace_back(escape_field("{}", field_kind));
-        else if (field_kind == table_field && field.type.find(schema_name) == 0) {
-            // For a value of composite value and when it is a field of the top level table, it must use "\\N" to represent the empty value;
-            // however, it must use empty string to represent empty value when it's a field of a type.
-            values.emplace_back("\\N");
+        } else {
+            f(field, nullptr);
+        }
+    }
+}
+
+void abieos_sql_converter::append_fields(
+    std::string& out, eosio::input_stream& bin, const eosio::abi_type::struct_& struct_abi_type, field_kind_t field_kind, bool first) {
+    const char separator = field_kind == table_field ? '\t' : ',';
+    for (auto& f : struct_abi_type.fields) {
+        if (!first)
+            out += separator;
+        first = false;
+        append_sql_value(out, bin, *f.type, field_kind);
+    }
+}
+
+std::size_t abieos_sql_converter::append_fields(
+    std::string& out, eosio::input_stream& bin, const std::string& type_name, const eosio::abi_type::variant& variant_abi_type,
+    field_kind_t field_kind, bool first) {
+    const char  separator = field_kind == table_field ? '\t' : ',';
+    std::size_t n         = 0;
+    for_each_union_value(bin, type_name, variant_abi_type, [&](const field_def& field, const eosio::abi_type* type) {
+        if (!first)
+            out += separator;
+        first = false;
+        ++n;
+        if (type)
+            append_sql_value(out, bin, *type, field_kind);
+        else
+            append_missing_value(out, field, field_kind);
+    });
+    return n;
+}
+
+void abieos_sql_converter::append_missing_value(std::string& out, const field_def& field, field_kind_t field_kind) const {
+    if (ends_with(field.type, "[]"))
+        out += field_kind == table_field ? "{}" : "\"{}\"";
+    else if (field_kind == table_field && field.type.compare(0, schema_name.size(), schema_name) == 0) {
+        // For a value of composite value and when it is a field of the top level table, it must use "\\N" to represent the empty value;
+        // however, it must use empty string to represent empty value when it's a field of a type.
+        out += "\\N";
+    }
+}
+
+struct builtin_pg_type {
+    const char* sql;
+    uint32_t    oid, array_oid;
+};
+
+// oids from postgresql's pg_type.dat; they are fixed across installations
+constexpr builtin_pg_type builtin_pg_types[] = {
+    {"bool", 16, 1000},      {"smallint", 21, 1005}, {"integer", 23, 1007}, {"bigint", 20, 1016},      {"decimal", 1700, 1231},
+    {"float8", 701, 1022},   {"varchar", 1043, 1015}, {"bytea", 17, 1001},  {"timestamp", 1114, 1115},
+};
+
+/// matches "varchar(13)" to "varchar"
+const builtin_pg_type* find_builtin_pg_type(std::string_view sql_type) {
+    for (auto& t : builtin_pg_types) {
+        auto len = strlen(t.sql);
+        if (sql_type.compare(0, len, t.sql) == 0 && (sql_type.size() == len || sql_type[len] == '('))
+            return &t;
+    }
+    return nullptr;
+}
+
+uint32_t abieos_sql_converter::schema_type_oid(const std::string& name, bool array) const {
+    // postgresql truncates identifiers to 63 bytes
+    auto it = schema_type_oids.find(name.substr(0, 63));
+    if (it == schema_type_oids.end())
+        throw std::runtime_error("oid of type " + name + " is not loaded");
+    return array ? it->second.array_oid : it->second.oid;
+}
+
+uint32_t abieos_sql_converter::pg_array_oid(uint32_t element_oid) const {
+    for (auto& t : builtin_pg_types)
+        if (t.oid == element_oid)
+            return t.array_oid;
+    for (auto& [_, t] : schema_type_oids)
+        if (t.oid == element_oid)
+            return t.array_oid;
+    throw std::runtime_error("no array type for oid " + std::to_string(element_oid));
+}
+
+uint32_t abieos_sql_converter::pg_oid(const std::string& sql_type) const {
+    std::string_view type  = sql_type;
+    bool             array = ends_with(sql_type, "[]");
+    if (array)
+        type.remove_suffix(2);
+    if (type.size() > schema_name.size() && type.compare(0, schema_name.size(), schema_name) == 0 && type[schema_name.size()] == '.')
+        return schema_type_oid(std::string{type.substr(schema_name.size() + 1)}, array);
+    if (auto t = find_builtin_pg_type(type))
+        return array ? t->array_oid : t->oid;
+    throw std::runtime_error("don't know oid of sql type: " + sql_type);
+}
+
+uint32_t abieos_sql_converter::pg_oid(const field_def& field) {
+    auto it = oid_cache.find(&field);
+    if (it != oid_cache.end())
+        return it->second;
+    return oid_cache[&field] = pg_oid(field.type);
+}
+
+uint32_t abieos_sql_converter::pg_oid(const eosio::abi_type* type) {
+    auto it = oid_cache.find(type);
+    if (it != oid_cache.end())
+        return it->second;
+
+    uint32_t result;
+    if (type->optional_of()) {
+        result = pg_oid(type->optional_of());
+    } else if (type->array_of()) {
+        result = pg_array_oid(pg_oid(type->array_of()));
+    } else if (type->as_struct() && type->as_struct()->fields.size() == 1) {
+        result = pg_oid(type->as_struct()->fields[0].type);
+    } else if (type->as_struct() || type->as_variant()) {
+        result = schema_type_oid(type->name, false);
+    } else {
+        auto c = basic_converters.find(type->name);
+        if (c == basic_converters.end())
+            throw std::runtime_error("don't know sql type for abi type: " + type->name);
+        if (strcmp(c->second.name, "transaction_status_type") == 0)
+            result = schema_type_oid(c->second.name, false);
+        else if (auto t = find_builtin_pg_type(c->second.name))
+            result = t->oid;
+        else
+            throw std::runtime_error(std::string("don't know oid of sql type: ") + c->second.name);
+    }
+    return oid_cache[type] = result;
+}
+
+/// composite: field count, then an oid and a value per field. array: dimensions, null flag, element oid, then for each
+/// dimension its size and lower bound, then the elements.
+void abieos_sql_converter::append_pg_binary_value(std::string& out, eosio::input_stream& bin, const eosio::abi_type& type_ref) {
+    using namespace state_history::pg;
+    const eosio::abi_type* type = &type_ref;
+    if (type->optional_of()) {
+        bool present = true;
+        bin.read_raw(present);
+        if (!present)
+            return append_pg_null(out);
+        type = type->optional_of();
+    }
+
+    if (auto struct_abi_type = type->as_struct()) {
+        auto& fields = struct_abi_type->fields;
+        if (fields.size() == 1)
+            return append_pg_binary_value(out, bin, *fields[0].type);
+        if (fields.empty())
+            return append_pg_null(out);
+        auto pos = begin_pg_value(out);
+        append_be<int32_t>(out, fields.size());
+        for (auto& f : fields) {
+            append_be<uint32_t>(out, pg_oid(f.type));
+            append_pg_binary_value(out, bin, *f.type);
+        }
+        end_pg_value(out, pos);
+    } else if (auto variant_abi_type = type->as_variant()) {
+        auto pos       = begin_pg_value(out);
+        auto count_pos = out.size();
+        append_be<int32_t>(out, 0);
+        auto n = append_pg_binary_values(out, bin, type->name, *variant_abi_type, true);
+        patch_be32(out, count_pos, n);
+        end_pg_value(out, pos);
+    } else if (auto element_type = type->array_of()) {
+        uint32_t n;
+        varuint32_from_bin(n, bin);
+        auto pos = begin_pg_value(out);
+        append_be<int32_t>(out, n ? 1 : 0);
+        append_be<int32_t>(out, 0);
+        append_be<uint32_t>(out, pg_oid(element_type));
+        if (n) {
+            append_be<int32_t>(out, n);
+            append_be<int32_t>(out, 1);
+        }
+        for (uint32_t i = 0; i < n; ++i)
+            append_pg_binary_value(out, bin, *element_type);
+        end_pg_value(out, pos);
+    } else {
+        auto it = basic_converters.find(type->name);
+        if (it == basic_converters.end() || !it->second.append_bin_to_pg_binary)
+            throw std::runtime_error("don't know how to process " + type->name);
+        it->second.append_bin_to_pg_binary(out, bin);
+    }
+}
+
+std::size_t
+abieos_sql_converter::append_pg_binary_values(std::string& out, eosio::input_stream& bin, const eosio::abi_type::struct_& struct_abi_type) {
+    for (auto& f : struct_abi_type.fields)
+        append_pg_binary_value(out, bin, *f.type);
+    return struct_abi_type.fields.size();
+}
+
+std::size_t abieos_sql_converter::append_pg_binary_values(
+    std::string& out, eosio::input_stream& bin, const std::string& type_name, const eosio::abi_type::variant& variant_abi_type,
+    bool with_oids) {
+    std::size_t n = 0;
+    for_each_union_value(bin, type_name, variant_abi_type, [&](const field_def& field, const eosio::abi_type* type) {
+        ++n;
+        if (with_oids)
+            state_history::pg::append_be<uint32_t>(out, pg_oid(field));
+        if (type)
+            append_pg_binary_value(out, bin, *type);
+        else
+            append_missing_pg_binary_value(out, field);
+    });
+    return n;
+}
+
+/// missing arrays are empty, as "{}" is in the text format; everything else is null
+void abieos_sql_converter::append_missing_pg_binary_value(std::string& out, const field_def& field) {
+    using namespace state_history::pg;
+    if (!ends_with(field.type, "[]"))
+        return append_pg_null(out);
+    append_be<int32_t>(out, 12);
+    append_be<int32_t>(out, 0);
+    append_be<int32_t>(out, 0);
+    append_be<uint32_t>(out, pg_oid(field.type.substr(0, field.type.size() - 2)));
+}
+
+void abieos_sql_converter::reset_row_encoders() {
+    row_encoders.clear();
+    oid_cache.clear();
+}
+
+void abieos_sql_converter::compile_row_encoder(const eosio::abi_type& type) {
+    const void* key = type.as_struct() ? static_cast<const void*>(type.as_struct()) : static_cast<const void*>(type.as_variant());
+    if (!key)
+        throw std::runtime_error("don't know how to process " + type.name);
+    row_encoder encoder;
+    add_op(encoder, type, false);
+    row_encoders[key] = std::move(encoder);
+}
+
+uint32_t abieos_sql_converter::add_op(row_encoder& encoder, const eosio::abi_type& type, bool with_oid) {
+    uint32_t index = encoder.ops.size();
+    encoder.ops.emplace_back();
+    compile_op(encoder, index, type, with_oid);
+    return index;
+}
+
+/// fills in ops[index]; the children of an op are appended after it, so ops may be reallocated meanwhile
+void abieos_sql_converter::compile_op(row_encoder& encoder, uint32_t index, const eosio::abi_type& type, bool with_oid) {
+    using op_t = row_encoder::op_t;
+    op_t op;
+    if (binary_format && with_oid)
+        op.oid = pg_oid(&type);
+
+    if (auto inner_type = type.optional_of()) {
+        op.kind  = op_t::optional;
+        op.first = add_op(encoder, *inner_type, false);
+    } else if (auto struct_abi_type = type.as_struct()) {
+        auto& fields = struct_abi_type->fields;
+        op.kind      = fields.size() > 1 ? op_t::composite : op_t::single;
+        op.first     = encoder.ops.size();
+        op.size      = fields.size();
+        encoder.ops.resize(op.first + op.size);
+        for (uint32_t i = 0; i < op.size; ++i)
+            compile_op(encoder, op.first + i, *fields[i].type, op.kind == op_t::composite && index != 0);
+    } else if (type.as_variant()) {
+        compile_variant(encoder, op, type, index != 0);
+    } else if (auto element_type = type.array_of()) {
+        op.kind  = op_t::array;
+        op.first = add_op(encoder, *element_type, true);
+    } else {
+        auto it = basic_converters.find(type.name);
+        if (it == basic_converters.end() || !it->second.append_bin_to_sql || !it->second.append_bin_to_pg_binary)
+            throw std::runtime_error("don't know how to process " + type.name);
+        auto sql_type_name  = it->second.name;
+        op.append_text      = it->second.append_bin_to_sql;
+        op.append_binary    = it->second.append_bin_to_pg_binary;
+        op.escape_composite = strncmp(sql_type_name, "varchar", 7) == 0 || strcmp(sql_type_name, "bytea") == 0;
+        op.null_if_empty    = strcmp(sql_type_name, "timestamp") == 0;
+    }
+    encoder.ops[index] = op;
+}
+
+/// matches the fields of each alternative to the union fields, as for_each_union_value() does for every row
+void abieos_sql_converter::compile_variant(row_encoder& encoder, row_encoder::op_t& op, const eosio::abi_type& type, bool with_oids) {
+    auto& variant_abi_type = *type.as_variant();
+    auto& union_fields     = variant_union_fields.try_emplace(type.name, schema_name, variant_abi_type, basic_converters).first->second;
+    op.kind                = row_encoder::op_t::variant;
+    op.first               = encoder.alternatives.size();
+    op.size                = variant_abi_type.size();
+    op.num_fields          = union_fields.size();
+    encoder.alternatives.resize(op.first + op.size, row_encoder::none);
+
+    for (uint32_t i = 0; i < op.size; ++i) {
+        auto& alternative = variant_abi_type[i];
+        if (!alternative.type->as_struct())
+            continue;
+        uint32_t slot_first = encoder.slots.size();
+        encoder.slots.resize(slot_first + op.num_fields);
+        encoder.alternatives[op.first + i] = slot_first;
+
+        auto const& alternative_fields = alternative.type->as_struct()->fields;
+        auto        field_itr          = alternative_fields.begin();
+        for (uint32_t j = 0; j < op.num_fields; ++j) {
+            const auto&         field = union_fields[j];
+            row_encoder::slot_t slot;
+            if (binary_format && with_oids)
+                slot.oid = pg_oid(field);
+            if (field_itr != alternative_fields.end() &&
+                (field.name == field_itr->name || is_prefixed_name(field.name, alternative.name, field_itr->name))) {
+                slot.op = add_op(encoder, *field_itr->type, false);
+                ++field_itr;
+            } else {
+                slot.missing_array     = ends_with(field.type, "[]");
+                slot.missing_composite = field.type.compare(0, schema_name.size(), schema_name) == 0;
+                if (binary_format && slot.missing_array)
+                    slot.missing_element_oid = pg_oid(field.type.substr(0, field.type.size() - 2));
+            }
+            encoder.slots[slot_first + j] = slot;
+        }
+    }
+}
+
+std::size_t
+abieos_sql_converter::row_encoder::append_values(std::string& out, eosio::input_stream& bin, field_kind_t field_kind, bool binary) const {
+    auto& root = ops[0];
+    if (root.kind == op_t::variant)
+        return binary ? append_pg_binary_union_values(out, bin, root, false) : append_union_values(out, bin, root, field_kind, false);
+
+    const char separator = field_kind == table_field ? '\t' : ',';
+    for (uint32_t i = root.first; i < root.first + root.size; ++i) {
+        if (binary) {
+            append_pg_binary_value(out, bin, i);
+        } else {
+            out += separator;
+            append_value(out, bin, i, field_kind);
+        }
+    }
+    return root.size;
+}
+
+const abieos_sql_converter::row_encoder::slot_t*
+abieos_sql_converter::row_encoder::alternative_slots(eosio::input_stream& bin, const op_t& op) const {
+    uint32_t v;
+    varuint32_from_bin(v, bin);
+    if (v >= op.size || alternatives[op.first + v] == none)
+        throw std::runtime_error("invalid variant index " + std::to_string(v));
+    return slots.data() + alternatives[op.first + v];
+}
+
+void abieos_sql_converter::row_encoder::append_value(std::string& out, eosio::input_stream& bin, uint32_t index, field_kind_t field_kind) const {
+    auto& op  = ops[index];
+    auto  pos = out.size();
+    switch (op.kind) {
+    case op_t::basic:
+        op.append_text(out, bin);
+        if (field_kind == composite_field) {
+            if (op.escape_composite)
+                escape_composite_field_at(out, pos);
+        } else if (out.size() == pos && op.null_if_empty) {
+            out += "\\N";
+        }
+        break;
+    case op_t::optional: {
+        bool present = true;
+        bin.read_raw(present);
+        if (present)
+            append_value(out, bin, op.first, field_kind);
+        else if (field_kind == table_field)
+            out += "\\N";
+        break;
+    }
+    case op_t::single:
+        if (op.size)
+            append_value(out, bin, op.first, composite_field);
+        break;
+    case op_t::composite:
+        out += '(';
+        for (uint32_t i = op.first; i < op.first + op.size; ++i) {
+            if (i != op.first)
+                out += ',';
+            append_value(out, bin, i, composite_field);
+        }
+        out += ')';
+        escape_field_at(out, pos, field_kind);
+        break;
+    case op_t::variant:
+        out += '(';
+        append_union_values(out, bin, op, composite_field, true);
+        out += ')';
+        escape_field_at(out, pos, field_kind);
+        break;
+    case op_t::array: {
+        uint32_t n;
+        varuint32_from_bin(n, bin);
+        out += '{';
+        for (uint32_t i = 0; i < n; ++i) {
+            if (i)
+                out += ',';
+            append_value(out, bin, op.first, composite_field);
         }
+        out += '}';
+        escape_field_at(out, pos, field_kind);
+        break;
+    }
+    }
+}
+
+std::size_t abieos_sql_converter::row_encoder::append_union_values(
+    std::string& out, eosio::input_stream& bin, const op_t& op, field_kind_t field_kind, bool first) const {
+    const char separator = field_kind == table_field ? '\t' : ',';
+    auto       slot      = alternative_slots(bin, op);
+    for (uint32_t i = 0; i < op.num_fields; ++i, ++slot) {
+        if (!first)
+            out += separator;
+        first = false;
+        if (slot->op != none)
+            append_value(out, bin, slot->op, field_kind);
+        else if (slot->missing_array)
+            out += field_kind == table_field ? "{}" : "\"{}\"";
+        else if (field_kind == table_field && slot->missing_composite)
+            out += "\\N";
+    }
+    return op.num_fields;
+}
+
+void abieos_sql_converter::row_encoder::append_pg_binary_value(std::string& out, eosio::input_stream& bin, uint32_t index) const {
+    using namespace state_history::pg;
+    auto& op = ops[index];
+    switch (op.kind) {
+    case op_t::basic: op.append_binary(out, bin); break;
+    case op_t::optional: {
+        bool present = true;
+        bin.read_raw(present);
+        if (present)
+            append_pg_binary_value(out, bin, op.first);
         else
-            values.emplace_back("");
+            append_pg_null(out);
+        break;
+    }
+    case op_t::single:
+        if (op.size)
+            append_pg_binary_value(out, bin, op.first);
+        else
+            append_pg_null(out);
+        break;
+    case op_t::composite: {
+        auto pos = begin_pg_value(out);
+        append_be<int32_t>(out, op.size);
+        for (uint32_t i = op.first; i < op.first + op.size; ++i) {
+            append_be<uint32_t>(out, ops[i].oid);
+            append_pg_binary_value(out, bin, i);
+        }
+        end_pg_value(out, pos);
+        break;
+    }
+    case op_t::variant: {
+        auto pos = begin_pg_value(out);
+        append_be<int32_t>(out, op.num_fields);
+        append_pg_binary_union_values(out, bin, op, true);
+        end_pg_value(out, pos);
+        break;
+    }
+    case op_t::array: {
+        uint32_t n;
+        varuint32_from_bin(n, bin);
+        auto pos = begin_pg_value(out);
+        append_be<int32_t>(out, n ? 1 : 0);
+        append_be<int32_t>(out, 0);
+        append_be<uint32_t>(out, ops[op.first].oid);
+        if (n) {
+            append_be<int32_t>(out, n);
+            append_be<int32_t>(out, 1);
+        }
+        for (uint32_t i = 0; i < n; ++i)
+            append_pg_binary_value(out, bin, op.first);
+        end_pg_value(out, pos);
+        break;
+    }
+    }
+}
+
+std::size_t abieos_sql_converter::row_encoder::append_pg_binary_union_values(
+    std::string& out, eosio::input_stream& bin, const op_t& op, bool with_oids) const {
+    using namespace state_history::pg;
+    auto slot = alternative_slots(bin, op);
+    for (uint32_t i = 0; i < op.num_fields; ++i, ++slot) {
+        if (with_oids)
+            append_be<uint32_t>(out, slot->oid);
+        if (slot->op != none) {
+            append_pg_binary_value(out, bin, slot->op);
+        } else if (slot->missing_array) {
+            append_be<int32_t>(out, 12);
+            append_be<int32_t>(out, 0);
+            append_be<int32_t>(out, 0);
+            append_be<uint32_t>(out, slot->missing_element_oid);
+        } else {
+            append_pg_null(out);
+        }
     }
+    return op.num_fields;
 }
@@ -1,6 +1,7 @@
 #pragma once
 #include <eosio/abi.hpp>
 #include <string>
+#include <unordered_map>
 #include "state_history_pg.hpp"
 
 struct abieos_sql_converter {
@@ -8,6 +9,8 @@ struct abieos_sql_converter {
     struct sql_type {
         const char* name                                               = "";
         std::string (*bin_to_sql)(eosio::input_stream&)                = nullptr;
+        void (*append_bin_to_sql)(std::string&, eosio::input_stream&)  = nullptr;
+        void (*append_bin_to_pg_binary)(std::string&, eosio::input_stream&) = nullptr;
     };
 
     struct field_def {
@@ -26,18 +29,78 @@ struct abieos_sql_converter {
 
     using variant_fields_table = std::map<std::string, union_fields_t>;
 
+    struct pg_type_oids {
+        uint32_t oid = 0, array_oid = 0;
+    };
+
+    /// A table's abi_type compiled by compile_row_encoder() into a flat program, so rows are encoded without looking up converters
+    /// and union fields by name. ops[0] is the table's struct or variant; an op refers to its children by their index.
+    struct row_encoder {
+        static constexpr uint32_t none = ~uint32_t(0);
+
+        struct op_t {
+            enum kind_t : uint8_t { basic, optional, single, composite, variant, array };
+
+            kind_t kind             = basic;
+            bool   escape_composite = false; // basic: quoted within composite and array values
+            bool   null_if_empty    = false; // basic: empty text is null in a table field
+            void (*append_text)(std::string&, eosio::input_stream&)   = nullptr;
+            void (*append_binary)(std::string&, eosio::input_stream&) = nullptr;
+            uint32_t oid        = 0; // binary: oid of the value, when it is a composite field or an array element
+            uint32_t first      = 0; // optional, array: the child. single, composite: the first field. variant: the first alternative
+            uint32_t size       = 0; // single, composite: number of fields. variant: number of alternatives
+            uint32_t num_fields = 0; // variant: number of union fields
+        };
+
+        /// a union field of a variant alternative: the op of the alternative's field, or how to fill it in when it's missing
+        struct slot_t {
+            uint32_t op                  = none;
+            bool     missing_array       = false;
+            bool     missing_composite   = false;
+            uint32_t oid                 = 0; // binary: oid of the union field, when the variant is nested
+            uint32_t missing_element_oid = 0; // binary: oid of the elements of a missing array
+        };
+
+        std::vector<op_t>     ops;
+        std::vector<uint32_t> alternatives; // first slot of each variant alternative, or none when it isn't a struct
+        std::vector<slot_t>   slots;
+
+        std::size_t append_values(std::string& out, eosio::input_stream& bin, field_kind_t field_kind, bool binary) const;
+
+      private:
+        void        append_value(std::string& out, eosio::input_stream& bin, uint32_t op, field_kind_t field_kind) const;
+        std::size_t append_union_values(std::string& out, eosio::input_stream& bin, const op_t& op, field_kind_t field_kind, bool first) const;
+        void        append_pg_binary_value(std::string& out, eosio::input_stream& bin, uint32_t op) const;
+        std::size_t append_pg_binary_union_values(std::string& out, eosio::input_stream& bin, const op_t& op, bool with_oids) const;
+        const slot_t* alternative_slots(eosio::input_stream& bin, const op_t& op) const;
+    };
+
 
     std::string           schema_name;
     std::set<std::string> created_composite_types;
     variant_fields_table  variant_union_fields;
     basic_converters_t    basic_converters;
+    bool                  binary_format = false; // rows are binary COPY tuples instead of text COPY lines
+    bool                  partitioned   = false; // create_table() declares tables partition by range (block_num)
+    bool                  unlogged      = false; // create_table() creates unlogged tables
+    bool                  primary_keys  = true;  // create_table() declares the primary keys; without, they're added after a bulk load
+
+    /// oids of the types created in schema_name, keyed by the type name; binary composite and array values carry them
+    std::map<std::string, pg_type_oids> schema_type_oids;
+
+    /// encoders used by append_sql_values(), keyed by the table's abi_type::struct_ or abi_type::variant
+    std::unordered_map<const void*, row_encoder> row_encoders;
 
     template <typename T>
     void register_basic_types() {
         std::apply(
             [this](auto... x) {
                 using namespace state_history::pg;
-                (basic_converters.try_emplace(names_for<decltype(x)>.abi, sql_type{names_for<decltype(x)>.sql, bin_to_sql<decltype(x)>}),
+                (basic_converters.try_emplace(
+                     names_for<decltype(x)>.abi,
+                     sql_type{
+                         names_for<decltype(x)>.sql, bin_to_sql<decltype(x)>, append_bin_to_sql<decltype(x)>,
+                         append_bin_to_pg_binary<decltype(x)>}),
                  ...);
             },
             T{});
@@ -49,6 +112,9 @@ struct abieos_sql_converter {
     std::string
     create_sql_type(std::string name, const eosio::abi_type::variant* variant_abi_type, const std::function<void(std::string)>& exec);
 
+    /// The columns which create_table() declares for a table's struct or variant type, after fields_prefix
+    std::vector<field_def> table_fields(const eosio::abi_type& type);
+
     void create_table(
         std::string table_name, const eosio::abi_type& type, std::string fields_prefix, const std::vector<std::string>& keys,
         const std::function<void(std::string)>& exec);
@@ -56,6 +122,70 @@ struct abieos_sql_converter {
     std::string to_sql_value(eosio::input_stream& bin, const eosio::abi_type& type, field_kind_t field_kind = table_field);
     void to_sql_values(eosio::input_stream& bin, const eosio::abi_type::struct_&, std::vector<std::string>& values, field_kind_t field_kind = table_field);
     void to_sql_values(
-        eosio::input_stream& bin, std::string type_name, const eosio::abi_type::variant&, std::vector<std::string>& values,
+        eosio::input_stream& bin, const std::string& type_name, const eosio::abi_type::variant&, std::vector<std::string>& values,
         field_kind_t field_kind = table_field);
+
+    /// Append-into-buffer forms of the above, producing the same text without building a string per field. Each value of
+    /// append_sql_values() is preceded by a separator: a tab for table fields, a comma for composite fields. With binary_format,
+    /// append_sql_values() writes binary COPY fields instead. It returns the number of values appended.
+    void append_sql_value(std::string& out, eosio::input_stream& bin, const eosio::abi_type& type, field_kind_t field_kind = table_field);
+    std::size_t append_sql_values(
+        std::string& out, eosio::input_stream& bin, const eosio::abi_type::struct_&, field_kind_t field_kind = table_field);
+    std::size_t append_sql_values(
+        std::string& out, eosio::input_stream& bin, const std::string& type_name, const eosio::abi_type::variant&,
+        field_kind_t field_kind = table_field);
+
+    /// Compiles the row encoder of a table's struct or variant type. With binary_format, schema_type_oids must be loaded first.
+    /// reset_row_encoders() drops the encoders and cached oids, which refer to the abi_types of the previous ABI.
+    void compile_row_encoder(const eosio::abi_type& type);
+    void reset_row_encoders();
+
+    /// Rows in the selected format. Text rows are separated by '\n' and their columns by '\t'; binary rows start with a column
+    /// count which end_row() fills in. begin_row() returns the position of the row within out.
+    std::size_t begin_row(std::string& out) const;
+    void        end_row(std::string& out, std::size_t row_begin, std::size_t num_columns) const;
+
+    template <typename T>
+    void append_column(std::string& out, std::size_t row_begin, const T& v) const {
+        using namespace state_history::pg;
+        if (binary_format) {
+            append_pg_binary(out, v);
+        } else {
+            if (out.size() > row_begin)
+                out += '\t';
+            append_sql_str(out, v);
+        }
+    }
+
+    /// Columns read from bin by a basic type's converter in basic_converters, and null columns
+    void append_column(std::string& out, std::size_t row_begin, eosio::input_stream& bin, const sql_type& type) const;
+    void append_null_column(std::string& out, std::size_t row_begin) const;
+
+  private:
+    std::unordered_map<const void*, uint32_t> oid_cache;
+
+    uint32_t pg_oid(const eosio::abi_type* type);
+    uint32_t pg_oid(const field_def& field);
+    uint32_t pg_oid(const std::string& sql_type) const;
+    uint32_t pg_array_oid(uint32_t element_oid) const;
+    uint32_t schema_type_oid(const std::string& name, bool array) const;
+
+    void        append_pg_binary_value(std::string& out, eosio::input_stream& bin, const eosio::abi_type& type);
+    std::size_t append_pg_binary_values(std::string& out, eosio::input_stream& bin, const eosio::abi_type::struct_&);
+    std::size_t append_pg_binary_values(
+        std::string& out, eosio::input_stream& bin, const std::string& type_name, const eosio::abi_type::variant&,
+        bool with_oids = false);
+    void append_missing_pg_binary_value(std::string& out, const field_def& field);
+
+    template <typename F>
+    void for_each_union_value(eosio::input_stream& bin, const std::string& type_name, const eosio::abi_type::variant&, F&& f);
+    void append_fields(std::string& out, eosio::input_stream& bin, const eosio::abi_type::struct_&, field_kind_t field_kind, bool first);
+    std::size_t append_fields(
+        std::string& out, eosio::input_stream& bin, const std::string& type_name, const eosio::abi_type::variant&,
+        field_kind_t field_kind, bool first);
+    void append_missing_value(std::string& out, const field_def& field, field_kind_t field_kind) const;
+
+    uint32_t add_op(row_encoder& encoder, const eosio::abi_type& type, bool with_oid);
+    void     compile_op(row_encoder& encoder, uint32_t index, const eosio::abi_type& type, bool with_oid);
+    void     compile_variant(row_encoder& encoder, row_encoder::op_t& op, const eosio::abi_type& type, bool with_oids);
 };
\ No newline at end of file
@@ -188,6 +188,24 @@ function generate_state({ table, index, has_block_snapshot, keys, sort_keys, his
         ${indent}            end if;
     `;
 
+    // A sort key outside the table's keys (e.g. a secondary key) may have moved in a newer version of the row. The index then
+    // still holds the old version; skip it without counting it toward max_results.
+    const key_names = new Set(keys.map(x => x.name));
+    const may_be_stale = sort_keys.some(x => !key_names.has(x.name));
+    const stale_check = indent => !may_be_stale ? '' : `
+        ${indent}        if exists (
+        ${indent}            select 1
+        ${indent}            from
+        ${indent}                ${schema}.${table}
+        ${indent}            where
+        ${indent}                ${keys.map(x => `${table}."${x.name}" = block_search."${x.name}"`).join('\n                        ' + indent + 'and ')}
+        ${indent}                and ${table}.block_num > block_search.block_num
+        ${indent}                ${has_block_snapshot ? `and ${table}.block_num <= snapshot_block_num` : ``}
+        ${indent}        ) then
+        ${indent}            found_block = true;
+        ${indent}            exit;
+        ${indent}        end if;`;
+
     const key_search = (compare, indent) => `
         ${indent}for key_search in
         ${indent}    select
@@ -219,7 +237,7 @@ function generate_state({ table, index, has_block_snapshot, keys, sort_keys, his
         ${indent}            ${sort_keys_tuple(`${table}."`, '"', ',\n                    ' + indent)},
         ${indent}            ${history_keys.map(x => `${table}."${x.name + (x.desc ? '" desc' : '"')}`).join(',\n                    ' + indent)}
         ${indent}        limit 1
-        ${indent}    loop
+        ${indent}    loop${stale_check(indent)}
         ${indent}        if block_search.present then
         ${indent}            ${join ? joined(compare, indent) : non_joined(compare, indent)}
         ${indent}        else
@@ -0,0 +1,140 @@
+// copyright defined in LICENSE.txt
+
+#pragma once
+#include <boost/beast/core/flat_buffer.hpp>
+#include <eosio/ship_protocol.hpp>
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Decodes blocks on worker threads into an Output each and hands them, in block order, to a single writer thread. With a
+/// reset function, written jobs are kept and reused, so their outputs keep their capacity instead of being allocated again for
+/// each block.
+template <typename Output, typename Result = eosio::ship_protocol::get_blocks_result_v0>
+struct decode_pipeline {
+    struct job {
+        std::shared_ptr<boost::beast::flat_buffer> buffer; // keeps the opaque fields of result valid
+        Result                                     result;
+        Output                                     output;
+        bool                                       decoded = false;
+    };
+
+    using decode_fn = std::function<void(uint32_t worker, job&)>;
+    using write_fn  = std::function<void(job&)>;
+    using reset_fn  = std::function<void(Output&)>;
+
+    decode_fn                         decode;
+    write_fn                          write;
+    reset_fn                          reset;
+    std::size_t                       max_jobs;
+    std::mutex                        mutex;
+    std::condition_variable           cv;
+    std::deque<std::shared_ptr<job>>  jobs;            // jobs not yet written, in block order
+    std::size_t                       num_started = 0; // jobs[0, num_started) have been handed to a worker
+    bool                              stopping    = false;
+    std::exception_ptr                error;
+    std::vector<std::shared_ptr<job>> spare; // written jobs, ready for reuse
+    std::vector<std::thread>          threads;
+
+    decode_pipeline(uint32_t num_workers, decode_fn decode, write_fn write, reset_fn reset = {})
+        : decode(std::move(decode))
+        , write(std::move(write))
+        , reset(std::move(reset))
+        , max_jobs(num_workers * 8) {
+        for (uint32_t i = 0; i < num_workers; ++i)
+            threads.emplace_back([this, i] { run_worker(i); });
+        threads.emplace_back([this] { run_writer(); });
+    }
+
+    ~decode_pipeline() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto& t : threads)
+            t.join();
+    }
+
+    /// blocks while the pipeline is full; rethrows the first error raised by a worker or the writer
+    void push(std::shared_ptr<boost::beast::flat_buffer> buffer, const Result& result) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return error || jobs.size() < max_jobs; });
+        if (error)
+            std::rethrow_exception(error);
+        std::shared_ptr<job> j;
+        if (!spare.empty()) {
+            j = std::move(spare.back());
+            spare.pop_back();
+        } else {
+            j = std::make_shared<job>();
+        }
+        j->buffer  = std::move(buffer);
+        j->result  = result;
+        j->decoded = false;
+        jobs.push_back(std::move(j));
+        cv.notify_all();
+    }
+
+    /// waits until every pushed block has been written
+    void drain() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return error || jobs.empty(); });
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+  private:
+    void run_worker(uint32_t worker) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv.wait(lock, [this] { return stopping || error || num_started < jobs.size(); });
+            if (stopping || error)
+                return;
+            auto j = jobs[num_started++];
+            lock.unlock();
+            std::exception_ptr e;
+            try {
+                decode(worker, *j);
+            } catch (...) { e = std::current_exception(); }
+            lock.lock();
+            if (e && !error)
+                error = e;
+            j->decoded = true;
+            cv.notify_all();
+        }
+    }
+
+    void run_writer() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv.wait(lock, [this] { return stopping || error || (!jobs.empty() && jobs.front()->decoded); });
+            if (stopping || error)
+                return;
+            auto j = jobs.front();
+            lock.unlock();
+            std::exception_ptr e;
+            try {
+                write(*j);
+                if (reset) {
+                    j->buffer.reset();
+                    reset(j->output);
+                }
+            } catch (...) { e = std::current_exception(); }
+            lock.lock();
+            if (e && !error)
+                error = e;
+            jobs.pop_front();
+            --num_started;
+            if (reset && !e)
+                spare.push_back(std::move(j));
+            cv.notify_all();
+        }
+    }
+}; // decode_pipeline
@@ -0,0 +1,738 @@
+// copyright defined in LICENSE.txt
+
+#include "fill_parquet_plugin.hpp"
+#include "abieos_sql_converter.hpp"
+#include "fill_rows.hpp"
+#include "metrics.hpp"
+#include "state_history_connection.hpp"
+
+#include <arrow/api.h>
+#include <arrow/io/file.h>
+#include <parquet/arrow/writer.h>
+#include <parquet/exception.h>
+
+#include <boost/filesystem.hpp>
+#include <fc/exception/exception.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <optional>
+#include <set>
+#include <type_traits>
+
+using namespace appbase;
+using namespace eosio::ship_protocol;
+using namespace state_history;
+using namespace std::literals;
+
+namespace asio = boost::asio;
+namespace bfs  = boost::filesystem;
+namespace bpo  = boost::program_options;
+
+inline parquet::Compression::type parquet_compression(const std::string& name) {
+    if (name == "zstd")
+        return parquet::Compression::ZSTD;
+    if (name == "snappy")
+        return parquet::Compression::SNAPPY;
+    if (name == "gzip")
+        return parquet::Compression::GZIP;
+    if (name == "none")
+        return parquet::Compression::UNCOMPRESSED;
+    throw std::runtime_error("unknown fparq-compression: " + name);
+}
+
+/// How a basic abi type is stored: natively where Arrow has the type, else as the text fill-pg writes for it
+struct arrow_basic_type {
+    std::shared_ptr<arrow::DataType> type;
+    void (*append)(arrow::ArrayBuilder&, eosio::input_stream&) = nullptr;
+};
+
+using arrow_basic_types = std::map<std::string_view, arrow_basic_type>;
+
+template <typename T>
+void append_native(arrow::ArrayBuilder& builder, eosio::input_stream& bin) {
+    using builder_type = typename arrow::CTypeTraits<T>::BuilderType;
+    PARQUET_THROW_NOT_OK(static_cast<builder_type&>(builder).Append(eosio::from_bin<T>(bin)));
+}
+
+template <typename T, typename V>
+void append_var(arrow::ArrayBuilder& builder, eosio::input_stream& bin) {
+    using builder_type = typename arrow::CTypeTraits<T>::BuilderType;
+    PARQUET_THROW_NOT_OK(static_cast<builder_type&>(builder).Append(eosio::from_bin<V>(bin).value));
+}
+
+/// string and bytes, appended from the row without a copy in between
+inline void append_sized(arrow::ArrayBuilder& builder, eosio::input_stream& bin) {
+    auto size = read_varuint32_bin(bin);
+    auto data = bin.pos;
+    skip_bin(bin, size);
+    PARQUET_THROW_NOT_OK(static_cast<arrow::BinaryBuilder&>(builder).Append(data, int32_t(size)));
+}
+
+/// microseconds since the epoch; the zero time is null, as fill-pg stores it
+template <typename T>
+void append_timestamp(arrow::ArrayBuilder& builder, eosio::input_stream& bin) {
+    auto    v = eosio::from_bin<T>(bin);
+    int64_t us;
+    if constexpr (std::is_same_v<T, eosio::time_point>)
+        us = v.elapsed.count();
+    else if constexpr (std::is_same_v<T, eosio::time_point_sec>)
+        us = int64_t(v.utc_seconds) * 1'000'000;
+    else
+        us = v.slot ? v.to_time_point().elapsed.count() : 0;
+    if (us)
+        PARQUET_THROW_NOT_OK(static_cast<arrow::TimestampBuilder&>(builder).Append(us));
+    else
+        PARQUET_THROW_NOT_OK(builder.AppendNull());
+}
+
+template <typename T>
+void append_text(arrow::ArrayBuilder& builder, eosio::input_stream& bin) {
+    thread_local std::string text;
+    text.clear();
+    state_history::pg::append_bin_to_sql<T>(text, bin);
+    PARQUET_THROW_NOT_OK(static_cast<arrow::StringBuilder&>(builder).Append(text));
+}
+
+template <typename T>
+arrow_basic_type make_arrow_basic_type() {
+    if constexpr (std::is_same_v<T, bool> || (std::is_integral_v<T> && sizeof(T) <= 8) || std::is_same_v<T, double>)
+        return {arrow::CTypeTraits<T>::type_singleton(), append_native<T>};
+    else if constexpr (std::is_same_v<T, eosio::varuint32>)
+        return {arrow::uint32(), append_var<uint32_t, T>};
+    else if constexpr (std::is_same_v<T, eosio::varint32>)
+        return {arrow::int32(), append_var<int32_t, T>};
+    else if constexpr (std::is_same_v<T, std::string>)
+        return {arrow::utf8(), append_sized};
+    else if constexpr (std::is_same_v<T, eosio::bytes>)
+        return {arrow::binary(), append_sized};
+    else if constexpr (
+        std::is_same_v<T, eosio::time_point> || std::is_same_v<T, eosio::time_point_sec> || std::is_same_v<T, eosio::block_timestamp>)
+        return {arrow::timestamp(arrow::TimeUnit::MICRO), append_timestamp<T>};
+    else
+        return {arrow::utf8(), append_text<T>};
+}
+
+template <typename... T>
+arrow_basic_types make_arrow_basic_types(std::tuple<T...>*) {
+    return {{state_history::pg::names_for<T>.abi, make_arrow_basic_type<T>()}...};
+}
+
+/// A column compiled from its abi type, so rows are appended to its builder without looking up types by name. Like fill-pg's
+/// columns, an optional is a nullable value and a struct of one field is that field. Other structs and arrays are Arrow
+/// structs and lists; nested variants, which Arrow's unions don't fit well, are stored as their JSON.
+struct arrow_column {
+    enum kind_t : uint8_t { basic, optional, struct_, list, json };
+
+    kind_t                           kind = basic;
+    std::shared_ptr<arrow::DataType> type;
+    void (*append_basic)(arrow::ArrayBuilder&, eosio::input_stream&) = nullptr;
+    const eosio::abi_type*           variant_type = nullptr; // json
+    std::vector<arrow_column>        children;               // optional: the value. struct_: the fields. list: the element
+
+    static arrow_column compile(const arrow_basic_types& basic_types, const eosio::abi_type& abi_type) {
+        arrow_column column;
+        if (auto value = abi_type.optional_of()) {
+            column.kind = optional;
+            column.children.push_back(compile(basic_types, *value));
+            column.type = column.children[0].type;
+        } else if (auto s = abi_type.as_struct()) {
+            if (s->fields.size() == 1)
+                return compile(basic_types, *s->fields[0].type);
+            column.kind = struct_;
+            arrow::FieldVector fields;
+            for (auto& field : s->fields) {
+                column.children.push_back(compile(basic_types, *field.type));
+                fields.push_back(arrow::field(field.name, column.children.back().type));
+            }
+            column.type = arrow::struct_(std::move(fields));
+        } else if (auto element = abi_type.array_of()) {
+            column.kind = list;
+            column.children.push_back(compile(basic_types, *element));
+            column.type = arrow::list(column.children[0].type);
+        } else if (abi_type.as_variant()) {
+            column.kind         = json;
+            column.type         = arrow::utf8();
+            column.variant_type = &abi_type;
+        } else {
+            auto it = basic_types.find(abi_type.name);
+            if (it == basic_types.end())
+                throw std::runtime_error("don't know how to store " + abi_type.name + " in Parquet");
+            column.type         = it->second.type;
+            column.append_basic = it->second.append;
+        }
+        return column;
+    }
+
+    void append(arrow::ArrayBuilder& builder, eosio::input_stream& bin) const {
+        switch (kind) {
+        case basic: return append_basic(builder, bin);
+        case optional:
+            if (read_bool_bin(bin))
+                return children[0].append(builder, bin);
+            PARQUET_THROW_NOT_OK(builder.AppendNull());
+            return;
+        case struct_:
+            PARQUET_THROW_NOT_OK(static_cast<arrow::StructBuilder&>(builder).Append());
+            for (std::size_t i = 0; i < children.size(); ++i)
+                children[i].append(*builder.child(int(i)), bin);
+            return;
+        case list: {
+            auto& list_builder = static_cast<arrow::ListBuilder&>(builder);
+            PARQUET_THROW_NOT_OK(list_builder.Append());
+            for (auto n = read_varuint32_bin(bin); n; --n)
+                children[0].append(*list_builder.value_builder(), bin);
+            return;
+        }
+        case json: PARQUET_THROW_NOT_OK(static_cast<arrow::StringBuilder&>(builder).Append(variant_type->bin_to_json(bin))); return;
+        }
+    }
+};
+
+/// The columns of a delta table after block_num and present, which are a struct's fields or a variant's union fields, named as
+/// fill-pg names them. A variant's alternative fills the union fields it has and leaves the rest null.
+struct delta_layout {
+    std::vector<std::string>           names;
+    std::vector<arrow_column>          columns;
+    bool                               variant = false;
+    std::vector<std::vector<uint32_t>> alternatives; // variant: the column of each field of each alternative, in order
+
+    delta_layout(abieos_sql_converter& converter, const arrow_basic_types& basic_types, const eosio::abi_type& type) {
+        for (auto& field : converter.table_fields(type))
+            names.push_back(field.name);
+        if (auto s = type.as_struct()) {
+            for (auto& field : s->fields)
+                columns.push_back(arrow_column::compile(basic_types, *field.type));
+            return;
+        }
+        // the union fields are matched the way abieos_sql_converter matches them
+        variant = true;
+        columns.resize(names.size());
+        std::vector<bool> compiled(names.size());
+        for (auto& alternative : *type.as_variant()) {
+            if (!alternative.type->as_struct())
+                throw std::runtime_error("don't know how to store " + type.name + " in Parquet");
+            auto& fields  = alternative.type->as_struct()->fields;
+            auto& mapping = alternatives.emplace_back();
+            for (uint32_t i = 0; i < names.size() && mapping.size() < fields.size(); ++i) {
+                auto& field = fields[mapping.size()];
+                if (names[i] != field.name && names[i] != alternative.name + "_" + field.name)
+                    continue;
+                if (!compiled[i])
+                    columns[i] = arrow_column::compile(basic_types, *field.type);
+                compiled[i] = true;
+                mapping.push_back(i);
+            }
+            if (mapping.size() != fields.size())
+                throw std::runtime_error("can't match the fields of " + alternative.name + " to the columns of " + type.name);
+        }
+    }
+
+    arrow::FieldVector fields() const {
+        arrow::FieldVector result = {arrow::field("block_num", arrow::uint32()), arrow::field("present", arrow::boolean())};
+        for (std::size_t i = 0; i < names.size(); ++i)
+            result.push_back(arrow::field(names[i], columns[i].type));
+        return result;
+    }
+};
+
+/// A table's rows within the current partition, in its columns' builders; write_batch() turns those into a row group of the
+/// partition's file. The file is written under a .tmp name until close() moves it to path.
+struct parquet_table {
+    std::string                                       name;
+    std::shared_ptr<arrow::Schema>                    schema;
+    std::vector<std::unique_ptr<arrow::ArrayBuilder>> builders;
+    std::shared_ptr<parquet::WriterProperties>        properties;
+    std::shared_ptr<arrow::io::FileOutputStream>      file;
+    std::unique_ptr<parquet::arrow::FileWriter>       writer;
+    std::string                                       path;
+    int64_t                                           num_rows = 0; // in the builders
+    metrics::counter&                                 rows_metric;
+
+    parquet_table(std::string name, arrow::FieldVector fields, std::shared_ptr<parquet::WriterProperties> properties)
+        : name(std::move(name))
+        , properties(std::move(properties))
+        , rows_metric(metrics::get_counter("fill_parquet_rows_total", "Rows written to Parquet", "table=\"" + this->name + "\"")) {
+        for (auto& field : fields) {
+            PARQUET_ASSIGN_OR_THROW(auto builder, arrow::MakeBuilder(field->type()));
+            builders.push_back(std::move(builder));
+        }
+        schema = arrow::schema(std::move(fields));
+    }
+
+    arrow::ArrayBuilder& column(std::size_t i) { return *builders[i]; }
+
+    void end_row() {
+        ++num_rows;
+        rows_metric.add();
+    }
+
+    void write_batch() {
+        if (!num_rows)
+            return;
+        if (!writer) {
+            PARQUET_ASSIGN_OR_THROW(file, arrow::io::FileOutputStream::Open(path + ".tmp"));
+            PARQUET_ASSIGN_OR_THROW(writer, parquet::arrow::FileWriter::Open(*schema, arrow::default_memory_pool(), file, properties));
+        }
+        arrow::ArrayVector arrays;
+        for (auto& builder : builders) {
+            std::shared_ptr<arrow::Array> array;
+            PARQUET_THROW_NOT_OK(builder->Finish(&array));
+            arrays.push_back(std::move(array));
+        }
+        PARQUET_THROW_NOT_OK(writer->WriteTable(*arrow::Table::Make(schema, arrays, num_rows), num_rows));
+        num_rows = 0;
+    }
+
+    /// Writes the rest of the partition and moves its file in place. A table without rows in the partition gets no file.
+    void close() {
+        write_batch();
+        if (!writer)
+            return;
+        PARQUET_THROW_NOT_OK(writer->Close());
+        PARQUET_THROW_NOT_OK(file->Close());
+        writer.reset();
+        file.reset();
+        bfs::rename(path + ".tmp", path);
+    }
+
+    /// drops the partition's rows and its unfinished file
+    void discard() {
+        for (auto& builder : builders)
+            builder->Reset();
+        num_rows = 0;
+        if (!writer)
+            return;
+        (void)writer->Close();
+        (void)file->Close();
+        writer.reset();
+        file.reset();
+        boost::system::error_code ec;
+        bfs::remove(path + ".tmp", ec);
+    }
+};
+
+/// Arrow fields of trace columns, by their abi types
+inline arrow::FieldVector trace_fields(const arrow_basic_types& basic_types, const trace_columns& columns) {
+    arrow::FieldVector result;
+    for (auto& column : columns)
+        result.push_back(arrow::field(column.name, basic_types.at(column.type).type));
+    return result;
+}
+
+/// transaction_trace rows hold the fields before action_traces; the actions go to the action tables
+inline const trace_columns transaction_trace_columns = {
+    {"block_num", "uint32"},
+    {"transaction_ordinal", "int32"},
+    {"id", "checksum256"},
+    {"status", "transaction_status"},
+    {"cpu_usage_us", "uint32"},
+    {"net_usage_words", "varuint32"},
+    {"elapsed", "int64"},
+    {"net_usage", "uint64"},
+    {"scheduled", "bool"},
+};
+
+/// Appends the rows of walk_action_traces() to the action tables which are written
+struct action_builders_sink {
+    std::array<parquet_table*, 3>          tables = {};
+    std::array<std::size_t, 3>             next   = {}; // column of the open row
+    std::array<const arrow_basic_type*, 8> types;
+
+    explicit action_builders_sink(const arrow_basic_types& basic_types) {
+        for (std::size_t i = 0; i < types.size(); ++i)
+            types[i] = &basic_types.at(action_column_types[i]);
+    }
+
+    bool writes() const { return tables[0] || tables[1] || tables[2]; }
+
+    arrow::ArrayBuilder& next_column(action_table table) { return tables[std::size_t(table)]->column(next[std::size_t(table)]++); }
+
+    void begin_row(action_table table) { next[std::size_t(table)] = 0; }
+
+    template <typename T>
+    void key(action_table table, T v) {
+        using builder_type = typename arrow::CTypeTraits<T>::BuilderType;
+        if (tables[std::size_t(table)])
+            PARQUET_THROW_NOT_OK(static_cast<builder_type&>(next_column(table)).Append(v));
+    }
+
+    void column(action_table table, eosio::input_stream& bin, action_column type) {
+        if (tables[std::size_t(table)])
+            types[std::size_t(type)]->append(next_column(table), bin);
+        else
+            skip_action_column(bin, type);
+    }
+
+    void null(action_table table) {
+        if (tables[std::size_t(table)])
+            PARQUET_THROW_NOT_OK(next_column(table).AppendNull());
+    }
+
+    void end_row(action_table table, std::size_t) {
+        if (tables[std::size_t(table)])
+            tables[std::size_t(table)]->end_row();
+    }
+};
+
+struct fparq_session;
+
+struct fill_parquet_config : connection_config {
+    std::string             dir;
+    uint32_t                skip_to          = 0;
+    uint32_t                stop_before      = 0;
+    trx_filter_set          trx_filters      = {};
+    uint32_t                partition_blocks = 100000;
+    uint32_t                row_group_rows   = 131072;
+    std::set<std::string>   tables           = {}; // empty writes every table
+    std::string             compression      = "zstd";
+};
+
+struct fill_parquet_plugin_impl : std::enable_shared_from_this<fill_parquet_plugin_impl> {
+    std::shared_ptr<fill_parquet_config>      config = std::make_shared<fill_parquet_config>();
+    std::shared_ptr<fparq_session>            session;
+    boost::asio::deadline_timer               timer;
+    std::shared_ptr<state_history::abi_cache> abis = std::make_shared<state_history::abi_cache>();
+    std::shared_ptr<capture_writer>           recorder; // fill-record
+
+    fill_parquet_plugin_impl()
+        : timer(app().get_io_service()) {}
+
+    ~fill_parquet_plugin_impl();
+
+    void schedule_retry() {
+        timer.expires_from_now(boost::posix_time::seconds(1));
+        timer.async_wait([this](auto&) {
+            ilog("retry...");
+            start();
+        });
+    }
+
+    void start();
+};
+
+/// Writes irreversible blocks to <fparq-dir>/<table>/blocks-<begin>-<end>.parquet, a file per table for each partition of
+/// fparq-partition-blocks blocks. <fparq-dir>/progress holds the block after the last partition whose files are all in
+/// place; a restart discards the unfinished partition and fetches it again.
+struct fparq_session : connection_callbacks, std::enable_shared_from_this<fparq_session> {
+    fill_parquet_plugin_impl*                         my = nullptr;
+    std::shared_ptr<fill_parquet_config>              config;
+    std::shared_ptr<state_history::connection>        connection;
+    std::shared_ptr<eosio::abi>                       abi;
+    abieos_sql_converter                              converter; // names the columns as fill-pg does
+    arrow_basic_types                                 arrow_types;
+    std::shared_ptr<parquet::WriterProperties>        properties;
+    std::map<std::string, parquet_table, std::less<>> tables;
+    std::map<std::string, delta_layout, std::less<>>  layouts;                      // of the delta tables which are written
+    parquet_table*                                    transaction_traces = nullptr; // when written
+    std::optional<action_builders_sink>               actions;
+    table_delta_v0                                    t_delta;
+    uint32_t                                          head            = 0;
+    uint32_t                                          partition_begin = 0; // tables hold the rows of [partition_begin, head]
+    uint64_t                                          partition_end   = 0; // 0 when no partition is open
+    metrics::counter&                                 blocks_metric =
+        metrics::get_counter("fill_parquet_blocks_total", "Blocks written to Parquet");
+
+    fparq_session(fill_parquet_plugin_impl* my)
+        : my(my)
+        , config(my->config) {
+        using basic_types = std::tuple<
+            bool, uint8_t, int8_t, uint16_t, int16_t, uint32_t, int32_t, uint64_t, int64_t, double, std::string, unsigned __int128,
+            __int128, eosio::float128, eosio::varuint32, eosio::varint32, eosio::name, eosio::checksum256, eosio::time_point,
+            eosio::time_point_sec, eosio::block_timestamp, eosio::public_key, eosio::signature, eosio::bytes, eosio::symbol,
+            eosio::ship_protocol::transaction_status, eosio::ship_protocol::recurse_transaction_trace, eosio::ship_protocol::wasm_config>;
+        converter.register_basic_types<basic_types>();
+        arrow_types = make_arrow_basic_types((basic_types*)nullptr);
+        properties  = parquet::WriterProperties::Builder().compression(parquet_compression(config->compression))->build();
+    }
+
+    void start(asio::io_context& ioc) {
+        remove_unfinished();
+        connection           = std::make_shared<state_history::connection>(ioc, *config, shared_from_this());
+        connection->abis     = my->abis;
+        connection->recorder = my->recorder;
+        connection->connect();
+    }
+
+    bool wanted(const std::string& table) const { return config->tables.empty() || config->tables.count(table); }
+
+    eosio::abi_type& get_type(const std::string& type_name) {
+        auto it = abi->abi_types.find(type_name);
+        if (it == abi->abi_types.end())
+            throw std::runtime_error("Unable to find " + type_name + " in the received abi");
+        return it->second;
+    }
+
+    void received_abi(const std::shared_ptr<eosio::abi>& received) override {
+        abi = received;
+        tables.clear();
+        layouts.clear();
+        auto add_table = [&](const std::string& name, arrow::FieldVector fields) -> parquet_table* {
+            if (!wanted(name))
+                return nullptr;
+            return &tables.try_emplace(name, name, std::move(fields), properties).first->second;
+        };
+        for (auto& table : connection->abi.tables) {
+            // fill_pg doesn't write it either
+            if (table.type == "global_property" || !wanted(table.type))
+                continue;
+            auto& layout = layouts.try_emplace(table.type, converter, arrow_types, get_type(table.type)).first->second;
+            add_table(table.type, layout.fields());
+        }
+        transaction_traces = add_table("transaction_trace", trace_fields(arrow_types, transaction_trace_columns));
+        actions.emplace(arrow_types);
+        actions->tables = {
+            add_table("action_trace", trace_fields(arrow_types, action_trace_columns)),
+            add_table("action_trace_authorization", trace_fields(arrow_types, action_trace_authorization_columns)),
+            add_table("action_trace_ram_delta", trace_fields(arrow_types, action_trace_ram_delta_columns))};
+        for (auto& name : config->tables)
+            if (!tables.count(name))
+                throw std::runtime_error("fparq-tables: unknown table " + name);
+        connection->send(get_status_request_v0{});
+    }
+
+    bool received(get_status_result_v0& status) override {
+        auto start = std::max(config->skip_to, read_progress());
+        if (config->stop_before && start >= config->stop_before) {
+            ilog("blocks before ${b} are already written", ("b", config->stop_before));
+            return false;
+        }
+        connection->request_blocks(status, start, {});
+        return true;
+    }
+
+    bool received(get_blocks_result_v0& result) override {
+        if (!result.this_block)
+            return true;
+        auto block_num = result.this_block->block_num;
+        if (config->stop_before && block_num >= config->stop_before) {
+            ilog("block ${b}: stop requested", ("b", block_num));
+            close_partition();
+            return false;
+        }
+        if (block_num <= head)
+            throw std::runtime_error(
+                "block " + std::to_string(block_num) + " isn't past " + std::to_string(head) + "; only irreversible blocks are written");
+        if (partition_end && block_num >= partition_end)
+            close_partition();
+        if (!partition_end)
+            open_partition(block_num);
+
+        if (result.deltas)
+            receive_deltas(block_num, *result.deltas);
+        if (result.traces)
+            receive_traces(block_num, *result.traces);
+        for (auto& [_, table] : tables)
+            if (table.num_rows >= config->row_group_rows)
+                table.write_batch();
+        head = block_num;
+        blocks_metric.add();
+        return true;
+    }
+
+    void receive_deltas(uint32_t block_num, eosio::input_stream bin) {
+        for (auto n = read_varuint32_bin(bin); n; --n) {
+            auto index = read_varuint32_bin(bin);
+            if (index != 0)
+                throw std::runtime_error("unknown table_delta type " + std::to_string(index));
+            t_delta.rows.clear();
+            from_bin(t_delta, bin);
+            auto layout = layouts.find(t_delta.name);
+            if (layout == layouts.end())
+                continue;
+            auto& table = tables.find(t_delta.name)->second;
+            for (auto& row : t_delta.rows)
+                append_delta_row(table, layout->second, block_num, row);
+        }
+    }
+
+    void append_delta_row(parquet_table& table, const delta_layout& layout, uint32_t block_num, const row& delta_row) {
+        PARQUET_THROW_NOT_OK(static_cast<arrow::UInt32Builder&>(table.column(0)).Append(block_num));
+        PARQUET_THROW_NOT_OK(static_cast<arrow::BooleanBuilder&>(table.column(1)).Append(delta_row.present));
+        auto bin = delta_row.data;
+        if (layout.variant) {
+            auto&       fields = layout.alternatives.at(read_varuint32_bin(bin));
+            std::size_t next   = 0;
+            for (uint32_t i = 0; i < layout.columns.size(); ++i) {
+                if (next < fields.size() && fields[next] == i) {
+                    layout.columns[i].append(table.column(i + 2), bin);
+                    ++next;
+                } else {
+                    PARQUET_THROW_NOT_OK(table.column(i + 2).AppendNull());
+                }
+            }
+        } else {
+            for (std::size_t i = 0; i < layout.columns.size(); ++i)
+                layout.columns[i].append(table.column(i + 2), bin);
+        }
+        table.end_row();
+    }
+
+    void receive_traces(uint32_t block_num, eosio::input_stream bin) {
+        uint32_t num_ordinals = 0;
+        for (auto n = read_varuint32_bin(bin); n; --n) {
+            auto            trace_bin = bin;
+            trace_bin_parts parts;
+            bool            keep = filter_trace_bin(config->trx_filters, bin, parts);
+            trace_bin.end        = bin.pos;
+            if (keep)
+                write_transaction_trace(block_num, num_ordinals, trace_bin, parts);
+        }
+    }
+
+    /// transaction ordinals are numbered the way fill_pg numbers them, so rows of both join alike
+    void write_transaction_trace(uint32_t block_num, uint32_t& num_ordinals, eosio::input_stream trace_bin, const trace_bin_parts& parts) {
+        if (parts.failed.pos != parts.failed.end) {
+            if (!parts.failed_kept)
+                return;
+            write_transaction_trace(block_num, num_ordinals, parts.failed, *parts.failed_parts);
+        }
+
+        auto transaction_ordinal = ++num_ordinals;
+        if (transaction_traces) {
+            read_varuint32_bin(trace_bin); // transaction_trace_v0, checked by filter_trace_bin()
+            PARQUET_THROW_NOT_OK(static_cast<arrow::UInt32Builder&>(transaction_traces->column(0)).Append(block_num));
+            PARQUET_THROW_NOT_OK(static_cast<arrow::Int32Builder&>(transaction_traces->column(1)).Append(int32_t(transaction_ordinal)));
+            for (std::size_t i = 2; i < transaction_trace_columns.size(); ++i)
+                arrow_types.at(transaction_trace_columns[i].type).append(transaction_traces->column(i), trace_bin);
+            transaction_traces->end_row();
+        }
+        if (actions->writes())
+            walk_action_traces(*actions, block_num, transaction_ordinal, parts.action_traces);
+    }
+
+    std::string partition_path(const std::string& table) const {
+        char name[48];
+        std::snprintf(name, sizeof(name), "blocks-%010u-%010llu.parquet", partition_begin, (unsigned long long)partition_end);
+        return (bfs::path(config->dir) / table / name).string();
+    }
+
+    void open_partition(uint32_t block_num) {
+        partition_begin = block_num;
+        partition_end   = (uint64_t(block_num) / config->partition_blocks + 1) * config->partition_blocks;
+        if (config->stop_before && config->stop_before < partition_end)
+            partition_end = config->stop_before;
+        for (auto& [name, table] : tables) {
+            bfs::create_directories(bfs::path(config->dir) / name);
+            table.path = partition_path(name);
+        }
+    }
+
+    void close_partition() {
+        if (!partition_end)
+            return;
+        for (auto& [_, table] : tables)
+            table.close();
+        write_progress(partition_end);
+        ilog("wrote blocks ${b} - ${e}", ("b", partition_begin)("e", partition_end - 1));
+        partition_end = 0;
+    }
+
+    uint32_t read_progress() const {
+        std::ifstream in((bfs::path(config->dir) / "progress").string());
+        uint32_t      block = 0;
+        in >> block;
+        return block;
+    }
+
+    void write_progress(uint64_t block) const {
+        auto path = bfs::path(config->dir) / "progress";
+        {
+            std::ofstream out(path.string() + ".tmp", std::ios::trunc);
+            out << block << "\n";
+            if (!out)
+                throw std::runtime_error("can't write " + path.string() + ".tmp");
+        }
+        bfs::rename(path.string() + ".tmp", path);
+    }
+
+    /// files of a partition which didn't finish, from before a restart
+    void remove_unfinished() const {
+        bfs::create_directories(config->dir);
+        std::vector<bfs::path> unfinished;
+        for (bfs::recursive_directory_iterator it(config->dir), end; it != end; ++it)
+            if (bfs::is_regular_file(it->path()) && it->path().extension() == ".tmp")
+                unfinished.push_back(it->path());
+        for (auto& path : unfinished)
+            bfs::remove(path);
+    }
+
+    void closed(bool retry) override {
+        for (auto& [_, table] : tables)
+            table.discard();
+        if (my) {
+            my->session.reset();
+            if (retry)
+                my->schedule_retry();
+        }
+    }
+}; // fparq_session
+
+static abstract_plugin& _fill_parquet_plugin = app().register_plugin<fill_parquet_plugin>();
+
+fill_parquet_plugin_impl::~fill_parquet_plugin_impl() {
+    if (session)
+        session->my = nullptr;
+}
+
+void fill_parquet_plugin_impl::start() {
+    session = std::make_shared<fparq_session>(this);
+    session->start(app().get_io_service());
+}
+
+fill_parquet_plugin::fill_parquet_plugin()
+    : my(std::make_shared<fill_parquet_plugin_impl>()) {}
+
+fill_parquet_plugin::~fill_parquet_plugin() {}
+
+void fill_parquet_plugin::set_program_options(options_description& cli, options_description& cfg) {
+    auto op = cfg.add_options();
+    op("fparq-dir", bpo::value<std::string>()->default_value("parquet"), "Directory the Parquet files are written to");
+    op("fparq-partition-blocks", bpo::value<uint32_t>()->default_value(100000), "Start new Parquet files every [arg] blocks");
+    op("fparq-row-group-rows", bpo::value<uint32_t>()->default_value(131072), "Write a table's rows as a row group every [arg] rows");
+    op("fparq-compression", bpo::value<std::string>()->default_value("zstd"), "Parquet compression: zstd, snappy, gzip or none");
+    op("fparq-tables", bpo::value<std::vector<std::string>>()->composing(),
+       "Write only table [arg] (default every table); may be given more than once");
+}
+
+void fill_parquet_plugin::plugin_initialize(const variables_map& options) {
+    try {
+        auto endpoint = options.at("fill-connect-to").as<std::string>();
+        if (endpoint.find(':') == std::string::npos)
+            throw std::runtime_error("invalid endpoint: " + endpoint);
+
+        my->config->host                   = endpoint.substr(0, endpoint.find(':'));
+        my->config->port                   = endpoint.substr(endpoint.find(':') + 1, endpoint.size());
+        my->config->max_messages_in_flight = options["fill-max-in-flight"].as<uint32_t>();
+        my->config->replay_file            = options.count("fill-replay") ? options["fill-replay"].as<std::string>() : "";
+        my->config->irreversible_only      = true;
+        my->config->dir                    = options["fparq-dir"].as<std::string>();
+        my->config->skip_to                = options.count("fill-skip-to") ? options["fill-skip-to"].as<uint32_t>() : 0;
+        my->config->stop_before            = options.count("fill-stop") ? options["fill-stop"].as<uint32_t>() : 0;
+        my->config->trx_filters            = fill_plugin::get_trx_filters(options);
+        my->config->partition_blocks       = options["fparq-partition-blocks"].as<uint32_t>();
+        my->config->row_group_rows         = options["fparq-row-group-rows"].as<uint32_t>();
+        my->config->compression            = options["fparq-compression"].as<std::string>();
+        if (options.count("fparq-tables")) {
+            auto tables        = options["fparq-tables"].as<std::vector<std::string>>();
+            my->config->tables = {tables.begin(), tables.end()};
+        }
+        if (!my->config->partition_blocks)
+            throw std::runtime_error("fparq-partition-blocks must be positive");
+        if (options.count("fill-trim"))
+            throw std::runtime_error("fill-parquet doesn't trim; its files only hold irreversible blocks");
+        parquet_compression(my->config->compression);
+        if (options.count("fill-record"))
+            my->recorder = std::make_shared<capture_writer>(options["fill-record"].as<std::string>());
+    }
+    FC_LOG_AND_RETHROW()
+}
+
+void fill_parquet_plugin::plugin_startup() { my->start(); }
+
+void fill_parquet_plugin::plugin_shutdown() {
+    if (my->session)
+        my->session->connection->close(false);
+    my->timer.cancel();
+    ilog("fill_parquet_plugin stopped");
+}
@@ -1,6 +1,9 @@
 // copyright defined in LICENSE.txt
 
 #include "fill_pg_plugin.hpp"
+#include "decode_pipeline.hpp"
+#include "fill_rows.hpp"
+#include "metrics.hpp"
 #include "state_history_connection.hpp"
 #include "state_history_pg.hpp"
 
@@ -9,8 +12,18 @@
 #include <boost/asio/ip/tcp.hpp>
 
 #include "abieos_sql_converter.hpp"
+#include <libpq-fe.h>
 #include <pqxx/tablewriter>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_set>
+
 using namespace appbase;
 using namespace eosio::ship_protocol;
 using namespace state_history;
@@ -40,6 +53,12 @@ struct work_t {
         return w.exec(stmt);
     }
 
+    template <typename... Args>
+    auto exec_prepared(const std::string& name, Args&&... args) {
+        dlog("execute ${n}", ("n", name));
+        return w.exec_prepared(name, std::forward<Args>(args)...);
+    }
+
     void commit() { w.commit(); }
 
     auto quote_name(const std::string& str) { return w.quote_name(str); }
@@ -75,36 +94,674 @@ struct tablewriter {
     tablewriter(work_t& t, const std::string& name)
         : wr(t.w, name) {}
 
-    void write_raw_line(std::string v) { wr.write_raw_line(v); }
+    void write_raw_line(const std::string& v) { wr.write_raw_line(v); }
     void complete() { wr.complete(); }
 };
 
 struct table_stream {
+    virtual ~table_stream() = default;
+    virtual void write(const std::string& data) = 0;
+    /// completes the COPY and commits its transaction
+    virtual void commit() = 0;
+};
+
+struct text_table_stream : table_stream {
     pqxx::connection c;
     work_t           t;
     tablewriter      writer;
 
-    table_stream(const std::string& name)
+    text_table_stream(const std::string& name)
         : t(c)
         , writer(t, name) {}
+
+    void write(const std::string& data) override { writer.write_raw_line(data); }
+
+    void commit() override {
+        writer.complete();
+        t.commit();
+    }
+};
+
+using pg_result_ptr = std::unique_ptr<PGresult, decltype(&PQclear)>;
+
+/// A libpq connection, for COPY streams which pqxx doesn't cover: binary COPY, and COPY from one connection to another
+struct pg_link {
+    std::unique_ptr<PGconn, decltype(&PQfinish)> conn;
+
+    explicit pg_link(const std::string& conninfo)
+        : conn(PQconnectdb(conninfo.c_str()), &PQfinish) {
+        if (PQstatus(conn.get()) != CONNECTION_OK)
+            throw std::runtime_error(std::string("connect to postgresql: ") + PQerrorMessage(conn.get()));
+    }
+
+    pg_result_ptr exec(const std::string& stmt, ExecStatusType expected) {
+        dlog(stmt.c_str());
+        pg_result_ptr result{PQexec(conn.get(), stmt.c_str()), &PQclear};
+        if (PQresultStatus(result.get()) != expected)
+            throw std::runtime_error(stmt + ": " + PQerrorMessage(conn.get()));
+        return result;
+    }
+
+    void put(const char* data, std::size_t size) {
+        if (PQputCopyData(conn.get(), data, size) != 1)
+            throw std::runtime_error(std::string("copy: ") + PQerrorMessage(conn.get()));
+    }
+
+    /// ends a COPY FROM STDIN and reads its results
+    void end_copy() {
+        if (PQputCopyEnd(conn.get(), nullptr) != 1)
+            throw std::runtime_error(std::string("copy: ") + PQerrorMessage(conn.get()));
+        finish_copy();
+    }
+
+    void finish_copy() {
+        while (auto r = PQgetResult(conn.get())) {
+            pg_result_ptr result{r, &PQclear};
+            if (PQresultStatus(r) != PGRES_COMMAND_OK)
+                throw std::runtime_error(std::string("copy: ") + PQresultErrorMessage(r));
+        }
+    }
+};
+
+/// COPY in the binary format over a libpq connection of its own; pqxx::tablewriter only speaks the text format
+struct binary_table_stream : table_stream {
+    pg_link link{""};
+
+    binary_table_stream(const std::string& name) {
+        link.exec("begin", PGRES_COMMAND_OK);
+        link.exec("copy " + name + " from stdin (format binary)", PGRES_COPY_IN);
+        // signature, flags, header extension length
+        static const char header[19] = {'P', 'G', 'C', 'O', 'P', 'Y', '\n', '\377', '\r', '\n', '\0'};
+        link.put(header, sizeof(header));
+    }
+
+    void write(const std::string& data) override { link.put(data.data(), data.size()); }
+
+    void commit() override {
+        static const char trailer[2] = {'\377', '\377'};
+        link.put(trailer, sizeof(trailer));
+        link.end_copy();
+        link.exec("commit", PGRES_COMMAND_OK);
+    }
 };
 
+/// runs tasks in order on a thread of its own
+struct stream_worker {
+    const std::size_t                                    max_tasks;
+    std::mutex                                           mutex;
+    std::condition_variable                              cv;
+    std::deque<std::function<void()>>                    tasks;
+    bool                                                 busy     = false;
+    bool                                                 stopping = false;
+    std::exception_ptr                                   error;
+    std::map<std::string, std::unique_ptr<table_stream>> streams; // only used by tasks
+    std::thread                                          thread{[this] { run(); }};
+
+    explicit stream_worker(std::size_t max_tasks = 64)
+        : max_tasks(max_tasks) {}
+
+    ~stream_worker() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        thread.join();
+    }
+
+    /// blocks while the queue is full; rethrows the first error raised by a task
+    void post(std::function<void()> f) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return error || tasks.size() < max_tasks; });
+        if (error)
+            std::rethrow_exception(error);
+        tasks.push_back(std::move(f));
+        cv.notify_all();
+    }
+
+    /// waits until every posted task has run
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return error || (tasks.empty() && !busy); });
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+  private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv.wait(lock, [this] { return stopping || (!error && !tasks.empty()); });
+            if (stopping)
+                return;
+            auto f = std::move(tasks.front());
+            tasks.pop_front();
+            busy = true;
+            lock.unlock();
+            std::exception_ptr e;
+            try {
+                f();
+            } catch (...) { e = std::current_exception(); }
+            lock.lock();
+            busy = false;
+            if (e && !error)
+                error = e;
+            cv.notify_all();
+        }
+    }
+}; // stream_worker
+
+/// The COPY streams of a bulk batch, one per table. With workers, each table is assigned to a worker, which owns its stream;
+/// tables are then copied concurrently and commit() commits them all in parallel.
+struct table_stream_set {
+    using create_fn = std::function<std::unique_ptr<table_stream>(const std::string& full_name)>;
+
+    create_fn                                            create;
+    std::map<std::string, std::unique_ptr<table_stream>> streams; // used without workers
+    std::vector<std::unique_ptr<stream_worker>>          workers;
+    std::map<std::string, stream_worker*>                worker_of; // kept across commits
+    std::set<std::string>                                open;      // tables written since the last commit
+
+    table_stream_set(create_fn create, uint32_t num_workers)
+        : create(std::move(create)) {
+        for (uint32_t i = 0; i < num_workers; ++i)
+            workers.push_back(std::make_unique<stream_worker>());
+    }
+
+    bool empty() const { return open.empty(); }
+
+    /// leaves data empty
+    void write(const std::string& name, const std::string& full_name, std::string& data) {
+        open.insert(name);
+        if (workers.empty()) {
+            auto& ts = streams[name];
+            if (!ts)
+                ts = create(full_name);
+            ts->write(data);
+            data.clear();
+            return;
+        }
+        auto& w = worker_of[name];
+        if (!w)
+            w = workers[(worker_of.size() - 1) % workers.size()].get();
+        w->post([this, w, name, full_name, data = std::move(data)] {
+            auto& ts = w->streams[name];
+            if (!ts)
+                ts = create(full_name);
+            ts->write(data);
+        });
+        data.clear();
+    }
+
+    void commit() {
+        if (workers.empty()) {
+            for (auto& [_, ts] : streams)
+                ts->commit();
+            streams.clear();
+        } else {
+            for (auto& w : workers) {
+                w->post([w = w.get()] {
+                    for (auto& [_, ts] : w->streams)
+                        ts->commit();
+                    w->streams.clear();
+                });
+            }
+            for (auto& w : workers)
+                w->wait();
+        }
+        open.clear();
+    }
+}; // table_stream_set
+
 template <typename T>
 std::size_t num_bytes(const eosio::opaque<T>& obj) {
     return obj.num_bytes();
 }
 std::size_t num_bytes(std::optional<eosio::input_stream> strm) { return strm.has_value() ? strm->end - strm->pos : 0; }
 
+/// Decides when the COPY streams of a bulk batch are committed: after enough bytes, rows, blocks or time, whichever comes first.
+/// A limit of 0 is disabled.
+struct flush_policy {
+    using clock = std::chrono::steady_clock;
+
+    uint64_t                  max_bytes  = 0;
+    uint64_t                  max_rows   = 0;
+    uint32_t                  max_blocks = 0;
+    std::chrono::milliseconds max_time{0};
+
+    uint64_t          bytes  = 0;
+    uint64_t          rows   = 0;
+    uint32_t          blocks = 0;
+    clock::time_point start  = clock::now();
+
+    void add(uint64_t num_bytes, uint64_t num_rows) {
+        if (!bytes && !rows)
+            start = clock::now();
+        bytes += num_bytes;
+        rows += num_rows;
+    }
+
+    bool due() const {
+        if (!bytes && !rows)
+            return false;
+        return (max_bytes && bytes >= max_bytes) || (max_rows && rows >= max_rows) || (max_blocks && blocks >= max_blocks) ||
+               (max_time.count() && clock::now() - start >= max_time);
+    }
+
+    double seconds() const { return std::chrono::duration<double>(clock::now() - start).count(); }
+
+    void reset() {
+        bytes  = 0;
+        rows   = 0;
+        blocks = 0;
+    }
+};
+
+/// Logs the fill rate every interval, in place of lines per block
+struct progress_reporter {
+    using clock = std::chrono::steady_clock;
+
+    std::chrono::seconds interval{0};
+    uint32_t             blocks = 0;
+    uint64_t             bytes  = 0;
+    clock::time_point    start  = clock::now();
+
+    void add(uint32_t block_num, uint32_t last_irreversible, uint64_t num_bytes) {
+        ++blocks;
+        bytes += num_bytes;
+        if (!interval.count())
+            return;
+        auto now = clock::now();
+        if (now - start < interval)
+            return;
+        auto seconds = std::chrono::duration<double>(now - start).count();
+        ilog(
+            "block ${b}, ${l} behind irreversible: ${r} blocks/s, ${m} MiB/s",
+            ("b", block_num)("l", block_num < last_irreversible ? last_irreversible - block_num : 0)("r", uint64_t(blocks / seconds))(
+                "m", uint64_t(bytes / seconds) >> 20));
+        blocks = 0;
+        bytes  = 0;
+        start  = now;
+    }
+};
+
+using string_view_set = std::unordered_set<std::string_view>;
+
+/// whether any tab separated field of a COPY line is one of values
+inline bool has_field(std::string_view line, const string_view_set& values) {
+    while (true) {
+        auto end = line.find('\t');
+        if (values.count(line.substr(0, end)))
+            return true;
+        if (end == std::string_view::npos)
+            return false;
+        line.remove_prefix(end + 1);
+    }
+}
+
+/// whether any field of a binary COPY tuple is one of values
+inline bool has_binary_field(std::string_view tuple, const string_view_set& values) {
+    for (std::size_t pos = 2; pos + 4 <= tuple.size();) {
+        int32_t len = 0;
+        for (int i = 0; i < 4; ++i)
+            len = (len << 8) | uint8_t(tuple[pos++]);
+        if (len < 0)
+            continue;
+        if (values.count(tuple.substr(pos, len)))
+            return true;
+        pos += len;
+    }
+    return false;
+}
+
+/// size of a value of a builtin abi type, or 0 when it varies
+inline uint32_t fixed_bin_size(const std::string& abi_type_name) {
+    static const std::map<std::string, uint32_t> sizes = {
+        {"bool", 1},        {"int8", 1},        {"uint8", 1},           {"int16", 2},          {"uint16", 2},   {"int32", 4},
+        {"uint32", 4},      {"int64", 8},       {"uint64", 8},          {"int128", 16},        {"uint128", 16}, {"float32", 4},
+        {"float64", 8},     {"float128", 16},   {"name", 8},            {"time_point", 8},     {"symbol", 8},   {"symbol_code", 8},
+        {"checksum256", 32}, {"time_point_sec", 4}, {"block_timestamp_type", 4},
+    };
+    auto it = sizes.find(abi_type_name);
+    return it == sizes.end() ? 0 : it->second;
+}
+
+/// Delta rows are kept when one of their columns is an account of the trx filters. The name fields of most tables come before
+/// any variable sized field, so the filter is evaluated on the binary row and only rows which may match are converted.
+struct account_filter {
+    enum match_t { no_match, match, unknown };
+
+    /// offsets of a row's name fields, past the variant index, for each alternative. An alternative has none when one of its name
+    /// fields follows a variable sized field.
+    struct layout {
+        bool                                              is_variant = false;
+        std::vector<std::optional<std::vector<uint32_t>>> alternatives;
+    };
+
+    std::vector<std::string>      accounts;
+    string_view_set               account_set; // views of accounts
+    std::unordered_set<uint64_t>  account_names;
+    std::map<std::string, layout> layouts; // keyed by table type
+
+    explicit account_filter(const std::vector<std::string>& filters)
+        : accounts(filters) {
+        for (auto& account : accounts) {
+            account_set.insert(account);
+            account_names.insert(eosio::name(account).value);
+        }
+    }
+
+    account_filter(const account_filter&) = delete;
+    account_filter& operator=(const account_filter&) = delete;
+
+    void add_layout(const std::string& table_type, const eosio::abi_type& type) {
+        layout l;
+        if (auto variant_abi_type = type.as_variant()) {
+            l.is_variant = true;
+            for (auto& alternative : *variant_abi_type)
+                l.alternatives.push_back(alternative.type->as_struct() ? name_offsets(*alternative.type->as_struct()) : std::nullopt);
+        } else if (auto struct_abi_type = type.as_struct()) {
+            l.alternatives.push_back(name_offsets(*struct_abi_type));
+        } else {
+            return;
+        }
+        layouts[table_type] = std::move(l);
+    }
+
+    const layout* find_layout(const std::string& table_type) const {
+        auto it = layouts.find(table_type);
+        return it == layouts.end() ? nullptr : &it->second;
+    }
+
+    /// whether a row's name fields decide it, without converting it
+    match_t match(const layout& l, eosio::input_stream bin) const {
+        auto* offsets = &l.alternatives[0];
+        if (l.is_variant) {
+            uint32_t v;
+            varuint32_from_bin(v, bin);
+            if (v >= l.alternatives.size())
+                return unknown;
+            offsets = &l.alternatives[v];
+        }
+        if (!*offsets)
+            return unknown;
+        for (auto offset : **offsets) {
+            if (offset + sizeof(uint64_t) > bin.remaining())
+                return unknown;
+            uint64_t value;
+            memcpy(&value, bin.pos + offset, sizeof(value));
+            if (account_names.count(value))
+                return match;
+        }
+        return no_match;
+    }
+
+    /// whether a converted row has a column which is one of the accounts
+    bool match_converted(std::string_view line, bool binary) const {
+        return binary ? has_binary_field(line, account_set) : has_field(line, account_set);
+    }
+
+  private:
+    static std::optional<std::vector<uint32_t>> name_offsets(const eosio::abi_type::struct_& struct_abi_type) {
+        std::vector<uint32_t> offsets;
+        uint32_t              offset = 0;
+        bool                  fixed  = true;
+        for (auto& f : struct_abi_type.fields) {
+            // single field structs are flattened into the column of their field
+            auto type = f.type;
+            while (type->as_struct() && type->as_struct()->fields.size() == 1)
+                type = type->as_struct()->fields[0].type;
+            if (type->name == "name") {
+                if (!fixed)
+                    return std::nullopt;
+                offsets.push_back(offset);
+            }
+            auto size = fixed_bin_size(type->name);
+            if (!size)
+                fixed = false;
+            offset += size;
+        }
+        return offsets;
+    }
+};
+
+/// Metrics shared by the sessions. Rows are counted per table by fpg_session::table_rows().
+struct fill_pg_metrics {
+    metrics::counter&   blocks     = metrics::get_counter("fill_blocks_total", "Block results received from state-history");
+    metrics::counter&   copy_bytes = metrics::get_counter("fill_pg_copy_bytes_total", "Bytes written to COPY streams");
+    metrics::histogram& copy_commit =
+        metrics::get_histogram("fill_pg_commit_seconds", "Time to commit a batch, by stage", "stage=\"copy\"");
+    metrics::histogram& status_commit =
+        metrics::get_histogram("fill_pg_commit_seconds", "Time to commit a batch, by stage", "stage=\"fill_status\"");
+    metrics::histogram& trim_chunk = metrics::get_histogram("fill_pg_trim_seconds", "Time to trim a chunk of history");
+
+    static fill_pg_metrics& get() {
+        static fill_pg_metrics m;
+        return m;
+    }
+};
+
+/// Runs trim_history in chunks of blocks, one transaction each, on its own connection and thread so that filling doesn't wait
+/// for it. trimmed is the block history is trimmed up to.
+struct background_trim {
+    std::string             schema_name;
+    uint32_t                chunk_blocks;
+    std::mutex              mutex;
+    std::condition_variable cv;
+    uint32_t                trimmed  = 0;
+    uint32_t                target   = 0;
+    bool                    stopping = false;
+    std::exception_ptr      error;
+    std::thread             thread;
+
+    background_trim(std::string schema_name, uint32_t chunk_blocks)
+        : schema_name(std::move(schema_name))
+        , chunk_blocks(chunk_blocks) {
+        thread = std::thread([this] { run(); });
+    }
+
+    ~background_trim() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        thread.join();
+    }
+
+    /// asks for history in [begin, end) to be trimmed and returns the block it is trimmed up to so far
+    uint32_t request(uint32_t begin, uint32_t end) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (error)
+            std::rethrow_exception(error);
+        if (!trimmed)
+            trimmed = begin;
+        if (end > target) {
+            target = end;
+            cv.notify_all();
+        }
+        return trimmed;
+    }
+
+  private:
+    void run() {
+        try {
+            pqxx::connection conn;
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                cv.wait(lock, [this] { return stopping || trimmed < target; });
+                if (stopping)
+                    return;
+                auto begin = trimmed;
+                auto end   = chunk_blocks ? std::min(target, begin + chunk_blocks) : target;
+                lock.unlock();
+                {
+                    metrics::scoped_timer timer{fill_pg_metrics::get().trim_chunk};
+                    work_t                t(conn);
+                    t.exec("select * from " + schema_name + ".trim_history(" + std::to_string(begin) + ", " + std::to_string(end) + ")");
+                    t.commit();
+                }
+                lock.lock();
+                trimmed = end;
+            }
+        } catch (...) {
+            elog("background trim failed");
+            std::lock_guard<std::mutex> lock(mutex);
+            error = std::current_exception();
+        }
+    }
+}; // background_trim
+
+/// Copies the contract and account state of another fill-pg schema, as of its last irreversible block, into a new schema.
+/// Each table is copied by a COPY out of the source feeding a COPY into the new schema; the tables are spread over several
+/// threads. The source connections share the snapshot exported by the first one, so the tables agree with each other while
+/// the source keeps filling.
+struct schema_seed {
+    struct table {
+        std::string              name;    // quoted
+        std::vector<std::string> columns; // quoted, the ones after block_num
+        std::vector<std::string> keys;    // quoted
+    };
+
+    std::string            source;        // libpq connection string of the source database
+    std::string            source_schema; // quoted
+    std::string            dest_schema;   // quoted
+    std::vector<table>     tables;
+    uint32_t               block = 0; // the source's last irreversible block, which the seeded rows are as of
+    std::string            block_id;
+    std::string            snapshot;
+    std::optional<pg_link> exporter; // holds the snapshot until copy() is done
+
+    /// reads the seed block within the exported snapshot
+    void begin() {
+        exporter.emplace(source);
+        exporter->exec("begin isolation level repeatable read read only", PGRES_COMMAND_OK);
+        snapshot    = PQgetvalue(exporter->exec("select pg_export_snapshot()", PGRES_TUPLES_OK).get(), 0, 0);
+        auto status = exporter->exec("select irreversible, irreversible_id from " + source_schema + ".fill_status", PGRES_TUPLES_OK);
+        if (PQntuples(status.get()) != 1 || !std::stoul(PQgetvalue(status.get(), 0, 0)))
+            throw std::runtime_error(source_schema + " has no irreversible block to seed from");
+        block    = std::stoul(PQgetvalue(status.get(), 0, 0));
+        block_id = PQgetvalue(status.get(), 0, 1);
+    }
+
+    void copy(uint32_t num_threads) {
+        ilog("seed ${n} tables from ${s} at block ${b}", ("n", tables.size())("s", source_schema)("b", block));
+        std::atomic<std::size_t> next{0};
+        std::mutex               mutex;
+        std::exception_ptr       error;
+        std::vector<std::thread> threads;
+        for (uint32_t i = 0; i < std::max(num_threads, 1u); ++i) {
+            threads.emplace_back([&] {
+                try {
+                    pg_link src(source);
+                    pg_link dst("");
+                    src.exec("begin isolation level repeatable read read only", PGRES_COMMAND_OK);
+                    src.exec("set transaction snapshot '" + snapshot + "'", PGRES_COMMAND_OK);
+                    for (auto j = next++; j < tables.size(); j = next++) {
+                        {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            if (error)
+                                return;
+                        }
+                        copy_table(src, dst, tables[j]);
+                    }
+                    src.exec("commit", PGRES_COMMAND_OK);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!error)
+                        error = std::current_exception();
+                }
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+        if (error)
+            std::rethrow_exception(error);
+        exporter->exec("commit", PGRES_COMMAND_OK);
+        exporter.reset();
+    }
+
+  private:
+    /// The newest row of each key at block, unless it's a removal. The rows get block as their block_num, so they land in a
+    /// single partition.
+    void copy_table(pg_link& src, pg_link& dst, const table& t) {
+        auto columns = boost::algorithm::join(t.columns, ", ");
+        auto keys    = boost::algorithm::join(t.keys, ", ");
+        auto from    = " from " + source_schema + "." + t.name + " where block_num <= " + std::to_string(block) + " order by ";
+        auto newest  = t.keys.empty() ? "select " + columns + from + "block_num desc, present desc limit 1"
+                                      : "select distinct on (" + keys + ") " + columns + from + keys + ", block_num desc, present desc";
+        auto out = "copy (select " + std::to_string(block) + ", " + columns + " from (" + newest + ") s where present <> 0) to stdout";
+        auto in  = "copy " + dest_schema + "." + t.name + " (block_num, " + columns + ") from stdin";
+
+        dst.exec("begin", PGRES_COMMAND_OK);
+        dst.exec(in, PGRES_COPY_IN);
+        src.exec(out, PGRES_COPY_OUT);
+        uint64_t num_bytes = 0;
+        while (true) {
+            char* buf  = nullptr;
+            int   size = PQgetCopyData(src.conn.get(), &buf, 0);
+            if (size == -1)
+                break;
+            if (size < 0)
+                throw std::runtime_error(out + ": " + PQerrorMessage(src.conn.get()));
+            std::unique_ptr<char, decltype(&PQfreemem)> data{buf, &PQfreemem};
+            dst.put(buf, size);
+            num_bytes += size;
+        }
+        src.finish_copy();
+        dst.end_copy();
+        dst.exec("commit", PGRES_COMMAND_OK);
+        ilog("seeded ${t}: ${m} MiB", ("t", t.name)("m", num_bytes >> 20));
+    }
+}; // schema_seed
+
+/// a reversible block held by fpg_session::stage_block()
+struct staged_block {
+    uint32_t    block_num = 0;
+    std::string block_id;
+    table_lines lines;
+};
+
 struct fpg_session;
 
+/// Part of a backfill: blocks [begin, end) are fetched from host:port while other ranges are fetched concurrently. head is the
+/// last block whose rows are committed.
+struct backfill_range {
+    uint32_t    begin = 0;
+    uint32_t    end   = 0;
+    std::string host;
+    std::string port;
+    uint32_t    head = 0;
+    std::string head_id;
+    bool        done = false;
+};
+
 struct fill_postgresql_config : connection_config {
     std::string             schema;
-    uint32_t                skip_to       = 0;
-    uint32_t                stop_before   = 0;
-    std::vector<trx_filter> trx_filters   = {};
-    bool                    drop_schema   = false;
-    bool                    create_schema = false;
-    bool                    enable_trim   = false;
+    uint32_t                skip_to        = 0;
+    uint32_t                stop_before    = 0;
+    trx_filter_set          trx_filters    = {};
+    bool                    drop_schema    = false;
+    bool                    create_schema  = false;
+    bool                    enable_trim    = false;
+    uint32_t                trim_chunk     = 10000; // blocks per trim transaction; 0 trims the whole range at once
+    bool                    trim_background = false;
+    uint32_t                decode_threads = 0;
+    bool                    copy_binary    = false;
+    uint32_t                copy_threads   = 0;
+    flush_policy            flush          = {};
+    uint32_t                backfill_ranges = 0; // fetch [skip_to, stop_before) over this many concurrent connections
+    std::vector<std::pair<std::string, std::string>> backfill_endpoints; // host, port
+    uint32_t                partition_blocks = 0; // tables are partitioned by ranges of this many blocks; 0 disables
+    uint32_t                bulk_load_blocks = 0; // primary keys are built within this many blocks of irreversible
+    bool                    unlogged       = false;
+    bool                    stage_reversible = false;
+    bool                    action_tables  = false;
+    uint32_t                progress_seconds = 10;
+    std::string             seed_schema    = {}; // with create_schema, seed the state tables from this fill-pg schema
+    std::string             seed_connection = {}; // libpq connection string of the database holding seed_schema
+    uint32_t                seed_threads   = 4;
+    bool                    async_writes   = false; // write blocks on a thread of their own instead of the io thread
 };
 
 struct fill_postgresql_plugin_impl : std::enable_shared_from_this<fill_postgresql_plugin_impl> {
@@ -112,6 +769,15 @@ struct fill_postgresql_plugin_impl : std::enable_shared_from_this<fill_postgresq
     std::shared_ptr<fpg_session>            session;
     boost::asio::deadline_timer             timer;
     std::vector<std::string>                account_filters;
+    std::vector<backfill_range>             ranges;
+    std::vector<std::shared_ptr<fpg_session>> range_sessions;
+    std::mutex                              ranges_mutex;
+    std::shared_ptr<state_history::abi_cache> abis = std::make_shared<state_history::abi_cache>();
+    std::shared_ptr<state_history::capture_writer> recorder; // fill-record
+
+    /// Converters set up for each abi of abis, which the sessions copy instead of building them again. The transaction_trace
+    /// types of those abis are already resolved. Only used by the io thread.
+    std::map<const eosio::abi*, std::shared_ptr<const abieos_sql_converter>> converters;
 
     fill_postgresql_plugin_impl()
         : timer(app().get_io_service()) {}
@@ -127,9 +793,33 @@ struct fill_postgresql_plugin_impl : std::enable_shared_from_this<fill_postgresq
     }
 
     void start();
+    void start_backfill();
+    void start_range(backfill_range& range);
+    void range_closed(backfill_range& range, bool retry);
+
+    /// The last block up to which every range is committed; fill_status only advances to it. Ranges are updated from the
+    /// sessions' writer threads, so they are guarded by ranges_mutex once the backfill started. head is used for self.
+    std::pair<uint32_t, std::string> backfill_head(const backfill_range* self, uint32_t head, const std::string& head_id) {
+        std::lock_guard<std::mutex>      lock(ranges_mutex);
+        std::pair<uint32_t, std::string> result;
+        for (auto& range : ranges) {
+            if (&range == self ? head : range.head)
+                result = &range == self ? std::make_pair(head, head_id) : std::make_pair(range.head, range.head_id);
+            if (!range.done)
+                break;
+        }
+        return result;
+    }
+
+    void set_range_head(backfill_range& range, uint32_t head, const std::string& head_id, bool done) {
+        std::lock_guard<std::mutex> lock(ranges_mutex);
+        range.head    = head;
+        range.head_id = head_id;
+        range.done    = done;
+    }
 };
 
-eosio::abi_type& get_type(std::map<std::string, eosio::abi_type>& abi_types, std::string type_name) {
+eosio::abi_type& get_type(std::map<std::string, eosio::abi_type>& abi_types, const std::string& type_name) {
     auto itr = abi_types.find(type_name);
     if (itr != abi_types.end()) {
         return itr->second;
@@ -149,16 +839,38 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
     std::string                                          irreversible_id = "";
     uint32_t                                             first           = 0;
     uint32_t                                             first_bulk      = 0;
-    std::map<std::string, std::unique_ptr<table_stream>> table_streams;
+    table_stream_set                                     table_streams;
     abieos_sql_converter                                 converter;
-    std::map<std::string, eosio::abi_type>               abi_types;
-    std::vector<std::string>                             account_filters;
-
-    fpg_session(fill_postgresql_plugin_impl* my)
+    std::shared_ptr<eosio::abi>                          abi;             // shared with the other sessions receiving the same ABI
+    account_filter                                       account_filters;
+    std::vector<abieos_sql_converter>                    pipeline_converters;
+    std::unique_ptr<decode_pipeline<table_lines>>        pipeline;
+    uint32_t                                             queued_head = 0; // last block pushed to pipeline since it was drained
+    table_lines                                          block_lines;     // reused by blocks decoded on the main thread
+    flush_policy                                         flush;
+    backfill_range*                                      range = nullptr; // set when the session fetches part of a backfill
+    std::unique_ptr<background_trim>                     trimmer;
+    uint32_t                                             dropped_end         = 0; // partitions before dropped_end are dropped
+    uint64_t                                             partition_begin     = 0; // the partitions of [partition_begin, partition_end) exist
+    uint64_t                                             partition_end       = 0;
+    bool                                                 bulk_load_pending   = false; // primary keys wait for finish_bulk_load()
+    bool                                                 statements_prepared = false;
+    std::map<std::string, uint32_t>                      table_watermarks; // highest block a table may have rows of; unknown before truncate()
+    std::deque<staged_block>                             staged;           // reversible blocks, oldest first
+    progress_reporter                                    progress;
+    std::map<std::string, metrics::counter*>             table_rows_metrics;
+    std::unique_ptr<stream_worker>                       db_writer;         // with async_writes, blocks are written by this thread
+    bool                                                 db_closing = false; // only used by db_writer's tasks
+
+    fpg_session(fill_postgresql_plugin_impl* my, backfill_range* range = nullptr)
         : my(my)
         , config(my->config)
-        , account_filters(my->account_filters) {
+        , table_streams([this](const std::string& full_name) { return create_table_stream(full_name); }, config->copy_threads)
+        , account_filters(my->account_filters)
+        , flush(config->flush)
+        , range(range) {
 
+        progress.interval = std::chrono::seconds(config->progress_seconds);
         ilog("connect to postgresql");
         sql_connection.emplace();
 
@@ -169,7 +881,12 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
             eosio::ship_protocol::transaction_status, eosio::ship_protocol::recurse_transaction_trace, eosio::ship_protocol::wasm_config>;
 
         converter.register_basic_types<basic_types>();
-        converter.schema_name = sql_connection->quote_name(config->schema);
+        converter.schema_name   = sql_connection->quote_name(config->schema);
+        converter.binary_format = config->copy_binary;
+        converter.partitioned   = config->partition_blocks;
+        converter.unlogged      = config->bulk_load_blocks && config->unlogged;
+        converter.primary_keys  = !config->bulk_load_blocks;
+        bulk_load_pending       = config->bulk_load_blocks;
     }
 
     std::string quote_name(std::string name) { return sql_connection->quote_name(name); }
@@ -182,36 +899,76 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
             config->drop_schema = false;
         }
 
-        connection = std::make_shared<state_history::connection>(ioc, *config, shared_from_this());
+        connection_config endpoint = *config;
+        if (range) {
+            endpoint.host = range->host;
+            endpoint.port = range->port;
+        }
+        connection = std::make_shared<state_history::connection>(ioc, endpoint, shared_from_this());
+        if (my) {
+            connection->abis     = my->abis;
+            connection->recorder = my->recorder;
+        }
         connection->connect();
     }
 
-    eosio::abi_type& get_type(std::string type_name) { return ::get_type(this->abi_types, type_name); }
+    eosio::abi_type& get_type(const std::string& type_name) { return ::get_type(abi->abi_types, type_name); }
 
-    void received_abi(eosio::abi&& abi) override {
-        auto& transaction_trace_abi = ::get_type(abi.abi_types, "transaction_trace");
+    void resolve_transaction_trace_types() {
+        auto& transaction_trace_abi = get_type("transaction_trace");
         for (auto& member : std::get<eosio::abi_type::variant>(transaction_trace_abi._data)) {
-            auto& member_abi = ::get_type(abi.abi_types, member.name);
+            auto& member_abi = get_type(member.name);
             for (auto& field : std::get<eosio::abi_type::struct_>(member_abi._data).fields) {
                 if (field.name == "status")
-                    field.type = &abi.abi_types.try_emplace("transaction_status", "transaction_status", eosio::abi_type::builtin{}, nullptr)
-                                      .first->second;
+                    field.type =
+                        &abi->abi_types.try_emplace("transaction_status", "transaction_status", eosio::abi_type::builtin{}, nullptr)
+                             .first->second;
                 else if (field.name == "failed_dtrx_trace" && field.type->name == "transaction_trace?") {
-                    field.type = eosio::add_type(abi, (std::vector<eosio::ship_protocol::recurse_transaction_trace>*)nullptr);
+                    field.type = eosio::add_type(*abi, (std::vector<eosio::ship_protocol::recurse_transaction_trace>*)nullptr);
                 }
             }
         }
+    }
 
-        abi_types = std::move(abi.abi_types);
+    /// A reconnect receiving an ABI seen before gets the same abi object, and copies the converter built for it
+    void received_abi(const std::shared_ptr<eosio::abi>& received) override {
+        abi = received;
+        std::shared_ptr<const abieos_sql_converter> cached;
+        if (my) {
+            if (auto it = my->converters.find(abi.get()); it != my->converters.end())
+                cached = it->second;
+        }
+        if (!cached)
+            resolve_transaction_trace_types();
 
         if (config->create_schema) {
             create_tables();
             config->create_schema = false;
         }
+        if (config->action_tables)
+            create_action_tables();
+        prepare_statements();
+        if (!config->seed_schema.empty()) {
+            seed_schema();
+            config->seed_schema.clear();
+        }
+        if (cached) {
+            converter = *cached;
+        } else {
+            if (config->copy_binary)
+                load_type_oids();
+            compile_row_encoders();
+            if (my)
+                my->converters[abi.get()] = std::make_shared<const abieos_sql_converter>(converter);
+        }
+        for (auto& table : connection->abi.tables)
+            account_filters.add_layout(table.type, get_type(table.type));
         connection->send(get_status_request_v0{});
     }
 
     bool received(get_status_result_v0& status) override {
+        if (range)
+            return request_range();
         work_t t(*sql_connection);
         load_fill_status(t);
         auto       positions = get_positions(t);
@@ -226,6 +983,93 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
         return true;
     }
 
+    /// A range resumes after its last committed block. Rows past it are left from an interrupted attempt and are deleted first.
+    bool request_range() {
+        {
+            std::lock_guard<std::mutex> lock(my->ranges_mutex);
+            head    = range->head;
+            head_id = range->head_id;
+        }
+        irreversible = head;
+        first        = range->begin;
+        auto begin   = head ? head + 1 : range->begin;
+
+        work_t     t(*sql_connection);
+        pipeline_t pipeline(t);
+        auto       trunc = [&](const std::string& name) {
+            pipeline.insert(
+                "delete from " + converter.schema_name + "." + quote_name(name) + " where block_num >= " + std::to_string(begin) +
+                " and block_num < " + std::to_string(range->end));
+        };
+        for (auto& table : block_tables())
+            trunc(table);
+        for (auto& table : connection->abi.tables)
+            trunc(table.type);
+        pipeline.complete();
+        t.commit();
+
+        ilog("request blocks ${b} - ${e} from ${h}:${p}", ("b", begin)("e", range->end)("h", range->host)("p", range->port));
+        // the block at end stops the range, as stop_before does
+        connection->request_blocks(begin, {}, range->end + 1);
+        return true;
+    }
+
+    uint32_t stop_before() const { return range ? range->end : config->stop_before; }
+
+    /// tables whose rows belong to a single block, unlike contract tables, whose rows hold until the key is modified again
+    std::vector<std::string> block_tables() const {
+        std::vector<std::string> result = {"received_block", "transaction_trace", "block_info"};
+        if (config->action_tables)
+            result.insert(result.end(), {"action_trace", "action_trace_authorization", "action_trace_ram_delta"});
+        return result;
+    }
+
+    /// tables partitioned by block_num with partition_blocks
+    std::vector<std::string> partitioned_tables() const {
+        auto result = block_tables();
+        for (auto& table : connection->abi.tables)
+            result.push_back(table.type);
+        return result;
+    }
+
+    std::string partition_name(const std::string& table, uint64_t begin) {
+        return converter.schema_name + "." + quote_name(table + "_" + std::to_string(begin));
+    }
+
+    /// Creates the partitions holding block_num. The COPY streams are committed first, since they keep the tables locked.
+    void ensure_partition(uint32_t block_num) {
+        auto n = config->partition_blocks;
+        if (!n || (block_num >= partition_begin && block_num < partition_end))
+            return;
+        close_streams();
+        uint64_t begin = block_num / n * uint64_t(n);
+        uint64_t end   = begin + n;
+        work_t   t(*sql_connection);
+        for (auto& table : partitioned_tables())
+            t.exec(
+                "create table if not exists " + partition_name(table, begin) + " partition of " + converter.schema_name + "." +
+                quote_name(table) + " for values from (" + std::to_string(begin) + ") to (" + std::to_string(end) + ")");
+        t.commit();
+        partition_begin = begin;
+        partition_end   = end;
+    }
+
+    /// Partitions of the block tables which trimming would empty are dropped instead. Contract tables keep the newest row of
+    /// each key, so they are still trimmed row by row.
+    void drop_trimmed_partitions(uint32_t begin, uint32_t end) {
+        auto n = config->partition_blocks;
+        if (!n)
+            return;
+        auto   tables = block_tables();
+        work_t t(*sql_connection);
+        for (uint64_t b = (begin + uint64_t(n) - 1) / n * n; b + n <= end; b += n) {
+            ilog("drop partitions of blocks ${b} - ${e}", ("b", b)("e", b + n));
+            for (auto& table : tables)
+                t.exec("drop table if exists " + partition_name(table, b));
+        }
+        t.commit();
+    }
+
     void create_tables() {
         work_t t(*sql_connection);
 
@@ -234,9 +1078,7 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
         t.exec(
             "create type " + converter.schema_name +
             ".transaction_status_type as enum('executed', 'soft_fail', 'hard_fail', 'delayed', 'expired')");
-        t.exec(
-            "create table " + converter.schema_name +
-            R"(.received_block ("block_num" bigint, "block_id" varchar(64), primary key("block_num")))");
+        t.exec(create_block_table_sql("received_block", R"("block_num" bigint, "block_id" varchar(64))"));
         t.exec(
             "create table " + converter.schema_name +
             R"(.fill_status ("head" bigint, "head_id" varchar(64), "irreversible" bigint, "irreversible_id" varchar(64), "first" bigint))");
@@ -244,22 +1086,146 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
         t.exec("insert into " + converter.schema_name + R"(.fill_status values (0, '', 0, '', 0))");
 
         auto exec = [&t](const auto& stmt) { t.exec(stmt); };
+        auto keys = table_keys();
         converter.create_table(
-            "block_info", get_type("signed_block_header"), "block_num bigint, block_id varchar(64)", {"block_num"}, exec);
+            "block_info", get_type("signed_block_header"), "block_num bigint, block_id varchar(64)", keys["block_info"], exec);
 
         converter.create_table(
             "transaction_trace", get_type("transaction_trace"), "block_num bigint, transaction_ordinal integer",
-            {"block_num", "transaction_ordinal"}, exec);
+            keys["transaction_trace"], exec);
+
+        for (auto& table : connection->abi.tables)
+            converter.create_table(table.type, get_type(table.type), "block_num bigint, present smallint", keys[table.type], exec);
+
+        t.commit();
+        ilog("scheme created");
+    } // create_tables()
+
+    /// Creates a block table which no abi type describes, declared the way converter.create_table() declares tables
+    std::string create_block_table_sql(const std::string& name, const std::string& columns) {
+        std::string query = std::string("create ") + (converter.unlogged ? "unlogged " : "") + "table if not exists " +
+                            converter.schema_name + "." + quote_name(name) + " (" + columns;
+        if (converter.primary_keys) {
+            auto keys = table_keys()[name];
+            query += ", primary key(" +
+                     pqxx::separated_list(",", keys.begin(), keys.end(), [this](auto k) { return quote_name(*k); }) + ")";
+        }
+        query += ")";
+        if (converter.partitioned)
+            query += " partition by range (block_num)";
+        return query;
+    }
 
+    /// The action tables may be added to an existing schema, so they're created whenever fpg-action-tables is on
+    void create_action_tables() {
+        work_t t(*sql_connection);
+        t.exec(create_block_table_sql("action_trace", sql_columns(converter, action_trace_columns)));
+        t.exec(create_block_table_sql("action_trace_authorization", sql_columns(converter, action_trace_authorization_columns)));
+        t.exec(create_block_table_sql("action_trace_ram_delta", sql_columns(converter, action_trace_ram_delta_columns)));
+        t.commit();
+    }
+
+    /// The new schema starts with the state of config->seed_schema at its last irreversible block, and fills from the next one
+    void seed_schema() {
+        schema_seed seed;
+        seed.source        = config->seed_connection;
+        seed.source_schema = quote_name(config->seed_schema);
+        seed.dest_schema   = converter.schema_name;
+        for (auto& table : connection->abi.tables) {
+            auto& t = seed.tables.emplace_back();
+            t.name  = quote_name(table.type);
+            t.columns.push_back(quote_name("present"));
+            for (auto& field : converter.table_fields(get_type(table.type)))
+                t.columns.push_back(quote_name(field.name));
+            for (auto& key : table.key_names)
+                t.keys.push_back(quote_name(key));
+        }
+        seed.begin();
+        ensure_partition(seed.block);
+        seed.copy(config->seed_threads);
+
+        head    = irreversible = first = seed.block;
+        head_id = irreversible_id = seed.block_id;
+        work_t t(*sql_connection);
+        write_fill_status(t);
+        t.exec_prepared("fpg_received_block", head, head_id);
+        t.commit();
+        ilog("seeded from ${s} at block ${b}", ("s", config->seed_schema)("b", head));
+    }
+
+    /// primary keys of the tables
+    std::map<std::string, std::vector<std::string>> table_keys() const {
+        std::map<std::string, std::vector<std::string>> result = {
+            {"received_block", {"block_num"}},
+            {"block_info", {"block_num"}},
+            {"transaction_trace", {"block_num", "transaction_ordinal"}},
+        };
+        if (config->action_tables) {
+            result["action_trace"]               = {"block_num", "transaction_ordinal", "action_ordinal"};
+            result["action_trace_authorization"] = {"block_num", "transaction_ordinal", "action_ordinal", "ordinal"};
+            result["action_trace_ram_delta"]     = {"block_num", "transaction_ordinal", "action_ordinal", "ordinal"};
+        }
         for (auto& table : connection->abi.tables) {
-            std::vector<std::string> keys = {"block_num", "present"};
+            auto& keys = result[table.type] = {"block_num", "present"};
             keys.insert(keys.end(), table.key_names.begin(), table.key_names.end());
-            converter.create_table(table.type, get_type(table.type), "block_num bigint, present smallint", keys, exec);
         }
+        return result;
+    }
+
+    /// Tables created by a bulk load lack their primary keys and may be unlogged. Once the filler nears the head, the keys are
+    /// built, concurrently where the table isn't partitioned, and the tables are logged. The catalog tells what's left to do, so
+    /// a restart picks up where this left off.
+    void finish_bulk_load() {
+        ilog("bulk load done; building primary keys");
+        close_streams();
+        pqxx::nontransaction n(*sql_connection);
+        for (auto& [table, keys] : table_keys()) {
+            auto name   = converter.schema_name + "." + quote_name(table);
+            auto status = n.exec(
+                "select c.relpersistence, c.relkind, exists(select 1 from pg_index i where i.indrelid = c.oid and i.indisprimary) "
+                "from pg_class c join pg_namespace ns on ns.oid = c.relnamespace where ns.nspname = " +
+                n.quote(config->schema) + " and c.relname = " + n.quote(table));
+            if (status.empty())
+                continue;
+            auto columns = pqxx::separated_list(",", keys.begin(), keys.end(), [this](auto k) { return quote_name(*k); });
+            if (!status[0][2].as<bool>()) {
+                ilog("build primary key of ${t}", ("t", table));
+                if (status[0][1].as<std::string>() == "p") {
+                    n.exec("alter table " + name + " add primary key (" + columns + ")");
+                } else {
+                    auto index = quote_name(table + "_pkey");
+                    n.exec("create unique index concurrently if not exists " + index + " on " + name + " (" + columns + ")");
+                    n.exec("alter table " + name + " add constraint " + index + " primary key using index " + index);
+                }
+            }
+            if (status[0][0].as<std::string>() == "u") {
+                ilog("set ${t} logged", ("t", table));
+                n.exec("alter table " + name + " set logged");
+            }
+        }
+        bulk_load_pending = false;
+    }
 
+    /// binary composite and array values name the oids of their element types
+    void load_type_oids() {
+        work_t t(*sql_connection);
+        auto   rows = t.exec(
+            "select typname, oid, typarray from pg_type where typnamespace = (select oid from pg_namespace where nspname = " +
+            t.w.quote(config->schema) + ")");
+        converter.schema_type_oids.clear();
+        for (auto row : rows)
+            converter.schema_type_oids[row[0].as<std::string>()] = {row[1].as<uint32_t>(), row[2].as<uint32_t>()};
         t.commit();
-        ilog("scheme created");
-    } // create_tables()
+    }
+
+    /// rows of these tables are encoded by programs compiled from their types
+    void compile_row_encoders() {
+        converter.reset_row_encoders();
+        converter.compile_row_encoder(get_type("signed_block_header"));
+        converter.compile_row_encoder(get_type("transaction_trace"));
+        for (auto& table : connection->abi.tables)
+            converter.compile_row_encoder(get_type(table.type));
+    }
 
     void create_trim() {
         if (created_trim)
@@ -287,6 +1253,8 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
         // std::cout << query << "\n";
         t.exec(query);
 
+        // Each table is trimmed by one set-based delete: every row older than the newest row of its key within
+        // (prev_block_num, irrev_block_num] goes.
         query = R"(
             create function )" +
                 converter.schema_name + R"(.trim_history(
@@ -294,17 +1262,9 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
                 irrev_block_num bigint
             ) returns void
             as $$
-                declare
-                    key_search record;
                 begin)";
 
-        static const char* const simple_cases[] = {
-            "received_block",
-            "transaction_trace",
-            "block_info",
-        };
-
-        for (const char* table : simple_cases) {
+        for (auto& table : block_tables()) {
             query += R"(
                     delete from )" +
                      converter.schema_name + "." + quote_name(table) + R"(
@@ -314,64 +1274,48 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
                     )";
         }
 
-        auto add_trim = [&](const std::string& table, const std::string& keys, const std::string& search_keys) {
-            query += R"(
-                    for key_search in
-                        select
-                            distinct on()" +
-                     keys + R"()
-                            )" +
-                     keys + R"(, block_num
-                        from
-                            )" +
-                     converter.schema_name + "." + quote_name(table) + R"(
-                        where
-                            block_num > prev_block_num and block_num <= irrev_block_num
-                        order by )" +
-                     keys + R"(, block_num desc, present desc
-                    loop
-                        delete from )" +
-                     converter.schema_name + "." + quote_name(table) + R"(
-                        where
-                            ()" +
-                     keys + R"() = ()" + search_keys + R"()
-                            and block_num < key_search.block_num;
-                    end loop;
-                    )";
-        };
-
         for (auto& table : connection->abi.tables) {
+            auto table_name = converter.schema_name + "." + quote_name(table.type);
             if (table.key_names.empty()) {
                 query += R"(
-                    for key_search in
-                        select
-                            block_num
-                        from
-                            )" +
-                         converter.schema_name + "." + quote_name(table.type) + R"(
-                        where
-                            block_num > prev_block_num and block_num <= irrev_block_num
-                        order by block_num desc, present desc
-                        limit 1
-                    loop
-                        delete from )" +
-                         converter.schema_name + "." + quote_name(table.type) + R"(
-                        where
-                            block_num < key_search.block_num;
-                    end loop;
+                    delete from )" +
+                         table_name + R"(
+                    where
+                        block_num < (
+                            select max(block_num) from )" +
+                         table_name + R"(
+                            where block_num > prev_block_num and block_num <= irrev_block_num);
                     )";
             } else {
-                std::string keys, search_keys;
+                std::string keys, row_keys, latest_keys;
                 for (auto& k : table.key_names) {
                     if (&k != &table.key_names.front()) {
                         keys += ", ";
-                        search_keys += ", ";
+                        row_keys += ", ";
+                        latest_keys += ", ";
                     }
                     keys += quote_name(k);
-                    search_keys += "key_search." + quote_name(k);
+                    row_keys += "r." + quote_name(k);
+                    latest_keys += "latest." + quote_name(k);
                 }
-                add_trim(table.type, keys, search_keys);
-            };
+                query += R"(
+                    delete from )" +
+                         table_name + R"( as r
+                    using (
+                        select )" +
+                         keys + R"(, max(block_num) as block_num
+                        from )" +
+                         table_name + R"(
+                        where block_num > prev_block_num and block_num <= irrev_block_num
+                        group by )" +
+                         keys + R"(
+                    ) as latest
+                    where
+                        ()" +
+                         row_keys + ") = (" + latest_keys + R"()
+                        and r.block_num < latest.block_num;
+                    )";
+            }
         }
         query += R"(
                 end 
@@ -403,26 +1347,60 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
         return result;
     }
 
-    void write_fill_status(work_t& t, pipeline_t& pipeline) {
-        std::string query =
-            "update " + converter.schema_name + ".fill_status set head=" + std::to_string(head) + ", head_id=" + quote(head_id) + ", ";
+    /// The per-block writes are server-side prepared statements, so Postgres plans them once per connection
+    void prepare_statements() {
+        if (statements_prepared)
+            return;
+        sql_connection->prepare(
+            "fpg_received_block", "insert into " + converter.schema_name + ".received_block (block_num, block_id) values ($1, $2)");
+        sql_connection->prepare(
+            "fpg_fill_status", "update " + converter.schema_name +
+                                   ".fill_status set head=$1, head_id=$2, irreversible=$3, irreversible_id=$4, first=$5");
+        // range sessions commit concurrently with fpg-async-writes; the row lock orders them and one computed earlier is dropped
+        sql_connection->prepare(
+            "fpg_backfill_status",
+            "update " + converter.schema_name +
+                ".fill_status set head=$1, head_id=$2, irreversible=$3, irreversible_id=$4, first=$5 where head < $1");
+        statements_prepared = true;
+    }
+
+    void write_fill_status(work_t& t) {
+        if (range)
+            return write_backfill_status(t);
         if (irreversible < head)
-            query += "irreversible=" + std::to_string(irreversible) + ", irreversible_id=" + quote(irreversible_id);
+            t.exec_prepared("fpg_fill_status", head, head_id, irreversible, irreversible_id, first);
         else
-            query += "irreversible=" + std::to_string(head) + ", irreversible_id=" + quote(head_id);
-        query += ", first=" + std::to_string(first);
-        pipeline.insert(query);
+            t.exec_prepared("fpg_fill_status", head, head_id, head, head_id, first);
     }
 
+    /// fill_status covers the ranges which are contiguous from the first one, counting this session's uncommitted head. It
+    /// only moves forward, since another range's session may commit a later head between the lookup and this commit.
+    void write_backfill_status(work_t& t) {
+        if (!my)
+            return;
+        auto [contiguous_head, contiguous_head_id] = my->backfill_head(range, head, head_id);
+        if (!contiguous_head)
+            return;
+        t.exec_prepared(
+            "fpg_backfill_status", contiguous_head, contiguous_head_id, contiguous_head, contiguous_head_id, my->ranges.front().begin);
+    }
+
+    /// The deletes go out as one pipelined batch. A table is skipped when its watermark shows it has no rows at or past block,
+    /// and otherwise only the blocks up to its watermark are deleted.
     void truncate(work_t& t, pipeline_t& pipeline, uint32_t block) {
         auto trunc = [&](const std::string& name) {
+            auto it = table_watermarks.find(name);
+            if (it != table_watermarks.end() && it->second < block)
+                return;
             std::string query{
                 "delete from " + converter.schema_name + "." + quote_name(name) + " where block_num >= " + std::to_string(block)};
+            if (it != table_watermarks.end())
+                query += " and block_num <= " + std::to_string(it->second);
             pipeline.insert(query);
+            table_watermarks[name] = block - 1;
         };
-        trunc("received_block");
-        trunc("transaction_trace");
-        trunc("block_info");
+        for (auto& table : block_tables())
+            trunc(table);
         for (auto& table : connection->abi.tables) {
             trunc(table.type);
         }
@@ -441,26 +1419,16 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
 
     template <typename GetBlockResult, typename HandleBlocksTracesDelta>
     bool process_blocks_result(GetBlockResult& result, HandleBlocksTracesDelta&& handler) {
-        if (!result.this_block){
-
-            ilog("this block is null");
+        if (!result.this_block)
             return true;
-        }
-        bool bulk         = result.this_block->block_num + 4 < result.last_irreversible.block_num;
-        bool large_deltas = false;
-        bool forks        = false;
-        auto deltas_size  = num_bytes(result.deltas);
-        ilog("delta size -> ${b}", ("b", deltas_size));
+        bool bulk  = result.this_block->block_num + 4 < result.last_irreversible.block_num;
+        bool forks = false;
 
-        if (!bulk && deltas_size >= 10 * 1024 * 1024) {
-            ilog("large deltas size: ${s}", ("s", uint64_t(deltas_size)));
-            bulk         = true;
-            large_deltas = true;
-        }
-
-        if (config->stop_before && result.this_block->block_num >= config->stop_before) {
+        if (stop_before() && result.this_block->block_num >= stop_before()) {
             ilog("block ${b}: stop requested", ("b", result.this_block->block_num));
             close_streams();
+            if (range)
+                finish_range();
             return false;
         }
 
@@ -471,23 +1439,30 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
             forks = true;
         }
 
-        if (!bulk || large_deltas || !(result.this_block->block_num % 200))
+        if (!bulk || flush.due())
             close_streams();
-        if (table_streams.empty()){
-            ilog("trim");
+        if (table_streams.empty())
             trim();
-        }
-        if (!bulk)
-            ilog("block ${b} bulk=false", ("b", result.this_block->block_num));
+        if (bulk_load_pending && uint64_t(result.this_block->block_num) + config->bulk_load_blocks >= result.last_irreversible.block_num)
+            finish_bulk_load();
+        ensure_partition(result.this_block->block_num);
 
-        work_t     t(*sql_connection);
-        pipeline_t pipeline(t);
-        if (result.this_block->block_num <= head)
-            truncate(t, pipeline, result.this_block->block_num);
+        // in bulk, received_block is written by the COPY streams along with the block's other rows
+        std::optional<work_t> t;
+        if (!bulk)
+            t.emplace(*sql_connection);
+        if (result.this_block->block_num <= head) {
+            pipeline_t pipeline(*t);
+            truncate(*t, pipeline, result.this_block->block_num);
+            pipeline.complete();
+            while (!pipeline.empty())
+                pipeline.retrieve();
+        }
         if (!head_id.empty() && (!result.prev_block || to_string(result.prev_block->block_id) != head_id))
             throw std::runtime_error("prev_block does not match");
 
         handler(bulk);
+        ++flush.blocks;
 
         head            = result.this_block->block_num;
         head_id         = to_string(result.this_block->block_id);
@@ -496,22 +1471,18 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
         if (!first)
             first = head;
         if (!bulk) {
-
             if (!forks)
                 flush_streams();
+            flush.reset();
 
-            write_fill_status(t, pipeline);
+            write_fill_status(*t);
+            raise_watermark("received_block", head);
+            t->exec_prepared("fpg_received_block", head, head_id);
+            t->commit();
         }
-        pipeline.insert(
-            "insert into " + converter.schema_name + ".received_block (block_num, block_id) values (" +
-            std::to_string(result.this_block->block_num) + ", " + quote(to_string(result.this_block->block_id)) + ")");
-
-        pipeline.complete();
-        while (!pipeline.empty())
-            pipeline.retrieve();
-        t.commit();
-        if (large_deltas)
-            close_streams();
+        progress.add(
+            result.this_block->block_num, result.last_irreversible.block_num,
+            num_bytes(result.block) + num_bytes(result.traces) + num_bytes(result.deltas));
         return true;
     }
 
@@ -544,183 +1515,432 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
 //    }
 
     bool received(get_blocks_result_v0& result) override {
+        if (config->stage_reversible && result.this_block && result.this_block->block_num + 4 >= result.last_irreversible.block_num)
+            return stage_block(result);
         return process_blocks_result(result, [this, &result](bool bulk) {
-            if (result.block) {
-                auto block_bin = *result.block;
-                receive_block(result.this_block->block_num, result.this_block->block_id, eosio::as_opaque<signed_block_header>(block_bin));
-            }
-            if (result.deltas)
-                receive_deltas(
-                    result.this_block->block_num, eosio::as_opaque<std::vector<eosio::ship_protocol::table_delta>>(*result.deltas), bulk);
-            if (result.traces)
-                receive_traces(
-                    result.this_block->block_num, eosio::as_opaque<std::vector<eosio::ship_protocol::transaction_trace>>(*result.traces));
+            decode_block(converter, result, bulk, block_lines);
+            write_lines(result.this_block->block_num, block_lines);
         });
     }
 
-    void write_stream(uint32_t block_num, const std::string& name, const std::vector<std::string>& values) {
-        if (!first_bulk)
-            first_bulk = block_num;
-        auto& ts = table_streams[name];
-        if (!ts)
-            ts = std::make_unique<table_stream>(converter.schema_name + "." + quote_name(name));
-        ts->writer.write_raw_line(boost::algorithm::join(values, "\t"));
+    /// With async_writes the io thread only queues the block, so reading from nodeos and acknowledging blocks doesn't wait
+    /// for commits. The queue holds fill-max-in-flight blocks, as many as nodeos sends before their buffers are released and
+    /// acknowledged, so posting never waits on the writer.
+    bool received(get_blocks_result_v0& result, const std::shared_ptr<flat_buffer>& buffer) override {
+        if (result.this_block)
+            fill_pg_metrics::get().blocks.add();
+        if (config->async_writes) {
+            if (!db_writer)
+                db_writer = std::make_unique<stream_worker>(config->max_messages_in_flight);
+            db_writer->post([this, result, buffer]() mutable { write_queued(result, buffer); });
+            return true;
+        }
+        return write_result(result, buffer);
+    }
+
+    /// runs on db_writer; a stop or an error closes the connection from the io thread, and the blocks queued after it are dropped
+    void write_queued(get_blocks_result_v0& result, const std::shared_ptr<flat_buffer>& buffer) {
+        if (db_closing)
+            return;
+        bool keep_going = false;
+        try {
+            keep_going = write_result(result, buffer);
+        } catch (const std::exception& e) {
+            elog("${e}", ("e", e.what()));
+        } catch (...) {
+            elog("unknown exception");
+        }
+        if (keep_going)
+            return;
+        db_closing = true;
+        asio::post(connection->ioc, [conn = std::weak_ptr<state_history::connection>(connection)] {
+            if (auto c = conn.lock())
+                c->close(false);
+        });
     }
 
-    void flush_streams() {
-        for (auto& [_, ts] : table_streams) {
-            ts->writer.complete();
-            ts->t.commit();
+    bool write_result(get_blocks_result_v0& result, const std::shared_ptr<flat_buffer>& buffer) {
+        if (config->decode_threads && result.this_block && can_pipeline(result)) {
+            if (!pipeline)
+                start_pipeline();
+            pipeline->push(buffer, result);
+            queued_head = result.this_block->block_num;
+            return true;
         }
-        table_streams.clear();
+        if (pipeline) {
+            pipeline->drain();
+            queued_head = 0;
+        }
+        return received(result);
     }
 
-    void close_streams() {
-        ilog("close streams");
-        if (table_streams.empty()){
-            ilog("table streams is empty");
+    /// Blocks which process_blocks_result() handles in bulk, without forks or stops, may be decoded ahead of the
+    /// writer. head is only read while the pipeline is drained.
+    bool can_pipeline(const get_blocks_result_v0& result) {
+        auto block_num = result.this_block->block_num;
+        if (block_num + 4 >= result.last_irreversible.block_num)
+            return false;
+        if (stop_before() && block_num >= stop_before())
+            return false;
+        return block_num > (queued_head ? queued_head : head);
+    }
+
+    void start_pipeline() {
+        ilog("start decode pipeline with ${n} threads", ("n", config->decode_threads));
+        pipeline_converters.assign(config->decode_threads, converter);
+        pipeline = std::make_unique<decode_pipeline<table_lines>>(
+            config->decode_threads,
+            [this](uint32_t worker, auto& j) { decode_block(pipeline_converters[worker], j.result, true, j.output); },
+            [this](auto& j) {
+                process_blocks_result(j.result, [this, &j](bool) { write_lines(j.result.this_block->block_num, j.output); });
+            },
+            clear_lines);
+    }
+
+    /// converts a block to COPY lines; only reads session state other than conv, so it may run on a pipeline worker
+    void decode_block(abieos_sql_converter& conv, const get_blocks_result_v0& result, bool bulk, table_lines& lines) {
+        if (bulk)
+            receive_received_block(conv, lines, result.this_block->block_num, result.this_block->block_id);
+        if (result.block) {
+            auto block_bin = *result.block;
+            receive_block(
+                conv, lines, result.this_block->block_num, result.this_block->block_id, eosio::as_opaque<signed_block_header>(block_bin));
+        }
+        if (result.deltas)
+            receive_deltas(
+                conv, lines, result.this_block->block_num, eosio::as_opaque<std::vector<eosio::ship_protocol::table_delta>>(*result.deltas),
+                bulk);
+        if (result.traces)
+            receive_traces(
+                conv, lines, result.this_block->block_num,
+                eosio::as_opaque<std::vector<eosio::ship_protocol::transaction_trace>>(*result.traces));
+    }
+
+    /// Blocks past last irreversible are decoded into staged instead of written; switching forks among them only drops them
+    /// from memory. They are written in one transaction once they become irreversible, so the database only holds
+    /// irreversible blocks. A fork below the database's head goes through process_blocks_result().
+    bool stage_block(get_blocks_result_v0& result) {
+        auto block_num = result.this_block->block_num;
+        if (stop_before() && block_num >= stop_before()) {
+            ilog("block ${b}: stop requested", ("b", block_num));
+            write_staged(result.last_irreversible.block_num);
+            close_streams();
+            return false;
+        }
+
+        while (!staged.empty() && staged.back().block_num >= block_num)
+            staged.pop_back();
+        if (block_num <= head) {
+            staged.clear();
+            return process_blocks_result(result, [this, &result](bool bulk) {
+                decode_block(converter, result, bulk, block_lines);
+                write_lines(result.this_block->block_num, block_lines);
+            });
+        }
+
+        auto& prev_id = staged.empty() ? head_id : staged.back().block_id;
+        if (!prev_id.empty() && (!result.prev_block || to_string(result.prev_block->block_id) != prev_id))
+            throw std::runtime_error("prev_block does not match");
+
+        auto& block     = staged.emplace_back();
+        block.block_num = block_num;
+        block.block_id  = to_string(result.this_block->block_id);
+        decode_block(converter, result, false, block.lines);
+
+        irreversible    = result.last_irreversible.block_num;
+        irreversible_id = to_string(result.last_irreversible.block_id);
+        write_staged(irreversible);
+        progress.add(block_num, irreversible, num_bytes(result.block) + num_bytes(result.traces) + num_bytes(result.deltas));
+        return true;
+    }
+
+    /// writes the staged blocks up to irreversible_block
+    void write_staged(uint32_t irreversible_block) {
+        if (staged.empty() || staged.front().block_num > irreversible_block)
             return;
+        close_streams();
+        trim();
+        std::string received_blocks;
+        while (!staged.empty() && staged.front().block_num <= irreversible_block) {
+            auto& block = staged.front();
+            ensure_partition(block.block_num);
+            write_lines(block.block_num, block.lines);
+            raise_watermark("received_block", block.block_num);
+            received_blocks += (received_blocks.empty() ? "(" : ", (") + std::to_string(block.block_num) + ", " + quote(block.block_id) + ")";
+            head    = block.block_num;
+            head_id = std::move(block.block_id);
+            staged.pop_front();
         }
+        if (!first)
+            first = head;
         flush_streams();
+        flush.reset();
 
-        work_t     t(*sql_connection);
-        pipeline_t pipeline(t);
-        write_fill_status(t, pipeline);
-        pipeline.complete();
+        work_t t(*sql_connection);
+        t.exec("insert into " + converter.schema_name + ".received_block (block_num, block_id) values " + received_blocks);
+        write_fill_status(t);
         t.commit();
-
-        ilog("block ${b} - ${e}", ("b", first_bulk)("e", head));
-        first_bulk = 0;
     }
 
-    void receive_block(uint32_t block_num, const eosio::checksum256& block_id, const eosio::opaque<signed_block_header>& opq) {
-        auto&                    abi_type = get_type("signed_block_header");
-        std::vector<std::string> values{std::to_string(block_num), sql_str(block_id)};
-        auto                     bin = opq.get();
-        converter.to_sql_values(bin, *abi_type.as_struct(), values);
-        write_stream(block_num, "block_info", values);
+    /// writes and clears lines
+    void write_lines(uint32_t block_num, table_lines& lines) {
+        for (auto& [name, table] : lines) {
+            if (table.data.empty())
+                continue;
+            if (!first_bulk)
+                first_bulk = block_num;
+            flush.add(table.data.size(), table.num_rows);
+            table_rows(name).add(table.num_rows);
+            fill_pg_metrics::get().copy_bytes.add(table.data.size());
+            raise_watermark(name, block_num);
+            table_streams.write(name, converter.schema_name + "." + quote_name(name), table.data);
+            table.num_rows = 0;
+        }
     }
 
-    void receive_deltas(uint32_t block_num, eosio::opaque<std::vector<eosio::ship_protocol::table_delta>> delta, bool bulk) {
-        ilog("${b} receive deltas", ("b", block_num));
-        for_each(delta, [this, block_num, bulk](table_delta&& t_delta) { write_table_delta(block_num, std::move(t_delta), bulk); });
-        ilog("${b} deltas done", ("b", block_num));
+    metrics::counter& table_rows(const std::string& name) {
+        auto& c = table_rows_metrics[name];
+        if (!c)
+            c = &metrics::get_counter("fill_pg_rows_total", "Rows written, by table", "table=\"" + name + "\"");
+        return *c;
     }
 
-    void write_table_delta(uint32_t block_num, table_delta&& t_delta, bool bulk) {
-        std::visit(
-            [&block_num, bulk, this](auto t_delta) {
+    void raise_watermark(const std::string& name, uint32_t block_num) {
+        auto it = table_watermarks.find(name);
+        if (it != table_watermarks.end())
+            it->second = std::max(it->second, block_num);
+    }
 
-                ilog("${b} write streams -> ${n}", ("b", block_num)("n", t_delta.name));
-                // 不处理
-                if (t_delta.name == "global_property"){
-                    return;
-                }
+    std::unique_ptr<table_stream> create_table_stream(const std::string& name) {
+        if (config->copy_binary)
+            return std::make_unique<binary_table_stream>(name);
+        return std::make_unique<text_table_stream>(name);
+    }
 
-                size_t num_processed = 0;
-                auto&  type          = get_type(t_delta.name);
-                if (type.as_variant() == nullptr && type.as_struct() == nullptr){
-                    ilog("don't know how to process ${n}", ("n", t_delta.name));
-                    throw std::runtime_error("don't know how to process " + t_delta.name);
-                }
+    void flush_streams() {
+        metrics::scoped_timer timer{fill_pg_metrics::get().copy_commit};
+        table_streams.commit();
+    }
 
-                for (auto& row : t_delta.rows) {
-                    if (t_delta.rows.size() > 10000 && !(num_processed % 10000))
-                        ilog(
-                            "block ${b} ${t} ${n} of ${r} bulk=${bulk}",
-                            ("b", block_num)("t", t_delta.name)("n", num_processed)("r", t_delta.rows.size())("bulk", bulk));
+    void close_streams() {
+        if (table_streams.empty())
+            return;
+        flush_streams();
 
-                    std::vector<std::string> values{std::to_string(block_num), std::to_string((unsigned)row.present)};
-                    if (type.as_variant()){
+        {
+            metrics::scoped_timer timer{fill_pg_metrics::get().status_commit};
+            work_t                t(*sql_connection);
+            write_fill_status(t);
+            t.commit();
+        }
+        if (range && my)
+            my->set_range_head(*range, head, head_id, false);
+
+        auto seconds = flush.seconds();
+        ilog(
+            "block ${b} - ${e}: ${r} rows, ${m} MiB in ${s} s, ${rs} rows/s",
+            ("b", first_bulk)("e", head)("r", flush.rows)("m", flush.bytes >> 20)("s", uint64_t(seconds))(
+                "rs", uint64_t(seconds > 0 ? flush.rows / seconds : flush.rows)));
+        first_bulk = 0;
+        flush.reset();
+    }
 
-//                        ilog("covert sql variant");
-                        converter.to_sql_values(row.data, t_delta.name, *type.as_variant(), values);
-//                        ilog("cover variant sql done");
-                    }else if (type.as_struct()){
+    void receive_received_block(abieos_sql_converter& conv, table_lines& lines, uint32_t block_num, const eosio::checksum256& block_id) {
+        auto& rows      = rows_of(lines, "received_block");
+        auto  row_begin = conv.begin_row(rows.data);
+        conv.append_column(rows.data, row_begin, block_num);
+        conv.append_column(rows.data, row_begin, block_id);
+        conv.end_row(rows.data, row_begin, 2);
+        ++rows.num_rows;
+    }
 
-//                        ilog("covert sql struct");
-                        converter.to_sql_values(row.data, *type.as_struct(), values);
-//                        ilog("cover struct sql done");
-                    }
+    void receive_block(
+        abieos_sql_converter& conv, table_lines& lines, uint32_t block_num, const eosio::checksum256& block_id,
+        const eosio::opaque<signed_block_header>& opq) {
+        static const std::string name      = "block_info";
+        auto&                    abi_type  = get_type("signed_block_header");
+        auto&                    rows      = rows_of(lines, name);
+        auto&                    out       = rows.data;
+        auto                     bin       = opq.get();
+        auto                     row_begin = conv.begin_row(out);
+        conv.append_column(out, row_begin, block_num);
+        conv.append_column(out, row_begin, block_id);
+        conv.end_row(out, row_begin, 2 + conv.append_sql_values(out, bin, *abi_type.as_struct()));
+        ++rows.num_rows;
+    }
 
-                    bool save = false;
-                    for (auto& account : account_filters){
-                        
-                        if (std::find(values.begin(), values.end(), account) != values.end()){
+    void receive_deltas(
+        abieos_sql_converter& conv, table_lines& lines, uint32_t block_num,
+        eosio::opaque<std::vector<eosio::ship_protocol::table_delta>> delta, bool bulk) {
+        // each thread decodes into the same table_delta, so its name and rows keep their capacity from delta to delta
+        thread_local table_delta_v0 t_delta;
+        auto                        bin = delta.get();
+        for (auto n = read_varuint32_bin(bin); n; --n) {
+            auto index = read_varuint32_bin(bin);
+            if (index != 0)
+                throw std::runtime_error("unknown table_delta type " + std::to_string(index));
+            t_delta.rows.clear();
+            from_bin(t_delta, bin);
+            write_table_delta(conv, lines, block_num, t_delta, bulk);
+        }
+    }
 
-                            save = true;
-                            break;
-                        }
-                    }
+    void write_table_delta(abieos_sql_converter& conv, table_lines& lines, uint32_t block_num, table_delta_v0& t_delta, bool bulk) {
+        // 不处理
+        if (t_delta.name == "global_property"){
+            return;
+        }
 
-                    ++num_processed;
-                    if (!save){
+        size_t num_processed = 0;
+        auto&  type          = get_type(t_delta.name);
+        if (type.as_variant() == nullptr && type.as_struct() == nullptr)
+            throw std::runtime_error("don't know how to process " + t_delta.name);
+        auto  layout = account_filters.find_layout(t_delta.name);
+        auto& rows   = rows_of(lines, t_delta.name);
+        auto& out    = rows.data;
+
+        for (auto& row : t_delta.rows) {
+            if (t_delta.rows.size() > 10000 && !(num_processed % 10000))
+                dlog(
+                    "block ${b} ${t} ${n} of ${r} bulk=${bulk}",
+                    ("b", block_num)("t", t_delta.name)("n", num_processed)("r", t_delta.rows.size())("bulk", bulk));
+
+            // skip rows whose name fields already rule them out
+            auto match = layout ? account_filters.match(*layout, row.data) : account_filter::unknown;
+            if (match == account_filter::no_match) {
+                ++num_processed;
+                continue;
+            }
 
-                        continue;
-                    }
-                    write_stream(block_num, t_delta.name, values);
-                }
-            },
-            t_delta);
+            auto        prev_size   = out.size();
+            auto        row_begin   = conv.begin_row(out);
+            std::size_t num_columns = 2;
+            conv.append_column(out, row_begin, block_num);
+            conv.append_column(out, row_begin, uint8_t(row.present));
+            if (type.as_variant())
+                num_columns += conv.append_sql_values(out, row.data, t_delta.name, *type.as_variant());
+            else if (type.as_struct())
+                num_columns += conv.append_sql_values(out, row.data, *type.as_struct());
+            conv.end_row(out, row_begin, num_columns);
+
+            ++num_processed;
+            // keep only rows with a field matching one of the account filters
+            auto line = std::string_view(out).substr(row_begin);
+            if (match == account_filter::unknown && !account_filters.match_converted(line, conv.binary_format))
+                out.resize(prev_size);
+            else
+                ++rows.num_rows;
+        }
     }
 
-    void receive_traces(uint32_t block_num, eosio::opaque<std::vector<eosio::ship_protocol::transaction_trace>> traces) {
-        ilog("${b} receive traces", ("b", block_num));
+    void receive_traces(
+        abieos_sql_converter& conv, table_lines& lines, uint32_t block_num,
+        eosio::opaque<std::vector<eosio::ship_protocol::transaction_trace>> traces) {
         auto     bin = traces.get();
         uint32_t num;
         varuint32_from_bin(num, bin);
         uint32_t num_ordinals = 0;
         for (uint32_t i = 0; i < num; ++i) {
-            auto              trace_bin = bin;
-            transaction_trace trace;
-            from_bin(trace, bin);
-            if (filter(config->trx_filters, trace))
-                write_transaction_trace(block_num, num_ordinals, trace, trace_bin);
+            auto            trace_bin = bin;
+            trace_bin_parts parts;
+            bool            keep = filter_trace_bin(config->trx_filters, bin, parts);
+            trace_bin.end        = bin.pos;
+            if (keep)
+                write_transaction_trace(conv, lines, block_num, num_ordinals, trace_bin, parts);
         }
     }
 
+    /// trace_bin holds exactly one transaction_trace, with parts as filter_trace_bin() found them. With action_tables, its
+    /// action traces go to the action tables and its transaction_trace row gets an empty action_traces.
     void write_transaction_trace(
-        uint32_t block_num, uint32_t& num_ordinals, const eosio::ship_protocol::transaction_trace& trace, eosio::input_stream trace_bin) {
+        abieos_sql_converter& conv, table_lines& lines, uint32_t block_num, uint32_t& num_ordinals, eosio::input_stream trace_bin,
+        const trace_bin_parts& parts) {
 
-        auto failed = std::visit(
-            [](auto& ttrace) { return !ttrace.failed_dtrx_trace.empty() ? &ttrace.failed_dtrx_trace[0].recurse : nullptr; }, trace);
-        if (failed != nullptr) {
-            if (!filter(config->trx_filters, *failed))
+        if (parts.failed.pos != parts.failed.end) {
+            if (!parts.failed_kept)
                 return;
-            std::vector<char> data = eosio::convert_to_bin(*failed);
-            write_transaction_trace(block_num, num_ordinals, *failed, eosio::input_stream{data});
+            write_transaction_trace(conv, lines, block_num, num_ordinals, parts.failed, *parts.failed_parts);
         }
 
+        static const std::string name                = "transaction_trace";
         auto                     transaction_ordinal = ++num_ordinals;
-        std::vector<std::string> values{std::to_string(block_num), std::to_string(transaction_ordinal)};
-        converter.to_sql_values(trace_bin, "transaction_trace", *get_type("transaction_trace").as_variant(), values);
-        write_stream(block_num, "transaction_trace", values);
+        auto&                    rows                = rows_of(lines, name);
+        auto&                    out                 = rows.data;
+        auto                     row_begin           = conv.begin_row(out);
+        conv.append_column(out, row_begin, block_num);
+        conv.append_column(out, row_begin, int32_t(transaction_ordinal));
+
+        if (config->action_tables) {
+            // reused by the thread's traces; the nested call for parts.failed is done with it by now
+            thread_local std::string without_actions;
+            append_action_trace_rows(conv, lines, block_num, transaction_ordinal, parts.action_traces);
+            without_actions.clear();
+            without_actions.reserve((parts.action_traces.pos - trace_bin.pos) + 1 + (trace_bin.end - parts.action_traces.end));
+            without_actions.append(trace_bin.pos, parts.action_traces.pos);
+            without_actions += '\0';
+            without_actions.append(parts.action_traces.end, trace_bin.end);
+            trace_bin = {without_actions.data(), without_actions.data() + without_actions.size()};
+        }
+        conv.end_row(out, row_begin, 2 + conv.append_sql_values(out, trace_bin, name, *get_type(name).as_variant()));
+        ++rows.num_rows;
     } // write_transaction_trace
 
+    /// a finished range may extend the contiguous blocks which fill_status covers
+    void finish_range() {
+        if (my)
+            my->set_range_head(*range, head, head_id, true);
+        work_t t(*sql_connection);
+        write_fill_status(t);
+        t.commit();
+        ilog("range ${b} - ${e} done", ("b", range->begin)("e", range->end));
+    }
+
     void trim() {
-        if (!config->enable_trim)
+        if (!config->enable_trim || range || bulk_load_pending)
             return;
         auto end_trim = std::min(head, irreversible);
         if (first >= end_trim)
             return;
         create_trim();
-        work_t t(*sql_connection);
-        ilog("trim  ${b} - ${e}", ("b", first)("e", end_trim));
-        t.exec("select * from " + converter.schema_name + ".trim_history(" + std::to_string(first) + ", " + std::to_string(end_trim) + ")");
-        t.commit();
-        ilog("      done");
-        first = end_trim;
+        if (config->trim_background) {
+            if (!trimmer)
+                trimmer = std::make_unique<background_trim>(converter.schema_name, config->trim_chunk);
+            // first lags behind the trimmer, so each partition is dropped once, starting where the last call stopped
+            drop_trimmed_partitions(std::max(first, dropped_end), end_trim);
+            if (config->partition_blocks)
+                dropped_end = end_trim / config->partition_blocks * config->partition_blocks;
+            first = trimmer->request(first, end_trim);
+            return;
+        }
+        drop_trimmed_partitions(first, end_trim);
+        dlog("trim  ${b} - ${e}", ("b", first)("e", end_trim));
+        while (first < end_trim) {
+            auto                  end = config->trim_chunk ? std::min(end_trim, first + config->trim_chunk) : end_trim;
+            metrics::scoped_timer timer{fill_pg_metrics::get().trim_chunk};
+            work_t                t(*sql_connection);
+            t.exec("select * from " + converter.schema_name + ".trim_history(" + std::to_string(first) + ", " + std::to_string(end) + ")");
+            t.commit();
+            first = end;
+        }
+        dlog("      done");
     }
 
     void closed(bool retry) override {
-        if (my) {
+        db_writer.reset(); // the blocks it still holds are written again after a reconnect
+        if (my && range) {
+            my->range_closed(*range, retry);
+        } else if (my) {
             my->session.reset();
             if (retry)
                 my->schedule_retry();
         }
     }
 
-    ~fpg_session() {}
+    ~fpg_session() {
+        db_writer.reset();
+        pipeline.reset();
+        trimmer.reset();
+    }
 }; // fpg_session
 
 static abstract_plugin& _fill_postgresql_plugin = app().register_plugin<fill_pg_plugin>();
@@ -728,22 +1948,98 @@ static abstract_plugin& _fill_postgresql_plugin = app().register_plugin<fill_pg_
 fill_postgresql_plugin_impl::~fill_postgresql_plugin_impl() {
     if (session)
         session->my = nullptr;
+    for (auto& s : range_sessions)
+        s->my = nullptr;
 }
 
 void fill_postgresql_plugin_impl::start() {
+    if (config->backfill_ranges)
+        return start_backfill();
     session = std::make_shared<fpg_session>(this);
     session->start(app().get_io_service());
 }
 
+/// splits [skip_to, stop_before) into equal ranges, spread over the endpoints
+void fill_postgresql_plugin_impl::start_backfill() {
+    auto num_blocks = config->stop_before - config->skip_to;
+    auto num_ranges = std::min(config->backfill_ranges, num_blocks);
+    ranges.resize(num_ranges);
+    for (uint32_t i = 0; i < num_ranges; ++i) {
+        auto& range = ranges[i];
+        range.begin = config->skip_to + uint64_t(num_blocks) * i / num_ranges;
+        range.end   = config->skip_to + uint64_t(num_blocks) * (i + 1) / num_ranges;
+        std::tie(range.host, range.port) = config->backfill_endpoints[i % config->backfill_endpoints.size()];
+    }
+    ilog("backfill ${b} - ${e} in ${n} ranges", ("b", config->skip_to)("e", config->stop_before)("n", num_ranges));
+    for (auto& range : ranges)
+        start_range(range);
+}
+
+void fill_postgresql_plugin_impl::start_range(backfill_range& range) {
+    auto s = std::make_shared<fpg_session>(this, &range);
+    range_sessions.push_back(s);
+    s->start(app().get_io_service());
+}
+
+void fill_postgresql_plugin_impl::range_closed(backfill_range& range, bool retry) {
+    range_sessions.erase(
+        std::remove_if(range_sessions.begin(), range_sessions.end(), [&](auto& s) { return s->range == &range; }), range_sessions.end());
+    std::lock_guard<std::mutex> lock(ranges_mutex);
+    if (range.done) {
+        if (std::all_of(ranges.begin(), ranges.end(), [](auto& r) { return r.done; }))
+            ilog("backfill done");
+        return;
+    }
+    if (!retry)
+        return;
+    auto range_timer = std::make_shared<boost::asio::deadline_timer>(app().get_io_service());
+    range_timer->expires_from_now(boost::posix_time::seconds(1));
+    range_timer->async_wait([this, range_timer, &range](auto&) {
+        ilog("retry range ${b} - ${e}", ("b", range.begin)("e", range.end));
+        start_range(range);
+    });
+}
+
 fill_pg_plugin::fill_pg_plugin()
     : my(std::make_shared<fill_postgresql_plugin_impl>()) {}
 
 fill_pg_plugin::~fill_pg_plugin() {}
 
 void fill_pg_plugin::set_program_options(options_description& cli, options_description& cfg) {
+    auto op   = cfg.add_options();
     auto clop = cli.add_options();
     clop("fpg-drop", "Drop (delete) schema and tables");
     clop("fpg-create", "Create schema and tables");
+    op("fpg-copy-binary", "Write tables with binary COPY instead of the text format");
+    op("fpg-copy-threads", bpo::value<uint32_t>()->default_value(0),
+       "Number of threads writing and committing table COPY streams concurrently (0 writes them on the main thread)");
+    op("fpg-flush-mb", bpo::value<uint64_t>()->default_value(256), "Commit bulk COPY streams after [arg] MiB of data (0 disables)");
+    op("fpg-flush-rows", bpo::value<uint64_t>()->default_value(0), "Commit bulk COPY streams after [arg] rows (0 disables)");
+    op("fpg-flush-blocks", bpo::value<uint32_t>()->default_value(0), "Commit bulk COPY streams after [arg] blocks (0 disables)");
+    op("fpg-flush-seconds", bpo::value<uint32_t>()->default_value(5), "Commit bulk COPY streams after [arg] seconds (0 disables)");
+    op("fpg-backfill-ranges", bpo::value<uint32_t>()->default_value(0),
+       "Split [fill-skip-to, fill-stop) into [arg] ranges which are fetched and written concurrently (0 disables)");
+    op("fpg-backfill-connect-to", bpo::value<std::vector<std::string>>()->composing(),
+       "State-history endpoints the backfill ranges are spread over (default fill-connect-to); may be given more than once");
+    op("fpg-trim-chunk", bpo::value<uint32_t>()->default_value(10000), "Trim history [arg] blocks per transaction (0 trims it at once)");
+    op("fpg-trim-background", "Trim history on a separate connection and thread instead of between blocks");
+    op("fpg-partition-blocks", bpo::value<uint32_t>()->default_value(0),
+       "Partition tables by ranges of [arg] blocks (0 disables). Must match the value the schema was created with");
+    op("fpg-bulk-load", bpo::value<uint32_t>()->default_value(0),
+       "Create tables without primary keys, and build them once within [arg] blocks of last irreversible (0 disables)");
+    op("fpg-unlogged", "With fpg-bulk-load, create tables unlogged until their primary keys are built");
+    op("fpg-action-tables", "Write action traces, their authorizations and RAM deltas to tables of their own instead of transaction_trace");
+    op("fpg-progress-seconds", bpo::value<uint32_t>()->default_value(10), "Log the fill rate every [arg] seconds (0 disables)");
+    op("fpg-stage-reversible", "Hold reversible blocks in memory and write them once they are irreversible");
+    op("fpg-seed-schema", bpo::value<std::string>(),
+       "With fpg-create, copy the contract and account tables of fill-pg schema [arg] as of its last irreversible block, and fill "
+       "from the block after it");
+    op("fpg-seed-connection", bpo::value<std::string>()->default_value(""),
+       "libpq connection string of the database holding fpg-seed-schema (default the one fill-pg writes to)");
+    op("fpg-seed-threads", bpo::value<uint32_t>()->default_value(4), "Number of tables fpg-seed-schema copies concurrently");
+    op("fpg-async-writes", "Write blocks to the database on a thread of their own, so the connection to nodeos doesn't wait for commits");
+    op("fpg-threads", bpo::value<uint32_t>()->default_value(0),
+       "Number of threads decoding blocks ahead of the database writer while catching up (0 decodes on the main thread)");
 }
 
 void fill_pg_plugin::plugin_initialize(const variables_map& options) {
@@ -752,20 +2048,75 @@ void fill_pg_plugin::plugin_initialize(const variables_map& options) {
         if (endpoint.find(':') == std::string::npos)
             throw std::runtime_error("invalid endpoint: " + endpoint);
 
-        auto port                 = endpoint.substr(endpoint.find(':') + 1, endpoint.size());
-        auto host                 = endpoint.substr(0, endpoint.find(':'));
-        my->config->host          = host;
-        my->config->port          = port;
-        my->config->schema        = options["pg-schema"].as<std::string>();
-        my->config->skip_to       = options.count("fill-skip-to") ? options["fill-skip-to"].as<uint32_t>() : 0;
-        my->config->stop_before   = options.count("fill-stop") ? options["fill-stop"].as<uint32_t>() : 0;
-        my->config->trx_filters   = fill_plugin::get_trx_filters(options);
-        my->config->drop_schema   = options.count("fpg-drop");
-        my->config->create_schema = options.count("fpg-create");
-        my->config->enable_trim   = options.count("fill-trim");
+        auto port                          = endpoint.substr(endpoint.find(':') + 1, endpoint.size());
+        auto host                          = endpoint.substr(0, endpoint.find(':'));
+        my->config->host                   = host;
+        my->config->port                   = port;
+        my->config->max_messages_in_flight = options["fill-max-in-flight"].as<uint32_t>();
+        my->config->schema                 = options["pg-schema"].as<std::string>();
+        my->config->skip_to                = options.count("fill-skip-to") ? options["fill-skip-to"].as<uint32_t>() : 0;
+        my->config->stop_before            = options.count("fill-stop") ? options["fill-stop"].as<uint32_t>() : 0;
+        my->config->trx_filters            = fill_plugin::get_trx_filters(options);
+        my->config->drop_schema            = options.count("fpg-drop");
+        my->config->create_schema          = options.count("fpg-create");
+        my->config->enable_trim            = options.count("fill-trim");
+        my->config->trim_chunk             = options["fpg-trim-chunk"].as<uint32_t>();
+        my->config->trim_background        = options.count("fpg-trim-background");
+        my->config->decode_threads         = options["fpg-threads"].as<uint32_t>();
+        my->config->async_writes           = options.count("fpg-async-writes");
+        my->config->copy_binary            = options.count("fpg-copy-binary");
+        my->config->copy_threads           = options["fpg-copy-threads"].as<uint32_t>();
+        my->config->partition_blocks       = options["fpg-partition-blocks"].as<uint32_t>();
+        my->config->bulk_load_blocks       = options["fpg-bulk-load"].as<uint32_t>();
+        my->config->unlogged               = options.count("fpg-unlogged");
+        my->config->stage_reversible       = options.count("fpg-stage-reversible");
+        my->config->action_tables          = options.count("fpg-action-tables");
+        my->config->progress_seconds       = options["fpg-progress-seconds"].as<uint32_t>();
+        my->config->replay_file            = options.count("fill-replay") ? options["fill-replay"].as<std::string>() : "";
+        my->config->seed_schema            = options.count("fpg-seed-schema") ? options["fpg-seed-schema"].as<std::string>() : "";
+        my->config->seed_connection        = options["fpg-seed-connection"].as<std::string>();
+        my->config->seed_threads           = options["fpg-seed-threads"].as<uint32_t>();
+        if (my->config->unlogged && my->config->partition_blocks)
+            throw std::runtime_error("partitioned tables can't be unlogged");
+        if (my->config->async_writes && !my->config->max_messages_in_flight)
+            throw std::runtime_error("fpg-async-writes needs fill-max-in-flight, which bounds the blocks queued for the writer");
+        if (!my->config->seed_schema.empty()) {
+            if (!my->config->create_schema)
+                throw std::runtime_error("fpg-seed-schema only seeds a schema created with fpg-create");
+            if (my->config->seed_connection.empty() && my->config->seed_schema == my->config->schema)
+                throw std::runtime_error("fpg-seed-schema can't be the schema being filled");
+        }
+
+        auto& flush      = my->config->flush;
+        flush.max_bytes  = options["fpg-flush-mb"].as<uint64_t>() << 20;
+        flush.max_rows   = options["fpg-flush-rows"].as<uint64_t>();
+        flush.max_blocks = options["fpg-flush-blocks"].as<uint32_t>();
+        flush.max_time   = std::chrono::seconds(options["fpg-flush-seconds"].as<uint32_t>());
+
+        my->config->backfill_ranges = options["fpg-backfill-ranges"].as<uint32_t>();
+        if (my->config->backfill_ranges && !my->config->seed_schema.empty())
+            throw std::runtime_error("fpg-seed-schema can't be used with fpg-backfill-ranges");
+        if (my->config->backfill_ranges) {
+            if (!my->config->skip_to || my->config->stop_before <= my->config->skip_to)
+                throw std::runtime_error("fpg-backfill-ranges needs fill-skip-to and a later fill-stop");
+            auto endpoints = options.count("fpg-backfill-connect-to") ? options["fpg-backfill-connect-to"].as<std::vector<std::string>>()
+                                                                      : std::vector<std::string>{endpoint};
+            for (auto& e : endpoints) {
+                if (e.find(':') == std::string::npos)
+                    throw std::runtime_error("invalid endpoint: " + e);
+                my->config->backfill_endpoints.emplace_back(e.substr(0, e.find(':')), e.substr(e.find(':') + 1));
+            }
+        }
+
+        if (options.count("fill-record")) {
+            // the ranges' messages would interleave
+            if (my->config->backfill_ranges)
+                throw std::runtime_error("fill-record can't be used with fpg-backfill-ranges");
+            my->recorder = std::make_shared<state_history::capture_writer>(options["fill-record"].as<std::string>());
+        }
 
         // 添加过滤
-        for (auto& filt : my->config->trx_filters) {
+        for (auto& filt : my->config->trx_filters.rules()) {
 
             auto account = filt.act_account.value().to_string();
             my->account_filters.push_back(account);
@@ -779,6 +2130,8 @@ void fill_pg_plugin::plugin_startup() { my->start(); }
 void fill_pg_plugin::plugin_shutdown() {
     if (my->session)
         my->session->connection->close(false);
+    for (auto s : std::vector(my->range_sessions))
+        s->connection->close(false);
     my->timer.cancel();
     ilog("fill_pg_plugin stopped");
 }
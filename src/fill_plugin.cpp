@@ -20,6 +20,12 @@ void fill_plugin::set_program_options(options_description& cli, options_descript
     auto clop = cli.add_options();
     op("fill-connect-to,f", bpo::value<std::string>()->default_value("127.0.0.1:8080"), "State-history endpoint to connect to (nodeos)");
     op("fill-trim,t", "Trim history before irreversible");
+    op("fill-max-in-flight", bpo::value<uint32_t>()->default_value(0),
+       "Maximum number of unprocessed blocks nodeos may send before it waits for acknowledgements (0 is unlimited)");
+    op("fill-record", bpo::value<std::string>(),
+       "Record the messages received from state-history into capture file [arg] (gzip-compressed if it ends in .gz)");
+    op("fill-replay", bpo::value<std::string>(),
+       "Read state-history messages from a capture made by fill-record instead of connecting to fill-connect-to");
     clop("fill-skip-to,k", bpo::value<uint32_t>(), "Skip blocks before [arg]");
     clop("fill-stop,x", bpo::value<uint32_t>(), "Stop before block [arg]");
     clop("fill-trx", bpo::value<std::vector<std::string>>(), "Filter transactions 'include:status:receiver:act_account:act_name'");
@@ -1,12 +1,13 @@
 // copyright defined in LICENSE.txt
 
 #pragma once
+#include "metrics_plugin.hpp"
 #include "state_history.hpp"
 #include <appbase/application.hpp>
 
 class fill_plugin : public appbase::plugin<fill_plugin> {
   public:
-    APPBASE_PLUGIN_REQUIRES()
+    APPBASE_PLUGIN_REQUIRES((metrics_plugin))
 
     fill_plugin();
     virtual ~fill_plugin();
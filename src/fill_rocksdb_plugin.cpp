@@ -1,6 +1,7 @@
 // copyright defined in LICENSE.txt
 
 #include "fill_rocksdb_plugin.hpp"
+#include "decode_pipeline.hpp"
 #include "state_history_connection.hpp"
 #include "state_history_rocksdb.hpp"
 #include "util.hpp"
@@ -11,8 +12,9 @@
 #include <boost/beast/websocket.hpp>
 #include <fc/exception/exception.hpp>
 
-using namespace abieos;
 using namespace appbase;
+using namespace eosio::literals;
+using namespace eosio::ship_protocol;
 using namespace std::literals;
 using namespace state_history;
 
@@ -32,7 +34,7 @@ struct rocksdb_table;
 
 struct rocksdb_field {
     std::string                    name        = {};
-    const abieos::abi_field*       abi_field   = {};
+    const eosio::abi_field*        abi_field   = {};
     const kv::type*                type        = {};
     std::unique_ptr<rocksdb_table> array_of    = {};
     std::unique_ptr<rocksdb_table> optional_of = {};
@@ -41,23 +43,34 @@ struct rocksdb_field {
 struct rocksdb_table {
     std::string                                 name      = {};
     const kv::table*                            kv_table  = {};
-    const abieos::abi_type*                     abi_type  = {};
+    const eosio::abi_type*                      abi_type  = {};
     std::vector<std::unique_ptr<rocksdb_field>> fields    = {};
     std::map<std::string, rocksdb_field*>       field_map = {};
 };
 
 struct fill_rocksdb_config : connection_config {
-    uint32_t                skip_to      = 0;
-    uint32_t                stop_before  = 0;
-    std::vector<trx_filter> trx_filters  = {};
-    bool                    enable_trim  = false;
-    bool                    enable_check = false;
+    uint32_t                skip_to         = 0;
+    uint32_t                stop_before     = 0;
+    std::vector<trx_filter> trx_filters     = {};
+    bool                    enable_trim     = false;
+    bool                    enable_check    = false;
+    uint32_t                decode_threads  = 0;
+    bool                    bulk_ingest     = false;
+    uint32_t                trim_chunk      = 10000; // blocks per trim; 0 trims the whole range at once
+    bool                    trim_compaction = false; // leave rows of tables without a trim index to the compaction filter
+};
+
+/// a block's rows and index entries, built on a pipeline worker
+struct block_batches {
+    rocksdb::WriteBatch content;
+    rocksdb::WriteBatch index;
 };
 
 struct fill_rocksdb_plugin_impl : std::enable_shared_from_this<fill_rocksdb_plugin_impl> {
-    std::shared_ptr<fill_rocksdb_config> config = std::make_shared<fill_rocksdb_config>();
-    std::shared_ptr<::flm_session>       session;
-    boost::asio::deadline_timer          timer;
+    std::shared_ptr<fill_rocksdb_config>           config = std::make_shared<fill_rocksdb_config>();
+    std::shared_ptr<::flm_session>                 session;
+    boost::asio::deadline_timer                    timer;
+    std::shared_ptr<state_history::capture_writer> recorder; // fill-record
 
     fill_rocksdb_plugin_impl()
         : timer(app().get_io_service()) {}
@@ -82,22 +95,28 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
     rocksdb::WriteBatch                        active_content_batch;
     rocksdb::WriteBatch                        active_index_batch;
     std::shared_ptr<state_history::connection> connection;
+    eosio::abi                                 abi                = {};
     std::map<std::string, rocksdb_table>       tables             = {};
     rocksdb_table*                             block_info_table   = {};
     rocksdb_table*                             action_trace_table = {};
     std::optional<state_history::fill_status>  current_db_status  = {};
     uint32_t                                   head               = 0;
-    abieos::checksum256                        head_id            = {};
+    eosio::checksum256                         head_id            = {};
     uint32_t                                   irreversible       = 0;
-    abieos::checksum256                        irreversible_id    = {};
+    eosio::checksum256                         irreversible_id    = {};
     uint32_t                                   first              = 0;
 
+    // queued_head is the last block pushed to the pipeline since it was drained
+    std::unique_ptr<decode_pipeline<block_batches>> pipeline;
+    uint32_t                                        queued_head = 0;
+
     flm_session(fill_rocksdb_plugin_impl* my)
         : my(my)
         , config(my->config) {}
 
     void connect(asio::io_context& ioc) {
-        connection = std::make_shared<state_history::connection>(ioc, *config, shared_from_this());
+        connection           = std::make_shared<state_history::connection>(ioc, *config, shared_from_this());
+        connection->recorder = my->recorder;
         connection->connect();
     }
 
@@ -141,12 +160,12 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
             throw std::runtime_error("Found head " + std::to_string(expected - 1) + " but fill_status.head = " + std::to_string(head));
 
         ilog("verifying index entries reference existing records");
-        uint64_t     num_ti_keys = 0;
-        abieos::name last_table, last_index;
-        uint64_t     last_num_keys = 0;
+        uint64_t    num_ti_keys = 0;
+        eosio::name last_table, last_index;
+        uint64_t    last_num_keys = 0;
         for_each(rocksdb_inst->database, kv::make_index_key(), kv::make_index_key(), [&](auto k, auto v) {
-            abieos::name table, index;
-            auto         kk = k;
+            eosio::name table, index;
+            auto        kk = k;
             kv::key_to_native<uint8_t>(kk);
             kv::read_index_prefix(kk, table, index);
             if (table != last_table || index != last_index) {
@@ -184,27 +203,36 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
         ilog("database appears ok");
     }
 
-    void fill_fields(rocksdb_table& table, const std::string& base_name, const abieos::abi_field& abi_field) {
-        if (abi_field.type->filled_struct) {
-            for (auto& f : abi_field.type->fields)
+    /// the struct held by a variant with a single alternative, such as the rows of a table delta
+    static const eosio::abi_type::struct_* struct_of_variant(const eosio::abi_type* type) {
+        auto* alternatives = type->as_variant();
+        if (!alternatives || alternatives->size() != 1)
+            return nullptr;
+        return (*alternatives)[0].type->as_struct();
+    }
+
+    void fill_fields(rocksdb_table& table, const std::string& base_name, const eosio::abi_field& abi_field) {
+        if (auto* s = abi_field.type->as_struct()) {
+            for (auto& f : s->fields)
                 fill_fields(table, base_name + abi_field.name + "_", f);
-        } else if (abi_field.type->filled_variant && abi_field.type->fields.size() == 1 && abi_field.type->fields[0].type->filled_struct) {
-            for (auto& f : abi_field.type->fields[0].type->fields)
+        } else if (auto* s = struct_of_variant(abi_field.type)) {
+            for (auto& f : s->fields)
                 fill_fields(table, base_name + abi_field.name + "_", f);
         } else {
-            bool array_of_struct  = abi_field.type->array_of && abi_field.type->array_of->filled_struct;
-            bool array_of_variant = abi_field.type->array_of && abi_field.type->array_of->filled_variant &&
-                                    abi_field.type->array_of->fields.size() == 1 && abi_field.type->array_of->fields[0].type->filled_struct;
-            bool optional_of_struct = abi_field.type->optional_of && abi_field.type->optional_of->filled_struct;
-            auto field_name         = base_name + abi_field.name;
+            auto* array_of           = abi_field.type->array_of();
+            auto* optional_of        = abi_field.type->optional_of();
+            bool  array_of_struct    = array_of && array_of->as_struct();
+            bool  array_of_variant   = array_of && struct_of_variant(array_of);
+            bool  optional_of_struct = optional_of && optional_of->as_struct();
+            auto  field_name         = base_name + abi_field.name;
             if (table.field_map.find(field_name) != table.field_map.end())
                 throw std::runtime_error("duplicate field " + field_name + " in table " + table.name);
 
             auto* raw_type = abi_field.type;
-            if (raw_type->optional_of)
-                raw_type = raw_type->optional_of;
-            if (raw_type->array_of)
-                raw_type = raw_type->array_of;
+            if (raw_type->optional_of())
+                raw_type = raw_type->optional_of();
+            if (raw_type->array_of())
+                raw_type = raw_type->array_of();
             auto type_it = kv::abi_type_to_kv_type.find(raw_type->name);
             if (type_it == kv::abi_type_to_kv_type.end() && !array_of_struct && !array_of_variant && !optional_of_struct)
                 throw std::runtime_error("don't know rocksdb type for abi type: " + raw_type->name);
@@ -217,18 +245,17 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
             f->type                     = (array_of_struct | array_of_variant | optional_of_struct) ? nullptr : &type_it->second;
 
             if (array_of_struct) {
-                f->array_of = std::make_unique<rocksdb_table>(rocksdb_table{.name = field_name, .abi_type = abi_field.type->array_of});
-                for (auto& g : abi_field.type->array_of->fields)
+                f->array_of = std::make_unique<rocksdb_table>(rocksdb_table{.name = field_name, .abi_type = array_of});
+                for (auto& g : array_of->as_struct()->fields)
                     fill_fields(*f->array_of, base_name, g);
             } else if (array_of_variant) {
-                f->array_of = std::make_unique<rocksdb_table>(
-                    rocksdb_table{.name = field_name, .abi_type = abi_field.type->array_of->fields[0].type});
-                for (auto& g : abi_field.type->array_of->fields[0].type->fields)
+                f->array_of =
+                    std::make_unique<rocksdb_table>(rocksdb_table{.name = field_name, .abi_type = (*array_of->as_variant())[0].type});
+                for (auto& g : struct_of_variant(array_of)->fields)
                     fill_fields(*f->array_of, base_name, g);
             } else if (optional_of_struct) {
-                f->optional_of =
-                    std::make_unique<rocksdb_table>(rocksdb_table{.name = field_name, .abi_type = abi_field.type->optional_of});
-                for (auto& g : abi_field.type->optional_of->fields)
+                f->optional_of = std::make_unique<rocksdb_table>(rocksdb_table{.name = field_name, .abi_type = optional_of});
+                for (auto& g : optional_of->as_struct()->fields)
                     fill_fields(*f->optional_of, base_name, g);
             }
         }
@@ -249,7 +276,7 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
         return *it->second;
     }
 
-    const kv::table& get_kv_table(abieos::name name) {
+    const kv::table& get_kv_table(eosio::name name) {
         auto& c  = *rocksdb_inst->query_config;
         auto  it = c.table_name_map.find(name);
         if (it == c.table_name_map.end())
@@ -257,7 +284,7 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
         return *it->second;
     }
 
-    void add_table(const std::string& table_name, const std::string& table_type, const jarray& key_names) {
+    void add_table(const std::string& table_name, const std::string& table_type) {
         if (tables.find(table_name) != tables.end())
             throw std::runtime_error("duplicate table \"" + table_name + "\"");
 
@@ -266,54 +293,49 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
         table.kv_table = &get_kv_table(table_name);
         table.abi_type = &get_type(table_type);
 
-        if (!table.abi_type->filled_variant || table.abi_type->fields.size() != 1 || !table.abi_type->fields[0].type->filled_struct)
+        auto* s = struct_of_variant(table.abi_type);
+        if (!s)
             throw std::runtime_error("don't know how to process " + table.abi_type->name);
 
-        for (auto& f : table.abi_type->fields[0].type->fields)
+        for (auto& f : s->fields)
             fill_fields(table, "", f);
     }
 
-    void init_tables(std::string_view abi_json) {
-        std::string error;
-        jvalue      j;
-        if (!json_to_jvalue(j, error, abi_json))
-            throw std::runtime_error(error);
-        for (auto& t : std::get<jarray>(std::get<jobject>(j.value)["tables"].value)) {
-            auto& o = std::get<jobject>(t.value);
-            add_table(
-                std::get<std::string>(o["name"].value), std::get<std::string>(o["type"].value), std::get<jarray>(o["key_names"].value));
-        }
+    // deltas are named after their table's type, as fill-pg names its tables
+    void init_tables() {
+        for (auto& t : connection->abi.tables)
+            add_table(t.type, t.type);
 
         block_info_table           = &tables["block_info"];
         block_info_table->name     = "block_info";
         block_info_table->kv_table = &get_kv_table("block_info");
-        fill_fields(*block_info_table, "", abieos::abi_field{"block_num", &get_type("uint32")});
-        fill_fields(*block_info_table, "", abieos::abi_field{"block_id", &get_type("checksum256")});
-        fill_fields(*block_info_table, "", abieos::abi_field{"timestamp", &get_type("block_timestamp_type")});
-        fill_fields(*block_info_table, "", abieos::abi_field{"producer", &get_type("name")});
-        fill_fields(*block_info_table, "", abieos::abi_field{"confirmed", &get_type("uint16")});
-        fill_fields(*block_info_table, "", abieos::abi_field{"previous", &get_type("checksum256")});
-        fill_fields(*block_info_table, "", abieos::abi_field{"transaction_mroot", &get_type("checksum256")});
-        fill_fields(*block_info_table, "", abieos::abi_field{"action_mroot", &get_type("checksum256")});
-        fill_fields(*block_info_table, "", abieos::abi_field{"schedule_version", &get_type("uint32")});
+        fill_fields(*block_info_table, "", eosio::abi_field{"block_num", &get_type("uint32")});
+        fill_fields(*block_info_table, "", eosio::abi_field{"block_id", &get_type("checksum256")});
+        fill_fields(*block_info_table, "", eosio::abi_field{"timestamp", &get_type("block_timestamp_type")});
+        fill_fields(*block_info_table, "", eosio::abi_field{"producer", &get_type("name")});
+        fill_fields(*block_info_table, "", eosio::abi_field{"confirmed", &get_type("uint16")});
+        fill_fields(*block_info_table, "", eosio::abi_field{"previous", &get_type("checksum256")});
+        fill_fields(*block_info_table, "", eosio::abi_field{"transaction_mroot", &get_type("checksum256")});
+        fill_fields(*block_info_table, "", eosio::abi_field{"action_mroot", &get_type("checksum256")});
+        fill_fields(*block_info_table, "", eosio::abi_field{"schedule_version", &get_type("uint32")});
 
         action_trace_table           = &tables["action_trace"];
         action_trace_table->name     = "action_trace";
         action_trace_table->kv_table = &get_kv_table("action_trace");
-        fill_fields(*action_trace_table, "", abieos::abi_field{"block_num", &get_type("uint32")});
-        fill_fields(*action_trace_table, "", abieos::abi_field{"transaction_id", &get_type("checksum256")});
-        fill_fields(*action_trace_table, "", abieos::abi_field{"transaction_status", &get_type("uint8")});
-        fill_fields(*action_trace_table, "", abieos::abi_field{"action_ordinal", &get_type("varuint32")});
-        fill_fields(*action_trace_table, "", abieos::abi_field{"creator_action_ordinal", &get_type("varuint32")});
-        fill_fields(*action_trace_table, "", abieos::abi_field{"receiver", &get_type("name")});
-        fill_fields(*action_trace_table, "", abieos::abi_field{"act_account", &get_type("name")});
-        fill_fields(*action_trace_table, "", abieos::abi_field{"act_name", &get_type("name")});
-        fill_fields(*action_trace_table, "", abieos::abi_field{"act_data", &get_type("bytes")});
-        fill_fields(*action_trace_table, "", abieos::abi_field{"context_free", &get_type("bool")});
-        fill_fields(*action_trace_table, "", abieos::abi_field{"elapsed", &get_type("int64")});
-        fill_fields(*action_trace_table, "", abieos::abi_field{"console", &get_type("string")});
-        fill_fields(*action_trace_table, "", abieos::abi_field{"except", &get_type("string")});
-        fill_fields(*action_trace_table, "", abieos::abi_field{"error_code", &get_type("uint64")});
+        fill_fields(*action_trace_table, "", eosio::abi_field{"block_num", &get_type("uint32")});
+        fill_fields(*action_trace_table, "", eosio::abi_field{"transaction_id", &get_type("checksum256")});
+        fill_fields(*action_trace_table, "", eosio::abi_field{"transaction_status", &get_type("uint8")});
+        fill_fields(*action_trace_table, "", eosio::abi_field{"action_ordinal", &get_type("varuint32")});
+        fill_fields(*action_trace_table, "", eosio::abi_field{"creator_action_ordinal", &get_type("varuint32")});
+        fill_fields(*action_trace_table, "", eosio::abi_field{"receiver", &get_type("name")});
+        fill_fields(*action_trace_table, "", eosio::abi_field{"act_account", &get_type("name")});
+        fill_fields(*action_trace_table, "", eosio::abi_field{"act_name", &get_type("name")});
+        fill_fields(*action_trace_table, "", eosio::abi_field{"act_data", &get_type("bytes")});
+        fill_fields(*action_trace_table, "", eosio::abi_field{"context_free", &get_type("bool")});
+        fill_fields(*action_trace_table, "", eosio::abi_field{"elapsed", &get_type("int64")});
+        fill_fields(*action_trace_table, "", eosio::abi_field{"console", &get_type("string")});
+        fill_fields(*action_trace_table, "", eosio::abi_field{"except", &get_type("string")});
+        fill_fields(*action_trace_table, "", eosio::abi_field{"error_code", &get_type("uint64")});
 
         if (config->enable_trim) {
             auto& c = *rocksdb_inst->query_config;
@@ -326,10 +348,12 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
         }
     } // init_tables
 
-    void received_abi(std::string_view abi) override {
-        init_tables(abi);
+    void received_abi(eosio::abi&& received) override {
+        abi = std::move(received);
+        init_tables();
 
         load_fill_status();
+        set_compaction_trim(first);
         ilog("clean up stale records");
         end_write(true);
         truncate(head + 1);
@@ -410,16 +434,82 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
         ilog("removed ${r} rows and ${i} index entries", ("r", num_rows)("i", num_indexes));
     }
 
-    void end_write(bool write_fill) {
+    void end_write(bool write_fill, bool ingest = false) {
         if (write_fill)
             write_fill_status(active_index_batch);
 
         // write content before indexes to enable truncate() to behave correctly if process exits before flushing
-        write(rocksdb_inst->database, active_content_batch);
-        write(rocksdb_inst->database, active_index_batch);
+        if (ingest) {
+            rdb::ingest(rocksdb_inst->database, active_content_batch);
+            rdb::ingest(rocksdb_inst->database, active_index_batch);
+        } else {
+            write(rocksdb_inst->database, active_content_batch);
+            write(rocksdb_inst->database, active_index_batch);
+        }
     }
 
     bool received(get_blocks_result_v0& result) override {
+        return process_blocks_result(result, [this, &result] { decode_block(result, active_content_batch, active_index_batch); });
+    }
+
+    bool received(get_blocks_result_v0& result, const std::shared_ptr<flat_buffer>& buffer) override {
+        static auto& blocks = metrics::get_counter("fill_blocks_total", "Block results received from state-history");
+        if (result.this_block)
+            blocks.add();
+        if (config->decode_threads && result.this_block && can_pipeline(result)) {
+            if (!pipeline)
+                start_pipeline();
+            pipeline->push(buffer, result);
+            queued_head = result.this_block->block_num;
+            return true;
+        }
+        if (pipeline) {
+            pipeline->drain();
+            queued_head = 0;
+        }
+        return received(result);
+    }
+
+    /// Blocks which don't switch forks, stop, or come near irreversible may be decoded ahead of the writer. head is only read
+    /// while the pipeline is drained.
+    bool can_pipeline(const get_blocks_result_v0& result) {
+        auto block_num = result.this_block->block_num;
+        if (block_num + 4 >= result.last_irreversible.block_num)
+            return false;
+        if (config->stop_before && block_num >= config->stop_before)
+            return false;
+        return block_num > (queued_head ? queued_head : head);
+    }
+
+    void start_pipeline() {
+        ilog("start decode pipeline with ${n} threads", ("n", config->decode_threads));
+        pipeline = std::make_unique<decode_pipeline<block_batches>>(
+            config->decode_threads, [this](uint32_t, auto& j) { decode_block(j.result, j.output.content, j.output.index); },
+            [this](auto& j) {
+                process_blocks_result(j.result, [this, &j] {
+                    rdb::append(rocksdb_inst->database, active_content_batch, j.output.content);
+                    rdb::append(rocksdb_inst->database, active_index_batch, j.output.index);
+                });
+            },
+            [](block_batches& batches) {
+                batches.content.Clear();
+                batches.index.Clear();
+            });
+    }
+
+    /// builds a block's rows and index entries; only reads session state, so it may run on a pipeline worker
+    void decode_block(const get_blocks_result_v0& result, rocksdb::WriteBatch& content_batch, rocksdb::WriteBatch& index_batch) {
+        if (result.block)
+            receive_block(result.this_block->block_num, result.this_block->block_id, *result.block, content_batch, index_batch);
+        if (result.deltas)
+            receive_deltas(content_batch, index_batch, result.this_block->block_num, *result.deltas);
+        if (result.traces)
+            receive_traces(content_batch, index_batch, result.this_block->block_num, *result.traces);
+    }
+
+    /// handles forks, stops and commits around decode(), which adds the block's rows to the active batches
+    template <typename F>
+    bool process_blocks_result(get_blocks_result_v0& result, F decode) {
         if (!result.this_block)
             return true;
         if (config->stop_before && result.this_block->block_num >= config->stop_before) {
@@ -460,15 +550,9 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
             if (commit_now)
                 ilog("block ${b}", ("b", result.this_block->block_num));
 
-            if (head_id != abieos::checksum256{} && (!result.prev_block || result.prev_block->block_id != head_id))
+            if (head_id != eosio::checksum256{} && (!result.prev_block || result.prev_block->block_id != head_id))
                 throw std::runtime_error("prev_block does not match");
-            if (result.block)
-                receive_block(
-                    result.this_block->block_num, result.this_block->block_id, *result.block, active_content_batch, active_index_batch);
-            if (result.deltas)
-                receive_deltas(active_content_batch, active_index_batch, result.this_block->block_num, *result.deltas);
-            if (result.traces)
-                receive_traces(active_content_batch, active_index_batch, result.this_block->block_num, *result.traces);
+            decode();
 
             head            = result.this_block->block_num;
             head_id         = result.this_block->block_id;
@@ -482,7 +566,7 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
                 kv::received_block{result.this_block->block_num, result.this_block->block_id});
 
             if (commit_now) {
-                end_write(true);
+                end_write(true, config->bulk_ingest && !near);
                 if (config->enable_trim)
                     trim();
             }
@@ -493,25 +577,24 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
         }
 
         return true;
-    } // receive_result()
+    } // process_blocks_result()
 
-    void fill(std::vector<char>& dest, input_buffer& src, rocksdb_field& field) {
-        if (field.abi_field->type->filled_variant && field.abi_field->type->fields.size() == 1 &&
-            field.abi_field->type->fields[0].type->filled_struct) {
-            auto v = read_varuint32(src);
+    void fill(std::vector<char>& dest, eosio::input_stream& src, rocksdb_field& field) {
+        if (struct_of_variant(field.abi_field->type)) {
+            auto v = read_varuint32_bin(src);
             if (v)
                 throw std::runtime_error("invalid variant in " + field.abi_field->type->name);
-            abieos::push_varuint32(dest, v);
+            eosio::convert_to_bin(eosio::varuint32{v}, dest);
         } else if (field.optional_of) {
-            bool b = read_raw<bool>(src);
-            abieos::push_raw(dest, b);
+            bool b = eosio::from_bin<bool>(src);
+            eosio::convert_to_bin(b, dest);
             if (b) {
                 for (auto& f : field.optional_of->fields)
                     fill(dest, src, *f);
             }
         } else if (field.array_of) {
-            uint32_t n = read_varuint32(src);
-            abieos::push_varuint32(dest, n);
+            uint32_t n = read_varuint32_bin(src);
+            eosio::convert_to_bin(eosio::varuint32{n}, dest);
             for (uint32_t i = 0; i < n; ++i) {
                 for (auto& f : field.array_of->fields)
                     fill(dest, src, *f);
@@ -519,9 +602,9 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
         } else {
             if (!field.type->bin_to_bin)
                 throw std::runtime_error("don't know how to process " + field.abi_field->type->name);
-            if (field.abi_field->type->optional_of) {
-                bool exists = read_raw<bool>(src);
-                abieos::push_raw<bool>(dest, exists);
+            if (field.abi_field->type->optional_of()) {
+                bool exists = eosio::from_bin<bool>(src);
+                eosio::convert_to_bin(exists, dest);
                 if (!exists)
                     return;
             }
@@ -534,30 +617,33 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
         const std::vector<char>& value) {
         std::vector<std::optional<uint32_t>> positions;
         kv::init_positions(positions, table.kv_table->fields.size());
-        kv::fill_positions({value.data(), value.data() + value.size()}, table.kv_table->fields, positions);
+        kv::fill_positions(eosio::input_stream{value}, table.kv_table->fields, positions);
 
+        // most keys fit without the vectors growing more than once
         std::vector<char> key;
+        key.reserve(64);
         kv::append_table_key(key, block_num, present_k, table.kv_table->short_name);
-        kv::extract_keys(key, {value.data(), value.data() + value.size()}, table.kv_table->keys, positions);
+        kv::extract_keys(key, eosio::input_stream{value}, table.kv_table->keys, positions);
         rdb::put(content_batch, key, value);
 
         std::vector<char> index_key;
+        index_key.reserve(64);
         for (auto* index : table.kv_table->indexes) {
             index_key.clear();
             kv::append_index_key(index_key, table.kv_table->short_name, index->short_name);
-            kv::extract_keys(index_key, {value.data(), value.data() + value.size()}, index->sort_keys, positions);
+            kv::extract_keys(index_key, eosio::input_stream{value}, index->sort_keys, positions);
             kv::append_index_suffix(index_key, block_num, present_k);
-            index_batch.Put(rdb::to_slice(index_key), {});
+            index_batch.Put(rocksdb_inst->database.index(), rdb::to_slice(index_key), {});
         }
     }
 
     void remove_row(
-        rocksdb::WriteBatch& content_batch, rocksdb::WriteBatch& index_batch, abieos::input_buffer k, abieos::input_buffer v,
+        rocksdb::WriteBatch& content_batch, rocksdb::WriteBatch& index_batch, eosio::input_stream k, eosio::input_stream v,
         uint64_t* num_rows = nullptr, uint64_t* num_indexes = nullptr) {
-        uint32_t     block_num;
-        abieos::name table_name;
-        bool         present_k;
-        auto         temp_k = k;
+        uint32_t    block_num;
+        eosio::name table_name;
+        bool        present_k;
+        auto        temp_k = k;
         kv::key_to_native<uint8_t>(temp_k);
         kv::read_table_prefix(temp_k, block_num, table_name, present_k);
 
@@ -573,7 +659,7 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
             kv::append_index_key(index_key, table_name, index->short_name);
             kv::extract_keys(index_key, v, index->sort_keys, positions);
             kv::append_index_suffix(index_key, block_num, present_k);
-            index_batch.Delete(rdb::to_slice(index_key));
+            index_batch.Delete(rocksdb_inst->database.index(), rdb::to_slice(index_key));
             if (num_indexes)
                 ++*num_indexes;
         }
@@ -584,88 +670,89 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
     }
 
     void remove_row(
-        rocksdb::WriteBatch& content_batch, rocksdb::WriteBatch& index_batch, abieos::input_buffer k, uint64_t* num_rows = nullptr,
+        rocksdb::WriteBatch& content_batch, rocksdb::WriteBatch& index_batch, eosio::input_stream k, uint64_t* num_rows = nullptr,
         uint64_t* num_indexes = nullptr) {
 
         rocksdb::PinnableSlice v;
         auto*                  db   = rocksdb_inst->database.db.get();
         auto                   stat = db->Get(rocksdb::ReadOptions(), db->DefaultColumnFamily(), rdb::to_slice(k), &v);
         rdb::check(stat, "get: ");
-        remove_row(content_batch, index_batch, k, rdb::to_input_buffer(v), num_rows, num_indexes);
+        remove_row(content_batch, index_batch, k, rdb::to_input_stream(v), num_rows, num_indexes);
     }
 
     void receive_block(
-        uint32_t block_num, const checksum256& block_id, input_buffer bin, rocksdb::WriteBatch& content_batch,
+        uint32_t block_num, const eosio::checksum256& block_id, eosio::input_stream bin, rocksdb::WriteBatch& content_batch,
         rocksdb::WriteBatch& index_batch) {
-        state_history::signed_block block;
-        bin_to_native(block, bin);
+        signed_block_header block;
+        from_bin(block, bin);
         std::vector<char> value;
 
-        abieos::native_to_bin(block_num, value);
-        abieos::native_to_bin(block_id, value);
-        abieos::native_to_bin(block.timestamp, value);
-        abieos::native_to_bin(block.producer, value);
-        abieos::native_to_bin(block.confirmed, value);
-        abieos::native_to_bin(block.previous, value);
-        abieos::native_to_bin(block.transaction_mroot, value);
-        abieos::native_to_bin(block.action_mroot, value);
-        abieos::native_to_bin(block.schedule_version, value);
-        abieos::native_to_bin(block.new_producers ? *block.new_producers : state_history::producer_schedule{}, value);
+        eosio::convert_to_bin(block_num, value);
+        eosio::convert_to_bin(block_id, value);
+        eosio::convert_to_bin(block.timestamp, value);
+        eosio::convert_to_bin(block.producer, value);
+        eosio::convert_to_bin(block.confirmed, value);
+        eosio::convert_to_bin(block.previous, value);
+        eosio::convert_to_bin(block.transaction_mroot, value);
+        eosio::convert_to_bin(block.action_mroot, value);
+        eosio::convert_to_bin(block.schedule_version, value);
+        eosio::convert_to_bin(block.new_producers ? *block.new_producers : producer_schedule{}, value);
 
         add_row(content_batch, index_batch, get_table("block_info"), block_num, true, value);
     } // receive_block
 
-    void receive_deltas(rocksdb::WriteBatch& content_batch, rocksdb::WriteBatch& index_batch, uint32_t block_num, input_buffer bin) {
-        auto&             table_delta_type = get_type("table_delta");
+    void receive_deltas(rocksdb::WriteBatch& content_batch, rocksdb::WriteBatch& index_batch, uint32_t block_num, eosio::input_stream bin) {
         std::vector<char> value;
 
-        auto num = read_varuint32(bin);
+        auto num = read_varuint32_bin(bin);
         for (uint32_t i = 0; i < num; ++i) {
-            check_variant(bin, table_delta_type, "table_delta_v0");
-            state_history::table_delta_v0 table_delta;
-            bin_to_native(table_delta, bin);
-            auto& table = get_table(table_delta.name);
-
-            size_t num_processed = 0;
-            for (auto& row : table_delta.rows) {
-                if (table_delta.rows.size() > 10000 && !(num_processed % 10000)) {
-                    ilog(
-                        "block ${b} ${t} ${n} of ${r}",
-                        ("b", block_num)("t", table_delta.name)("n", num_processed)("r", table_delta.rows.size()));
-                    end_write(false);
-                }
-                check_variant(row.data, *table.abi_type, 0u);
-                value.clear();
-                abieos::native_to_bin(block_num, value);
-                abieos::native_to_bin(row.present, value);
-                for (auto& field : table.fields)
-                    fill(value, row.data, *field);
-                add_row(content_batch, index_batch, table, block_num, row.present, value);
-                ++num_processed;
-            }
+            table_delta delta;
+            from_bin(delta, bin);
+            std::visit(
+                [&](auto& table_delta) {
+                    auto& table = get_table(table_delta.name);
+
+                    // a pipeline worker builds its own batches, which the writer merges once the block is done
+                    bool   active_batches = &content_batch == &active_content_batch;
+                    size_t num_processed  = 0;
+                    for (auto& row : table_delta.rows) {
+                        if (active_batches && table_delta.rows.size() > 10000 && !(num_processed % 10000)) {
+                            ilog(
+                                "block ${b} ${t} ${n} of ${r}",
+                                ("b", block_num)("t", table_delta.name)("n", num_processed)("r", table_delta.rows.size()));
+                            end_write(false);
+                        }
+                        check_variant(row.data, *table.abi_type, 0u);
+                        value.clear();
+                        eosio::convert_to_bin(block_num, value);
+                        eosio::convert_to_bin(bool(row.present), value);
+                        for (auto& field : table.fields)
+                            fill(value, row.data, *field);
+                        add_row(content_batch, index_batch, table, block_num, row.present, value);
+                        ++num_processed;
+                    }
+                },
+                delta);
         }
     } // receive_deltas
 
-    void receive_traces(rocksdb::WriteBatch& content_batch, rocksdb::WriteBatch& index_batch, uint32_t block_num, input_buffer bin) {
-        auto     num          = read_varuint32(bin);
+    void receive_traces(rocksdb::WriteBatch& content_batch, rocksdb::WriteBatch& index_batch, uint32_t block_num, eosio::input_stream bin) {
+        auto     num          = read_varuint32_bin(bin);
         uint32_t num_ordinals = 0;
         for (uint32_t i = 0; i < num; ++i) {
-            state_history::transaction_trace trace;
-            bin_to_native(trace, bin);
-            if (filter(config->trx_filters, std::get<0>(trace)))
-                write_transaction_trace(
-                    content_batch, index_batch, block_num, num_ordinals, std::get<state_history::transaction_trace_v0>(trace));
+            transaction_trace trace;
+            from_bin(trace, bin);
+            if (filter(config->trx_filters, trace))
+                write_transaction_trace(content_batch, index_batch, block_num, num_ordinals, std::get<transaction_trace_v0>(trace));
         }
     }
 
     void write_transaction_trace(
         rocksdb::WriteBatch& content_batch, rocksdb::WriteBatch& index_batch, uint32_t block_num, uint32_t& num_ordinals,
-        const state_history::transaction_trace_v0& ttrace) {
-        auto* failed = !ttrace.failed_dtrx_trace.empty()
-                           ? &std::get<state_history::transaction_trace_v0>(ttrace.failed_dtrx_trace[0].recurse)
-                           : nullptr;
+        const transaction_trace_v0& ttrace) {
+        auto* failed = !ttrace.failed_dtrx_trace.empty() ? &std::get<transaction_trace_v0>(ttrace.failed_dtrx_trace[0].recurse) : nullptr;
         if (failed) {
-            if (!filter(config->trx_filters, *failed))
+            if (!filter(config->trx_filters, ttrace.failed_dtrx_trace[0].recurse))
                 return;
             write_transaction_trace(content_batch, index_batch, block_num, num_ordinals, *failed);
         }
@@ -675,62 +762,64 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
         kv::append_transaction_trace_key(key, block_num, ttrace.id);
 
         std::vector<char> value;
-        abieos::native_to_bin(block_num, value);
-        abieos::native_to_bin(transaction_ordinal, value);
-        abieos::native_to_bin(failed ? failed->id : abieos::checksum256{}, value);
-        abieos::native_to_bin(ttrace.id, value);
-        abieos::native_to_bin((uint8_t)ttrace.status, value);
-        abieos::native_to_bin(ttrace.cpu_usage_us, value);
-        abieos::native_to_bin(ttrace.net_usage_words, value);
-        abieos::native_to_bin(ttrace.elapsed, value);
-        abieos::native_to_bin(ttrace.net_usage, value);
-        abieos::native_to_bin(ttrace.scheduled, value);
-        abieos::native_to_bin(ttrace.account_ram_delta.has_value(), value);
+        eosio::convert_to_bin(block_num, value);
+        eosio::convert_to_bin(transaction_ordinal, value);
+        eosio::convert_to_bin(failed ? failed->id : eosio::checksum256{}, value);
+        eosio::convert_to_bin(ttrace.id, value);
+        eosio::convert_to_bin((uint8_t)ttrace.status, value);
+        eosio::convert_to_bin(ttrace.cpu_usage_us, value);
+        eosio::convert_to_bin(ttrace.net_usage_words, value);
+        eosio::convert_to_bin(ttrace.elapsed, value);
+        eosio::convert_to_bin(ttrace.net_usage, value);
+        eosio::convert_to_bin(ttrace.scheduled, value);
+        eosio::convert_to_bin(ttrace.account_ram_delta.has_value(), value);
         if (ttrace.account_ram_delta) {
-            abieos::native_to_bin(ttrace.account_ram_delta->account, value);
-            abieos::native_to_bin(ttrace.account_ram_delta->delta, value);
+            eosio::convert_to_bin(ttrace.account_ram_delta->account, value);
+            eosio::convert_to_bin(ttrace.account_ram_delta->delta, value);
         }
-        abieos::native_to_bin(ttrace.except ? *ttrace.except : "", value);
-        abieos::native_to_bin(ttrace.error_code ? *ttrace.error_code : 0, value);
+        eosio::convert_to_bin(ttrace.except ? *ttrace.except : std::string(), value);
+        eosio::convert_to_bin(ttrace.error_code ? *ttrace.error_code : uint64_t(0), value);
 
         // rdb::put(batch, key, value); // todo: indexes, including trim
 
         for (auto& atrace : ttrace.action_traces)
-            write_action_trace(content_batch, index_batch, block_num, ttrace, std::get<state_history::action_trace_v0>(atrace), value);
+            std::visit(
+                [&](auto& atrace) { write_action_trace(content_batch, index_batch, block_num, ttrace, atrace, value); }, atrace);
     }
 
+    template <typename ActionTrace>
     void write_action_trace(
-        rocksdb::WriteBatch& content_batch, rocksdb::WriteBatch& index_batch, uint32_t block_num,
-        const state_history::transaction_trace_v0& ttrace, const state_history::action_trace_v0& atrace, std::vector<char>& value) {
+        rocksdb::WriteBatch& content_batch, rocksdb::WriteBatch& index_batch, uint32_t block_num, const transaction_trace_v0& ttrace,
+        const ActionTrace& atrace, std::vector<char>& value) {
         value.clear();
 
-        abieos::native_to_bin(block_num, value);
-        abieos::native_to_bin(ttrace.id, value);
-        abieos::native_to_bin((uint8_t)ttrace.status, value);
-        abieos::native_to_bin(atrace.action_ordinal, value);
-        abieos::native_to_bin(atrace.creator_action_ordinal, value);
-        abieos::native_to_bin(atrace.receipt.has_value(), value);
+        eosio::convert_to_bin(block_num, value);
+        eosio::convert_to_bin(ttrace.id, value);
+        eosio::convert_to_bin((uint8_t)ttrace.status, value);
+        eosio::convert_to_bin(atrace.action_ordinal, value);
+        eosio::convert_to_bin(atrace.creator_action_ordinal, value);
+        eosio::convert_to_bin(atrace.receipt.has_value(), value);
         if (atrace.receipt) {
-            auto& receipt = std::get<state_history::action_receipt_v0>(*atrace.receipt);
-            abieos::native_to_bin(receipt.receiver, value);
-            abieos::native_to_bin(receipt.act_digest, value);
-            abieos::native_to_bin(receipt.global_sequence, value);
-            abieos::native_to_bin(receipt.recv_sequence, value);
-            abieos::native_to_bin(receipt.code_sequence, value);
-            abieos::native_to_bin(receipt.abi_sequence, value);
+            auto& receipt = std::get<action_receipt_v0>(*atrace.receipt);
+            eosio::convert_to_bin(receipt.receiver, value);
+            eosio::convert_to_bin(receipt.act_digest, value);
+            eosio::convert_to_bin(receipt.global_sequence, value);
+            eosio::convert_to_bin(receipt.recv_sequence, value);
+            eosio::convert_to_bin(receipt.code_sequence, value);
+            eosio::convert_to_bin(receipt.abi_sequence, value);
         }
-        abieos::native_to_bin(atrace.receiver, value);
-        abieos::native_to_bin(atrace.act.account, value);
-        abieos::native_to_bin(atrace.act.name, value);
-        abieos::native_to_bin(atrace.act.data, value);
-        abieos::native_to_bin(atrace.context_free, value);
-        abieos::native_to_bin(atrace.elapsed, value);
-        abieos::native_to_bin(atrace.console, value);
-        abieos::native_to_bin(atrace.except ? *atrace.except : "", value);
-        abieos::native_to_bin(atrace.error_code ? *atrace.error_code : 0, value);
-
-        abieos::native_to_bin(atrace.console, value);
-        abieos::native_to_bin(atrace.except ? *atrace.except : std::string(), value);
+        eosio::convert_to_bin(atrace.receiver, value);
+        eosio::convert_to_bin(atrace.act.account, value);
+        eosio::convert_to_bin(atrace.act.name, value);
+        eosio::convert_to_bin(atrace.act.data, value);
+        eosio::convert_to_bin(atrace.context_free, value);
+        eosio::convert_to_bin(atrace.elapsed, value);
+        eosio::convert_to_bin(atrace.console, value);
+        eosio::convert_to_bin(atrace.except ? *atrace.except : std::string(), value);
+        eosio::convert_to_bin(atrace.error_code ? *atrace.error_code : uint64_t(0), value);
+
+        eosio::convert_to_bin(atrace.console, value);
+        eosio::convert_to_bin(atrace.except ? *atrace.except : std::string(), value);
 
         add_row(content_batch, index_batch, get_table("action_trace"), block_num, true, value);
 
@@ -739,29 +828,75 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
         // todo: account_ram_deltas
     }
 
+    /// Trims up to trim_chunk blocks per call, so a large trim is spread over several commits and its batch and trim_keys stay
+    /// bounded
+    /// Lets compactions drop the rows trim() skips. Sessions are short-lived, so trim() passes the previous first: a query
+    /// which read that fill.status can still see the rows it promises.
+    void set_compaction_trim(uint32_t watermark) {
+        if (!config->enable_trim || !config->trim_compaction)
+            return;
+        auto trim   = std::make_shared<rdb::compaction_trim>();
+        trim->first = watermark;
+        for (auto& table : rocksdb_inst->query_config->tables)
+            if (!table.trim_index_obj && table.short_name != "fill.status"_n)
+                trim->tables.insert(table.short_name);
+        rocksdb_inst->database.trim_state->set(std::move(trim));
+    }
+
     void trim() {
         auto end_trim = std::min(head, irreversible);
         if (first >= end_trim)
             return;
-        rocksdb_inst->database.flush(true, true);
+        if (config->trim_chunk)
+            end_trim = std::min(end_trim, first + config->trim_chunk);
         rocksdb::WriteBatch batch;
         ilog("trim: ${b} - ${e}", ("b", first)("e", end_trim));
 
         uint64_t                    num_rows    = 0;
         uint64_t                    num_indexes = 0;
+        uint64_t                    num_ranges  = 0;
         std::set<std::vector<char>> trim_keys;
 
+        // Consecutive rows which have no index entries to remove are erased with one DeleteRange. run holds the keys of a short
+        // run; once it reaches min_delete_range, only its first and last keys.
+        static constexpr size_t        min_delete_range = 64;
+        std::vector<std::vector<char>> run;
+        uint64_t                       run_rows = 0;
+        auto                           end_run  = [&] {
+            auto* content = rocksdb_inst->database.content();
+            if (run.size() >= min_delete_range) {
+                run.back().push_back(0);
+                batch.DeleteRange(content, rdb::to_slice(run.front()), rdb::to_slice(run.back()));
+                ++num_ranges;
+            } else {
+                for (auto& key : run)
+                    batch.Delete(content, rdb::to_slice(key));
+            }
+            num_rows += run_rows;
+            run.clear();
+            run_rows = 0;
+        };
+
         auto lower_bound = kv::make_table_key(first);
         auto upper_bound = kv::make_table_key(end_trim);
         rdb::for_each(rocksdb_inst->database, lower_bound, upper_bound, [&](auto k, auto v) {
-            uint32_t     block_num;
-            abieos::name table_name;
-            bool         present_k;
-            auto         temp_k = k;
+            uint32_t    block_num;
+            eosio::name table_name;
+            bool        present_k;
+            auto        temp_k = k;
             kv::key_to_native<uint8_t>(temp_k);
             kv::read_table_prefix(temp_k, block_num, table_name, present_k);
 
             auto& table = get_kv_table(table_name);
+            if (!table.trim_index_obj && block_num < end_trim && table.indexes.empty() && !config->trim_compaction) {
+                if (run.size() < min_delete_range)
+                    run.emplace_back(k.pos, k.end);
+                else
+                    run.back().assign(k.pos, k.end);
+                ++run_rows;
+                return true;
+            }
+            end_run();
             if (table.trim_index_obj && block_num > first) {
                 std::vector<char>                    index_key;
                 std::vector<std::optional<uint32_t>> positions;
@@ -770,16 +905,17 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
                 kv::append_index_key(index_key, table_name, table.trim_index_obj->short_name);
                 kv::extract_keys(index_key, v, table.trim_index_obj->sort_keys, positions);
                 trim_keys.insert(std::move(index_key));
-            } else if (!table.trim_index_obj && block_num < end_trim) {
+            } else if (!table.trim_index_obj && block_num < end_trim && !config->trim_compaction) {
                 remove_row(batch, batch, k, v, &num_rows, &num_indexes);
             }
             return true;
         });
+        end_run();
 
         for (auto& range : trim_keys) {
-            abieos::name         table_name;
-            abieos::name         index_name;
-            abieos::input_buffer rk{range.data(), range.data() + range.size()};
+            eosio::name         table_name;
+            eosio::name         index_name;
+            eosio::input_stream rk{range.data(), range.data() + range.size()};
             kv::key_to_native<uint8_t>(rk);
             kv::read_index_prefix(rk, table_name, index_name);
             auto& table = get_kv_table(table_name);
@@ -796,20 +932,26 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
 
                 if (prev_block <= end_trim) {
                     auto pk = extract_pk(k, table, block, present_k, positions);
-                    remove_row(batch, batch, {pk.data(), pk.data() + pk.size()}, &num_rows, &num_indexes);
+                    remove_row(batch, batch, eosio::input_stream{pk}, &num_rows, &num_indexes);
                 }
                 prev_block = block;
                 return true;
             });
         }
 
-        ilog("trim: removed ${r} rows and ${d} index entries", ("r", num_rows)("d", num_indexes));
+        ilog("trim: removed ${r} rows (${n} ranges) and ${d} index entries", ("r", num_rows)("n", num_ranges)("d", num_indexes));
+        set_compaction_trim(first);
         first = end_trim;
         write_fill_status(batch);
         write(rocksdb_inst->database, batch);
     }
 
-    const abi_type& get_type(const std::string& name) { return connection->get_type(name); }
+    const eosio::abi_type& get_type(const std::string& name) {
+        auto it = abi.abi_types.find(name);
+        if (it == abi.abi_types.end())
+            throw std::runtime_error("Unable to find " + name + " in the received abi");
+        return it->second;
+    }
 
     void closed(bool retry) override {
         if (my) {
@@ -819,7 +961,7 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
         }
     }
 
-    ~flm_session() {}
+    ~flm_session() { pipeline.reset(); }
 }; // flm_session
 
 static abstract_plugin& _fill_rocksdb_plugin = app().register_plugin<fill_rocksdb_plugin>();
@@ -842,6 +984,13 @@ fill_rocksdb_plugin::~fill_rocksdb_plugin() {}
 void fill_rocksdb_plugin::set_program_options(options_description& cli, options_description& cfg) {
     auto clop = cli.add_options();
     clop("frdb-check", "Check database");
+    clop("frdb-trim-compaction", "With --fill-trim, let compactions drop rows of tables without a trim index instead of deleting them");
+    clop("frdb-bulk-ingest", "While catching up, write blocks as sorted SST files and ingest them instead of going through the memtable");
+    auto op = cfg.add_options();
+    op("frdb-trim-chunk", bpo::value<uint32_t>()->default_value(10000), "Trim history [arg] blocks at a time (0 trims it at once)");
+    op("frdb-threads", bpo::value<uint32_t>()->default_value(0),
+       "Number of threads decoding blocks and building index keys ahead of the database writer while catching up; 0 decodes on the "
+       "main thread");
 }
 
 void fill_rocksdb_plugin::plugin_initialize(const variables_map& options) {
@@ -859,6 +1008,14 @@ void fill_rocksdb_plugin::plugin_initialize(const variables_map& options) {
         my->config->trx_filters  = fill_plugin::get_trx_filters(options);
         my->config->enable_trim  = options.count("fill-trim");
         my->config->enable_check = options.count("frdb-check");
+        my->config->max_messages_in_flight = options["fill-max-in-flight"].as<uint32_t>();
+        my->config->decode_threads         = options["frdb-threads"].as<uint32_t>();
+        my->config->bulk_ingest            = options.count("frdb-bulk-ingest");
+        my->config->trim_chunk             = options["frdb-trim-chunk"].as<uint32_t>();
+        my->config->trim_compaction        = options.count("frdb-trim-compaction");
+        my->config->replay_file            = options.count("fill-replay") ? options["fill-replay"].as<std::string>() : "";
+        if (options.count("fill-record"))
+            my->recorder = std::make_shared<state_history::capture_writer>(options["fill-record"].as<std::string>());
     }
     FC_LOG_AND_RETHROW()
 }
@@ -0,0 +1,225 @@
+// copyright defined in LICENSE.txt
+
+#pragma once
+#include "abieos_sql_converter.hpp"
+
+#include <array>
+#include <map>
+#include <string>
+#include <string_view>
+
+/// COPY rows of a table, in the format of abieos_sql_converter::begin_row(). They are written at once.
+struct table_rows {
+    std::string data;
+    uint64_t    num_rows = 0;
+};
+
+/// COPY rows of a block, grouped by table
+using table_lines = std::map<std::string, table_rows, std::less<>>;
+
+/// finds a table's rows without building a key unless the table is new to lines
+inline table_rows& rows_of(table_lines& lines, std::string_view table) {
+    auto it = lines.find(table);
+    if (it == lines.end())
+        it = lines.emplace(std::string{table}, table_rows{}).first;
+    return it->second;
+}
+
+/// empties lines, keeping their tables and capacity for the next block
+inline void clear_lines(table_lines& lines) {
+    for (auto& [_, rows] : lines) {
+        rows.data.clear();
+        rows.num_rows = 0;
+    }
+}
+
+/// A column of the action tables by its abi type; fill-pg declares it with the type's sql type, fill-parquet with its Arrow type
+struct trace_column {
+    const char* name;
+    const char* type;
+};
+
+using trace_columns = std::vector<trace_column>;
+
+/// Columns of the action tables which walk_action_traces() produces
+inline const trace_columns action_trace_columns = {
+    {"block_num", "uint32"},
+    {"transaction_ordinal", "int32"},
+    {"action_ordinal", "varuint32"},
+    {"creator_action_ordinal", "varuint32"},
+    {"receipt_receiver", "name"},
+    {"receipt_act_digest", "checksum256"},
+    {"receipt_global_sequence", "uint64"},
+    {"receipt_recv_sequence", "uint64"},
+    {"receipt_code_sequence", "varuint32"},
+    {"receipt_abi_sequence", "varuint32"},
+    {"receiver", "name"},
+    {"act_account", "name"},
+    {"act_name", "name"},
+    {"act_data", "bytes"},
+    {"context_free", "bool"},
+    {"elapsed", "int64"},
+    {"console", "string"},
+    {"except", "string"},
+    {"error_code", "uint64"},
+    {"return_value", "bytes"},
+};
+
+inline const trace_columns action_trace_authorization_columns = {
+    {"block_num", "uint32"}, {"transaction_ordinal", "int32"}, {"action_ordinal", "varuint32"},
+    {"ordinal", "int32"},    {"actor", "name"},                {"permission", "name"},
+};
+
+inline const trace_columns action_trace_ram_delta_columns = {
+    {"block_num", "uint32"}, {"transaction_ordinal", "int32"}, {"action_ordinal", "varuint32"},
+    {"ordinal", "int32"},    {"account", "name"},              {"delta", "int64"},
+};
+
+/// the column list of a create table statement
+inline std::string sql_columns(const abieos_sql_converter& conv, const trace_columns& columns) {
+    std::string result;
+    for (auto& column : columns)
+        result += (result.empty() ? "\"" : ", \"") + std::string(column.name) + "\" " + conv.basic_converters.at(column.type).name;
+    return result;
+}
+
+/// The tables walk_action_traces() writes rows of, and the abi types of the columns it reads from the traces
+enum class action_table : uint8_t { action_trace, authorization, ram_delta };
+enum class action_column : uint8_t { name, checksum256, uint64, varuint32, int64, boolean, string, bytes };
+
+inline constexpr const char* action_column_types[] = {"name", "checksum256", "uint64", "varuint32", "int64", "bool", "string", "bytes"};
+
+/// consumes a column for a sink which doesn't keep its table
+inline void skip_action_column(eosio::input_stream& bin, action_column column) {
+    using namespace state_history;
+    switch (column) {
+    case action_column::checksum256: return skip_bin(bin, 32);
+    case action_column::varuint32: read_varuint32_bin(bin); return;
+    case action_column::boolean: return skip_bin(bin, 1);
+    case action_column::string:
+    case action_column::bytes: return skip_sized_bin(bin);
+    default: return skip_bin(bin, 8);
+    }
+}
+
+/// Walks serialized action traces, whose layout filter_trace_bin() also follows, into rows of action_trace,
+/// action_trace_authorization and action_trace_ram_delta. For each row, sink gets begin_row(table), then the key columns as
+/// key(table, value) and the others as column(table, bin, type) or null(table), then end_row(table, num_columns). A nested
+/// row is written while its action's row is still open.
+template <typename Sink>
+void walk_action_traces(Sink& sink, uint32_t block_num, uint32_t transaction_ordinal, eosio::input_stream bin) {
+    using namespace state_history;
+    constexpr auto actions = action_table::action_trace;
+
+    // rows of the nested arrays start with the key of their action
+    auto begin_nested_row = [&](action_table table, uint32_t action_ordinal, int32_t ordinal) {
+        sink.begin_row(table);
+        sink.key(table, block_num);
+        sink.key(table, int32_t(transaction_ordinal));
+        sink.key(table, action_ordinal);
+        sink.key(table, ordinal);
+    };
+
+    for (auto n = read_varuint32_bin(bin); n; --n) {
+        auto version = read_varuint32_bin(bin);
+        if (version > 1)
+            throw std::runtime_error("unknown action_trace type " + std::to_string(version));
+        sink.begin_row(actions);
+        sink.key(actions, block_num);
+        sink.key(actions, int32_t(transaction_ordinal));
+        auto ordinal_bin    = bin;
+        auto action_ordinal = read_varuint32_bin(ordinal_bin);
+        sink.column(actions, bin, action_column::varuint32); // action_ordinal
+        sink.column(actions, bin, action_column::varuint32); // creator_action_ordinal
+        if (read_bool_bin(bin)) {
+            if (read_varuint32_bin(bin) != 0)
+                throw std::runtime_error("unknown action_receipt type");
+            sink.column(actions, bin, action_column::name);
+            sink.column(actions, bin, action_column::checksum256);
+            sink.column(actions, bin, action_column::uint64); // global_sequence
+            sink.column(actions, bin, action_column::uint64); // recv_sequence
+            skip_sized_bin(bin, 8 + 8);                       // auth_sequence
+            sink.column(actions, bin, action_column::varuint32);
+            sink.column(actions, bin, action_column::varuint32);
+        } else {
+            for (int i = 0; i < 6; ++i)
+                sink.null(actions);
+        }
+        sink.column(actions, bin, action_column::name); // receiver
+        sink.column(actions, bin, action_column::name); // act.account
+        sink.column(actions, bin, action_column::name); // act.name
+        auto num_auths = read_varuint32_bin(bin);
+        for (uint32_t i = 0; i < num_auths; ++i) {
+            begin_nested_row(action_table::authorization, action_ordinal, i);
+            sink.column(action_table::authorization, bin, action_column::name);
+            sink.column(action_table::authorization, bin, action_column::name);
+            sink.end_row(action_table::authorization, 6);
+        }
+        sink.column(actions, bin, action_column::bytes);   // act.data
+        sink.column(actions, bin, action_column::boolean); // context_free
+        sink.column(actions, bin, action_column::int64);   // elapsed
+        sink.column(actions, bin, action_column::string);  // console
+        auto num_deltas = read_varuint32_bin(bin);
+        for (uint32_t i = 0; i < num_deltas; ++i) {
+            begin_nested_row(action_table::ram_delta, action_ordinal, i);
+            sink.column(action_table::ram_delta, bin, action_column::name);
+            sink.column(action_table::ram_delta, bin, action_column::int64);
+            sink.end_row(action_table::ram_delta, 6);
+        }
+        if (read_bool_bin(bin))
+            sink.column(actions, bin, action_column::string); // except
+        else
+            sink.null(actions);
+        if (read_bool_bin(bin))
+            sink.column(actions, bin, action_column::uint64); // error_code
+        else
+            sink.null(actions);
+        if (version == 1)
+            sink.column(actions, bin, action_column::bytes); // return_value
+        else
+            sink.null(actions);
+        sink.end_row(actions, 20);
+    }
+}
+
+/// Writes the rows of walk_action_traces() to lines, in the format of abieos_sql_converter::begin_row()
+struct action_rows_sink {
+    abieos_sql_converter&                                conv;
+    std::array<table_rows*, 3>                           rows;
+    std::array<std::size_t, 3>                           row_begin = {};
+    std::array<const abieos_sql_converter::sql_type*, 8> types;
+
+    action_rows_sink(abieos_sql_converter& conv, table_lines& lines)
+        : conv(conv)
+        , rows{&rows_of(lines, "action_trace"), &rows_of(lines, "action_trace_authorization"), &rows_of(lines, "action_trace_ram_delta")} {
+        for (std::size_t i = 0; i < types.size(); ++i)
+            types[i] = &conv.basic_converters.at(action_column_types[i]);
+    }
+
+    std::string& data(action_table table) { return rows[std::size_t(table)]->data; }
+
+    void begin_row(action_table table) { row_begin[std::size_t(table)] = conv.begin_row(data(table)); }
+
+    template <typename T>
+    void key(action_table table, const T& v) {
+        conv.append_column(data(table), row_begin[std::size_t(table)], v);
+    }
+
+    void column(action_table table, eosio::input_stream& bin, action_column type) {
+        conv.append_column(data(table), row_begin[std::size_t(table)], bin, *types[std::size_t(type)]);
+    }
+
+    void null(action_table table) { conv.append_null_column(data(table), row_begin[std::size_t(table)]); }
+
+    void end_row(action_table table, std::size_t num_columns) {
+        conv.end_row(data(table), row_begin[std::size_t(table)], num_columns);
+        ++rows[std::size_t(table)]->num_rows;
+    }
+};
+
+/// Writes rows of action_trace, action_trace_authorization and action_trace_ram_delta from serialized action traces
+inline void append_action_trace_rows(
+    abieos_sql_converter& conv, table_lines& lines, uint32_t block_num, uint32_t transaction_ordinal, eosio::input_stream bin) {
+    action_rows_sink sink{conv, lines};
+    walk_action_traces(sink, block_num, transaction_ordinal, bin);
+}
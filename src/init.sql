@@ -69,6 +69,15 @@
             "present" desc
         );
 
+        create index if not exists contract_index64_code_table_scope_pk_block_prese_idx on chain.contract_index64(
+            "code",
+            "table",
+            "scope",
+            "primary_key",
+            "block_num" desc,
+            "present" desc
+        );
+
         create index if not exists contract_index64_code_table_scope_sk_pk_block_num_prese_idx on chain.contract_index64(
             "code",
             "table",
@@ -1903,6 +1912,21 @@
                             contract_index64."present" desc
                         limit 1
                     loop
+                        if exists (
+                            select 1
+                            from
+                                chain.contract_index64
+                            where
+                                contract_index64."code" = block_search."code"
+                                and contract_index64."scope" = block_search."scope"
+                                and contract_index64."table" = block_search."table"
+                                and contract_index64."primary_key" = block_search."primary_key"
+                                and contract_index64.block_num > block_search.block_num
+                                and contract_index64.block_num <= snapshot_block_num
+                        ) then
+                            found_block = true;
+                            exit;
+                        end if;
                         if block_search.present then
                             
                             found_join_block = false;
@@ -2051,6 +2075,21 @@
                                 contract_index64."present" desc
                             limit 1
                         loop
+                            if exists (
+                                select 1
+                                from
+                                    chain.contract_index64
+                                where
+                                    contract_index64."code" = block_search."code"
+                                    and contract_index64."scope" = block_search."scope"
+                                    and contract_index64."table" = block_search."table"
+                                    and contract_index64."primary_key" = block_search."primary_key"
+                                    and contract_index64.block_num > block_search.block_num
+                                    and contract_index64.block_num <= snapshot_block_num
+                            ) then
+                                found_block = true;
+                                exit;
+                            end if;
                             if block_search.present then
                                 
                                 found_join_block = false;
@@ -18,6 +18,10 @@
 #include "wasm_ql_pg_plugin.hpp"
 #endif
 
+#ifdef INCLUDE_FILL_PARQUET_PLUGIN
+#include "fill_parquet_plugin.hpp"
+#endif
+
 #ifdef INCLUDE_FILL_ROCKSDB_PLUGIN
 #include "fill_rocksdb_plugin.hpp"
 #endif
@@ -0,0 +1,166 @@
+// copyright defined in LICENSE.txt
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+/// Counters, gauges and histograms in the Prometheus text format; metrics_plugin serves them. Metrics are created once by
+/// name and labels and live as long as the process, so hot paths look them up once and keep the reference. Updates are
+/// relaxed atomics.
+namespace metrics {
+
+struct metric {
+    virtual ~metric() = default;
+    virtual void render(std::string& out, const std::string& name, const std::string& labels) const = 0;
+};
+
+inline void render_sample(std::string& out, const std::string& name, const std::string& labels, const std::string& value) {
+    out += name;
+    if (!labels.empty())
+        out += "{" + labels + "}";
+    out += " " + value + "\n";
+}
+
+struct counter : metric {
+    std::atomic<uint64_t> value = 0;
+
+    void add(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+
+    void render(std::string& out, const std::string& name, const std::string& labels) const override {
+        render_sample(out, name, labels, std::to_string(value.load(std::memory_order_relaxed)));
+    }
+};
+
+struct gauge : metric {
+    std::atomic<int64_t> value = 0;
+
+    void set(int64_t v) { value.store(v, std::memory_order_relaxed); }
+    void add(int64_t n) { value.fetch_add(n, std::memory_order_relaxed); }
+
+    void render(std::string& out, const std::string& name, const std::string& labels) const override {
+        render_sample(out, name, labels, std::to_string(value.load(std::memory_order_relaxed)));
+    }
+};
+
+/// Durations in seconds, over fixed buckets from 100us to 60s
+struct histogram : metric {
+    static constexpr std::array<double, 16> bounds = {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025,
+                                                      0.05,   0.1,     0.25,   0.5,   1,      2.5,   10,   60};
+
+    std::array<std::atomic<uint64_t>, bounds.size() + 1> buckets = {}; // the last one counts samples above every bound
+    std::atomic<uint64_t>                                sum_ns  = 0;
+
+    void observe(std::chrono::steady_clock::duration d) {
+        double seconds = std::chrono::duration<double>(d).count();
+        size_t i       = 0;
+        while (i < bounds.size() && seconds > bounds[i])
+            ++i;
+        buckets[i].fetch_add(1, std::memory_order_relaxed);
+        sum_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count(), std::memory_order_relaxed);
+    }
+
+    void render(std::string& out, const std::string& name, const std::string& labels) const override {
+        auto     prefix     = labels.empty() ? std::string{} : labels + ",";
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < bounds.size(); ++i) {
+            cumulative += buckets[i].load(std::memory_order_relaxed);
+            auto le = std::to_string(bounds[i]);
+            le.erase(le.find_last_not_of('0') + 1);
+            if (le.back() == '.')
+                le.pop_back();
+            render_sample(out, name + "_bucket", prefix + "le=\"" + le + "\"", std::to_string(cumulative));
+        }
+        cumulative += buckets[bounds.size()].load(std::memory_order_relaxed);
+        render_sample(out, name + "_bucket", prefix + "le=\"+Inf\"", std::to_string(cumulative));
+        render_sample(out, name + "_sum", labels, std::to_string(sum_ns.load(std::memory_order_relaxed) / 1e9));
+        render_sample(out, name + "_count", labels, std::to_string(cumulative));
+    }
+};
+
+/// observes the time until it's destroyed
+class scoped_timer {
+    histogram&                                  h;
+    std::chrono::steady_clock::time_point const start = std::chrono::steady_clock::now();
+
+  public:
+    explicit scoped_timer(histogram& h)
+        : h(h) {}
+    scoped_timer(const scoped_timer&) = delete;
+    ~scoped_timer() { h.observe(std::chrono::steady_clock::now() - start); }
+};
+
+class registry {
+    struct family {
+        std::string                                    type = {};
+        std::string                                    help = {};
+        std::map<std::string, std::unique_ptr<metric>> by_labels;
+    };
+
+    std::mutex                    mutex;
+    std::map<std::string, family> families;
+
+    template <typename T>
+    T& get(const char* type, const std::string& name, const std::string& help, const std::string& labels) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto&                       f = families[name];
+        if (f.type.empty()) {
+            f.type = type;
+            f.help = help;
+        } else if (f.type != type) {
+            throw std::runtime_error("metric " + name + " is already a " + f.type);
+        }
+        auto& m = f.by_labels[labels];
+        if (!m)
+            m = std::make_unique<T>();
+        return static_cast<T&>(*m);
+    }
+
+  public:
+    /// labels are in the exposition syntax, e.g. `table="block_info"`
+    counter& get_counter(const std::string& name, const std::string& help, const std::string& labels = {}) {
+        return get<counter>("counter", name, help, labels);
+    }
+    gauge& get_gauge(const std::string& name, const std::string& help, const std::string& labels = {}) {
+        return get<gauge>("gauge", name, help, labels);
+    }
+    histogram& get_histogram(const std::string& name, const std::string& help, const std::string& labels = {}) {
+        return get<histogram>("histogram", name, help, labels);
+    }
+
+    std::string render() {
+        std::string                 out;
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& [name, f] : families) {
+            out += "# HELP " + name + " " + f.help + "\n";
+            out += "# TYPE " + name + " " + f.type + "\n";
+            for (auto& [labels, m] : f.by_labels)
+                m->render(out, name, labels);
+        }
+        return out;
+    }
+};
+
+inline registry& get() {
+    static registry r;
+    return r;
+}
+
+inline counter& get_counter(const std::string& name, const std::string& help, const std::string& labels = {}) {
+    return get().get_counter(name, help, labels);
+}
+inline gauge& get_gauge(const std::string& name, const std::string& help, const std::string& labels = {}) {
+    return get().get_gauge(name, help, labels);
+}
+inline histogram& get_histogram(const std::string& name, const std::string& help, const std::string& labels = {}) {
+    return get().get_histogram(name, help, labels);
+}
+
+} // namespace metrics
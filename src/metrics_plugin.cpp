@@ -0,0 +1,123 @@
+// copyright defined in LICENSE.txt
+
+#include "metrics_plugin.hpp"
+#include "metrics.hpp"
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/version.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/log/logger.hpp>
+
+#include <thread>
+
+using namespace appbase;
+using namespace std::literals;
+
+namespace beast = boost::beast;
+namespace http  = beast::http;
+namespace net   = boost::asio;
+using tcp       = net::ip::tcp;
+
+static abstract_plugin& _metrics_plugin = app().register_plugin<metrics_plugin>();
+
+/// One request per connection; scrapes are rare and small, so this runs on a thread of its own instead of the app's
+struct metrics_session : std::enable_shared_from_this<metrics_session> {
+    beast::tcp_stream                 stream;
+    beast::flat_buffer                buffer;
+    http::request<http::empty_body>   req;
+    http::response<http::string_body> res;
+
+    explicit metrics_session(tcp::socket&& socket)
+        : stream(std::move(socket)) {}
+
+    void start() {
+        stream.expires_after(10s);
+        http::async_read(stream, buffer, req, [self = shared_from_this()](beast::error_code ec, std::size_t) {
+            if (!ec)
+                self->reply();
+        });
+    }
+
+    void reply() {
+        res.version(req.version());
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.keep_alive(false);
+        if (req.method() != http::verb::get || req.target() != "/metrics") {
+            res.result(http::status::not_found);
+            res.set(http::field::content_type, "text/plain");
+            res.body() = "The resource '" + req.target().to_string() + "' was not found.\n";
+        } else {
+            res.result(http::status::ok);
+            res.set(http::field::content_type, "text/plain; version=0.0.4");
+            res.body() = metrics::get().render();
+        }
+        res.prepare_payload();
+        http::async_write(stream, res, [self = shared_from_this()](beast::error_code ec, std::size_t) {
+            self->stream.socket().shutdown(tcp::socket::shutdown_send, ec);
+        });
+    }
+};
+
+struct metrics_plugin_impl {
+    std::string                    address  = {};
+    std::string                    port     = {};
+    net::io_context                ioc      = {};
+    std::unique_ptr<tcp::acceptor> acceptor = {};
+    std::thread                    thread   = {};
+
+    void start() {
+        tcp::resolver resolver{ioc};
+        auto          endpoint = *resolver.resolve(address, port).begin();
+        acceptor               = std::make_unique<tcp::acceptor>(ioc, endpoint);
+        ilog("metrics at http://${a}:${p}/metrics", ("a", address)("p", port));
+        accept();
+        thread = std::thread([this] { ioc.run(); });
+    }
+
+    void accept() {
+        acceptor->async_accept([this](beast::error_code ec, tcp::socket socket) {
+            if (ec)
+                return;
+            std::make_shared<metrics_session>(std::move(socket))->start();
+            accept();
+        });
+    }
+
+    void stop() {
+        ioc.stop();
+        if (thread.joinable())
+            thread.join();
+    }
+};
+
+metrics_plugin::metrics_plugin()
+    : my(std::make_shared<metrics_plugin_impl>()) {}
+
+metrics_plugin::~metrics_plugin() {}
+
+void metrics_plugin::set_program_options(options_description& cli, options_description& cfg) {
+    auto op = cfg.add_options();
+    op("metrics-listen", bpo::value<std::string>(), "Endpoint to serve metrics on at /metrics (default: disabled)");
+}
+
+void metrics_plugin::plugin_initialize(const variables_map& options) {
+    try {
+        if (!options.count("metrics-listen"))
+            return;
+        auto ip_port = options.at("metrics-listen").as<std::string>();
+        if (ip_port.find(':') == std::string::npos)
+            throw std::runtime_error("invalid --metrics-listen value: " + ip_port);
+        my->address = ip_port.substr(0, ip_port.find(':'));
+        my->port    = ip_port.substr(ip_port.find(':') + 1);
+    }
+    FC_LOG_AND_RETHROW()
+}
+
+void metrics_plugin::plugin_startup() {
+    if (!my->port.empty())
+        my->start();
+}
+
+void metrics_plugin::plugin_shutdown() { my->stop(); }
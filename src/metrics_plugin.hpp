@@ -0,0 +1,21 @@
+// copyright defined in LICENSE.txt
+
+#pragma once
+#include <appbase/application.hpp>
+
+/// Serves the metrics in metrics.hpp over HTTP at --metrics-listen, in the Prometheus text format
+class metrics_plugin : public appbase::plugin<metrics_plugin> {
+  public:
+    APPBASE_PLUGIN_REQUIRES()
+
+    metrics_plugin();
+    virtual ~metrics_plugin();
+
+    virtual void set_program_options(appbase::options_description& cli, appbase::options_description& cfg) override;
+    void         plugin_initialize(const appbase::variables_map& options);
+    void         plugin_startup();
+    void         plugin_shutdown();
+
+  private:
+    std::shared_ptr<struct metrics_plugin_impl> my;
+};
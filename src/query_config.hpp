@@ -16,7 +16,7 @@ struct field {
 };
 
 template <typename Defs, typename F>
-constexpr void for_each_field(field<Defs>*, F f) {
+constexpr void eosio_for_each_field(field<Defs>*, F f) {
     EOSIO_REFLECT_MEMBER(field<Defs>, name);
     EOSIO_REFLECT_MEMBER(field<Defs>, type);
     EOSIO_REFLECT_MEMBER(field<Defs>, begin_optional);
@@ -34,7 +34,7 @@ struct key {
 };
 
 template <typename Defs, typename F>
-constexpr void for_each_field(key<Defs>*, F f) {
+constexpr void eosio_for_each_field(key<Defs>*, F f) {
     EOSIO_REFLECT_MEMBER(key<Defs>, name);
     EOSIO_REFLECT_MEMBER(key<Defs>, join_src_name);
     EOSIO_REFLECT_MEMBER(key<Defs>, join_new_name);
@@ -57,7 +57,7 @@ struct table {
 };
 
 template <typename Defs, typename F>
-constexpr void for_each_field(table<Defs>*, F f) {
+constexpr void eosio_for_each_field(table<Defs>*, F f) {
     EOSIO_REFLECT_MEMBER(table<Defs>, name);
     EOSIO_REFLECT_MEMBER(table<Defs>, short_name);
     EOSIO_REFLECT_MEMBER(table<Defs>, fields);
@@ -79,7 +79,7 @@ struct index {
 };
 
 template <typename Defs, typename F>
-constexpr void for_each_field(index<Defs>*, F f) {
+constexpr void eosio_for_each_field(index<Defs>*, F f) {
     EOSIO_REFLECT_MEMBER(index<Defs>, short_name);
     EOSIO_REFLECT_MEMBER(index<Defs>, index);
     EOSIO_REFLECT_MEMBER(index<Defs>, table);
@@ -109,7 +109,7 @@ struct query {
 };
 
 template <typename Defs, typename F>
-constexpr void for_each_field(query<Defs>*, F f) {
+constexpr void eosio_for_each_field(query<Defs>*, F f) {
     EOSIO_REFLECT_MEMBER(query<Defs>, short_name);
     EOSIO_REFLECT_MEMBER(query<Defs>, index);
     EOSIO_REFLECT_MEMBER(query<Defs>, function);
@@ -249,7 +249,7 @@ struct config {
 };    // config
 
 template <typename Defs, typename F>
-constexpr void for_each_field(config<Defs>*, F f) {
+constexpr void eosio_for_each_field(config<Defs>*, F f) {
     EOSIO_REFLECT_MEMBER(config<Defs>, tables);
     EOSIO_REFLECT_MEMBER(config<Defs>, indexes);
     EOSIO_REFLECT_MEMBER(config<Defs>, queries);
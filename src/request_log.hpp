@@ -0,0 +1,72 @@
+// copyright defined in LICENSE.txt
+
+#pragma once
+
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Query requests recorded by wasm-ql's --wql-request-log, which wasm-ql-load replays. Each record is a line holding the
+/// target and the body's size, then the body and a newline.
+namespace request_log {
+
+struct record {
+    std::string       target;
+    std::vector<char> body;
+};
+
+/// appends records from any thread; each is flushed as it's written, so a log cut short by a crash only loses its last record
+class writer {
+    std::mutex mutex;
+    FILE*      file = nullptr;
+
+  public:
+    explicit writer(const std::string& path)
+        : file(fopen(path.c_str(), "ab")) {
+        if (!file)
+            throw std::runtime_error("can't open request log " + path);
+    }
+    writer(const writer&) = delete;
+    ~writer() { fclose(file); }
+
+    void write(std::string_view target, const std::vector<char>& body) {
+        auto                        header = std::string{target} + " " + std::to_string(body.size()) + "\n";
+        std::lock_guard<std::mutex> lock(mutex);
+        fwrite(header.data(), 1, header.size(), file);
+        fwrite(body.data(), 1, body.size(), file);
+        fputc('\n', file);
+        fflush(file);
+    }
+};
+
+/// reads every complete record of a log; a truncated last record is ignored
+inline std::vector<record> read(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file)
+        throw std::runtime_error("can't open request log " + path);
+    std::vector<record> result;
+    std::string         line;
+    while (true) {
+        line.clear();
+        int c;
+        while ((c = fgetc(file)) != EOF && c != '\n')
+            line += char(c);
+        if (c == EOF)
+            break;
+        auto space = line.rfind(' ');
+        if (space == std::string::npos)
+            throw std::runtime_error("bad record in request log " + path);
+        record r{line.substr(0, space)};
+        r.body.resize(std::stoull(line.substr(space + 1)));
+        if (fread(r.body.data(), 1, r.body.size(), file) != r.body.size() || fgetc(file) != '\n')
+            break;
+        result.push_back(std::move(r));
+    }
+    fclose(file);
+    return result;
+}
+
+} // namespace request_log
@@ -0,0 +1,86 @@
+// copyright defined in LICENSE.txt
+
+#pragma once
+
+#include "metrics.hpp"
+
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace wasm_ql {
+
+/// Whether a reply may be cached: every query read at or below irreversible, and the wasm didn't see the status, which it
+/// may have used to pick blocks relative to head
+inline bool is_immutable_reply(bool read_status, uint32_t newest_block_read, uint32_t irreversible) {
+    return !read_status && newest_block_read <= irreversible;
+}
+
+/// Replies to requests which depend only on the request and on irreversible blocks, keyed by target and body and evicted
+/// least recently used first. Trimming history removes what these were computed from, so a change to fill_status.first
+/// empties the cache.
+class response_cache {
+  private:
+    using entry_list = std::list<std::pair<std::string, std::vector<char>>>;
+
+    std::mutex                                                 mutex;
+    uint32_t                                                   max_entries;
+    uint32_t                                                   first = 0;
+    entry_list                                                 entries; // most recently used first
+    std::unordered_map<std::string_view, entry_list::iterator> index;
+
+  public:
+    response_cache(uint32_t max_entries)
+        : max_entries(max_entries) {}
+
+    static std::string make_key(std::string_view target, const std::vector<char>& body) {
+        std::string key{target};
+        key += '\0';
+        key.append(body.data(), body.size());
+        return key;
+    }
+
+    // query threads contend for the cache; the wait is observed by wasmql_cache_lock_wait_seconds
+    std::unique_lock<std::mutex> lock() {
+        static auto& wait =
+            metrics::get_histogram("wasmql_cache_lock_wait_seconds", "Time query threads waited for the response cache's lock");
+        auto                         start = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock{mutex};
+        wait.observe(std::chrono::steady_clock::now() - start);
+        return lock;
+    }
+
+    std::optional<std::vector<char>> get(const std::string& key) {
+        auto lock = this->lock();
+        auto it   = index.find(key);
+        if (it == index.end())
+            return {};
+        entries.splice(entries.begin(), entries, it->second);
+        return it->second->second;
+    }
+
+    /// keeps reply if immutable; first is fill_status.first as the request saw it
+    void update(std::string key, const std::vector<char>& reply, uint32_t first, bool immutable) {
+        auto lock = this->lock();
+        if (first != this->first) {
+            index.clear();
+            entries.clear();
+            this->first = first;
+        }
+        if (!immutable || index.count(key))
+            return;
+        entries.emplace_front(std::move(key), reply);
+        index[entries.front().first] = entries.begin();
+        while (entries.size() > max_entries) {
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+};
+
+} // namespace wasm_ql
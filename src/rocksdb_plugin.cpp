@@ -3,18 +3,37 @@
 #include "rocksdb_plugin.hpp"
 #include "util.hpp"
 
+#include <boost/asio/steady_timer.hpp>
 #include <fc/exception/exception.hpp>
 
 using namespace appbase;
 using namespace std::literals;
 
 struct rocksdb_plugin_impl {
-    boost::filesystem::path         config_path    = {};
-    boost::filesystem::path         db_path        = {};
-    std::optional<uint32_t>         threads        = {};
-    std::optional<uint32_t>         max_open_files = {};
-    std::shared_ptr<::rocksdb_inst> rocksdb_inst   = {};
-    std::mutex                      mutex          = {};
+    boost::filesystem::path                    config_path    = {};
+    boost::filesystem::path                    db_path        = {};
+    std::optional<uint32_t>                    threads        = {};
+    std::optional<uint32_t>                    max_open_files = {};
+    std::optional<std::string>                 secondary_path = {};
+    uint32_t                                   catch_up_ms    = 1000;
+    bool                                       mmap_reads     = false;
+    std::shared_ptr<::rocksdb_inst>            rocksdb_inst   = {};
+    std::mutex                                 mutex          = {};
+    std::unique_ptr<boost::asio::steady_timer> catch_up_timer = {};
+
+    void schedule_catch_up() {
+        catch_up_timer->expires_after(std::chrono::milliseconds(catch_up_ms));
+        catch_up_timer->async_wait([this](const boost::system::error_code& ec) {
+            if (ec)
+                return;
+            try {
+                rocksdb_inst->database.catch_up();
+            } catch (const std::exception& e) {
+                elog("${e}", ("e", e.what()));
+            }
+            schedule_catch_up();
+        });
+    }
 };
 
 static abstract_plugin& _rocksdb_plugin = app().register_plugin<rocksdb_plugin>();
@@ -33,6 +52,11 @@ void rocksdb_plugin::set_program_options(options_description& cli, options_descr
     op("rdb-max-files", bpo::value<uint32_t>(),
        "RocksDB limit max number of open files (default unlimited). This should be smaller than 'ulimit -n #'. "
        "# should be a very large number for full-history nodes.");
+    op("rdb-secondary", bpo::value<std::string>(),
+       "Open the database read-only, as a secondary instance which keeps its own files in this path and follows the filler "
+       "writing the primary. Only used with wasm_ql_rocksdb_plugin.");
+    op("rdb-catch-up-ms", bpo::value<uint32_t>()->default_value(1000), "With rdb-secondary, catch up with the primary this often");
+    op("rdb-mmap-reads", bpo::bool_switch(), "Read SST files through mmap");
 }
 
 void rocksdb_plugin::plugin_initialize(const variables_map& options) {
@@ -43,19 +67,28 @@ void rocksdb_plugin::plugin_initialize(const variables_map& options) {
             my->threads = options["rdb-threads"].as<uint32_t>();
         if (!options["rdb-max-files"].empty())
             my->max_open_files = options["rdb-max-files"].as<uint32_t>();
+        if (!options["rdb-secondary"].empty())
+            my->secondary_path = options["rdb-secondary"].as<std::string>();
+        my->catch_up_ms = options["rdb-catch-up-ms"].as<uint32_t>();
+        my->mmap_reads  = options["rdb-mmap-reads"].as<bool>();
     }
     FC_LOG_AND_RETHROW()
 }
 
 void rocksdb_plugin::plugin_startup() {}
 
-void rocksdb_plugin::plugin_shutdown() {}
+void rocksdb_plugin::plugin_shutdown() {
+    if (my->catch_up_timer)
+        my->catch_up_timer->cancel();
+}
 
 static void open_query_config(rocksdb_plugin_impl* my, std::shared_ptr<rocksdb_inst>& inst) {
     try {
         ilog("using query config ${qc}", ("qc", my->config_path.c_str()));
         auto query_config = std::make_unique<state_history::kv::config>();
-        abieos::json_to_native(*query_config, read_string(my->config_path.c_str()));
+        auto x            = read_string(my->config_path.c_str());
+        auto is           = eosio::json_token_stream{x.data()};
+        from_json(*query_config, is);
         query_config->prepare(state_history::kv::abi_type_to_kv_type);
         inst->query_config = std::move(query_config);
     } catch (const std::exception& e) {
@@ -67,8 +100,16 @@ static void open_query_config(rocksdb_plugin_impl* my, std::shared_ptr<rocksdb_i
 std::shared_ptr<rocksdb_inst> rocksdb_plugin::get_rocksdb_inst(bool fast_reads) {
     std::lock_guard<std::mutex> lock(my->mutex);
     if (!my->rocksdb_inst) {
-        my->rocksdb_inst = std::make_shared<rocksdb_inst>(my->db_path.c_str(), my->threads, my->max_open_files, fast_reads);
+        if (my->secondary_path && !fast_reads)
+            throw std::runtime_error("rdb-secondary opens the database read-only; it can't be used by a filler");
+        my->rocksdb_inst = std::make_shared<rocksdb_inst>(
+            my->db_path.c_str(), my->threads, my->max_open_files, fast_reads, my->secondary_path ? my->secondary_path->c_str() : nullptr,
+            my->mmap_reads);
         open_query_config(my.get(), my->rocksdb_inst);
+        if (my->secondary_path) {
+            my->catch_up_timer = std::make_unique<boost::asio::steady_timer>(app().get_io_service());
+            my->schedule_catch_up();
+        }
     }
     return my->rocksdb_inst;
 }
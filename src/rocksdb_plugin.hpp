@@ -10,8 +10,10 @@ struct rocksdb_inst {
     state_history::rdb::database                     database;
     std::unique_ptr<const state_history::kv::config> query_config{};
 
-    rocksdb_inst(const char* db_path, std::optional<uint32_t> threads, std::optional<uint32_t> max_open_files, bool fast_reads)
-        : database{db_path, threads, max_open_files, fast_reads} {}
+    rocksdb_inst(
+        const char* db_path, std::optional<uint32_t> threads, std::optional<uint32_t> max_open_files, bool fast_reads,
+        const char* secondary_path, bool mmap_reads)
+        : database{db_path, threads, max_open_files, fast_reads, secondary_path, mmap_reads} {}
 };
 
 class rocksdb_plugin : public appbase::plugin<rocksdb_plugin> {
@@ -3,6 +3,9 @@
 #pragma once
 #include <eosio/ship_protocol.hpp>
 #include <eosio/abi.hpp>
+#include <array>
+#include <cstring>
+#include <unordered_map>
 namespace eosio { namespace ship_protocol {
     enum class transaction_status : uint8_t;
 }}
@@ -112,6 +115,29 @@ inline bool matches(const trx_filter& filter, const eosio::ship_protocol::transa
     return true;
 }
 
+inline bool matches(
+    const trx_filter& filter, const eosio::ship_protocol::transaction_status status, eosio::name receiver, eosio::name act_account,
+    eosio::name act_name) {
+    if (filter.status && status != *filter.status)
+        return false;
+    if (filter.receiver && receiver != *filter.receiver)
+        return false;
+    if (filter.act_account && act_account != *filter.act_account)
+        return false;
+    if (filter.act_name && act_name != *filter.act_name)
+        return false;
+    return true;
+}
+
+inline bool filter(
+    const std::vector<trx_filter>& filters, const eosio::ship_protocol::transaction_status status, eosio::name receiver,
+    eosio::name act_account, eosio::name act_name) {
+    for (auto& filt : filters)
+        if (matches(filt, status, receiver, act_account, act_name))
+            return filt.include;
+    return false;
+}
+
 inline bool filter(const std::vector<trx_filter>& filters, const eosio::ship_protocol::transaction_status& status, const eosio::ship_protocol::action_trace& atrace) {
     for (auto& filt : filters) {
         if (matches(filt, status, atrace)) {
@@ -124,6 +150,70 @@ inline bool filter(const std::vector<trx_filter>& filters, const eosio::ship_pro
     return false;
 }
 
+/// The trx_filter rules compiled for lookups by receiver, act account and act name. As with filter(), the first rule matching an
+/// action decides. Rules are hashed by the fields they name, once for each combination of wildcards the rules use, so a lookup
+/// probes at most 8 maps however many rules there are.
+class trx_filter_set {
+  public:
+    trx_filter_set() = default;
+
+    trx_filter_set(std::vector<trx_filter> filters)
+        : filters(std::move(filters)) {
+        for (uint32_t i = 0; i < this->filters.size(); ++i) {
+            auto& filt = this->filters[i];
+            auto  mask = (filt.receiver ? 1 : 0) | (filt.act_account ? 2 : 0) | (filt.act_name ? 4 : 0);
+            auto  key  = make_key(
+                mask, filt.receiver.value_or(eosio::name{}), filt.act_account.value_or(eosio::name{}), filt.act_name.value_or(eosio::name{}));
+            if (by_mask[mask].empty())
+                masks.push_back(mask);
+            by_mask[mask][key].push_back({i, filt.status, filt.include});
+        }
+    }
+
+    const std::vector<trx_filter>& rules() const { return filters; }
+
+    bool match(eosio::ship_protocol::transaction_status status, eosio::name receiver, eosio::name act_account, eosio::name act_name) const {
+        const rule* first = nullptr;
+        for (auto mask : masks) {
+            auto it = by_mask[mask].find(make_key(mask, receiver, act_account, act_name));
+            if (it == by_mask[mask].end())
+                continue;
+            for (auto& r : it->second) {
+                if (first && first->index < r.index)
+                    break;
+                if (!r.status || *r.status == status) {
+                    first = &r;
+                    break;
+                }
+            }
+        }
+        return first && first->include;
+    }
+
+  private:
+    using key = std::array<uint64_t, 3>;
+
+    struct rule {
+        uint32_t                                                index   = 0; // position within filters; the lowest one decides
+        std::optional<eosio::ship_protocol::transaction_status> status  = {};
+        bool                                                    include = false;
+    };
+
+    struct key_hash {
+        size_t operator()(const key& k) const {
+            return std::hash<uint64_t>{}(k[0] * 0x9e37'79b9'7f4a'7c15 ^ k[1] * 0xc2b2'ae3d'27d4'eb4f ^ k[2]);
+        }
+    };
+
+    static key make_key(int mask, eosio::name receiver, eosio::name act_account, eosio::name act_name) {
+        return {(mask & 1) ? receiver.value : 0, (mask & 2) ? act_account.value : 0, (mask & 4) ? act_name.value : 0};
+    }
+
+    std::vector<trx_filter>                                             filters;
+    std::array<std::unordered_map<key, std::vector<rule>, key_hash>, 8> by_mask; // indexed by which of the 3 fields are named
+    std::vector<int>                                                    masks;   // of the maps which have rules
+};
+
 inline bool filter(const std::vector<trx_filter>& filters, const eosio::ship_protocol::transaction_trace& trace) {
     auto status = std::visit([](auto&& ttrace) { return ttrace.status; }, trace);
     auto action_traces = std::visit([](auto&& ttrace) { return ttrace.action_traces; }, trace);
@@ -134,4 +224,139 @@ inline bool filter(const std::vector<trx_filter>& filters, const eosio::ship_pro
     return false;
 }
 
+inline void skip_bin(eosio::input_stream& bin, uint64_t size) {
+    if (size > uint64_t(bin.end - bin.pos))
+        throw std::runtime_error("read past end of stream");
+    bin.pos += size;
+}
+
+inline uint32_t read_varuint32_bin(eosio::input_stream& bin) {
+    uint32_t v;
+    eosio::varuint32_from_bin(v, bin);
+    return v;
+}
+
+/// skips bytes, string and other length-prefixed fields; elem_size is the size of a vector's elements
+inline void skip_sized_bin(eosio::input_stream& bin, uint32_t elem_size = 1) { skip_bin(bin, uint64_t(read_varuint32_bin(bin)) * elem_size); }
+
+inline bool read_bool_bin(eosio::input_stream& bin) {
+    skip_bin(bin, 1);
+    return bin.pos[-1];
+}
+
+inline eosio::name read_name_bin(eosio::input_stream& bin) {
+    uint64_t v;
+    skip_bin(bin, sizeof(v));
+    memcpy(&v, bin.pos - sizeof(v), sizeof(v));
+    return eosio::name{v};
+}
+
+inline void skip_signature_bin(eosio::input_stream& bin) {
+    auto index = read_varuint32_bin(bin);
+    if (index > 2)
+        throw std::runtime_error("unknown signature type " + std::to_string(index));
+    skip_bin(bin, 65);
+    if (index == 2) { // webauthn: auth_data, client_json
+        skip_sized_bin(bin);
+        skip_sized_bin(bin);
+    }
+}
+
+inline void skip_partial_transaction_bin(eosio::input_stream& bin) {
+    auto index = read_varuint32_bin(bin);
+    if (index != 0)
+        throw std::runtime_error("unknown partial_transaction type " + std::to_string(index));
+    skip_bin(bin, 4 + 2 + 4); // expiration, ref_block_num, ref_block_prefix
+    read_varuint32_bin(bin);  // max_net_usage_words
+    skip_bin(bin, 1);         // max_cpu_usage_ms
+    read_varuint32_bin(bin);  // delay_sec
+    for (auto n = read_varuint32_bin(bin); n; --n) { // transaction_extensions
+        skip_bin(bin, 2);
+        skip_sized_bin(bin);
+    }
+    for (auto n = read_varuint32_bin(bin); n; --n)
+        skip_signature_bin(bin);
+    for (auto n = read_varuint32_bin(bin); n; --n) // context_free_data
+        skip_sized_bin(bin);
+}
+
+/// where filter_trace_bin() found the parts of a serialized transaction_trace
+struct trace_bin_parts {
+    eosio::input_stream              action_traces; // including their count
+    eosio::input_stream              failed;        // the failed_dtrx_trace, empty if there is none
+    bool                             failed_kept = false; // what filter_trace_bin() returned for failed
+    std::unique_ptr<trace_bin_parts> failed_parts;        // the parts of failed, if there is one
+};
+
+/// Reads one serialized transaction_trace from bin, as from_bin() would, and returns what filter() returns for it. Only the
+/// status and each action's receiver and act account and name are decoded; the rest is skipped without allocating, except
+/// for the parts of a failed_dtrx_trace. Once an action is kept, the others aren't matched.
+inline bool filter_trace_bin(const trx_filter_set& filters, eosio::input_stream& bin, trace_bin_parts& parts) {
+    auto index = read_varuint32_bin(bin);
+    if (index != 0)
+        throw std::runtime_error("unknown transaction_trace type " + std::to_string(index));
+    skip_bin(bin, 32); // id
+    skip_bin(bin, 1);
+    auto status = eosio::ship_protocol::transaction_status(bin.pos[-1]);
+    skip_bin(bin, 4);         // cpu_usage_us
+    read_varuint32_bin(bin);  // net_usage_words
+    skip_bin(bin, 8 + 8 + 1); // elapsed, net_usage, scheduled
+
+    bool result             = false;
+    parts.action_traces.pos = bin.pos;
+    for (auto n = read_varuint32_bin(bin); n; --n) {
+        auto version = read_varuint32_bin(bin);
+        if (version > 1)
+            throw std::runtime_error("unknown action_trace type " + std::to_string(version));
+        read_varuint32_bin(bin);  // action_ordinal
+        read_varuint32_bin(bin);  // creator_action_ordinal
+        if (read_bool_bin(bin)) { // receipt
+            if (read_varuint32_bin(bin) != 0)
+                throw std::runtime_error("unknown action_receipt type");
+            skip_bin(bin, 8 + 32 + 8 + 8); // receiver, act_digest, global_sequence, recv_sequence
+            skip_sized_bin(bin, 8 + 8);    // auth_sequence
+            read_varuint32_bin(bin);       // code_sequence
+            read_varuint32_bin(bin);       // abi_sequence
+        }
+        auto receiver    = read_name_bin(bin);
+        auto act_account = read_name_bin(bin);
+        auto act_name    = read_name_bin(bin);
+        skip_sized_bin(bin, 8 + 8); // authorization
+        skip_sized_bin(bin);        // data
+        skip_bin(bin, 1 + 8);       // context_free, elapsed
+        skip_sized_bin(bin);        // console
+        skip_sized_bin(bin, 8 + 8); // account_ram_deltas
+        if (read_bool_bin(bin))     // except
+            skip_sized_bin(bin);
+        if (read_bool_bin(bin))     // error_code
+            skip_bin(bin, 8);
+        if (version == 1)           // return_value
+            skip_sized_bin(bin);
+        result = result || filters.match(status, receiver, act_account, act_name);
+    }
+    parts.action_traces.end = bin.pos;
+
+    if (read_bool_bin(bin)) // account_ram_delta
+        skip_bin(bin, 8 + 8);
+    if (read_bool_bin(bin)) // except
+        skip_sized_bin(bin);
+    if (read_bool_bin(bin)) // error_code
+        skip_bin(bin, 8);
+    // failed_dtrx_trace is a vector holding at most one trace; like from_bin() users, only its first one is taken
+    parts.failed = {bin.pos, bin.pos};
+    for (uint32_t i = 0, n = read_varuint32_bin(bin); i < n; ++i) {
+        auto begin  = bin.pos;
+        auto nested = std::make_unique<trace_bin_parts>();
+        auto kept   = filter_trace_bin(filters, bin, *nested);
+        if (!i) {
+            parts.failed       = {begin, bin.pos};
+            parts.failed_parts = std::move(nested);
+            parts.failed_kept  = kept;
+        }
+    }
+    if (read_bool_bin(bin)) // partial
+        skip_partial_transaction_bin(bin);
+    return result;
+}
+
 } // namespace state_history
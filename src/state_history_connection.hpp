@@ -2,6 +2,7 @@
 
 #pragma once
 
+#include "metrics.hpp"
 #include "state_history.hpp"
 #include <eosio/check.hpp>
 #include <eosio/ship_protocol.hpp>
@@ -9,17 +10,32 @@
 
 #include <boost/asio/connect.hpp>
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/post.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/websocket.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
 #include <fc/exception/exception.hpp>
 
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
+
 namespace state_history {
 
 struct connection_callbacks {
     virtual ~connection_callbacks() = default;
     virtual void received_abi(eosio::abi&& abi) {}
+    /// Connections with an abi_cache share the abi instead; every connection receiving the same ABI gets the same object
+    virtual void received_abi(const std::shared_ptr<eosio::abi>& abi) {}
     virtual bool received(eosio::ship_protocol::get_status_result_v0& /*status*/) { return true; }
     virtual bool received(eosio::ship_protocol::get_blocks_result_v0& /*result*/) { return true; }
+    /// `buffer` backs the opaque fields of `result`; callbacks which hold on to `result` past the call keep it alive
+    virtual bool received(eosio::ship_protocol::get_blocks_result_v0& result, const std::shared_ptr<boost::beast::flat_buffer>& /*buffer*/) {
+        return received(result);
+    }
 //    virtual bool received(eosio::ship_protocol::get_blocks_result_v1& /*result*/) { return true; }
 //    virtual bool received(eosio::ship_protocol::get_blocks_result_v2& /*result*/) { return true; }
     virtual void closed(bool retry) = 0;
@@ -28,6 +44,168 @@ struct connection_callbacks {
 struct connection_config {
     std::string host;
     std::string port;
+    uint32_t    max_messages_in_flight = 0;     // unacknowledged block results nodeos may send; 0 is unlimited
+    std::string replay_file            = {};    // read a capture made with capture_writer instead of connecting to host:port
+    bool        irreversible_only      = false; // request_blocks() asks for irreversible blocks only
+};
+
+/// Captures hold the messages a state-history endpoint sent: "shipcap1", then each message as a little-endian uint32 size
+/// followed by its bytes. Every connection starts with its ABI, so a capture may hold several. Names ending in ".gz" are
+/// gzip-compressed.
+inline constexpr char capture_magic[8] = {'s', 'h', 'i', 'p', 'c', 'a', 'p', '1'};
+
+inline bool is_gzip_capture(const std::string& path) { return path.size() >= 3 && path.compare(path.size() - 3, 3, ".gz") == 0; }
+
+/// Shared by the connections of a filler; called on the thread running the connections
+struct capture_writer {
+    std::ofstream                       file;
+    boost::iostreams::filtering_ostream out;
+
+    explicit capture_writer(const std::string& path)
+        : file(path, std::ios::binary | std::ios::trunc) {
+        if (!file)
+            throw std::runtime_error("can't create " + path);
+        if (is_gzip_capture(path))
+            out.push(boost::iostreams::gzip_compressor(boost::iostreams::gzip_params(boost::iostreams::gzip::best_speed)));
+        out.push(file);
+        out.write(capture_magic, sizeof(capture_magic));
+    }
+
+    ~capture_writer() {
+        try {
+            out.reset();
+        } catch (...) {
+        }
+    }
+
+    void write(const boost::beast::flat_buffer& message) {
+        auto     data      = message.data();
+        uint32_t size      = data.size();
+        char     prefix[4] = {char(size), char(size >> 8), char(size >> 16), char(size >> 24)};
+        out.write(prefix, sizeof(prefix));
+        out.write((const char*)data.data(), size);
+        if (!out)
+            throw std::runtime_error("can't write capture");
+    }
+};
+
+/// Reads a capture; uncompressed ones are mapped instead of read
+struct capture_reader {
+    boost::iostreams::mapped_file_source map;
+    const char*                          pos = nullptr;
+    const char*                          end = nullptr;
+    std::ifstream                        file;
+    boost::iostreams::filtering_istream  in;
+
+    explicit capture_reader(const std::string& path) {
+        if (is_gzip_capture(path)) {
+            file.open(path, std::ios::binary);
+            if (!file)
+                throw std::runtime_error("can't open " + path);
+            in.push(boost::iostreams::gzip_decompressor());
+            in.push(file);
+        } else {
+            map.open(path);
+            pos = map.data();
+            end = pos + map.size();
+        }
+        char magic[sizeof(capture_magic)];
+        if (!read(magic, sizeof(magic)) || memcmp(magic, capture_magic, sizeof(magic)))
+            throw std::runtime_error(path + " is not a state-history capture");
+    }
+
+    /// reads the next message into buffer; false at the end of the capture
+    bool next(boost::beast::flat_buffer& buffer) {
+        unsigned char prefix[4];
+        if (!read((char*)prefix, sizeof(prefix)))
+            return false;
+        uint32_t size = prefix[0] | (prefix[1] << 8) | (prefix[2] << 16) | (uint32_t(prefix[3]) << 24);
+        auto     dest = buffer.prepare(size);
+        if (!read((char*)dest.data(), size))
+            throw std::runtime_error("capture is truncated");
+        buffer.commit(size);
+        return true;
+    }
+
+  private:
+    bool read(char* dest, std::size_t size) {
+        if (map.is_open()) {
+            if (std::size_t(end - pos) < size)
+                return false;
+            memcpy(dest, pos, size);
+            pos += size;
+            return true;
+        }
+        in.read(dest, size);
+        return std::size_t(in.gcount()) == size;
+    }
+};
+
+/// ABIs parsed by the connections sharing the cache, keyed by a hash of their JSON, so a reconnect to a nodeos with the same
+/// ABI doesn't parse it again
+struct abi_cache {
+    struct entry {
+        std::string                 json;
+        eosio::abi_def              def;
+        std::shared_ptr<eosio::abi> abi;
+        bool                        have_get_blocks_request_v1 = false;
+    };
+
+    std::mutex                                              mutex;
+    std::unordered_map<std::size_t, std::shared_ptr<entry>> entries;
+
+    std::shared_ptr<entry> find(std::string_view json) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto                        it = entries.find(std::hash<std::string_view>{}(json));
+        if (it == entries.end() || it->second->json != json)
+            return nullptr;
+        return it->second;
+    }
+
+    void add(const std::shared_ptr<entry>& e) {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries[std::hash<std::string_view>{}(e->json)] = e;
+    }
+};
+
+/// Receive buffers which are reused once every holder of a message has released it
+struct receive_buffer_pool : std::enable_shared_from_this<receive_buffer_pool> {
+    using flat_buffer = boost::beast::flat_buffer;
+
+    // larger buffers are freed instead of kept around for the next message
+    static constexpr std::size_t max_reused_capacity = 64 * 1024 * 1024;
+
+    std::size_t                               max_free;
+    std::mutex                                mutex;
+    std::vector<std::unique_ptr<flat_buffer>> free;
+
+    explicit receive_buffer_pool(std::size_t max_free)
+        : max_free(max_free) {}
+
+    std::shared_ptr<flat_buffer> get() {
+        std::unique_ptr<flat_buffer> buffer;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!free.empty()) {
+                buffer = std::move(free.back());
+                free.pop_back();
+            }
+        }
+        if (!buffer)
+            buffer = std::make_unique<flat_buffer>();
+        return {buffer.release(), [pool = shared_from_this()](flat_buffer* b) { pool->put(std::unique_ptr<flat_buffer>{b}); }};
+    }
+
+  private:
+    // called from whichever thread releases the buffer last
+    void put(std::unique_ptr<flat_buffer> buffer) {
+        if (buffer->capacity() > max_reused_capacity)
+            return;
+        buffer->clear();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (free.size() < max_free)
+            free.push_back(std::move(buffer));
+    }
 };
 
 struct connection : std::enable_shared_from_this<connection> {
@@ -41,24 +219,40 @@ struct connection : std::enable_shared_from_this<connection> {
 
     connection_config                            config;
     std::shared_ptr<connection_callbacks>        callbacks;
+    boost::asio::io_context&                     ioc;
     tcp::resolver                                resolver;
     boost::beast::websocket::stream<tcp::socket> stream;
     bool                                         have_abi  = false;
     bool                                         have_get_blocks_request_v1 = false;
     abi_def                                      abi                       = {};
     std::map<std::string, abi_type>              abi_types{};
+    std::shared_ptr<receive_buffer_pool>         buffers;
+    uint32_t                                     unacked = 0; // block results consumed but not acknowledged yet
+    std::shared_ptr<abi_cache>                   abis;        // optional
+    std::shared_ptr<capture_writer>              recorder;    // optional; receives every message read from nodeos
+
+    // replaying config.replay_file
+    std::unique_ptr<capture_reader> replay;
+    uint32_t                        replay_start     = 0;
+    uint32_t                        replay_end       = 0;
+    uint32_t                        replay_in_flight = 0;     // delivered but not acknowledged
+    bool                            replay_streaming = false; // blocks were requested and delivery isn't paused
 
     connection(boost::asio::io_context& ioc, const connection_config& config, std::shared_ptr<connection_callbacks> callbacks)
         : config(config)
         , callbacks(callbacks)
+        , ioc(ioc)
         , resolver(ioc)
         , stream(ioc) {
 
         stream.binary(true);
         stream.read_message_max(10ull * 1024 * 1024 * 1024);
+        buffers = std::make_shared<receive_buffer_pool>(config.max_messages_in_flight ? config.max_messages_in_flight : 16);
     }
 
     void connect() {
+        if (!config.replay_file.empty())
+            return open_replay();
         ilog("connect to ${h}:${p}", ("h", config.host)("p", config.port));
         resolver.async_resolve(
             config.host, config.port, [self = shared_from_this(), this](error_code ec, tcp::resolver::results_type results) {
@@ -78,9 +272,11 @@ struct connection : std::enable_shared_from_this<connection> {
     }
 
     void start_read() {
-        auto in_buffer = std::make_shared<flat_buffer>();
+        auto in_buffer = buffers->get();
         stream.async_read(*in_buffer, [self = shared_from_this(), this, in_buffer](error_code ec, size_t) {
             enter_callback(ec, "async_read", [&] {
+                if (recorder)
+                    recorder->write(*in_buffer);
                 if (!have_abi)
                     receive_abi(in_buffer);
                 else {
@@ -95,25 +291,46 @@ struct connection : std::enable_shared_from_this<connection> {
     }
 
     void receive_abi(const std::shared_ptr<flat_buffer>& p) {
-        auto data = p->data();
-        auto sv   = std::string_view{(const char*)data.data(), data.size()};
-        std::string buf((const char *)data.data(), data.size());
-        auto is   = eosio::json_token_stream{buf.data()};
-        from_json(abi, is);
-        if (abi.version.substr(0, 13) != "eosio::abi/1.") {
+        auto data  = p->data();
+        auto json  = std::string_view{(const char*)data.data(), data.size()};
+        auto entry = abis ? abis->find(json) : nullptr;
+        if (!entry) {
+            entry = parse_abi(json);
+            if (abis)
+                abis->add(entry);
+        } else {
+            ilog("reuse the abi received before");
+        }
+        abi                        = entry->def;
+        have_get_blocks_request_v1 = entry->have_get_blocks_request_v1;
+        have_abi                   = true;
+        if (!callbacks)
+            return;
+        if (abis)
+            callbacks->received_abi(entry->abi);
+        else
+            callbacks->received_abi(std::move(*entry->abi));
+    }
+
+    static std::shared_ptr<abi_cache::entry> parse_abi(std::string_view json) {
+        auto entry  = std::make_shared<abi_cache::entry>();
+        entry->json = json;
+        entry->abi  = std::make_shared<eosio::abi>();
+        // the JSON is parsed in place, so it's parsed from a copy
+        std::string buf{json};
+        auto        is = eosio::json_token_stream{buf.data()};
+        from_json(entry->def, is);
+        if (entry->def.version.substr(0, 13) != "eosio::abi/1.") {
             throw std::runtime_error("unsupported abi version");
         }
-        eosio::abi a;
-        eosio::convert(abi, a);
-        have_abi  = true;
+        eosio::convert(entry->def, *entry->abi);
         try {
-            have_get_blocks_request_v1 = a.get_type("get_blocks_request_v1");
+            entry->have_get_blocks_request_v1 = entry->abi->get_type("get_blocks_request_v1");
         }
         catch (...) {
             ilog("get_blocks_request_v1 not available, use get_blocks_request_v0 instead");
         }
-        if (callbacks)
-            callbacks->received_abi(std::move(a));
+        return entry;
     }
 
     bool receive_result(const std::shared_ptr<flat_buffer>& p) {
@@ -121,17 +338,73 @@ struct connection : std::enable_shared_from_this<connection> {
         input_buffer                 bin{(const char*)data.data(), (const char*)data.data() + data.size()};
         eosio::ship_protocol::result result;
         from_bin(result, bin);
-        return callbacks && std::visit([&](auto& r) { return callbacks->received(r); }, result);
+        return dispatch(result, p);
+    }
+
+    bool dispatch(eosio::ship_protocol::result& result, const std::shared_ptr<flat_buffer>& p) {
+        return callbacks && std::visit(
+                                [&](auto& r) {
+                                    if constexpr (std::is_same_v<std::decay_t<decltype(r)>, eosio::ship_protocol::get_blocks_result_v0>)
+                                        return callbacks->received(r, acknowledged_on_release(p));
+                                    else
+                                        return callbacks->received(r);
+                                },
+                                result);
+    }
+
+    /// With max_messages_in_flight, a block result is acknowledged once the callbacks release its buffer, so nodeos paces
+    /// itself to the filler instead of filling socket buffers. The returned pointer shares ownership of p. Block results
+    /// which aren't released yet are counted by the ship_blocks_held gauge.
+    std::shared_ptr<flat_buffer> acknowledged_on_release(const std::shared_ptr<flat_buffer>& p) {
+        static auto& held = metrics::get_gauge("ship_blocks_held", "Block results received but not processed yet");
+        struct ack_on_release {
+            std::shared_ptr<flat_buffer> buffer;
+            std::weak_ptr<connection>    conn;
+            boost::asio::io_context&     ioc;
+
+            ack_on_release(std::shared_ptr<flat_buffer> buffer, std::weak_ptr<connection> conn, boost::asio::io_context& ioc)
+                : buffer(std::move(buffer))
+                , conn(std::move(conn))
+                , ioc(ioc) {
+                held.add(1);
+            }
+            ack_on_release(const ack_on_release&) = delete;
+
+            ~ack_on_release() {
+                held.add(-1);
+                if (conn.expired())
+                    return;
+                boost::asio::post(ioc, [conn = std::move(conn)] {
+                    if (auto c = conn.lock())
+                        c->consumed(1);
+                });
+            }
+        };
+        auto token = std::make_shared<ack_on_release>(
+            p, config.max_messages_in_flight ? weak_from_this() : std::weak_ptr<connection>{}, ioc);
+        return {token, p.get()};
+    }
+
+    /// acknowledges in batches of half the window
+    void consumed(uint32_t num_messages) {
+        if (!callbacks)
+            return;
+        unacked += num_messages;
+        if (unacked < std::max(config.max_messages_in_flight / 2, 1u))
+            return;
+        send(eosio::ship_protocol::get_blocks_ack_request_v0{unacked});
+        unacked = 0;
     }
 
-    void request_blocks(uint32_t start_block_num, const std::vector<eosio::ship_protocol::block_position>& positions) {
+    void request_blocks(
+        uint32_t start_block_num, const std::vector<eosio::ship_protocol::block_position>& positions, uint32_t end_block_num = 0xffff'ffff) {
 
         eosio::ship_protocol::get_blocks_request_v0 req;
         req.start_block_num        = start_block_num;
-        req.end_block_num          = 0xffff'ffff;
-        req.max_messages_in_flight = 0xffff'ffff;
+        req.end_block_num          = end_block_num;
+        req.max_messages_in_flight = config.max_messages_in_flight ? config.max_messages_in_flight : 0xffff'ffff;
         req.have_positions         = positions;
-        req.irreversible_only      = false;
+        req.irreversible_only      = config.irreversible_only;
         req.fetch_block            = true;
         req.fetch_traces           = true;
         req.fetch_deltas           = true;
@@ -153,6 +426,8 @@ struct connection : std::enable_shared_from_this<connection> {
     }
 
     void send(const eosio::ship_protocol::request& req) {
+        if (replay)
+            return replay_request(req);
         auto bin = std::make_shared<std::vector<char>>();
         eosio::convert_to_bin(req, *bin);
         stream.async_write(boost::asio::buffer(*bin), [self = shared_from_this(), bin, this](error_code ec, size_t) {
@@ -160,10 +435,114 @@ struct connection : std::enable_shared_from_this<connection> {
         });
     }
 
+    /// The capture stands in for nodeos: requests are answered from it, blocks before the requested start are skipped, and
+    /// max_messages_in_flight paces delivery the same way. Reaching its end closes the connection without a retry.
+    void open_replay() {
+        ilog("replay ${f}", ("f", config.replay_file));
+        catch_and_close([&] {
+            replay = std::make_unique<capture_reader>(config.replay_file);
+            boost::asio::post(ioc, [self = shared_from_this(), this] {
+                catch_and_close([&] {
+                    auto buffer = buffers->get();
+                    if (!replay->next(*buffer) || !is_abi(*buffer))
+                        throw std::runtime_error("capture doesn't start with an abi");
+                    receive_abi(buffer);
+                });
+            });
+        });
+    }
+
+    static bool is_abi(const flat_buffer& message) {
+        auto data = message.data();
+        return data.size() && *(const char*)data.data() == '{';
+    }
+
+    void replay_request(const eosio::ship_protocol::request& req) {
+        std::visit(
+            [&](auto& r) {
+                using T = std::decay_t<decltype(r)>;
+                if constexpr (std::is_same_v<T, eosio::ship_protocol::get_status_request_v0>) {
+                    boost::asio::post(ioc, [self = shared_from_this(), this] { catch_and_close([&] { replay_status(); }); });
+                } else if constexpr (std::is_same_v<T, eosio::ship_protocol::get_blocks_request_v0>) {
+                    replay_start = r.start_block_num;
+                    replay_end   = r.end_block_num;
+                    resume_replay();
+                } else if constexpr (std::is_same_v<T, eosio::ship_protocol::get_blocks_ack_request_v0>) {
+                    replay_in_flight -= std::min(replay_in_flight, r.num_messages);
+                    resume_replay();
+                }
+            },
+            req);
+    }
+
+    void resume_replay() {
+        if (replay_streaming)
+            return;
+        replay_streaming = true;
+        boost::asio::post(ioc, [self = shared_from_this(), this] { catch_and_close([&] { replay_blocks(); }); });
+    }
+
+    // status results before the first block are answers to the status request
+    void replay_status() {
+        while (callbacks) {
+            auto buffer = buffers->get();
+            if (!replay->next(*buffer))
+                throw std::runtime_error("capture has no status");
+            if (is_abi(*buffer))
+                continue;
+            auto                         data = buffer->data();
+            input_buffer                 bin{(const char*)data.data(), (const char*)data.data() + data.size()};
+            eosio::ship_protocol::result result;
+            from_bin(result, bin);
+            if (auto* status = std::get_if<eosio::ship_protocol::get_status_result_v0>(&result)) {
+                if (!callbacks->received(*status))
+                    close(false);
+                return;
+            }
+        }
+    }
+
+    // delivers a batch of blocks, then lets other handlers run before the next one
+    void replay_blocks() {
+        for (int i = 0; i < 64; ++i) {
+            if (!callbacks)
+                return;
+            if (config.max_messages_in_flight && replay_in_flight >= config.max_messages_in_flight) {
+                replay_streaming = false;
+                return;
+            }
+            auto buffer = buffers->get();
+            if (!replay->next(*buffer)) {
+                ilog("end of capture");
+                close(false);
+                return;
+            }
+            if (is_abi(*buffer))
+                continue;
+            auto                         data = buffer->data();
+            input_buffer                 bin{(const char*)data.data(), (const char*)data.data() + data.size()};
+            eosio::ship_protocol::result result;
+            from_bin(result, bin);
+            auto* blocks = std::get_if<eosio::ship_protocol::get_blocks_result_v0>(&result);
+            if (!blocks || !blocks->this_block || blocks->this_block->block_num < replay_start)
+                continue;
+            if (blocks->this_block->block_num >= replay_end) {
+                replay_streaming = false;
+                return;
+            }
+            if (config.max_messages_in_flight)
+                ++replay_in_flight;
+            if (!dispatch(result, buffer)) {
+                close(false);
+                return;
+            }
+        }
+        boost::asio::post(ioc, [self = shared_from_this(), this] { catch_and_close([&] { replay_blocks(); }); });
+    }
+
     template <typename F>
     void catch_and_close(F f) {
         try {
-            ilog("try call empty func");
             f();
         } catch (const std::exception& e) {
             elog("${e}", ("e", e.what()));
@@ -176,7 +555,6 @@ struct connection : std::enable_shared_from_this<connection> {
 
     template <typename F>
     void enter_callback(error_code ec, const char* what, F f) {
-        ilog("enter callback");
         if (ec)
             return on_fail(ec, what);
         catch_and_close(f);
@@ -3,11 +3,17 @@
 #pragma once
 #include "query_config.hpp"
 #include "state_history.hpp"
+#include <eosio/from_bin.hpp>
+#include <eosio/to_bin.hpp>
+#include <eosio/varint.hpp>
+
+#include <algorithm>
 
 namespace state_history {
 namespace kv {
 
-using namespace abieos::literals;
+using namespace eosio::literals;
+using eosio::ship_protocol::transaction_status;
 
 inline void inc_key(std::vector<char>& key) {
     for (auto it = key.rbegin(); it != key.rend(); ++it)
@@ -22,12 +28,33 @@ void reverse_bin(std::vector<char>& bin, F f) {
     std::reverse(bin.begin() + s, bin.end());
 }
 
+// Types whose key is their sizeof(T)-byte serialization reversed
+template <typename T>
+inline constexpr bool is_reversed_key_v = std::is_unsigned_v<T> || std::is_same_v<std::decay_t<T>, eosio::name> ||
+                                          std::is_same_v<std::decay_t<T>, unsigned __int128> ||
+                                          std::is_same_v<std::decay_t<T>, eosio::checksum256>;
+
+// size is a constant, so the compiler turns this into byte swaps instead of a loop
+template <size_t size>
+void append_reversed(std::vector<char>& dest, const char* src) {
+    auto pos = dest.size();
+    dest.resize(pos + size);
+    std::reverse_copy(src, src + size, dest.data() + pos);
+}
+
+// Reads a reversed_key type's serialization from bin and appends its key
+template <typename T>
+void bin_to_reversed_key(std::vector<char>& dest, eosio::input_stream& bin) {
+    if (size_t(bin.end - bin.pos) < sizeof(T))
+        throw std::runtime_error("read past end");
+    append_reversed<sizeof(T)>(dest, bin.pos);
+    bin.pos += sizeof(T);
+}
+
 // Modify serialization of types so lexigraphical sort matches data sort
 template <typename T, typename F>
 void fixup_key(std::vector<char>& bin, F f) {
-    if constexpr (
-        std::is_unsigned_v<T> || std::is_same_v<std::decay_t<T>, abieos::name> || std::is_same_v<std::decay_t<T>, abieos::uint128> ||
-        std::is_same_v<std::decay_t<T>, abieos::checksum256>)
+    if constexpr (is_reversed_key_v<T>)
         reverse_bin(bin, f);
     else
         throw std::runtime_error("unsupported key type");
@@ -35,72 +62,78 @@ void fixup_key(std::vector<char>& bin, F f) {
 
 template <typename T>
 void native_to_key(std::vector<char>& bin, const T& obj) {
-    fixup_key<T>(bin, [&] { abieos::native_to_bin(obj, bin); });
+    if constexpr (std::is_integral_v<T> && std::is_unsigned_v<T>)
+        append_reversed<sizeof(T)>(bin, reinterpret_cast<const char*>(&obj));
+    else if constexpr (std::is_same_v<std::decay_t<T>, eosio::name>)
+        append_reversed<sizeof(obj.value)>(bin, reinterpret_cast<const char*>(&obj.value));
+    else
+        fixup_key<T>(bin, [&] { eosio::convert_to_bin(obj, bin); });
 }
 
 template <typename T>
-T key_to_native(abieos::input_buffer& b) {
-    if constexpr (
-        std::is_unsigned_v<T> || std::is_same_v<std::decay_t<T>, abieos::name> || std::is_same_v<std::decay_t<T>, abieos::uint128> ||
-        std::is_same_v<std::decay_t<T>, abieos::checksum256>) {
+T key_to_native(eosio::input_stream& b) {
+    if constexpr (is_reversed_key_v<T>) {
         if (b.pos + sizeof(T) > b.end)
             throw std::runtime_error("key deserialization error");
-        std::vector<char> v(b.pos, b.pos + sizeof(T));
+        char v[sizeof(T)];
+        std::reverse_copy(b.pos, b.pos + sizeof(T), v);
         b.pos += sizeof(T);
-        std::reverse(v.begin(), v.end());
-        auto br = abieos::input_buffer{v.data(), v.data() + v.size()};
-        return abieos::bin_to_native<T>(br);
+        eosio::input_stream br{v, v + sizeof(T)};
+        return eosio::from_bin<T>(br);
     } else {
         throw std::runtime_error("unsupported key type");
     }
 }
 
 struct type {
-    void (*bin_to_bin)(std::vector<char>&, abieos::input_buffer&)   = nullptr;
-    void (*bin_to_key)(std::vector<char>&, abieos::input_buffer&)   = nullptr;
-    void (*key_to_key)(std::vector<char>&, abieos::input_buffer&)   = nullptr;
-    void (*query_to_key)(std::vector<char>&, abieos::input_buffer&) = nullptr;
-    void (*lower_bound_key)(std::vector<char>&)                     = nullptr;
-    void (*upper_bound_key)(std::vector<char>&)                     = nullptr;
-    bool (*skip_bin)(abieos::input_buffer&)                         = nullptr;
-    bool (*skip_key)(abieos::input_buffer&)                         = nullptr;
-    void (*fill_empty)(std::vector<char>&)                          = nullptr;
+    void (*bin_to_bin)(std::vector<char>&, eosio::input_stream&)   = nullptr;
+    void (*bin_to_key)(std::vector<char>&, eosio::input_stream&)   = nullptr;
+    void (*key_to_key)(std::vector<char>&, eosio::input_stream&)   = nullptr;
+    void (*query_to_key)(std::vector<char>&, eosio::input_stream&) = nullptr;
+    void (*lower_bound_key)(std::vector<char>&)                    = nullptr;
+    void (*upper_bound_key)(std::vector<char>&)                    = nullptr;
+    bool (*skip_bin)(eosio::input_stream&)                         = nullptr;
+    bool (*skip_key)(eosio::input_stream&)                         = nullptr;
+    void (*fill_empty)(std::vector<char>&)                         = nullptr;
+    uint32_t fixed_size                                            = 0; // serialized size, if it's the same for every value
 };
 
 template <typename T>
-void bin_to_bin(std::vector<char>& dest, abieos::input_buffer& bin) {
-    abieos::native_to_bin(abieos::bin_to_native<T>(bin), dest);
+void bin_to_bin(std::vector<char>& dest, eosio::input_stream& bin) {
+    eosio::convert_to_bin(eosio::from_bin<T>(bin), dest);
 }
 
 template <>
-inline void bin_to_bin<abieos::uint128>(std::vector<char>& dest, abieos::input_buffer& bin) {
+inline void bin_to_bin<unsigned __int128>(std::vector<char>& dest, eosio::input_stream& bin) {
     bin_to_bin<uint64_t>(dest, bin);
     bin_to_bin<uint64_t>(dest, bin);
 }
 
 template <>
-inline void bin_to_bin<abieos::int128>(std::vector<char>& dest, abieos::input_buffer& bin) {
+inline void bin_to_bin<__int128>(std::vector<char>& dest, eosio::input_stream& bin) {
     bin_to_bin<uint64_t>(dest, bin);
     bin_to_bin<uint64_t>(dest, bin);
 }
 
 template <>
-inline void bin_to_bin<transaction_status>(std::vector<char>& dest, abieos::input_buffer& bin) {
+inline void bin_to_bin<transaction_status>(std::vector<char>& dest, eosio::input_stream& bin) {
     return bin_to_bin<std::underlying_type_t<transaction_status>>(dest, bin);
 }
 
 template <typename T>
-void bin_to_key(std::vector<char>& dest, abieos::input_buffer& bin) {
-    if constexpr (std::is_same_v<std::decay_t<T>, abieos::varuint32>) {
-        reverse_bin(dest, [&] { abieos::native_to_bin(abieos::bin_to_native<abieos::varuint32>(bin).value, dest); });
+void bin_to_key(std::vector<char>& dest, eosio::input_stream& bin) {
+    if constexpr (std::is_same_v<std::decay_t<T>, eosio::varuint32>) {
+        native_to_key(dest, eosio::from_bin<eosio::varuint32>(bin).value);
+    } else if constexpr (is_reversed_key_v<T>) {
+        bin_to_reversed_key<T>(dest, bin);
     } else {
         fixup_key<T>(dest, [&] { bin_to_bin<T>(dest, bin); });
     }
 }
 
 template <typename T>
-void key_to_key(std::vector<char>& dest, abieos::input_buffer& bin) {
-    if constexpr (std::is_same_v<std::decay_t<T>, abieos::varuint32>) {
+void key_to_key(std::vector<char>& dest, eosio::input_stream& bin) {
+    if constexpr (std::is_same_v<std::decay_t<T>, eosio::varuint32>) {
         bin_to_bin<uint32_t>(dest, bin);
     } else {
         bin_to_bin<T>(dest, bin);
@@ -108,9 +141,11 @@ void key_to_key(std::vector<char>& dest, abieos::input_buffer& bin) {
 }
 
 template <typename T>
-void query_to_key(std::vector<char>& dest, abieos::input_buffer& bin) {
-    if constexpr (std::is_same_v<std::decay_t<T>, abieos::varuint32>) {
-        fixup_key<uint32_t>(dest, [&] { bin_to_bin<uint32_t>(dest, bin); });
+void query_to_key(std::vector<char>& dest, eosio::input_stream& bin) {
+    if constexpr (std::is_same_v<std::decay_t<T>, eosio::varuint32>) {
+        bin_to_reversed_key<uint32_t>(dest, bin);
+    } else if constexpr (is_reversed_key_v<T>) {
+        bin_to_reversed_key<T>(dest, bin);
     } else {
         fixup_key<T>(dest, [&] { bin_to_bin<T>(dest, bin); });
     }
@@ -118,9 +153,7 @@ void query_to_key(std::vector<char>& dest, abieos::input_buffer& bin) {
 
 template <typename T>
 void lower_bound_key(std::vector<char>& dest) {
-    if constexpr (
-        std::is_unsigned_v<T> || std::is_same_v<std::decay_t<T>, abieos::name> || std::is_same_v<std::decay_t<T>, abieos::uint128> ||
-        std::is_same_v<std::decay_t<T>, abieos::checksum256>)
+    if constexpr (is_reversed_key_v<T>)
         dest.resize(dest.size() + sizeof(T));
     else
         throw std::runtime_error("unsupported key type");
@@ -128,29 +161,25 @@ void lower_bound_key(std::vector<char>& dest) {
 
 template <typename T>
 void upper_bound_key(std::vector<char>& dest) {
-    if constexpr (
-        std::is_unsigned_v<T> || std::is_same_v<std::decay_t<T>, abieos::name> || std::is_same_v<std::decay_t<T>, abieos::uint128> ||
-        std::is_same_v<std::decay_t<T>, abieos::checksum256>)
+    if constexpr (is_reversed_key_v<T>)
         dest.resize(dest.size() + sizeof(T), 0xff);
     else
         throw std::runtime_error("unsupported key type");
 }
 
 template <typename T>
-bool skip_bin(abieos::input_buffer& bin) {
+bool skip_bin(eosio::input_stream& bin) {
     if constexpr (
-        std::is_integral_v<T> || std::is_same_v<std::decay_t<T>, abieos::name> || std::is_same_v<std::decay_t<T>, abieos::uint128> ||
-        std::is_same_v<std::decay_t<T>, abieos::checksum256> || std::is_same_v<std::decay_t<T>, abieos::time_point> ||
-        std::is_same_v<std::decay_t<T>, abieos::block_timestamp> || std::is_same_v<std::decay_t<T>, transaction_status>) {
+        std::is_integral_v<T> || std::is_same_v<std::decay_t<T>, eosio::name> || std::is_same_v<std::decay_t<T>, unsigned __int128> ||
+        std::is_same_v<std::decay_t<T>, eosio::checksum256> || std::is_same_v<std::decay_t<T>, eosio::time_point> ||
+        std::is_same_v<std::decay_t<T>, eosio::block_timestamp> || std::is_same_v<std::decay_t<T>, transaction_status>) {
         if (size_t(bin.end - bin.pos) < sizeof(T))
             throw std::runtime_error("skip past end");
         bin.pos += sizeof(T);
         return true;
-    } else if constexpr (std::is_same_v<std::decay_t<T>, abieos::varuint32>) {
-        uint32_t    dummy;
-        std::string error;
-        if (!abieos::read_varuint32(bin, error, dummy))
-            throw std::runtime_error("skip past end");
+    } else if constexpr (std::is_same_v<std::decay_t<T>, eosio::varuint32>) {
+        uint32_t dummy;
+        varuint32_from_bin(dummy, bin);
         return true;
     } else {
         return false;
@@ -158,16 +187,16 @@ bool skip_bin(abieos::input_buffer& bin) {
 }
 
 template <typename T>
-bool skip_key(abieos::input_buffer& bin) {
+bool skip_key(eosio::input_stream& bin) {
     if constexpr (
-        std::is_integral_v<T> || std::is_same_v<std::decay_t<T>, abieos::name> || std::is_same_v<std::decay_t<T>, abieos::uint128> ||
-        std::is_same_v<std::decay_t<T>, abieos::checksum256> || std::is_same_v<std::decay_t<T>, abieos::time_point> ||
-        std::is_same_v<std::decay_t<T>, abieos::block_timestamp> || std::is_same_v<std::decay_t<T>, transaction_status>) {
+        std::is_integral_v<T> || std::is_same_v<std::decay_t<T>, eosio::name> || std::is_same_v<std::decay_t<T>, unsigned __int128> ||
+        std::is_same_v<std::decay_t<T>, eosio::checksum256> || std::is_same_v<std::decay_t<T>, eosio::time_point> ||
+        std::is_same_v<std::decay_t<T>, eosio::block_timestamp> || std::is_same_v<std::decay_t<T>, transaction_status>) {
         if (size_t(bin.end - bin.pos) < sizeof(T))
             throw std::runtime_error("skip past end");
         bin.pos += sizeof(T);
         return true;
-    } else if constexpr (std::is_same_v<std::decay_t<T>, abieos::varuint32>) {
+    } else if constexpr (std::is_same_v<std::decay_t<T>, eosio::varuint32>) {
         return skip_key<uint32_t>(bin);
     } else {
         return false;
@@ -177,48 +206,60 @@ bool skip_key(abieos::input_buffer& bin) {
 template <typename T>
 void fill_empty(std::vector<char>& dest) {
     if constexpr (
-        std::is_integral_v<T> || std::is_same_v<std::decay_t<T>, abieos::name> || std::is_same_v<std::decay_t<T>, abieos::uint128> ||
-        std::is_same_v<std::decay_t<T>, abieos::checksum256> || std::is_same_v<std::decay_t<T>, abieos::time_point> ||
-        std::is_same_v<std::decay_t<T>, abieos::block_timestamp>) {
+        std::is_integral_v<T> || std::is_same_v<std::decay_t<T>, eosio::name> || std::is_same_v<std::decay_t<T>, unsigned __int128> ||
+        std::is_same_v<std::decay_t<T>, eosio::checksum256> || std::is_same_v<std::decay_t<T>, eosio::time_point> ||
+        std::is_same_v<std::decay_t<T>, eosio::block_timestamp>) {
         dest.insert(dest.end(), sizeof(T), 0);
-    } else if constexpr (std::is_same_v<std::decay_t<T>, abieos::bytes>) {
+    } else if constexpr (std::is_same_v<std::decay_t<T>, eosio::bytes>) {
         dest.push_back(0);
     } else {
         throw std::runtime_error("unsupported fill_empty type");
     }
 }
 
+// skip_bin skips sizeof(T) bytes for these
+template <typename T>
+constexpr uint32_t fixed_size() {
+    if constexpr (
+        std::is_integral_v<T> || std::is_same_v<std::decay_t<T>, eosio::name> || std::is_same_v<std::decay_t<T>, unsigned __int128> ||
+        std::is_same_v<std::decay_t<T>, eosio::checksum256> || std::is_same_v<std::decay_t<T>, eosio::time_point> ||
+        std::is_same_v<std::decay_t<T>, eosio::block_timestamp> || std::is_same_v<std::decay_t<T>, transaction_status>)
+        return sizeof(T);
+    else
+        return 0;
+}
+
 template <typename T>
 constexpr type make_type_for() {
     return type{bin_to_bin<T>,      bin_to_key<T>, key_to_key<T>, query_to_key<T>, lower_bound_key<T>,
-                upper_bound_key<T>, skip_bin<T>,   skip_key<T>,   fill_empty<T>};
+                upper_bound_key<T>, skip_bin<T>,   skip_key<T>,   fill_empty<T>,   fixed_size<T>()};
 }
 
 // clang-format off
 const inline std::map<std::string, type> abi_type_to_kv_type = {
     {"bool",                    make_type_for<bool>()},
-    {"varuint32",               make_type_for<abieos::varuint32>()},
+    {"varuint32",               make_type_for<eosio::varuint32>()},
     {"uint8",                   make_type_for<uint8_t>()},
     {"uint16",                  make_type_for<uint16_t>()},
     {"uint32",                  make_type_for<uint32_t>()},
     {"uint32?",                 make_type_for<std::optional<uint32_t>>()},
     {"uint64",                  make_type_for<uint64_t>()},
-    {"uint128",                 make_type_for<abieos::uint128>()},
+    {"uint128",                 make_type_for<unsigned __int128>()},
     {"int8",                    make_type_for<int8_t>()},
     {"int16",                   make_type_for<int16_t>()},
     {"int32",                   make_type_for<int32_t>()},
     {"int64",                   make_type_for<int64_t>()},
-    {"int128",                  make_type_for<abieos::int128>()},
+    {"int128",                  make_type_for<__int128>()},
     {"float64",                 make_type_for<double>()},
-    {"float128",                make_type_for<abieos::float128>()},
-    {"name",                    make_type_for<abieos::name>()},
+    {"float128",                make_type_for<eosio::float128>()},
+    {"name",                    make_type_for<eosio::name>()},
     {"string",                  make_type_for<std::string>()},
-    {"time_point",              make_type_for<abieos::time_point>()},
-    {"time_point_sec",          make_type_for<abieos::time_point_sec>()},
-    {"block_timestamp_type",    make_type_for<abieos::block_timestamp>()},
-    {"checksum256",             make_type_for<abieos::checksum256>()},
-    {"public_key",              make_type_for<abieos::public_key>()},
-    {"bytes",                   make_type_for<abieos::bytes>()},
+    {"time_point",              make_type_for<eosio::time_point>()},
+    {"time_point_sec",          make_type_for<eosio::time_point_sec>()},
+    {"block_timestamp_type",    make_type_for<eosio::block_timestamp>()},
+    {"checksum256",             make_type_for<eosio::checksum256>()},
+    {"public_key",              make_type_for<eosio::public_key>()},
+    {"bytes",                   make_type_for<eosio::bytes>()},
     {"transaction_status",      make_type_for<transaction_status>()},
 };
 // clang-format on
@@ -248,7 +289,7 @@ enum class key_tag : uint8_t {
     index = 0x60,
 };
 
-inline key_tag bin_to_key_tag(abieos::input_buffer& b) { return (key_tag)abieos::bin_to_native<uint8_t>(b); }
+inline key_tag bin_to_key_tag(eosio::input_stream& b) { return (key_tag)eosio::from_bin<uint8_t>(b); }
 
 inline const char* to_string(key_tag t) {
     switch (t) {
@@ -258,7 +299,7 @@ inline const char* to_string(key_tag t) {
     }
 }
 
-inline std::string key_to_string(abieos::input_buffer b) {
+inline std::string key_to_string(eosio::input_stream b) {
     using std::to_string;
     std::string result;
     auto        t0 = bin_to_key_tag(b);
@@ -269,13 +310,13 @@ inline std::string key_to_string(abieos::input_buffer b) {
     //         auto t1 = bin_to_key_tag(b);
     //         result += " " + std::string{to_string(t1)};
     //         // if (t1 == key_tag::table_row) {
-    //         //     auto table_name = key_to_native<abieos::name>(b);
+    //         //     auto table_name = key_to_native<eosio::name>(b);
     //         //     result += " '" + (std::string)table_name + "' ";
-    //         //     abieos::hex(b.pos, b.end, std::back_inserter(result));
+    //         //     eosio::hex(b.pos, b.end, std::back_inserter(result));
     //         //     // } else if (t1 == key_tag::table_delta) {
-    //         //     //     auto table_name = key_to_native<abieos::name>(b);
+    //         //     //     auto table_name = key_to_native<eosio::name>(b);
     //         //     //     result += " '" + (std::string)table_name + "' present: " + (key_to_native<bool>(b) ? "true" : "false") + " ";
-    //         //     //     abieos::hex(b.pos, b.end, std::back_inserter(result));
+    //         //     //     eosio::hex(b.pos, b.end, std::back_inserter(result));
     //         // } else {
     //         //     result += " ...";
     //         // }
@@ -295,7 +336,7 @@ inline void append_table_key(std::vector<char>& dest, uint32_t block) {
     native_to_key(dest, block);
 }
 
-inline void append_table_key(std::vector<char>& dest, uint32_t block, bool present_k, abieos::name table_name) {
+inline void append_table_key(std::vector<char>& dest, uint32_t block, bool present_k, eosio::name table_name) {
     native_to_key(dest, (uint8_t)key_tag::table);
     native_to_key(dest, block);
     native_to_key(dest, table_name);
@@ -314,7 +355,7 @@ inline std::vector<char> make_table_key(uint32_t block) {
     return result;
 }
 
-inline std::vector<char> make_table_key(uint32_t block, bool present_k, abieos::name table_name) {
+inline std::vector<char> make_table_key(uint32_t block, bool present_k, eosio::name table_name) {
     std::vector<char> result;
     append_table_key(result, block, present_k, table_name);
     return result;
@@ -322,7 +363,7 @@ inline std::vector<char> make_table_key(uint32_t block, bool present_k, abieos::
 
 inline void append_index_key(std::vector<char>& dest) { native_to_key(dest, (uint8_t)key_tag::index); }
 
-inline void append_index_key(std::vector<char>& dest, abieos::name table_name, abieos::name index_name) {
+inline void append_index_key(std::vector<char>& dest, eosio::name table_name, eosio::name index_name) {
     native_to_key(dest, (uint8_t)key_tag::index);
     native_to_key(dest, table_name);
     native_to_key(dest, index_name);
@@ -334,15 +375,15 @@ inline std::vector<char> make_index_key() {
     return result;
 }
 
-inline std::vector<char> make_index_key(abieos::name table_name, abieos::name index_name) {
+inline std::vector<char> make_index_key(eosio::name table_name, eosio::name index_name) {
     std::vector<char> result;
     append_index_key(result, table_name, index_name);
     return result;
 }
 
-inline void read_table_prefix(abieos::input_buffer& bin, uint32_t& block_num, abieos::name& table_name, bool& present_k) {
+inline void read_table_prefix(eosio::input_stream& bin, uint32_t& block_num, eosio::name& table_name, bool& present_k) {
     block_num  = key_to_native<uint32_t>(bin);
-    table_name = key_to_native<abieos::name>(bin);
+    table_name = key_to_native<eosio::name>(bin);
     present_k  = key_to_native<bool>(bin);
 }
 
@@ -353,12 +394,12 @@ inline void append_index_suffix(std::vector<char>& dest, uint32_t block, bool pr
     native_to_key(dest, !present_k);
 }
 
-inline void read_index_prefix(abieos::input_buffer& bin, abieos::name& table, abieos::name& index) {
-    table = key_to_native<abieos::name>(bin);
-    index = key_to_native<abieos::name>(bin);
+inline void read_index_prefix(eosio::input_stream& bin, eosio::name& table, eosio::name& index) {
+    table = key_to_native<eosio::name>(bin);
+    index = key_to_native<eosio::name>(bin);
 }
 
-inline void read_index_suffix(abieos::input_buffer& bin, uint32_t& block, bool& present_k) {
+inline void read_index_suffix(eosio::input_stream& bin, uint32_t& block, bool& present_k) {
     block     = ~key_to_native<uint32_t>(bin);
     present_k = !key_to_native<bool>(bin);
 }
@@ -367,24 +408,21 @@ inline std::vector<char> make_fill_status_key() { return make_table_key(0, true,
 
 struct received_block {
     uint32_t            block_num = {};
-    abieos::checksum256 block_id  = {};
+    eosio::checksum256 block_id  = {};
 };
 
-ABIEOS_REFLECT(received_block) {
-    ABIEOS_MEMBER(received_block, block_num)
-    ABIEOS_MEMBER(received_block, block_id)
-}
+EOSIO_REFLECT(received_block, block_num, block_id)
 
 inline std::vector<char> make_received_block_key(uint32_t block) { return make_table_key(block, true, "recvd.block"_n); }
 inline std::vector<char> make_block_info_key(uint32_t block) { return make_table_key(block, true, "block.info"_n); }
 
-inline void append_transaction_trace_key(std::vector<char>& dest, uint32_t block, const abieos::checksum256 transaction_id) {
+inline void append_transaction_trace_key(std::vector<char>& dest, uint32_t block, const eosio::checksum256 transaction_id) {
     append_table_key(dest, block, true, "ttrace"_n);
     native_to_key(dest, transaction_id);
 }
 
 inline void
-append_action_trace_key(std::vector<char>& dest, uint32_t block, const abieos::checksum256 transaction_id, uint32_t action_index) {
+append_action_trace_key(std::vector<char>& dest, uint32_t block, const eosio::checksum256 transaction_id, uint32_t action_index) {
     append_table_key(dest, block, true, "atrace"_n);
     native_to_key(dest, transaction_id);
     native_to_key(dest, action_index);
@@ -396,7 +434,9 @@ struct defs {
     using query = query_config::query<defs>;
 
     struct field : query_config::field<defs> {
-        uint32_t field_index = -1; // index within table::fields
+        uint32_t                field_index     = -1; // index within table::fields
+        std::optional<uint32_t> static_position = {}; // offset within a row, if every field before this one is fixed
+        bool                    fixed           = {}; // has a fixed size and doesn't begin or end an optional
     };
 
     using key   = query_config::key<defs>;
@@ -406,9 +446,19 @@ struct defs {
         template <typename M>
         void prepare(const M& type_map) {
             query_config::config<defs>::prepare(type_map);
-            for (auto& table : tables)
-                for (uint32_t i = 0; i < table.fields.size(); ++i)
-                    table.fields[i].field_index = i;
+            for (auto& table : tables) {
+                std::optional<uint32_t> pos = 0;
+                for (uint32_t i = 0; i < table.fields.size(); ++i) {
+                    auto& field           = table.fields[i];
+                    field.field_index     = i;
+                    field.static_position = pos;
+                    field.fixed           = field.type_obj->fixed_size && !field.begin_optional && !field.end_optional;
+                    if (pos && field.fixed)
+                        pos = *pos + field.type_obj->fixed_size;
+                    else
+                        pos = std::nullopt;
+                }
+            }
         }
     };
 }; // defs
@@ -427,13 +477,13 @@ inline void init_positions(std::vector<std::optional<uint32_t>>& positions, size
 
 template <typename F>
 void fill_positions_impl(
-    const char* begin, abieos::input_buffer& src, bool is_key, std::vector<std::optional<uint32_t>>& positions, F for_each_field) {
+    const char* begin, eosio::input_stream& src, bool is_key, std::vector<std::optional<uint32_t>>& positions, F for_each_field) {
     bool present = true;
     for_each_field([&](auto& field) {
         if (present)
             positions.at(field.field_index) = src.pos - begin;
         if (field.begin_optional) {
-            present = abieos::bin_to_native<bool>(src);
+            present = eosio::from_bin<bool>(src);
         } else {
             if (present) {
                 if (is_key) {
@@ -452,20 +502,36 @@ void fill_positions_impl(
 }
 
 inline void fill_positions_rw(
-    const char* begin, abieos::input_buffer& src, const std::vector<field>& fields, std::vector<std::optional<uint32_t>>& positions) {
+    const char* begin, eosio::input_stream& src, const std::vector<field>& fields, std::vector<std::optional<uint32_t>>& positions) {
+    // a row's leading fixed fields are at the offsets prepare() found; parsing starts after them
+    size_t first_parsed = 0;
+    if (begin == src.pos) {
+        uint32_t offset = 0;
+        for (; first_parsed < fields.size() && fields[first_parsed].static_position; ++first_parsed) {
+            auto& field                     = fields[first_parsed];
+            offset                          = *field.static_position;
+            positions.at(field.field_index) = offset;
+            if (!field.fixed)
+                break;
+            offset += field.type_obj->fixed_size;
+        }
+        if (offset > size_t(src.end - src.pos))
+            throw std::runtime_error("skip past end");
+        src.pos += offset;
+    }
     fill_positions_impl(begin, src, false, positions, [&](auto f) {
-        for (auto& field : fields)
-            if (!f(field))
+        for (size_t i = first_parsed; i < fields.size(); ++i)
+            if (!f(fields[i]))
                 break;
     });
 }
 
-inline void fill_positions(abieos::input_buffer src, const std::vector<field>& fields, std::vector<std::optional<uint32_t>>& positions) {
+inline void fill_positions(eosio::input_stream src, const std::vector<field>& fields, std::vector<std::optional<uint32_t>>& positions) {
     fill_positions_rw(src.pos, src, fields, positions);
 }
 
 inline void fill_positions_rw(
-    const char* begin, abieos::input_buffer& src, const std::vector<key>& keys, std::vector<std::optional<uint32_t>>& positions) {
+    const char* begin, eosio::input_stream& src, const std::vector<key>& keys, std::vector<std::optional<uint32_t>>& positions) {
     fill_positions_impl(begin, src, true, positions, [&](auto f) {
         for (auto& key : keys)
             if (!f(*key.field))
@@ -473,7 +539,7 @@ inline void fill_positions_rw(
     });
 }
 
-inline void fill_positions(abieos::input_buffer src, const std::vector<key>& fields, std::vector<std::optional<uint32_t>>& positions) {
+inline void fill_positions(eosio::input_stream src, const std::vector<key>& fields, std::vector<std::optional<uint32_t>>& positions) {
     fill_positions_rw(src.pos, src, fields, positions);
 }
 
@@ -485,24 +551,24 @@ inline bool keys_have_positions(const std::vector<key>& keys, std::vector<std::o
 }
 
 inline void extract_keys(
-    std::vector<char>& dest, abieos::input_buffer value, const std::vector<kv::key>& keys,
+    std::vector<char>& dest, eosio::input_stream value, const std::vector<kv::key>& keys,
     std::vector<std::optional<uint32_t>>& positions) {
     for (auto& k : keys) {
         if (!positions.at(k.field->field_index))
             throw std::runtime_error("key fields are missing");
-        abieos::input_buffer b = {value.pos + *positions[k.field->field_index], value.end};
+        eosio::input_stream b{value.pos + *positions[k.field->field_index], value.end};
         k.field->type_obj->bin_to_key(dest, b);
     }
 }
 
 inline const char* fill_positions_from_index(
-    abieos::input_buffer index, const std::vector<kv::key>& index_keys, uint32_t& block, bool& present_k,
+    eosio::input_stream index, const std::vector<kv::key>& index_keys, uint32_t& block, bool& present_k,
     std::vector<std::optional<uint32_t>>& positions) {
 
     auto start = index.pos;
     skip_key<uint8_t>(index);      // key_tag::index
-    skip_key<abieos::name>(index); // table_name
-    skip_key<abieos::name>(index); // index_name
+    skip_key<eosio::name>(index); // table_name
+    skip_key<eosio::name>(index); // index_name
 
     fill_positions_rw(start, index, index_keys, positions);
     auto suffix_pos = index.pos;
@@ -511,19 +577,19 @@ inline const char* fill_positions_from_index(
 }
 
 inline std::vector<char> extract_pk(
-    abieos::input_buffer index, const kv::table& table, uint32_t block, bool present_k, std::vector<std::optional<uint32_t>>& positions) {
+    eosio::input_stream index, const kv::table& table, uint32_t block, bool present_k, std::vector<std::optional<uint32_t>>& positions) {
     std::vector<char> result;
     append_table_key(result, block, present_k, table.short_name);
     for (auto& k : table.keys) {
         if (!positions.at(k.field->field_index))
             throw std::runtime_error("secondary index is missing pk fields");
-        abieos::input_buffer b = {index.pos + *positions[k.field->field_index], index.end};
+        eosio::input_stream b{index.pos + *positions[k.field->field_index], index.end};
         k.field->type_obj->key_to_key(result, b);
     }
     return result;
 }
 
-inline std::vector<char> extract_pk_from_index(abieos::input_buffer index, const kv::table& table, const std::vector<kv::key>& index_keys) {
+inline std::vector<char> extract_pk_from_index(eosio::input_stream index, const kv::table& table, const std::vector<kv::key>& index_keys) {
     std::vector<std::optional<uint32_t>> positions;
     init_positions(positions, table.fields.size());
     uint32_t block;
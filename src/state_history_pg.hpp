@@ -13,6 +13,10 @@
 #include <pqxx/pqxx>
 #include <pqxx/tablewriter.hxx>
 #include <boost/algorithm/hex.hpp>
+#include <charconv>
+#include <cstdio>
+#include <map>
+#include <optional>
 
 
 namespace eosio {
@@ -135,6 +139,78 @@ std::string bin_to_sql(eosio::input_stream& bin) {
     return sql_str(v);
 }
 
+/// Appends the same text as sql_str() to out. Types without an overload below go through sql_str().
+template <typename T>
+void append_sql_str(std::string& out, const T& v) {
+    out += sql_str(v);
+}
+
+template <typename T>
+std::enable_if_t<std::is_integral_v<T>> append_sql_int(std::string& out, T v) {
+    char buf[24];
+    auto r = std::to_chars(buf, buf + sizeof(buf), v);
+    out.append(buf, r.ptr);
+}
+
+inline void append_hex(std::string& out, const uint8_t* begin, const uint8_t* end) {
+    static const char digits[] = "0123456789ABCDEF";
+    for (auto p = begin; p != end; ++p) {
+        out += digits[*p >> 4];
+        out += digits[*p & 15];
+    }
+}
+
+// clang-format off
+inline void append_sql_str(std::string& out, bool v)                          { out += v ? "true" : "false"; }
+inline void append_sql_str(std::string& out, uint8_t v)                       { append_sql_int(out, v); }
+inline void append_sql_str(std::string& out, int8_t v)                        { append_sql_int(out, v); }
+inline void append_sql_str(std::string& out, uint16_t v)                      { append_sql_int(out, v); }
+inline void append_sql_str(std::string& out, int16_t v)                       { append_sql_int(out, v); }
+inline void append_sql_str(std::string& out, uint32_t v)                      { append_sql_int(out, v); }
+inline void append_sql_str(std::string& out, int32_t v)                       { append_sql_int(out, v); }
+inline void append_sql_str(std::string& out, uint64_t v)                      { append_sql_int(out, v); }
+inline void append_sql_str(std::string& out, int64_t v)                       { append_sql_int(out, v); }
+inline void append_sql_str(std::string& out, eosio::varuint32 v)              { append_sql_int(out, v.value); }
+inline void append_sql_str(std::string& out, eosio::varint32 v)               { append_sql_int(out, v.value); }
+inline void append_sql_str(std::string& out, const std::string& v)            { out += v; }
+// clang-format on
+
+inline void append_sql_str(std::string& out, const eosio::checksum256& v) {
+    if (v.value != eosio::checksum256{}.value) {
+        const auto& bytes = v.extract_as_byte_array();
+        append_hex(out, bytes.data(), bytes.data() + bytes.size());
+    }
+}
+
+inline void append_sql_str(std::string& out, const __int128& v) {
+    char  buf[41];
+    char* end = eosio::int_to_decimal(v, buf);
+    out.append(buf, end);
+}
+
+inline void append_sql_str(std::string& out, const unsigned __int128& v) {
+    char  buf[41];
+    char* end = eosio::int_to_decimal(v, buf);
+    out.append(buf, end);
+}
+
+template <typename T>
+void append_bin_to_sql(std::string& out, eosio::input_stream& bin) {
+    T v;
+    from_bin(v, bin);
+    append_sql_str(out, v);
+}
+
+/// strings are copied straight from the stream
+template <>
+inline void append_bin_to_sql<std::string>(std::string& out, eosio::input_stream& bin) {
+    uint32_t size;
+    eosio::varuint32_from_bin(size, bin);
+    eosio::check(size <= bin.end - bin.pos, "invalid string size");
+    out.append(bin.pos, size);
+    bin.pos += size;
+}
+
 template <>
 inline std::string bin_to_sql<eosio::bytes>(eosio::input_stream& bin) {
     uint32_t size;
@@ -146,6 +222,136 @@ inline std::string bin_to_sql<eosio::bytes>(eosio::input_stream& bin) {
     return quote_bytea(result);
 }
 
+template <>
+inline void append_bin_to_sql<eosio::bytes>(std::string& out, eosio::input_stream& bin) {
+    uint32_t size;
+    eosio::varuint32_from_bin(size, bin);
+    eosio::check(size <= bin.end - bin.pos, "invalid bytes size");
+    out += "\\\\x";
+    append_hex(out, reinterpret_cast<const uint8_t*>(bin.pos), reinterpret_cast<const uint8_t*>(bin.pos + size));
+    bin.pos += size;
+}
+
+/// PostgreSQL binary COPY encoding. Every value is written as a big-endian int32 length followed by its payload, or a length of
+/// -1 for null. Types without an overload below are sent as text, which matches the varchar and enum columns they map to.
+template <typename T>
+void append_be(std::string& out, T v) {
+    static_assert(std::is_integral_v<T>);
+    using U = std::make_unsigned_t<T>;
+    for (int shift = 8 * (sizeof(T) - 1); shift >= 0; shift -= 8)
+        out += char(uint8_t(U(v) >> shift));
+}
+
+inline void patch_be32(std::string& out, std::size_t pos, uint32_t v) {
+    for (int i = 0; i < 4; ++i)
+        out[pos + i] = char(uint8_t(v >> (8 * (3 - i))));
+}
+
+/// reserves the length of a binary value; end_pg_value() fills it in
+inline std::size_t begin_pg_value(std::string& out) {
+    auto pos = out.size();
+    out.append(4, '\0');
+    return pos;
+}
+
+inline void end_pg_value(std::string& out, std::size_t pos) { patch_be32(out, pos, out.size() - pos - 4); }
+
+inline void append_pg_null(std::string& out) { append_be<int32_t>(out, -1); }
+
+template <typename T>
+void append_pg_fixed(std::string& out, T v) {
+    append_be<int32_t>(out, sizeof(T));
+    append_be(out, v);
+}
+
+/// numeric: ndigits, weight, sign, dscale, then base-10000 digits starting with the most significant
+inline void append_pg_numeric(std::string& out, unsigned __int128 v, bool negative) {
+    uint16_t digits[10];
+    int      n = 0;
+    for (; v; v /= 10000)
+        digits[n++] = uint16_t(v % 10000);
+    int trailing = 0;
+    while (trailing < n && !digits[trailing])
+        ++trailing;
+    int16_t ndigits = n - trailing;
+    append_be<int32_t>(out, 8 + 2 * ndigits);
+    append_be<int16_t>(out, ndigits);
+    append_be<int16_t>(out, n ? n - 1 : 0);
+    append_be<uint16_t>(out, negative ? 0x4000 : 0);
+    append_be<uint16_t>(out, 0);
+    for (int i = n - 1; i >= trailing; --i)
+        append_be<int16_t>(out, digits[i]);
+}
+
+/// timestamp: microseconds since 2000-01-01; unset times are null, as in the text format
+inline void append_pg_timestamp(std::string& out, int64_t unix_us) {
+    if (!unix_us)
+        return append_pg_null(out);
+    append_pg_fixed<int64_t>(out, unix_us - 946'684'800'000'000ll);
+}
+
+template <typename T>
+void append_pg_binary(std::string& out, const T& v) {
+    auto pos = begin_pg_value(out);
+    append_sql_str(out, v);
+    end_pg_value(out, pos);
+}
+
+// clang-format off
+inline void append_pg_binary(std::string& out, bool v)                        { append_be<int32_t>(out, 1); out += char(v); }
+inline void append_pg_binary(std::string& out, uint8_t v)                     { append_pg_fixed<int16_t>(out, v); }
+inline void append_pg_binary(std::string& out, int8_t v)                      { append_pg_fixed<int16_t>(out, v); }
+inline void append_pg_binary(std::string& out, uint16_t v)                    { append_pg_fixed<int32_t>(out, v); }
+inline void append_pg_binary(std::string& out, int16_t v)                     { append_pg_fixed<int16_t>(out, v); }
+inline void append_pg_binary(std::string& out, uint32_t v)                    { append_pg_fixed<int64_t>(out, v); }
+inline void append_pg_binary(std::string& out, int32_t v)                     { append_pg_fixed<int32_t>(out, v); }
+inline void append_pg_binary(std::string& out, uint64_t v)                    { append_pg_numeric(out, v, false); }
+inline void append_pg_binary(std::string& out, int64_t v)                     { append_pg_fixed<int64_t>(out, v); }
+inline void append_pg_binary(std::string& out, const unsigned __int128& v)    { append_pg_numeric(out, v, false); }
+inline void append_pg_binary(std::string& out, const __int128& v)             { append_pg_numeric(out, v < 0 ? -(unsigned __int128)v : v, v < 0); }
+inline void append_pg_binary(std::string& out, eosio::varuint32 v)            { append_pg_fixed<int64_t>(out, v.value); }
+inline void append_pg_binary(std::string& out, eosio::varint32 v)             { append_pg_fixed<int32_t>(out, v.value); }
+inline void append_pg_binary(std::string& out, eosio::time_point v)           { append_pg_timestamp(out, v.elapsed.count()); }
+inline void append_pg_binary(std::string& out, eosio::time_point_sec v)       { append_pg_timestamp(out, int64_t(v.utc_seconds) * 1'000'000); }
+inline void append_pg_binary(std::string& out, eosio::block_timestamp v)      { append_pg_timestamp(out, v.slot ? v.to_time_point().elapsed.count() : 0); }
+// clang-format on
+
+inline void append_pg_binary(std::string& out, double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    append_pg_fixed<uint64_t>(out, bits);
+}
+
+inline void append_pg_binary(std::string& out, const eosio::float128& v) {
+    const auto& bytes = v.extract_as_byte_array();
+    append_be<int32_t>(out, bytes.size());
+    out.append(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+}
+
+template <typename T>
+void append_bin_to_pg_binary(std::string& out, eosio::input_stream& bin) {
+    T v;
+    from_bin(v, bin);
+    append_pg_binary(out, v);
+}
+
+template <>
+inline void append_bin_to_pg_binary<std::string>(std::string& out, eosio::input_stream& bin) {
+    auto pos = begin_pg_value(out);
+    append_bin_to_sql<std::string>(out, bin);
+    end_pg_value(out, pos);
+}
+
+template <>
+inline void append_bin_to_pg_binary<eosio::bytes>(std::string& out, eosio::input_stream& bin) {
+    uint32_t size;
+    eosio::varuint32_from_bin(size, bin);
+    eosio::check(size <= bin.end - bin.pos, "invalid bytes size");
+    append_be<int32_t>(out, size);
+    out.append(bin.pos, size);
+    bin.pos += size;
+}
+
 struct type_names {
     const char *abi, *sql;
 };
@@ -184,5 +390,233 @@ template<> inline constexpr type_names names_for<eosio::ship_protocol::recurse_t
 template<> inline constexpr type_names names_for<eosio::ship_protocol::wasm_config>               = type_names{"wasm_config$","varchar"};
 // clang-format on
 
+/// The text of a query function's argument, before any quoting; bin_to_sql()'s text is already that except where COPY's text
+/// format escapes the bytea backslash or leaves unset times empty.
+template <typename T>
+std::string bin_to_param(eosio::input_stream& bin) {
+    return bin_to_sql<T>(bin);
+}
+
+inline std::string bytea_param(const char* begin, const char* end) {
+    std::string result = "\\x";
+    append_hex(result, reinterpret_cast<const uint8_t*>(begin), reinterpret_cast<const uint8_t*>(end));
+    return result;
+}
+
+template <>
+inline std::string bin_to_param<eosio::bytes>(eosio::input_stream& bin) {
+    uint32_t size;
+    eosio::varuint32_from_bin(size, bin);
+    eosio::check(size <= bin.end - bin.pos, "invalid bytes size");
+    auto result = bytea_param(bin.pos, bin.pos + size);
+    bin.pos += size;
+    return result;
+}
+
+template <>
+inline std::string bin_to_param<eosio::float128>(eosio::input_stream& bin) {
+    eosio::float128 v;
+    from_bin(v, bin);
+    const auto& bytes = v.extract_as_byte_array();
+    return bytea_param(reinterpret_cast<const char*>(bytes.data()), reinterpret_cast<const char*>(bytes.data() + bytes.size()));
+}
+
+template <>
+inline std::string bin_to_param<double>(eosio::input_stream& bin) {
+    double v;
+    from_bin(v, bin);
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.17g", v);
+    return buf;
+}
+
+template <>
+inline std::string bin_to_param<eosio::time_point>(eosio::input_stream& bin) {
+    eosio::time_point v;
+    from_bin(v, bin);
+    return eosio::microseconds_to_str(v.elapsed.count());
+}
+
+template <>
+inline std::string bin_to_param<eosio::time_point_sec>(eosio::input_stream& bin) {
+    eosio::time_point_sec v;
+    from_bin(v, bin);
+    return eosio::microseconds_to_str(uint64_t(v.utc_seconds) * 1'000'000);
+}
+
+template <>
+inline std::string bin_to_param<eosio::block_timestamp>(eosio::input_stream& bin) {
+    eosio::block_timestamp v;
+    from_bin(v, bin);
+    return eosio::microseconds_to_str(v.to_time_point().elapsed.count());
+}
+
+template <>
+inline std::string bin_to_param<std::optional<uint32_t>>(eosio::input_stream& bin) {
+    throw std::runtime_error("an optional can't be a query argument");
+}
+
+/// parses a timestamp column, as PostgreSQL prints it ("2020-01-02 03:04:05.5") or as sql_str() writes it
+/// ("2020-01-02T03:04:05.500"), into microseconds since 1970
+inline int64_t sql_to_utc_microseconds(const char* s) {
+    if (!s || !*s)
+        return 0;
+    int year, month, day, hour, minute, second, n = 0;
+    if (sscanf(s, "%4d-%2d-%2d%*1[ T]%2d:%2d:%2d%n", &year, &month, &day, &hour, &minute, &second, &n) != 6 || !n)
+        throw std::runtime_error("invalid timestamp: " + std::string(s));
+    int64_t     us = 0;
+    const char* p  = s + n;
+    if (*p == '.')
+        for (int64_t scale = 100'000; *++p >= '0' && *p <= '9'; scale /= 10)
+            us += (*p - '0') * scale;
+
+    // days from the civil date, counting years from March so leap days come last
+    int64_t y    = year - (month <= 2);
+    int64_t era  = (y >= 0 ? y : y - 399) / 400;
+    int64_t yoe  = y - era * 400;
+    int64_t doy  = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int64_t days = era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+    return (((days * 24 + hour) * 60 + minute) * 60 + second) * 1'000'000 + us;
+}
+
+/// bytea's hex output format, "\x0a0b"
+inline std::vector<char> sql_to_bytea(const char* s) {
+    std::vector<char> result;
+    if (!s || !*s)
+        return result;
+    if (s[0] != '\\' || s[1] != 'x')
+        throw std::runtime_error("expected bytea in hex format");
+    boost::algorithm::unhex(s + 2, s + strlen(s), std::back_inserter(result));
+    return result;
+}
+
+/// Fills v from a result column's text; s is null when the column is null, which reads as the type's default
+template <typename T>
+std::enable_if_t<std::is_integral_v<T>> sql_to_native(T& v, const char* s) {
+    v = 0;
+    if (!s || !*s)
+        return;
+    auto end = s + strlen(s);
+    auto r   = std::from_chars(s, end, v);
+    if (r.ec != std::errc{} || r.ptr != end)
+        throw std::runtime_error("invalid integer: " + std::string(s));
+}
+
+template <typename T>
+void sql_to_int128(T& v, const char* s) {
+    v = 0;
+    if (!s || !*s)
+        return;
+    bool              negative = *s == '-';
+    unsigned __int128 u        = 0;
+    for (auto p = s + negative; *p; ++p) {
+        if (*p < '0' || *p > '9')
+            throw std::runtime_error("invalid integer: " + std::string(s));
+        u = u * 10 + (*p - '0');
+    }
+    v = negative ? T(-u) : T(u);
+}
+
+// clang-format off
+inline void sql_to_native(bool& v, const char* s)                             { v = s && (*s == 't' || *s == '1'); }
+inline void sql_to_native(unsigned __int128& v, const char* s)                { sql_to_int128(v, s); }
+inline void sql_to_native(__int128& v, const char* s)                         { sql_to_int128(v, s); }
+inline void sql_to_native(double& v, const char* s)                           { v = s ? strtod(s, nullptr) : 0; }
+inline void sql_to_native(eosio::varuint32& v, const char* s)                 { sql_to_native(v.value, s); }
+inline void sql_to_native(eosio::varint32& v, const char* s)                  { sql_to_native(v.value, s); }
+inline void sql_to_native(eosio::name& v, const char* s)                      { v = s ? eosio::name{std::string_view{s}} : eosio::name{}; }
+inline void sql_to_native(eosio::checksum256& v, const char* s)               { v = sql_to_checksum256(s ? s : ""); }
+inline void sql_to_native(std::string& v, const char* s)                      { v = s ? s : ""; }
+inline void sql_to_native(eosio::time_point& v, const char* s)                { v = eosio::time_point{eosio::microseconds{sql_to_utc_microseconds(s)}}; }
+inline void sql_to_native(eosio::time_point_sec& v, const char* s)            { v = eosio::time_point_sec{uint32_t(sql_to_utc_microseconds(s) / 1'000'000)}; }
+inline void sql_to_native(eosio::bytes& v, const char* s)                     { v.data = sql_to_bytea(s); }
+// clang-format on
+
+inline void sql_to_native(eosio::block_timestamp& v, const char* s) {
+    eosio::time_point t;
+    sql_to_native(t, s);
+    v = t.elapsed.count() ? eosio::block_timestamp{t} : eosio::block_timestamp{};
+}
+
+inline void sql_to_native(eosio::ship_protocol::transaction_status& v, const char* s) {
+    using eosio::ship_protocol::transaction_status;
+    for (uint8_t i = 0; i <= uint8_t(transaction_status::expired); ++i) {
+        if (s && to_string(transaction_status(i)) == std::string_view{s}) {
+            v = transaction_status(i);
+            return;
+        }
+    }
+    throw std::runtime_error("invalid transaction_status: " + std::string(s ? s : "null"));
+}
+
+/// Appends the binary form of a query function's result column, given its text or null
+template <typename T>
+void sql_to_bin(std::vector<char>& bin, const char* s) {
+    T v{};
+    sql_to_native(v, s);
+    eosio::convert_to_bin(v, bin);
+}
+
+template <>
+inline void sql_to_bin<eosio::float128>(std::vector<char>& bin, const char* s) {
+    auto bytes = sql_to_bytea(s);
+    bytes.resize(16);
+    bin.insert(bin.end(), bytes.begin(), bytes.end());
+}
+
+template <>
+inline void sql_to_bin<eosio::ship_protocol::transaction_status>(std::vector<char>& bin, const char* s) {
+    eosio::ship_protocol::transaction_status v;
+    sql_to_native(v, s);
+    bin.push_back(char(v));
+}
+
+template <>
+inline void sql_to_bin<std::optional<uint32_t>>(std::vector<char>& bin, const char* s) {
+    bin.push_back(s != nullptr);
+    if (s)
+        sql_to_bin<uint32_t>(bin, s);
+}
+
+/// A field type of wasm-ql's query config: how an argument becomes a query function's parameter, and how a result column
+/// becomes binary again
+struct type {
+    const char* name                                          = "";
+    std::string (*bin_to_param)(eosio::input_stream& bin)     = nullptr;
+    void (*sql_to_bin)(std::vector<char>& bin, const char* s) = nullptr;
+};
+
+struct defs;
+using field  = query_config::field<defs>;
+using key    = query_config::key<defs>;
+using table  = query_config::table<defs>;
+using index  = query_config::index<defs>;
+using query  = query_config::query<defs>;
+using config = query_config::config<defs>;
+
+struct defs {
+    using type  = pg::type;
+    using field = pg::field;
+    using key   = pg::key;
+    using table = pg::table;
+    using index = pg::index;
+    using query = pg::query;
+};
+
+template <typename... T>
+std::map<std::string, type> make_types() {
+    return {{names_for<T>.abi, type{names_for<T>.sql, bin_to_param<T>, sql_to_bin<T>}}...};
+}
+
+inline const std::map<std::string, type> abi_type_to_sql_type = [] {
+    namespace ship = eosio::ship_protocol;
+    auto result    = make_types<
+        bool, uint8_t, int8_t, uint16_t, int16_t, uint32_t, int32_t, uint64_t, int64_t, unsigned __int128, __int128, double,
+        eosio::float128, eosio::varuint32, eosio::varint32, eosio::name, eosio::checksum256, std::string, eosio::time_point,
+        eosio::time_point_sec, eosio::block_timestamp, eosio::bytes, ship::transaction_status>();
+    result["uint32?"] = {"bigint", bin_to_param<std::optional<uint32_t>>, sql_to_bin<std::optional<uint32_t>>};
+    return result;
+}();
+
 } // namespace pg
 } // namespace state_history
@@ -3,9 +3,18 @@
 #pragma once
 #include "state_history_kv.hpp"
 
+#include <algorithm>
 #include <boost/filesystem.hpp>
 #include <fc/exception/exception.hpp>
+#include <map>
+#include <mutex>
+#include <set>
+#include <rocksdb/compaction_filter.h>
 #include <rocksdb/db.h>
+#include <rocksdb/filter_policy.h>
+#include <rocksdb/slice_transform.h>
+#include <rocksdb/sst_file_writer.h>
+#include <rocksdb/table.h>
 
 namespace state_history {
 namespace rdb {
@@ -20,11 +29,95 @@ inline void check(rocksdb::Status s, const char* prefix) {
         throw std::runtime_error(std::string(prefix) + s.ToString());
 }
 
+// key_tag::index, table_name, index_name
+inline constexpr size_t index_prefix_size = 17;
+
+// ~block_num, !present_k
+inline constexpr size_t index_suffix_size = 5;
+
+/// rows, and index entries, which compactions may drop
+struct compaction_trim {
+    uint32_t               first  = 0;  // drop blocks before this
+    std::set<eosio::name> tables = {}; // tables whose rows never outlive their block, because they have no trim index
+};
+
+struct compaction_trim_state {
+    std::mutex                             mutex;
+    std::shared_ptr<const compaction_trim> trim;
+
+    std::shared_ptr<const compaction_trim> get() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return trim;
+    }
+
+    void set(std::shared_ptr<const compaction_trim> t) {
+        std::lock_guard<std::mutex> lock(mutex);
+        trim = std::move(t);
+    }
+};
+
+/// Drops rows and index entries of compaction_trim::tables before compaction_trim::first. Each compaction uses the trim which
+/// was current when it started.
+struct trim_filter : rocksdb::CompactionFilter {
+    std::shared_ptr<const compaction_trim> trim;
+
+    trim_filter(std::shared_ptr<const compaction_trim> trim)
+        : trim(std::move(trim)) {}
+
+    bool Filter(int, const rocksdb::Slice& key, const rocksdb::Slice&, std::string*, bool*) const override {
+        eosio::input_stream bin{key.data(), key.data() + key.size()};
+        uint32_t            block_num;
+        eosio::name         table_name;
+        bool                present_k;
+        auto                tag = kv::bin_to_key_tag(bin);
+        if (tag == kv::key_tag::table) {
+            kv::read_table_prefix(bin, block_num, table_name, present_k);
+        } else if (tag == kv::key_tag::index && key.size() >= index_prefix_size + index_suffix_size) {
+            table_name = kv::key_to_native<eosio::name>(bin);
+            eosio::input_stream suffix{key.data() + key.size() - index_suffix_size, key.data() + key.size()};
+            kv::read_index_suffix(suffix, block_num, present_k);
+        } else {
+            return false;
+        }
+        return block_num < trim->first && trim->tables.count(table_name);
+    }
+
+    const char* Name() const override { return "state_history::rdb::trim_filter"; }
+};
+
+struct trim_filter_factory : rocksdb::CompactionFilterFactory {
+    std::shared_ptr<compaction_trim_state> state;
+
+    trim_filter_factory(std::shared_ptr<compaction_trim_state> state)
+        : state(std::move(state)) {}
+
+    std::unique_ptr<rocksdb::CompactionFilter> CreateCompactionFilter(const rocksdb::CompactionFilter::Context&) override {
+        auto trim = state->get();
+        if (!trim || !trim->first)
+            return nullptr;
+        return std::make_unique<trim_filter>(std::move(trim));
+    }
+
+    const char* Name() const override { return "state_history::rdb::trim_filter_factory"; }
+};
+
+/// key_tag::table keys, including fill.status and recvd.block, live in the default column family. key_tag::index keys live in
+/// the "index" family, which has a bloom filter on index_prefix_size.
 struct database {
-    std::shared_ptr<rocksdb::Statistics> stats;
-    std::unique_ptr<rocksdb::DB>         db;
+    std::string                                               path;
+    std::shared_ptr<rocksdb::Statistics>                      stats;
+    std::unique_ptr<rocksdb::DB>                              db;
+    std::vector<std::unique_ptr<rocksdb::ColumnFamilyHandle>> families;
+    uint64_t                                                  num_ingested = 0;
+    std::shared_ptr<compaction_trim_state>                    trim_state   = std::make_shared<compaction_trim_state>();
+    bool                                                      secondary    = false;
 
-    database(const char* db_path, std::optional<uint32_t> threads, std::optional<uint32_t> max_open_files, bool fast_reads) {
+    /// With secondary_path, opens a read-only secondary instance of the primary at db_path, which follows it through catch_up()
+    database(
+        const char* db_path, std::optional<uint32_t> threads, std::optional<uint32_t> max_open_files, bool fast_reads,
+        const char* secondary_path = nullptr, bool mmap_reads = false)
+        : path(db_path)
+        , secondary(secondary_path) {
         rocksdb::DB*     p;
         rocksdb::Options options;
         // stats = options.statistics = rocksdb::CreateDBStatistics();
@@ -53,17 +146,83 @@ struct database {
         }
         if (max_open_files)
             options.max_open_files = *max_open_files;
+        if (secondary)
+            options.max_open_files = -1; // required by secondary instances
+        options.allow_mmap_reads               = mmap_reads;
+        options.create_missing_column_families = true;
+        options.compaction_filter_factory      = std::make_shared<trim_filter_factory>(trim_state);
+
+        // content is mostly appended and read by primary key; compress it where the build supports it
+        rocksdb::ColumnFamilyOptions    content_options(options);
+        rocksdb::BlockBasedTableOptions content_table;
+        content_table.block_size = 64 << 10;
+        content_options.table_factory.reset(rocksdb::NewBlockBasedTableFactory(content_table));
+        auto supported = rocksdb::GetSupportedCompressions();
+        if (std::find(supported.begin(), supported.end(), rocksdb::kLZ4Compression) != supported.end())
+            for (size_t i = 2; i < content_options.compression_per_level.size(); ++i)
+                content_options.compression_per_level[i] = rocksdb::kLZ4Compression;
+
+        // indexes are scanned within a single table and index
+        rocksdb::ColumnFamilyOptions    index_options(options);
+        rocksdb::BlockBasedTableOptions index_table;
+        index_table.block_size          = 4 << 10;
+        index_table.whole_key_filtering = false;
+        index_table.filter_policy.reset(rocksdb::NewBloomFilterPolicy(10));
+        index_options.table_factory.reset(rocksdb::NewBlockBasedTableFactory(index_table));
+        index_options.prefix_extractor.reset(rocksdb::NewFixedPrefixTransform(index_prefix_size));
 
-        check(rocksdb::DB::Open(options, db_path, &p), "rocksdb::DB::Open: ");
+        std::vector<rocksdb::ColumnFamilyDescriptor> descriptors{
+            {rocksdb::kDefaultColumnFamilyName, content_options}, {"index", index_options}};
+        std::vector<rocksdb::ColumnFamilyHandle*> handles;
+        if (secondary) {
+            ilog("open ${p} as a secondary instance in ${s}", ("p", db_path)("s", secondary_path));
+            check(
+                rocksdb::DB::OpenAsSecondary(options, db_path, secondary_path, descriptors, &handles, &p),
+                "rocksdb::DB::OpenAsSecondary: ");
+        } else {
+            check(rocksdb::DB::Open(options, db_path, descriptors, &handles, &p), "rocksdb::DB::Open: ");
+        }
         db.reset(p);
+        for (auto* h : handles)
+            families.emplace_back(h);
+
+        std::unique_ptr<rocksdb::Iterator> it{db->NewIterator(rocksdb::ReadOptions(), content())};
+        char                               tag = (char)kv::key_tag::index;
+        it->Seek({&tag, 1});
+        if (it->Valid() && it->key()[0] == tag)
+            throw std::runtime_error(std::string(db_path) + " has indexes in the default column family; it needs to be refilled");
         ilog("database opened");
     }
 
+    rocksdb::ColumnFamilyHandle* content() { return families[0].get(); }
+    rocksdb::ColumnFamilyHandle* index() { return families[1].get(); }
+
+    rocksdb::ColumnFamilyHandle* family(rocksdb::Slice key) {
+        return key.size() && key[0] == (char)kv::key_tag::index ? index() : content();
+    }
+
+    rocksdb::ColumnFamilyHandle* family(uint32_t id) {
+        for (auto& f : families)
+            if (f->GetID() == id)
+                return f.get();
+        throw std::runtime_error("unknown column family " + std::to_string(id));
+    }
+
+    /// iterates over the family holding lower_bound; ranges that don't fit in one index prefix need a total order seek
+    std::unique_ptr<rocksdb::Iterator> iterate(rocksdb::Slice lower_bound) {
+        rocksdb::ReadOptions opt;
+        opt.total_order_seek = lower_bound.size() < index_prefix_size;
+        return std::unique_ptr<rocksdb::Iterator>{db->NewIterator(opt, family(lower_bound))};
+    }
+
     database(const database&) = delete;
     database(database&&)      = delete;
     database& operator=(const database&) = delete;
     database& operator=(database&&) = delete;
 
+    /// secondary instances only: catch up with the primary's writes
+    void catch_up() { check(db->TryCatchUpWithPrimary(), "TryCatchUpWithPrimary: "); }
+
     void flush(bool allow_write_stall, bool wait) {
         rocksdb::FlushOptions op;
         op.allow_write_stall = allow_write_stall;
@@ -74,11 +233,11 @@ struct database {
 
 inline rocksdb::Slice to_slice(const std::vector<char>& v) { return {v.data(), v.size()}; }
 
-inline rocksdb::Slice to_slice(abieos::input_buffer v) { return {v.pos, size_t(v.end - v.pos)}; }
+inline rocksdb::Slice to_slice(eosio::input_stream v) { return {v.pos, size_t(v.end - v.pos)}; }
 
-inline abieos::input_buffer to_input_buffer(rocksdb::Slice v) { return {v.data(), v.data() + v.size()}; }
+inline eosio::input_stream to_input_stream(rocksdb::Slice v) { return eosio::input_stream{v.data(), v.data() + v.size()}; }
 
-inline abieos::input_buffer to_input_buffer(rocksdb::PinnableSlice& v) { return {v.data(), v.data() + v.size()}; }
+inline eosio::input_stream to_input_stream(rocksdb::PinnableSlice& v) { return eosio::input_stream{v.data(), v.data() + v.size()}; }
 
 inline void put(rocksdb::WriteBatch& batch, const std::vector<char>& key, const std::vector<char>& value, bool overwrite = false) {
     // !!! remove overwrite
@@ -87,7 +246,32 @@ inline void put(rocksdb::WriteBatch& batch, const std::vector<char>& key, const
 
 template <typename T>
 void put(rocksdb::WriteBatch& batch, const std::vector<char>& key, const T& value, bool overwrite = false) {
-    put(batch, key, abieos::native_to_bin(value), overwrite);
+    put(batch, key, eosio::convert_to_bin(value), overwrite);
+}
+
+/// puts into the column family which holds key
+inline void put(database& db, rocksdb::WriteBatch& batch, rocksdb::Slice key, rocksdb::Slice value) {
+    batch.Put(db.family(key), key, value);
+}
+
+inline void erase(database& db, rocksdb::WriteBatch& batch, rocksdb::Slice key) { batch.Delete(db.family(key), key); }
+
+/// appends src's puts and deletes to dest
+inline void append(database& db, rocksdb::WriteBatch& dest, const rocksdb::WriteBatch& src) {
+    struct handler : rocksdb::WriteBatch::Handler {
+        database&            db;
+        rocksdb::WriteBatch& dest;
+
+        handler(database& db, rocksdb::WriteBatch& dest)
+            : db(db)
+            , dest(dest) {}
+
+        rocksdb::Status PutCF(uint32_t cf, const rocksdb::Slice& key, const rocksdb::Slice& value) override {
+            return dest.Put(db.family(cf), key, value);
+        }
+        rocksdb::Status DeleteCF(uint32_t cf, const rocksdb::Slice& key) override { return dest.Delete(db.family(cf), key); }
+    } h{db, dest};
+    check(src.Iterate(&h), "append batch: ");
 }
 
 inline void write(database& db, rocksdb::WriteBatch& batch) {
@@ -98,16 +282,57 @@ inline void write(database& db, rocksdb::WriteBatch& batch) {
     batch.Clear();
 }
 
+/// Writes batch's puts to a sorted SST file and ingests it, bypassing the WAL and memtable. Falls back to write() if batch
+/// contains deletes. The file is moved into the database, so it's written within the database directory.
+inline void ingest(database& db, rocksdb::WriteBatch& batch) {
+    struct handler : rocksdb::WriteBatch::Handler {
+        std::map<uint32_t, std::vector<std::pair<rocksdb::Slice, rocksdb::Slice>>> rows; // by column family
+        bool                                                                        has_deletes = false;
+
+        rocksdb::Status PutCF(uint32_t cf, const rocksdb::Slice& key, const rocksdb::Slice& value) override {
+            rows[cf].emplace_back(key, value);
+            return {};
+        }
+        rocksdb::Status DeleteCF(uint32_t cf, const rocksdb::Slice& key) override {
+            has_deletes = true;
+            return {};
+        }
+    } h;
+    check(batch.Iterate(&h), "ingest: ");
+    if (h.has_deletes)
+        return write(db, batch);
+
+    for (auto& [id, rows] : h.rows) {
+        // SstFileWriter needs strictly increasing keys; the last put of a key wins, as it would in the batch
+        auto* family = db.family(id);
+        auto  cmp    = family->GetComparator();
+        std::stable_sort(rows.begin(), rows.end(), [&](auto& a, auto& b) { return cmp->Compare(a.first, b.first) < 0; });
+
+        auto                   file = db.path + "/ingest-" + std::to_string(db.num_ingested++) + ".sst";
+        rocksdb::SstFileWriter writer(rocksdb::EnvOptions(), db.db->GetOptions(family), family);
+        check(writer.Open(file), "ingest: ");
+        for (size_t i = 0; i < rows.size(); ++i)
+            if (i + 1 == rows.size() || cmp->Compare(rows[i].first, rows[i + 1].first))
+                check(writer.Put(rows[i].first, rows[i].second), "ingest: ");
+        check(writer.Finish(), "ingest: ");
+
+        rocksdb::IngestExternalFileOptions opt;
+        opt.move_files = true;
+        check(db.db->IngestExternalFile(family, {file}, opt), "ingest: ");
+    }
+    batch.Clear();
+}
+
 inline bool exists(database& db, rocksdb::Slice key) {
     rocksdb::PinnableSlice v;
-    auto                   stat = db.db->Get(rocksdb::ReadOptions(), db.db->DefaultColumnFamily(), key, &v);
+    auto                   stat = db.db->Get(rocksdb::ReadOptions(), db.family(key), key, &v);
     if (stat.IsNotFound())
         return false;
     check(stat, "exists: ");
     return true;
 }
 
-inline std::optional<abieos::input_buffer> get_raw(rocksdb::Iterator& it, const std::vector<char>& key, bool required) {
+inline std::optional<eosio::input_stream> get_raw(rocksdb::Iterator& it, const std::vector<char>& key, bool required) {
     it.Seek(to_slice(key));
     auto stat = it.status();
     if (stat.IsNotFound() && !required)
@@ -120,14 +345,14 @@ inline std::optional<abieos::input_buffer> get_raw(rocksdb::Iterator& it, const
         else
             return {};
     }
-    return to_input_buffer(it.value());
+    return to_input_stream(it.value());
 }
 
 template <typename T>
 std::optional<T> get(rocksdb::Iterator& it, const std::vector<char>& key, bool required) {
     auto bin = get_raw(it, key, required);
     if (bin)
-        return abieos::bin_to_native<T>(*bin);
+        return eosio::from_bin<T>(*bin);
     else
         return {};
 }
@@ -135,18 +360,18 @@ std::optional<T> get(rocksdb::Iterator& it, const std::vector<char>& key, bool r
 template <typename T>
 std::optional<T> get(database& db, const std::vector<char>& key, bool required) {
     rocksdb::PinnableSlice v;
-    auto                   stat = db.db->Get(rocksdb::ReadOptions(), db.db->DefaultColumnFamily(), to_slice(key), &v);
+    auto                   stat = db.db->Get(rocksdb::ReadOptions(), db.family(to_slice(key)), to_slice(key), &v);
     if (stat.IsNotFound() && !required)
         return {};
     check(stat, "get: ");
-    auto bin = to_input_buffer(v);
-    return abieos::bin_to_native<T>(bin);
+    auto bin = to_input_stream(v);
+    return eosio::from_bin<T>(bin);
 }
 
 // Loop through keys in range [lower_bound, upper_bound], inclusive. lower_bound and upper_bound may
 // be partial keys (prefixes). They may be different sizes. Does not skip keys with duplicate prefixes.
 //
-// bool f(abieos::input_buffer key, abieos::input_buffer data);
+// bool f(eosio::input_stream key, eosio::input_stream data);
 // * return true to continue loop
 // * return false to break out of loop
 template <typename F>
@@ -155,7 +380,7 @@ void for_each(rocksdb::Iterator& it, const std::vector<char>& lower_bound, const
         auto k = it.key();
         if (memcmp(k.data(), upper_bound.data(), std::min(k.size(), upper_bound.size())) > 0)
             break;
-        if (!f(to_input_buffer(k), to_input_buffer(it.value())))
+        if (!f(to_input_stream(k), to_input_stream(it.value())))
             return;
     }
     check(it.status(), "for_each: ");
@@ -163,14 +388,14 @@ void for_each(rocksdb::Iterator& it, const std::vector<char>& lower_bound, const
 
 template <typename F>
 void for_each(database& db, const std::vector<char>& lower_bound, const std::vector<char>& upper_bound, F f) {
-    std::unique_ptr<rocksdb::Iterator> it{db.db->NewIterator(rocksdb::ReadOptions())};
+    auto it = db.iterate(to_slice(lower_bound));
     for_each(*it, lower_bound, upper_bound, f);
 }
 
 // Loop through keys in range [lower_bound, upper_bound], inclusive. Skip keys with duplicate prefix.
 // The prefix is the same size as lower_bound and upper_bound, which must have the same size.
 //
-// bool f(const std::vector& prefix, abieos::input_buffer whole_key, abieos::input_buffer data);
+// bool f(const std::vector& prefix, eosio::input_stream whole_key, eosio::input_stream data);
 // * return true to continue loop
 // * return false to break out of loop
 template <typename F>
@@ -185,7 +410,7 @@ void for_each_subkey(rocksdb::Iterator& it, std::vector<char> lower_bound, const
         if (k.size() < lower_bound.size())
             throw std::runtime_error("for_each_subkey: found key with size < prefix");
         memmove(lower_bound.data(), k.data(), lower_bound.size());
-        if (!f(std::as_const(lower_bound), to_input_buffer(k), to_input_buffer(it.value())))
+        if (!f(std::as_const(lower_bound), to_input_stream(k), to_input_stream(it.value())))
             return;
         kv::inc_key(lower_bound);
         it.Seek(to_slice(lower_bound));
@@ -195,7 +420,7 @@ void for_each_subkey(rocksdb::Iterator& it, std::vector<char> lower_bound, const
 
 template <typename F>
 void for_each_subkey(database& db, std::vector<char> lower_bound, const std::vector<char>& upper_bound, F f) {
-    std::unique_ptr<rocksdb::Iterator> it{db.db->NewIterator(rocksdb::ReadOptions())};
+    auto it = db.iterate(to_slice(lower_bound));
     for_each_subkey(*it, std::move(lower_bound), upper_bound, f);
 }
 
@@ -1,21 +1,46 @@
 // copyright defined in LICENSE.txt
 
 #include "wasm_ql.hpp"
+#include "metrics.hpp"
+#include "response_cache.hpp"
 
+#include <boost/filesystem.hpp>
 #include <fc/log/logger.hpp>
 #include <fc/scoped_exit.hpp>
 
-using namespace abieos::literals;
+#include <algorithm>
+
+using namespace eosio::literals;
 
 namespace wasm_ql {
 
 struct callbacks;
-using backend_t = eosio::vm::backend<callbacks>;
-using rhf_t     = eosio::vm::registered_host_functions<callbacks>;
+using rhf_t         = eosio::vm::registered_host_functions<callbacks>;
+using backend_t     = eosio::vm::backend<rhf_t, eosio::vm::interpreter>;
+using jit_backend_t = eosio::vm::backend<rhf_t, eosio::vm::jit>;
+
+static const uint32_t max_cursors    = 64;
+static const uint32_t max_batch_rows = 1000;
+
+struct wasm_ql_metrics {
+    metrics::histogram& module_load =
+        metrics::get_histogram("wasmql_module_load_seconds", "Time to parse a server wasm and resolve its host functions");
+    metrics::histogram& execution =
+        metrics::get_histogram("wasmql_execution_seconds", "Time to run a query's wasm, including its database time");
+    metrics::histogram& database = metrics::get_histogram("wasmql_database_seconds", "Time spent in query_database and its cursors");
+    metrics::counter&   fork_retries =
+        metrics::get_counter("wasmql_fork_retries_total", "Queries run again because the head switched forks");
+
+    static wasm_ql_metrics& get() {
+        static wasm_ql_metrics m;
+        return m;
+    }
+};
 
 struct callbacks {
     wasm_ql::thread_state& thread_state;
-    backend_t&             backend;
+    void*                  backend;
+    uint32_t (*call_alloc)(void* backend, callbacks* cb, uint32_t cb_alloc, uint32_t cb_alloc_data, uint32_t size);
 
     void check_bounds(const char* begin, const char* end) {
         if (begin > end)
@@ -25,24 +50,21 @@ struct callbacks {
 
     char* alloc(uint32_t cb_alloc_data, uint32_t cb_alloc, uint32_t size) {
         // todo: verify cb_alloc isn't in imports
-        auto result = backend.get_context().execute_func_table(
-            this, eosio::vm::interpret_visitor(backend.get_context()), cb_alloc, cb_alloc_data, size);
-        if (!result || !result->is_a<eosio::vm::i32_const_t>())
-            throw std::runtime_error("cb_alloc returned incorrect type");
-        char* begin = thread_state.wa.get_base_ptr<char>() + result->to_ui32();
+        char* begin = thread_state.wa.get_base_ptr<char>() + call_alloc(backend, this, cb_alloc, cb_alloc_data, size);
         check_bounds(begin, begin + size);
         return begin;
     }
 
     void abort() { throw std::runtime_error("called abort"); }
 
-    void eosio_assert_message(bool test, const char* msg, size_t msg_len) {
+    void eosio_assert_message(bool test, const char* msg, uint32_t msg_len) {
         // todo: pass assert message through RPC API
         if (!test)
             throw std::runtime_error("assert failed");
     }
 
     void get_database_status(uint32_t cb_alloc_data, uint32_t cb_alloc) {
+        thread_state.read_status = true;
         auto data = alloc(cb_alloc_data, cb_alloc, thread_state.database_status.size());
         memcpy(data, thread_state.database_status.data(), thread_state.database_status.size());
     }
@@ -57,13 +79,100 @@ struct callbacks {
         thread_state.reply.assign(begin, end);
     }
 
+    // [begin, end) holds (wasm address, size) pairs; gather them into the reply
+    void set_output_pieces(const char* begin, const char* end) {
+        check_bounds(begin, end);
+        const auto num_pieces = (end - begin) / (2 * sizeof(uint32_t));
+        auto       piece      = [&](size_t i) {
+            uint32_t p[2];
+            memcpy(p, begin + i * sizeof(p), sizeof(p));
+            auto piece_begin = thread_state.wa.get_base_ptr<char>() + p[0];
+            check_bounds(piece_begin, piece_begin + p[1]);
+            return std::make_pair(piece_begin, piece_begin + p[1]);
+        };
+        size_t size = 0;
+        for (size_t i = 0; i < num_pieces; ++i)
+            size += piece(i).second - piece(i).first;
+        thread_state.reply.clear();
+        thread_state.reply.reserve(size);
+        for (size_t i = 0; i < num_pieces; ++i) {
+            auto [piece_begin, piece_end] = piece(i);
+            thread_state.reply.insert(thread_state.reply.end(), piece_begin, piece_end);
+        }
+    }
+
     void query_database(const char* req_begin, const char* req_end, uint32_t cb_alloc_data, uint32_t cb_alloc) {
         check_bounds(req_begin, req_end);
-        auto result = thread_state.query_session->query_database({req_begin, req_end}, thread_state.fill_status.head);
-        auto data   = alloc(cb_alloc_data, cb_alloc, result.size());
+        std::vector<char> result;
+        {
+            metrics::scoped_timer timer{wasm_ql_metrics::get().database};
+            result = thread_state.query_session->query_database({req_begin, req_end}, thread_state.fill_status.head);
+        }
+        auto data = alloc(cb_alloc_data, cb_alloc, result.size());
         memcpy(data, result.data(), result.size());
     }
 
+    uint32_t query_database_open(const char* req_begin, const char* req_end) {
+        check_bounds(req_begin, req_end);
+        // closed cursors' slots are reused, so only open cursors count against max_cursors
+        auto&  cursors = thread_state.cursors;
+        size_t slot    = std::find(cursors.begin(), cursors.end(), nullptr) - cursors.begin();
+        if (slot == cursors.size() && cursors.size() >= max_cursors)
+            throw std::runtime_error("too many query cursors");
+        metrics::scoped_timer timer{wasm_ql_metrics::get().database};
+        auto cursor = thread_state.query_session->open_query({req_begin, req_end}, thread_state.fill_status.head);
+        if (slot == cursors.size())
+            cursors.push_back(std::move(cursor));
+        else
+            cursors[slot] = std::move(cursor);
+        return slot;
+    }
+
+    query_cursor& get_cursor(uint32_t cursor) {
+        if (cursor >= thread_state.cursors.size() || !thread_state.cursors[cursor])
+            throw std::runtime_error("invalid query cursor");
+        return *thread_state.cursors[cursor];
+    }
+
+    void query_database_next(uint32_t cursor, uint32_t max_rows, uint32_t cb_alloc_data, uint32_t cb_alloc) {
+        auto& c = get_cursor(cursor);
+        thread_state.batch.clear();
+        {
+            metrics::scoped_timer timer{wasm_ql_metrics::get().database};
+            c.next_batch(thread_state.batch, std::min(max_rows, max_batch_rows));
+        }
+        auto data = alloc(cb_alloc_data, cb_alloc, thread_state.batch.size());
+        memcpy(data, thread_state.batch.data(), thread_state.batch.size());
+    }
+
+    void query_database_close(uint32_t cursor) {
+        get_cursor(cursor);
+        thread_state.cursors[cursor].reset();
+    }
+
+    bool contract_row_to_json(
+        uint64_t account, uint32_t abi_block, const char* abi_begin, const char* abi_end, uint64_t table, const char* row_begin,
+        const char* row_end, uint32_t cb_alloc_data, uint32_t cb_alloc) {
+        check_bounds(abi_begin, abi_end);
+        check_bounds(row_begin, row_end);
+        auto abi = thread_state.shared->abi_cache->get(eosio::name{account}, abi_block, {abi_begin, abi_end});
+        if (!abi)
+            return false;
+        auto type = abi->table_types.find(table);
+        if (type == abi->table_types.end())
+            return false;
+        std::string         json;
+        eosio::input_stream row{row_begin, row_end};
+        try {
+            json = type->second->bin_to_json(row);
+        } catch (const std::exception&) {
+            return false;
+        }
+        auto data = alloc(cb_alloc_data, cb_alloc, json.size());
+        memcpy(data, json.data(), json.size());
+        return true;
+    }
+
     void print_range(const char* begin, const char* end) {
         check_bounds(begin, end);
         if (thread_state.shared->console)
@@ -71,27 +180,49 @@ struct callbacks {
     }
 }; // callbacks
 
+/// calls the wasm's cb_alloc; the interpreter and the jit run table functions with different visitors
+template <typename Backend>
+uint32_t call_cb_alloc(void* backend, callbacks* cb, uint32_t cb_alloc, uint32_t cb_alloc_data, uint32_t size) {
+    auto& ctx    = static_cast<Backend*>(backend)->get_context();
+    auto  result = [&] {
+        if constexpr (std::is_same_v<Backend, jit_backend_t>)
+            return ctx.execute_func_table(cb, eosio::vm::jit_visitor(42), cb_alloc, cb_alloc_data, size);
+        else
+            return ctx.execute_func_table(cb, eosio::vm::interpret_visitor(ctx), cb_alloc, cb_alloc_data, size);
+    }();
+    if (!result || !result->template is_a<eosio::vm::i32_const_t>())
+        throw std::runtime_error("cb_alloc returned incorrect type");
+    return result->to_ui32();
+}
+
 void register_callbacks() {
-    rhf_t::add<callbacks, &callbacks::abort, eosio::vm::wasm_allocator>("env", "abort");
-    rhf_t::add<callbacks, &callbacks::eosio_assert_message, eosio::vm::wasm_allocator>("env", "eosio_assert_message");
-    rhf_t::add<callbacks, &callbacks::get_database_status, eosio::vm::wasm_allocator>("env", "get_database_status");
-    rhf_t::add<callbacks, &callbacks::get_input_data, eosio::vm::wasm_allocator>("env", "get_input_data");
-    rhf_t::add<callbacks, &callbacks::set_output_data, eosio::vm::wasm_allocator>("env", "set_output_data");
-    rhf_t::add<callbacks, &callbacks::query_database, eosio::vm::wasm_allocator>("env", "query_database");
-    rhf_t::add<callbacks, &callbacks::print_range, eosio::vm::wasm_allocator>("env", "print_range");
+    rhf_t::add<&callbacks::abort>("env", "abort");
+    rhf_t::add<&callbacks::eosio_assert_message>("env", "eosio_assert_message");
+    rhf_t::add<&callbacks::get_database_status>("env", "get_database_status");
+    rhf_t::add<&callbacks::get_input_data>("env", "get_input_data");
+    rhf_t::add<&callbacks::set_output_data>("env", "set_output_data");
+    rhf_t::add<&callbacks::set_output_pieces>("env", "set_output_pieces");
+    rhf_t::add<&callbacks::query_database>("env", "query_database");
+    rhf_t::add<&callbacks::query_database_open>("env", "query_database_open");
+    rhf_t::add<&callbacks::query_database_next>("env", "query_database_next");
+    rhf_t::add<&callbacks::query_database_close>("env", "query_database_close");
+    rhf_t::add<&callbacks::contract_row_to_json>("env", "contract_row_to_json");
+    rhf_t::add<&callbacks::print_range>("env", "print_range");
 }
 
 static void fill_context_data(wasm_ql::thread_state& thread_state) {
     thread_state.database_status.clear();
-    abieos::native_to_bin(thread_state.fill_status.head, thread_state.database_status);
-    abieos::native_to_bin(thread_state.fill_status.head_id, thread_state.database_status);
-    abieos::native_to_bin(thread_state.fill_status.irreversible, thread_state.database_status);
-    abieos::native_to_bin(thread_state.fill_status.irreversible_id, thread_state.database_status);
-    abieos::native_to_bin(thread_state.fill_status.first, thread_state.database_status);
+    eosio::convert_to_bin(thread_state.fill_status.head, thread_state.database_status);
+    eosio::convert_to_bin(thread_state.fill_status.head_id, thread_state.database_status);
+    eosio::convert_to_bin(thread_state.fill_status.irreversible, thread_state.database_status);
+    eosio::convert_to_bin(thread_state.fill_status.irreversible_id, thread_state.database_status);
+    eosio::convert_to_bin(thread_state.fill_status.first, thread_state.database_status);
 }
 
 // todo: detect thread_state.fill_status.first changing (history trim)
 static bool did_fork(wasm_ql::thread_state& thread_state) {
+    if (thread_state.query_session->consistent_reads)
+        return false;
     auto id = thread_state.query_session->get_block_id(thread_state.fill_status.head);
     if (!id) {
         ilog("fork detected (prev head not found)");
@@ -108,64 +239,171 @@ template <typename F>
 static void retry_loop(wasm_ql::thread_state& thread_state, F f) {
     int num_tries = 0;
     while (true) {
-        auto exit                  = fc::make_scoped_exit([&] { thread_state.query_session.reset(); });
+        auto exit = fc::make_scoped_exit([&] {
+            thread_state.cursors.clear();
+            thread_state.query_session.reset();
+        });
         thread_state.query_session = thread_state.shared->db_iface->create_query_session();
         thread_state.fill_status   = thread_state.query_session->get_fill_status();
         if (!thread_state.fill_status.head)
             throw std::runtime_error("database is empty");
         fill_context_data(thread_state);
-        if (f())
+        thread_state.read_status = false;
+        if (f()) {
+            thread_state.immutable_reply = is_immutable_reply(
+                thread_state.read_status, thread_state.query_session->newest_block_read, thread_state.fill_status.irreversible);
             return;
+        }
+        wasm_ql_metrics::get().fork_retries.add();
         if (++num_tries >= 4)
             throw std::runtime_error("too many fork events during request");
         ilog("retry request");
     }
 }
 
-static void run_query(wasm_ql::thread_state& thread_state, abieos::name short_name) {
-    auto      code = backend_t::read_wasm(thread_state.shared->wasm_dir + "/" + (std::string)short_name + "-server.wasm");
-    backend_t backend(code);
-    callbacks cb{thread_state, backend};
-    backend.set_wasm_allocator(&thread_state.wa);
+static std::shared_ptr<const contract_abi_cache::parsed_abi> parse_abi(eosio::input_stream bin) {
+    auto result = std::make_shared<contract_abi_cache::parsed_abi>();
+    try {
+        eosio::abi_def def;
+        from_bin(def, bin);
+        if (def.version.substr(0, 13) != "eosio::abi/1.")
+            return {};
+        eosio::convert(def, result->abi);
+        for (auto& table : def.tables) {
+            auto it = result->abi.abi_types.find(table.type);
+            if (it != result->abi.abi_types.end())
+                result->table_types[table.name.value] = &it->second;
+        }
+    } catch (const std::exception&) {
+        return {};
+    }
+    return result;
+}
+
+std::shared_ptr<const contract_abi_cache::parsed_abi>
+contract_abi_cache::get(eosio::name account, uint32_t abi_block, eosio::input_stream abi) {
+    if (!max_entries)
+        return parse_abi(abi);
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        auto                        it = entries.find(account.value);
+        if (it != entries.end() && it->second.abi_block == abi_block)
+            return it->second.abi;
+    }
+
+    // parse outside the lock; a query at an older snapshot doesn't replace a newer entry
+    auto                        parsed = parse_abi(abi);
+    std::lock_guard<std::mutex> lock{mutex};
+    if (entries.size() >= max_entries && !entries.count(account.value))
+        entries.clear();
+    auto& e = entries[account.value];
+    if (!e.abi_block || e.abi_block < abi_block)
+        e = {abi_block, parsed};
+    return parsed;
+}
+
+std::shared_ptr<const eosio::vm::wasm_code> wasm_code_cache::get(const std::string& path) {
+    auto                        mtime = boost::filesystem::last_write_time(path);
+    std::lock_guard<std::mutex> lock{mutex};
+    auto&                       e = entries[path];
+    if (!e.code || e.mtime != mtime) {
+        e.code  = std::make_shared<const eosio::vm::wasm_code>(backend_t::read_wasm(path));
+        e.mtime = mtime;
+    }
+    return e.code;
+}
+
+/// A thread's parsed server wasm, with its host functions resolved, run by the interpreter or compiled by the jit. Each query
+/// initializes it again, which resets its memory.
+struct module_instance {
+    std::shared_ptr<const eosio::vm::wasm_code> code;
+    eosio::vm::wasm_code                        parsed_code; // the backend parses from a mutable copy
+    std::unique_ptr<backend_t>                  interpreter;
+    std::unique_ptr<jit_backend_t>              jit;
+
+    module_instance(std::shared_ptr<const eosio::vm::wasm_code> code, bool use_jit)
+        : code(std::move(code))
+        , parsed_code(*this->code) {
+        if (use_jit) {
+            jit = std::make_unique<jit_backend_t>(parsed_code, nullptr);
+            rhf_t::resolve(jit->get_module());
+        } else {
+            interpreter = std::make_unique<backend_t>(parsed_code, nullptr);
+            rhf_t::resolve(interpreter->get_module());
+        }
+    }
+
+    void run(wasm_ql::thread_state& thread_state) {
+        if (jit)
+            run(*jit, thread_state);
+        else
+            run(*interpreter, thread_state);
+    }
 
-    rhf_t::resolve(backend.get_module());
-    backend.initialize(&cb);
-    backend(&cb, "env", "initialize");
-    backend(&cb, "env", "run_query");
+    template <typename Backend>
+    static void run(Backend& backend, wasm_ql::thread_state& thread_state) {
+        callbacks cb{thread_state, &backend, &call_cb_alloc<Backend>};
+        backend.set_wasm_allocator(&thread_state.wa);
+        backend.initialize(&cb);
+        backend(cb, "env", "initialize");
+        backend(cb, "env", "run_query");
+    }
+};
+
+static module_instance& get_module(wasm_ql::thread_state& thread_state, eosio::name short_name) {
+    auto  code     = thread_state.shared->code_cache->get(thread_state.shared->wasm_dir + "/" + (std::string)short_name + "-server.wasm");
+    auto& instance = thread_state.modules[short_name.value];
+    if (!instance || instance->code != code) {
+        metrics::scoped_timer timer{wasm_ql_metrics::get().module_load};
+        instance = std::make_shared<module_instance>(std::move(code), thread_state.shared->jit);
+    }
+    return *instance;
+}
+
+static void run_query(wasm_ql::thread_state& thread_state, eosio::name short_name) {
+    try {
+        auto&                 instance = get_module(thread_state, short_name);
+        metrics::scoped_timer timer{wasm_ql_metrics::get().execution};
+        instance.run(thread_state);
+    } catch (...) {
+        // a failed run may leave the instance midway; the next query starts from a fresh one
+        thread_state.modules.erase(short_name.value);
+        throw;
+    }
 }
 
 std::vector<char> query(wasm_ql::thread_state& thread_state, const std::vector<char>& request) {
     std::vector<char> result;
     retry_loop(thread_state, [&]() {
-        abieos::input_buffer request_bin{request.data(), request.data() + request.size()};
-        auto                 num_requests = abieos::bin_to_native<abieos::varuint32>(request_bin).value;
+        eosio::input_stream request_bin{request.data(), request.data() + request.size()};
+        auto                num_requests = eosio::from_bin<eosio::varuint32>(request_bin).value;
         result.clear();
-        abieos::push_varuint32(result, num_requests);
+        eosio::convert_to_bin(eosio::varuint32{num_requests}, result);
         for (uint32_t request_index = 0; request_index < num_requests; ++request_index) {
-            thread_state.request = abieos::bin_to_native<abieos::input_buffer>(request_bin);
-            auto ns_name         = abieos::bin_to_native<abieos::name>(thread_state.request);
+            thread_state.request = eosio::from_bin<eosio::input_stream>(request_bin);
+            auto ns_name         = eosio::from_bin<eosio::name>(thread_state.request);
             if (ns_name != "local"_n)
                 throw std::runtime_error("unknown namespace: " + (std::string)ns_name);
-            auto short_name = abieos::bin_to_native<abieos::name>(thread_state.request);
+            auto short_name = eosio::from_bin<eosio::name>(thread_state.request);
 
             run_query(thread_state, short_name);
-            if (did_fork(thread_state))
-                return false;
 
             // elog("result: ${s} ${x}", ("s", thread_state.reply.size())("x", fc::to_hex(thread_state.reply)));
-            abieos::push_varuint32(result, thread_state.reply.size());
+            eosio::convert_to_bin(eosio::varuint32{uint32_t(thread_state.reply.size())}, result);
             result.insert(result.end(), thread_state.reply.begin(), thread_state.reply.end());
         }
-        return true;
+
+        // the sub-requests share the session's snapshot, so one check covers the whole batch
+        return !did_fork(thread_state);
     });
     return result;
 }
 
 const std::vector<char>& legacy_query(wasm_ql::thread_state& thread_state, const std::string& target, const std::vector<char>& request) {
     std::vector<char> req;
-    abieos::native_to_bin(target, req);
-    abieos::native_to_bin(request, req);
-    thread_state.request = abieos::input_buffer{req.data(), req.data() + req.size()};
+    eosio::convert_to_bin(target, req);
+    eosio::convert_to_bin(request, req);
+    thread_state.request = eosio::input_stream{req.data(), req.data() + req.size()};
     retry_loop(thread_state, [&]() {
         run_query(thread_state, "legacy"_n);
         return !did_fork(thread_state);
@@ -1,28 +1,87 @@
 // copyright defined in LICENSE.txt
 
 #pragma once
+#include "request_log.hpp"
 #include "wasm_ql_plugin.hpp"
 
+#include <chrono>
+#include <eosio/abi.hpp>
 #include <eosio/vm/backend.hpp>
+#include <mutex>
 
 namespace wasm_ql {
 
+/// Server wasms by path, shared by the threads. A file is read again once its mtime changes.
+struct wasm_code_cache {
+    struct entry {
+        std::time_t                                 mtime = {};
+        std::shared_ptr<const eosio::vm::wasm_code> code  = {};
+    };
+
+    std::mutex                   mutex   = {};
+    std::map<std::string, entry> entries = {};
+
+    std::shared_ptr<const eosio::vm::wasm_code> get(const std::string& path);
+};
+
+/// Contract ABIs by account, parsed once and shared by the threads. An account's entry is replaced when a query passes a newer
+/// abi_block, the block of the account row its ABI came from.
+struct contract_abi_cache {
+    struct parsed_abi {
+        eosio::abi                                 abi         = {};
+        std::map<uint64_t, const eosio::abi_type*> table_types = {}; // into abi, which isn't modified once parsed
+    };
+
+    struct entry {
+        uint32_t                          abi_block = {};
+        std::shared_ptr<const parsed_abi> abi       = {}; // null if the ABI doesn't parse
+    };
+
+    uint32_t                  max_entries = {}; // 0 disables caching
+    std::mutex                mutex       = {};
+    std::map<uint64_t, entry> entries     = {};
+
+    std::shared_ptr<const parsed_abi> get(eosio::name account, uint32_t abi_block, eosio::input_stream abi);
+};
+
+struct module_instance;
+
 struct shared_state {
-    bool                                console      = {};
-    std::string                         allow_origin = {};
-    std::string                         wasm_dir     = {};
-    std::string                         static_dir   = {};
-    std::shared_ptr<database_interface> db_iface     = {};
+    bool                                 console           = {};
+    bool                                 jit               = {}; // run server wasms with eos-vm's jit instead of its interpreter
+    std::string                          allow_origin      = {};
+    uint32_t                             cache_size        = {}; // responses to keep in wasm_ql_http's cache; 0 disables it
+    uint32_t                             compress_min_size = {}; // smallest reply to gzip or deflate; 0 disables compression
+    int                                  io_threads        = 1;  // threads for networking; queries run on their own threads
+    uint32_t                             max_queued        = {}; // queries which may wait for a thread before more get 503
+    std::chrono::milliseconds            queue_timeout     = {}; // how long a query may wait for a thread
+    uint32_t                             pipeline_depth    = 8;  // requests a connection may have in progress
+    std::chrono::milliseconds            idle_timeout      = {}; // how long a connection may send nothing while it's owed nothing
+    uint32_t                             max_request_size  = {}; // largest request body
+    std::chrono::milliseconds            subscribe_poll    = {}; // how often subscriptions check for new blocks; 0 disables them
+    std::string                          wasm_dir          = {};
+    std::string                          static_dir        = {};
+    std::shared_ptr<database_interface>  db_iface          = {};
+    std::shared_ptr<wasm_code_cache>     code_cache        = std::make_shared<wasm_code_cache>();
+    std::shared_ptr<contract_abi_cache>  abi_cache         = std::make_shared<contract_abi_cache>();
+    std::shared_ptr<request_log::writer> request_log       = {}; // records query requests for wasm-ql-load; null disables it
 };
 
 struct thread_state {
     std::shared_ptr<const shared_state> shared          = {};
     eosio::vm::wasm_allocator           wa              = {};
     std::vector<char>                   database_status = {};
-    abieos::input_buffer                request         = {}; // todo: rename
+    eosio::input_stream                 request         = {}; // todo: rename
     std::vector<char>                   reply           = {}; // todo: rename
     std::unique_ptr<::query_session>    query_session   = {};
     state_history::fill_status          fill_status     = {};
+    bool                                read_status     = {}; // the wasm called get_database_status
+    bool                                immutable_reply = {}; // the last reply only depends on the request and irreversible blocks
+    std::vector<char>                   batch           = {}; // reused by query_database_next
+
+    std::vector<std::unique_ptr<query_cursor>> cursors = {}; // this request's cursors; closed ones are null until their slot is reused
+
+    std::map<uint64_t, std::shared_ptr<module_instance>> modules = {}; // this thread's instances of the server wasms, by short name
 };
 
 void                     register_callbacks();
@@ -8,13 +8,23 @@
 // file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
 
 #include "wasm_ql_http.hpp"
+#include "metrics.hpp"
+#include "response_cache.hpp"
 
+#include <boost/algorithm/hex.hpp>
 #include <boost/asio/bind_executor.hpp>
+#include <boost/asio/post.hpp>
 #include <boost/asio/signal_set.hpp>
 #include <boost/asio/strand.hpp>
+#include <boost/asio/thread_pool.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 #include <boost/beast/version.hpp>
+#include <boost/beast/websocket.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
 #include <boost/make_unique.hpp>
 #include <boost/optional.hpp>
 
@@ -22,49 +32,68 @@
 #include <fc/log/logger.hpp>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <thread>
 #include <vector>
 
-namespace beast = boost::beast;         // from <boost/beast.hpp>
-namespace http  = beast::http;          // from <boost/beast/http.hpp>
-namespace net   = boost::asio;          // from <boost/asio.hpp>
-using tcp       = boost::asio::ip::tcp; // from <boost/asio/ip/tcp.hpp>
+namespace beast     = boost::beast;         // from <boost/beast.hpp>
+namespace http      = beast::http;          // from <boost/beast/http.hpp>
+namespace websocket = beast::websocket;     // from <boost/beast/websocket.hpp>
+namespace net       = boost::asio;          // from <boost/asio.hpp>
+using tcp           = boost::asio::ip::tcp; // from <boost/asio/ip/tcp.hpp>
 
 using namespace std::literals;
 
 namespace wasm_ql {
 
+/// Each query thread owns one thread_state, created on its first request and kept for the thread's lifetime, so a state's
+/// allocator and query session never move between threads and no lock is taken per request
 class thread_state_cache {
   private:
-    std::mutex                                   mutex;
     std::shared_ptr<const wasm_ql::shared_state> shared_state;
-    std::vector<std::unique_ptr<thread_state>>   states;
 
   public:
+    const std::unique_ptr<response_cache> responses;
+
     thread_state_cache(const std::shared_ptr<const wasm_ql::shared_state>& shared_state)
-        : shared_state(shared_state) {}
-
-    std::unique_ptr<thread_state> get_state() {
-        std::lock_guard<std::mutex> lock{mutex};
-        if (states.empty()) {
-            auto result    = std::make_unique<thread_state>();
-            result->shared = shared_state;
-            return result;
+        : shared_state(shared_state)
+        , responses(shared_state->cache_size ? std::make_unique<response_cache>(shared_state->cache_size) : nullptr) {}
+
+    thread_state& get_state() {
+        thread_local std::unique_ptr<thread_state> state;
+        if (!state) {
+            static auto& states = metrics::get_gauge("wasmql_thread_states", "Query threads which have created their thread_state");
+            state               = std::make_unique<thread_state>();
+            state->shared       = shared_state;
+            states.add(1);
         }
-        auto result = std::move(states.back());
-        states.pop_back();
-        return result;
+        return *state;
     }
+};
 
-    void store_state(std::unique_ptr<thread_state> state) {
-        std::lock_guard<std::mutex> lock{mutex};
-        states.push_back(std::move(state));
-    }
+/// Runs queries on their own threads, apart from the io threads, so slow queries can't hold up accepting and reading
+/// connections. A request which finds max_queued requests already waiting, or which waits longer than queue_timeout, is
+/// answered with 503 instead of run.
+struct query_executor {
+    net::thread_pool          pool;
+    std::atomic<uint32_t>     queued = 0;
+    uint32_t                  max_queued;
+    std::chrono::milliseconds queue_timeout;
+
+    query_executor(int num_threads, uint32_t max_queued, std::chrono::milliseconds queue_timeout)
+        : pool(num_threads)
+        , max_queued(max_queued)
+        , queue_timeout(queue_timeout) {}
 };
 
 // Report a failure
@@ -149,6 +178,61 @@ std::string path_cat(beast::string_view base, beast::string_view path) {
     return result;
 }
 
+// Whether a request runs a wasm, and so goes to the query_executor
+static bool is_query(beast::string_view target) { return target == "/wasmql/v1/query" || target.starts_with("/v1/"); }
+
+// Picks a content coding from the request's Accept-Encoding: "gzip", "deflate", or nullptr to send the reply as-is
+static const char* choose_encoding(beast::string_view accept_encoding) {
+    bool gzip = false, deflate = false;
+    while (!accept_encoding.empty()) {
+        auto item = accept_encoding.substr(0, accept_encoding.find(','));
+        accept_encoding.remove_prefix(std::min(item.size() + 1, accept_encoding.size()));
+        auto coding = item.substr(0, item.find(';'));
+        auto params = item.substr(coding.size());
+        while (!coding.empty() && coding.front() == ' ')
+            coding.remove_prefix(1);
+        while (!coding.empty() && coding.back() == ' ')
+            coding.remove_suffix(1);
+        auto q = params.find("q=");
+        if (q != beast::string_view::npos && !std::strtod(params.substr(q + 2).to_string().c_str(), nullptr))
+            continue; // q=0 refuses the coding
+        if (beast::iequals(coding, "gzip") || coding == "*")
+            gzip = true;
+        else if (beast::iequals(coding, "deflate"))
+            deflate = true;
+    }
+    return gzip ? "gzip" : deflate ? "deflate" : nullptr;
+}
+
+// gzip or zlib ("deflate" in HTTP) framing. Favors speed; replies are compressed on every send.
+static std::vector<char> compress(const std::vector<char>& data, bool gzip) {
+    namespace bio = boost::iostreams;
+    std::vector<char>      out;
+    bio::filtering_ostream comp;
+    if (gzip)
+        comp.push(bio::gzip_compressor(bio::gzip_params(bio::zlib::best_speed)));
+    else
+        comp.push(bio::zlib_compressor(bio::zlib_params(bio::zlib::best_speed)));
+    comp.push(bio::back_inserter(out));
+    bio::write(comp, data.data(), data.size());
+    bio::close(comp);
+    return out;
+}
+
+// Returns a response which asks the client to try again later
+template <class Body, class Allocator>
+http::response<http::string_body>
+service_unavailable(const http::request<Body, http::basic_fields<Allocator>>& req, beast::string_view why) {
+    http::response<http::string_body> res{http::status::service_unavailable, req.version()};
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(http::field::content_type, "text/html");
+    res.set(http::field::retry_after, "1");
+    res.keep_alive(req.keep_alive());
+    res.body() = why.to_string();
+    res.prepare_payload();
+    return res;
+}
+
 // This function produces an HTTP response for the given
 // request. The type of the response object depends on the
 // contents of the request, so the interface requires the
@@ -197,26 +281,46 @@ void handle_request(
         if (!shared_state->allow_origin.empty())
             res.set(http::field::access_control_allow_origin, shared_state->allow_origin);
         res.keep_alive(req.keep_alive());
+        if (shared_state->compress_min_size) {
+            res.set(http::field::vary, "Accept-Encoding");
+            auto encoding = reply.size() >= shared_state->compress_min_size ? choose_encoding(req[http::field::accept_encoding]) : nullptr;
+            if (encoding) {
+                reply = compress(reply, !strcmp(encoding, "gzip"));
+                res.set(http::field::content_encoding, encoding);
+            }
+        }
         res.body() = std::move(reply);
         res.prepare_payload();
         return res;
     };
 
+    // runs f, or reuses the reply it gave an identical request
+    const auto cached = [&state_cache, &req](auto f) {
+        auto* cache = state_cache->responses.get();
+        if (!cache)
+            return f(state_cache->get_state());
+        auto key = response_cache::make_key({req.target().data(), req.target().size()}, req.body());
+        if (auto reply = cache->get(key))
+            return std::move(*reply);
+        auto& thread_state = state_cache->get_state();
+        auto  reply        = f(thread_state);
+        cache->update(std::move(key), reply, thread_state.fill_status.first, thread_state.immutable_reply);
+        return reply;
+    };
+
     try {
         if (req.target() == "/wasmql/v1/query") {
             if (req.method() != http::verb::post)
                 return send(error(http::status::bad_request, "Unsupported HTTP-method for " + req.target().to_string() + "\n"));
-            auto thread_state = state_cache->get_state();
-            send(ok(query(*thread_state, req.body()), "application/octet-stream"));
-            state_cache->store_state(std::move(thread_state));
-            return;
+            return send(
+                ok(cached([&](thread_state& thread_state) { return query(thread_state, req.body()); }), "application/octet-stream"));
         } else if (req.target().starts_with("/v1/")) {
             if (req.method() != http::verb::post)
                 return send(error(http::status::bad_request, "Unsupported HTTP-method for " + req.target().to_string() + "\n"));
-            auto thread_state = state_cache->get_state();
-            send(ok(legacy_query(*thread_state, req.target().to_string(), req.body()), "application/octet-stream"));
-            state_cache->store_state(std::move(thread_state));
-            return;
+            return send(ok(cached([&](thread_state& thread_state) {
+                               return std::vector<char>{legacy_query(thread_state, req.target().to_string(), req.body())};
+                           }),
+                           "application/octet-stream"));
         } else if (doc_root.empty()) {
             return send(error(http::status::not_found, "The resource '" + req.target().to_string() + "' was not found.\n"));
         } else {
@@ -277,48 +381,303 @@ void handle_request(
     }
 }
 
+/// What a websocket client subscribed to, from the target it upgraded: /wasmql/v1/subscribe/head, or
+/// /wasmql/v1/subscribe/table?code=...&table=...[&scope=...]
+struct subscription {
+    bool        tables = false; // contract table changes too, not just heads
+    eosio::name code   = {};
+    eosio::name table  = {};
+    eosio::name scope  = {}; // 0 matches every scope
+
+    bool matches(const table_change& change) const {
+        return change.code == code && change.table == table && (!scope.value || change.scope == scope);
+    }
+};
+
+// Returns the subscription a websocket target asks for; throws if it's malformed
+static subscription parse_subscription(beast::string_view target) {
+    static const beast::string_view prefix = "/wasmql/v1/subscribe/";
+    auto                            kind   = target.substr(prefix.size(), target.find('?') - prefix.size());
+    subscription                    result;
+    if (kind == "head")
+        return result;
+    if (kind != "table")
+        throw std::runtime_error("unknown subscription: " + kind.to_string());
+    result.tables = true;
+    auto params   = target.substr(std::min(target.find('?'), target.size()));
+    while (params.size() > 1) {
+        params.remove_prefix(1);
+        auto param = params.substr(0, params.find('&'));
+        params.remove_prefix(param.size());
+        auto key   = param.substr(0, param.find('='));
+        auto value = std::string{param.substr(std::min(key.size() + 1, param.size()))};
+        if (key == "code")
+            result.code = eosio::name{value.c_str()};
+        else if (key == "table")
+            result.table = eosio::name{value.c_str()};
+        else if (key == "scope")
+            result.scope = eosio::name{value.c_str()};
+        else
+            throw std::runtime_error("unknown subscription parameter: " + key.to_string());
+    }
+    if (!result.code.value || !result.table.value)
+        throw std::runtime_error("table subscriptions need code and table");
+    return result;
+}
+
+class subscription_hub;
+
+// Pushes a subscription's messages to one websocket client. Messages wait their turn while a write is in flight; a client
+// which lets max_pending of them pile up is disconnected rather than buffered without bound.
+class websocket_session : public std::enable_shared_from_this<websocket_session> {
+    enum { max_pending = 64 };
+
+    websocket::stream<beast::tcp_stream>           ws_;
+    beast::flat_buffer                             buffer_;
+    std::shared_ptr<subscription_hub>              hub_;
+    std::deque<std::shared_ptr<const std::string>> pending_;
+
+  public:
+    const subscription sub;
+
+    websocket_session(tcp::socket&& socket, const std::shared_ptr<subscription_hub>& hub, const subscription& sub)
+        : ws_(std::move(socket))
+        , hub_(hub)
+        , sub(sub) {}
+
+    template <class Body, class Allocator>
+    void run(http::request<Body, http::basic_fields<Allocator>>&& req) {
+        // the websocket stream has its own timeouts and keepalive pings
+        beast::get_lowest_layer(ws_).expires_never();
+        ws_.set_option(websocket::stream_base::timeout::suggested(beast::role_type::server));
+        ws_.async_accept(req, beast::bind_front_handler(&websocket_session::on_accept, shared_from_this()));
+    }
+
+    // may be called from any thread
+    void send(const std::shared_ptr<const std::string>& msg) {
+        net::post(ws_.get_executor(), [self = shared_from_this(), msg] { self->queue(msg); });
+    }
+
+  private:
+    void on_accept(beast::error_code ec);
+
+    // Clients don't send anything, but reading handles pings and notices when they close
+    void do_read() { ws_.async_read(buffer_, beast::bind_front_handler(&websocket_session::on_read, shared_from_this())); }
+
+    void on_read(beast::error_code ec, std::size_t) {
+        if (ec == websocket::error::closed)
+            return;
+        if (ec)
+            return fail(ec, "websocket read");
+        buffer_.consume(buffer_.size());
+        do_read();
+    }
+
+    void queue(const std::shared_ptr<const std::string>& msg) {
+        if (pending_.size() >= max_pending) {
+            beast::get_lowest_layer(ws_).close();
+            return;
+        }
+        pending_.push_back(msg);
+        if (pending_.size() == 1)
+            do_write();
+    }
+
+    void do_write() {
+        ws_.text(true);
+        ws_.async_write(net::buffer(*pending_.front()), beast::bind_front_handler(&websocket_session::on_write, shared_from_this()));
+    }
+
+    void on_write(beast::error_code ec, std::size_t) {
+        if (ec)
+            return fail(ec, "websocket write");
+        pending_.pop_front();
+        if (!pending_.empty())
+            do_write();
+    }
+};
+
+/// Tells websocket subscribers about new heads and contract table changes. One poll of the database, on a query thread,
+/// serves every subscriber. After a fork, the changes since the previous poll's irreversible block are sent again.
+class subscription_hub : public std::enable_shared_from_this<subscription_hub> {
+    enum { max_blocks_per_poll = 1000 }; // a head which jumped further has its older changes skipped
+
+    std::shared_ptr<const shared_state>           shared_state_;
+    std::shared_ptr<query_executor>               executor_;
+    net::steady_timer                             timer_;
+    std::mutex                                    mutex_;
+    std::vector<std::weak_ptr<websocket_session>> sessions_;
+    std::optional<state_history::fill_status>     last_; // as of the previous poll; polls never overlap
+
+  public:
+    subscription_hub(
+        net::io_context& ioc, const std::shared_ptr<const shared_state>& shared_state, const std::shared_ptr<query_executor>& executor)
+        : shared_state_(shared_state)
+        , executor_(executor)
+        , timer_(ioc) {}
+
+    void run() { schedule(); }
+
+    void add(const std::shared_ptr<websocket_session>& session) {
+        std::lock_guard<std::mutex> lock{mutex_};
+        sessions_.push_back(session);
+    }
+
+  private:
+    void schedule() {
+        timer_.expires_after(shared_state_->subscribe_poll);
+        timer_.async_wait([self = shared_from_this()](beast::error_code ec) {
+            if (ec)
+                return;
+            net::post(self->executor_->pool, [self] {
+                try {
+                    self->poll();
+                } catch (const std::exception& e) {
+                    elog("subscription poll failed: ${s}", ("s", e.what()));
+                } catch (...) {
+                    elog("subscription poll failed: unknown exception");
+                }
+                self->schedule();
+            });
+        });
+    }
+
+    std::vector<std::shared_ptr<websocket_session>> live_sessions() {
+        std::lock_guard<std::mutex>                     lock{mutex_};
+        std::vector<std::shared_ptr<websocket_session>> result;
+        for (auto it = sessions_.begin(); it != sessions_.end();) {
+            if (auto session = it->lock()) {
+                result.push_back(std::move(session));
+                ++it;
+            } else {
+                it = sessions_.erase(it);
+            }
+        }
+        return result;
+    }
+
+    static std::string to_hex(const eosio::checksum256& id) {
+        std::string result;
+        const auto& bytes = id.extract_as_byte_array();
+        boost::algorithm::hex_lower(bytes.begin(), bytes.end(), std::back_inserter(result));
+        return result;
+    }
+
+    void poll() {
+        auto sessions = live_sessions();
+        if (sessions.empty()) {
+            last_.reset(); // a later subscriber starts from the head of its time, not a backlog
+            return;
+        }
+        auto query_session = shared_state_->db_iface->create_query_session();
+        auto status        = query_session->get_fill_status();
+        if (!last_) {
+            last_ = status;
+            return;
+        }
+        auto prev_head_id = query_session->get_block_id(last_->head);
+        bool forked       = status.head < last_->head || !prev_head_id || *prev_head_id != last_->head_id;
+        if (!forked && status.head == last_->head)
+            return;
+
+        auto first = forked ? std::min(last_->irreversible, status.head) : last_->head;
+        first      = std::max(first, status.head - std::min<uint32_t>(status.head, max_blocks_per_poll));
+        last_      = status;
+
+        std::vector<table_change> changes;
+        if (std::any_of(sessions.begin(), sessions.end(), [](auto& s) { return s->sub.tables; }))
+            changes = query_session->get_table_changes(first, status.head);
+        query_session.reset();
+
+        auto head = R"({"head":)" + std::to_string(status.head) + R"(,"head_id":")" + to_hex(status.head_id) + R"(","irreversible":)" +
+                    std::to_string(status.irreversible) + R"(,"irreversible_id":")" + to_hex(status.irreversible_id) +
+                    R"(","forked":)" + (forked ? "true" : "false");
+        auto head_msg = std::make_shared<const std::string>(head + "}");
+        for (auto& session : sessions) {
+            if (!session->sub.tables) {
+                session->send(head_msg);
+                continue;
+            }
+            std::string msg = head + R"(,"changes":[)";
+            bool        any = false;
+            for (auto& change : changes) {
+                if (!session->sub.matches(change))
+                    continue;
+                msg += (any ? R"(,{"block_num":)" : R"({"block_num":)") + std::to_string(change.block_num) + R"(,"code":")" +
+                       (std::string)change.code + R"(","table":")" + (std::string)change.table + R"(","scope":")" +
+                       (std::string)change.scope + R"("})";
+                any = true;
+            }
+            if (any || forked)
+                session->send(std::make_shared<const std::string>(msg + "]}"));
+        }
+    }
+};
+
+void websocket_session::on_accept(beast::error_code ec) {
+    if (ec)
+        return fail(ec, "websocket accept");
+    hub_->add(shared_from_this());
+    do_read();
+}
+
+// Returns a response which refuses a malformed subscription
+template <class Body, class Allocator>
+http::response<http::string_body> bad_subscription(const http::request<Body, http::basic_fields<Allocator>>& req, beast::string_view why) {
+    http::response<http::string_body> res{http::status::bad_request, req.version()};
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(http::field::content_type, "text/html");
+    res.keep_alive(req.keep_alive());
+    res.body() = why.to_string() + "\n";
+    res.prepare_payload();
+    return res;
+}
+
 // Handles an HTTP server connection
 class http_session : public std::enable_shared_from_this<http_session> {
-    // This queue is used for HTTP pipelining.
+    // This queue is used for HTTP pipelining. Responses go out in request order; a query's slot is reserved when its
+    // request is read and filled when the query finishes, so up to limit requests may run at once.
     class queue {
-        enum {
-            // Maximum number of responses we will queue
-            limit = 8
-        };
-
         // The type-erased, saved work item
         struct work {
             virtual ~work()           = default;
             virtual void operator()() = 0;
         };
 
-        http_session&                      self_;
-        std::vector<std::unique_ptr<work>> items_;
+        http_session&                     self_;
+        const size_t                      limit_;        // Maximum number of responses we will queue
+        uint64_t                          first_id_ = 0; // id of items_.front()
+        std::deque<std::unique_ptr<work>> items_;        // null until the response is ready
 
       public:
-        explicit queue(http_session& self)
-            : self_(self) {
-            static_assert(limit > 0, "queue limit must be positive");
-            items_.reserve(limit);
-        }
+        explicit queue(http_session& self, size_t limit)
+            : self_(self)
+            , limit_(limit) {}
 
         // Returns `true` if we have reached the queue limit
-        bool is_full() const { return items_.size() >= limit; }
+        bool is_full() const { return items_.size() >= limit_; }
+
+        // Returns `true` if every queued response has been sent
+        bool empty() const { return items_.empty(); }
 
         // Called when a message finishes sending
-        // Returns `true` if the caller should initiate a read
-        bool on_write() {
+        void on_write() {
             BOOST_ASSERT(!items_.empty());
-            const auto was_full = is_full();
-            items_.erase(items_.begin());
-            if (!items_.empty())
+            items_.pop_front();
+            ++first_id_;
+            if (!items_.empty() && items_.front())
                 (*items_.front())();
-            return was_full;
         }
 
-        // Called by the HTTP handler to send a response.
+        // Holds a place for a response which isn't ready yet
+        uint64_t reserve() {
+            items_.emplace_back();
+            return first_id_ + items_.size() - 1;
+        }
+
+        // Fills a reserved place. The response is sent once those before it are.
         template <bool isRequest, class Body, class Fields>
-        void operator()(http::message<isRequest, Body, Fields>&& msg) {
+        void fill(uint64_t id, http::message<isRequest, Body, Fields>&& msg) {
             // This holds a work item
             struct work_impl : work {
                 http_session&                          self_;
@@ -329,26 +688,40 @@ class http_session : public std::enable_shared_from_this<http_session> {
                     , msg_(std::move(msg)) {}
 
                 void operator()() {
+                    self_.stream_.expires_after(self_.shared_state_->idle_timeout);
                     http::async_write(
                         self_.stream_, msg_, beast::bind_front_handler(&http_session::on_write, self_.shared_from_this(), msg_.need_eof()));
                 }
             };
 
-            // Allocate and store the work
-            items_.push_back(boost::make_unique<work_impl>(self_, std::move(msg)));
+            auto& item = items_.at(id - first_id_);
+            item       = boost::make_unique<work_impl>(self_, std::move(msg));
 
-            // If there was no previous work, start this one
-            if (items_.size() == 1)
-                (*items_.front())();
+            // If there is no earlier work, start this one
+            if (id == first_id_)
+                (*item)();
+        }
+
+        // Called by the HTTP handler to send a response.
+        template <bool isRequest, class Body, class Fields>
+        void operator()(http::message<isRequest, Body, Fields>&& msg) {
+            fill(reserve(), std::move(msg));
         }
     };
 
     beast::tcp_stream                   stream_;
     beast::flat_buffer                  buffer_;
+    net::steady_timer                   idle_timer_;
     std::shared_ptr<const std::string>  doc_root_;
     std::shared_ptr<const shared_state> shared_state_;
     std::shared_ptr<thread_state_cache> state_cache_;
+    std::shared_ptr<query_executor>     executor_;
+    std::shared_ptr<subscription_hub>   hub_; // null if subscriptions are disabled
     queue                               queue_;
+    bool                                reading_ = false;
+    bool                                idle_    = false; // reading, with no responses owed; idle_timer_ is running
+    bool                                closing_ = false; // the client is done sending; close once the queue drains
+    std::vector<char>                   spare_body_;      // a finished request's body, reused by the next request
 
     // The parser is stored in an optional container so we can
     // construct it from scratch it at the beginning of each new message.
@@ -358,48 +731,142 @@ class http_session : public std::enable_shared_from_this<http_session> {
     // Take ownership of the socket
     http_session(
         tcp::socket&& socket, const std::shared_ptr<const std::string>& doc_root, const std::shared_ptr<const shared_state>& shared_state,
-        const std::shared_ptr<thread_state_cache>& state_cache)
+        const std::shared_ptr<thread_state_cache>& state_cache, const std::shared_ptr<query_executor>& executor,
+        const std::shared_ptr<subscription_hub>& hub)
         : stream_(std::move(socket))
+        , idle_timer_(stream_.get_executor())
         , doc_root_(doc_root)
         , shared_state_(shared_state)
         , state_cache_(state_cache)
-        , queue_(*this) {}
+        , executor_(executor)
+        , hub_(hub)
+        , queue_(*this, shared_state->pipeline_depth) {}
 
     // Start the session
     void run() { do_read(); }
 
   private:
+    // Reads the next request unless one is being read, the queue is full, or the client is done
+    void maybe_read() {
+        if (!reading_ && !closing_ && !queue_.is_full())
+            do_read();
+    }
+
     void do_read() {
-        // Construct a new parser for each message
+        // Construct a new parser for each message. Its body reuses an earlier request's storage.
         parser_.emplace();
+        spare_body_.clear();
+        parser_->get().body() = std::move(spare_body_);
+        spare_body_           = {};
 
         // Apply a reasonable limit to the allowed size
         // of the body in bytes to prevent abuse.
-        parser_->body_limit(10000);
+        parser_->body_limit(shared_state_->max_request_size);
 
-        // Set the timeout.
-        stream_.expires_after(std::chrono::seconds(30));
+        // Reads aren't timed; idle_timer_ closes connections which send nothing while they're owed nothing
+        stream_.expires_never();
 
         // Read a request using the parser-oriented interface
+        reading_ = true;
         http::async_read(stream_, buffer_, *parser_, beast::bind_front_handler(&http_session::on_read, shared_from_this()));
+        update_idle_timer();
+    }
+
+    void update_idle_timer() {
+        bool idle = reading_ && queue_.empty();
+        if (idle == idle_)
+            return;
+        idle_ = idle;
+        if (!idle) {
+            idle_timer_.cancel();
+            return;
+        }
+        idle_timer_.expires_after(shared_state_->idle_timeout);
+        idle_timer_.async_wait([self = shared_from_this()](beast::error_code ec) {
+            if (ec)
+                return;
+            self->stream_.socket().shutdown(tcp::socket::shutdown_both, ec);
+            self->stream_.socket().close(ec);
+        });
     }
 
     void on_read(beast::error_code ec, std::size_t bytes_transferred) {
         boost::ignore_unused(bytes_transferred);
-
-        // This means they closed the connection
-        if (ec == http::error::end_of_stream)
-            return do_close();
+        reading_ = false;
+        update_idle_timer();
+
+        // This means they closed the connection. Responses still owed go out first.
+        if (ec == http::error::end_of_stream) {
+            closing_ = true;
+            if (queue_.empty())
+                do_close();
+            return;
+        }
 
         if (ec)
             return fail(ec, "read");
 
+        auto req = parser_->release();
+        if (hub_ && websocket::is_upgrade(req) && req.target().starts_with("/wasmql/v1/subscribe/")) {
+            // the socket moves to the websocket session, which would drop the replies still owed on it
+            if (!queue_.empty()) {
+                queue_(service_unavailable(req, "subscribe once earlier requests are answered\n"));
+                return maybe_read();
+            }
+            try {
+                auto sub = parse_subscription(req.target());
+                return std::make_shared<websocket_session>(stream_.release_socket(), hub_, sub)->run(std::move(req));
+            } catch (const std::exception& e) {
+                queue_(bad_subscription(req, e.what()));
+                return maybe_read();
+            }
+        }
+
+        // Queries run on the executor while the next requests are read; their responses keep their places in the queue
+        if (is_query(req.target()))
+            return execute(std::move(req));
+
         // Send the response
-        handle_request(*doc_root_, shared_state_, state_cache_, parser_->release(), queue_);
+        handle_request(*doc_root_, shared_state_, state_cache_, std::move(req), queue_);
 
         // If we aren't at the queue limit, try to pipeline another request
-        if (!queue_.is_full())
-            do_read();
+        maybe_read();
+    }
+
+    void execute(http::request<http::vector_body<char>>&& req) {
+        static auto& rejected   = metrics::get_counter("wasmql_rejected_total", "Queries answered with 503 because the queue was full");
+        static auto& queue_wait = metrics::get_histogram("wasmql_queue_wait_seconds", "Time queries waited for a query thread");
+        if (shared_state_->request_log)
+            shared_state_->request_log->write(req.target(), req.body());
+        if (executor_->queued++ >= executor_->max_queued) {
+            --executor_->queued;
+            rejected.add();
+            queue_(service_unavailable(req, "server is busy\n"));
+            return maybe_read();
+        }
+        auto id    = queue_.reserve();
+        auto r     = std::make_shared<http::request<http::vector_body<char>>>(std::move(req));
+        auto start = std::chrono::steady_clock::now();
+        net::post(executor_->pool, [self = shared_from_this(), id, r, start] {
+            --self->executor_->queued;
+            queue_wait.observe(std::chrono::steady_clock::now() - start);
+
+            // hands the response, and the request's body for reuse, back to the connection's strand
+            auto send = [&self, id, &r](auto&& msg) {
+                auto m    = std::make_shared<std::decay_t<decltype(msg)>>(std::move(msg));
+                auto body = std::make_shared<std::vector<char>>(std::move(r->body()));
+                net::post(self->stream_.get_executor(), [self, id, m, body] {
+                    self->queue_.fill(id, std::move(*m));
+                    if (body->capacity() > self->spare_body_.capacity())
+                        self->spare_body_ = std::move(*body);
+                    self->maybe_read();
+                });
+            };
+            if (std::chrono::steady_clock::now() - start > self->executor_->queue_timeout)
+                return send(service_unavailable(*r, "request timed out waiting for a query thread\n"));
+            handle_request(*self->doc_root_, self->shared_state_, self->state_cache_, std::move(*r), send);
+        });
+        maybe_read();
     }
 
     void on_write(bool close, beast::error_code ec, std::size_t bytes_transferred) {
@@ -415,10 +882,13 @@ class http_session : public std::enable_shared_from_this<http_session> {
         }
 
         // Inform the queue that a write completed
-        if (queue_.on_write()) {
-            // Read another request
-            do_read();
-        }
+        queue_.on_write();
+        if (closing_ && queue_.empty())
+            return do_close();
+        update_idle_timer();
+
+        // Read another request
+        maybe_read();
     }
 
     void do_close() {
@@ -437,16 +907,21 @@ class listener : public std::enable_shared_from_this<listener> {
     std::shared_ptr<const std::string>  doc_root_;
     std::shared_ptr<const shared_state> shared_state_;
     std::shared_ptr<thread_state_cache> state_cache_;
+    std::shared_ptr<query_executor>     executor_;
+    std::shared_ptr<subscription_hub>   hub_;
 
   public:
     listener(
         net::io_context& ioc, tcp::endpoint endpoint, const std::shared_ptr<const std::string>& doc_root,
-        const std::shared_ptr<const shared_state>& shared_state)
+        const std::shared_ptr<const shared_state>& shared_state, const std::shared_ptr<query_executor>& executor,
+        const std::shared_ptr<subscription_hub>& hub)
         : ioc_(ioc)
         , acceptor_(net::make_strand(ioc))
         , doc_root_(doc_root)
         , shared_state_(shared_state)
-        , state_cache_(std::make_shared<thread_state_cache>(shared_state_)) {
+        , state_cache_(std::make_shared<thread_state_cache>(shared_state_))
+        , executor_(executor)
+        , hub_(hub) {
 
         beast::error_code ec;
 
@@ -493,7 +968,7 @@ class listener : public std::enable_shared_from_this<listener> {
             fail(ec, "accept");
         } else {
             // Create the http session and run it
-            std::make_shared<http_session>(std::move(socket), doc_root_, shared_state_, state_cache_)->run();
+            std::make_shared<http_session>(std::move(socket), doc_root_, shared_state_, state_cache_, executor_, hub_)->run();
         }
 
         // Accept another connection
@@ -502,20 +977,27 @@ class listener : public std::enable_shared_from_this<listener> {
 };
 
 struct server_impl : http_server, std::enable_shared_from_this<server_impl> {
-    int                                 num_threads;
+    int                                 num_io_threads;
     net::io_service                     ioc;
     std::shared_ptr<const shared_state> state    = {};
     std::string                         address  = {};
     std::string                         port     = {};
     std::vector<std::thread>            threads  = {};
     std::unique_ptr<tcp::acceptor>      acceptor = {};
+    std::shared_ptr<query_executor>     executor = {};
 
     server_impl(int num_threads, const std::shared_ptr<const shared_state>& state, const std::string& address, const std::string& port)
-        : num_threads{num_threads}
-        , ioc{num_threads}
+        : num_io_threads{state->io_threads}
+        , ioc{state->io_threads}
         , state{state}
         , address{address}
-        , port{port} {}
+        , port{port}
+        , executor{std::make_shared<query_executor>(num_threads, state->max_queued, state->queue_timeout)} {
+        state->db_iface->post_query_work = [executor = std::weak_ptr<query_executor>{executor}](std::function<void()> work) {
+            if (auto e = executor.lock())
+                net::post(e->pool, std::move(work));
+        };
+    }
 
     virtual ~server_impl() {}
 
@@ -524,6 +1006,8 @@ struct server_impl : http_server, std::enable_shared_from_this<server_impl> {
         for (auto& t : threads)
             t.join();
         threads.clear();
+        executor->pool.stop();
+        executor->pool.join();
     }
 
     void start() {
@@ -542,19 +1026,25 @@ struct server_impl : http_server, std::enable_shared_from_this<server_impl> {
         } catch (std::exception& e) {
             throw std::runtime_error("make_address(): "s + address + ": " + e.what());
         }
+        std::shared_ptr<subscription_hub> hub;
+        if (state->subscribe_poll.count()) {
+            hub = std::make_shared<subscription_hub>(ioc, state, executor);
+            hub->run();
+        }
         std::make_shared<listener>(
-            ioc, tcp::endpoint{a, (unsigned short)std::atoi(port.c_str())}, std::make_shared<std::string>(state->static_dir), state)
+            ioc, tcp::endpoint{a, (unsigned short)std::atoi(port.c_str())}, std::make_shared<std::string>(state->static_dir), state,
+            executor, hub)
             ->run();
 
-        threads.reserve(num_threads);
-        for (int i = 0; i < num_threads; ++i)
+        threads.reserve(num_io_threads);
+        for (int i = 0; i < num_io_threads; ++i)
             threads.emplace_back([self = shared_from_this()] { self->ioc.run(); });
     }
 }; // server_impl
 
 std::shared_ptr<http_server> http_server::create(
     int num_threads, const std::shared_ptr<const shared_state>& state, const std::string& address, const std::string& port) {
-    FC_ASSERT(num_threads > 0, "too few threads");
+    FC_ASSERT(num_threads > 0 && state->io_threads > 0, "too few threads");
     auto server = std::make_shared<server_impl>(num_threads, state, address, port);
     server->start();
     return server;
@@ -4,31 +4,158 @@
 #include "state_history_pg.hpp"
 #include "util.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <fc/exception/exception.hpp>
+#include <future>
+#include <mutex>
+#include <set>
 
 using namespace appbase;
 namespace pg = state_history::pg;
 
 static abstract_plugin& _wasm_ql_pg_plugin = app().register_plugin<wasm_ql_pg_plugin>();
 
+using read_transaction = pqxx::transaction<pqxx::isolation_level::repeatable_read, pqxx::write_policy::read_only>;
+
+/// a connection and the query functions already prepared on it
+struct pooled_connection {
+    pqxx::connection   sql_connection = {};
+    std::set<uint64_t> prepared       = {};
+};
+
 struct pg_database_interface : database_interface, std::enable_shared_from_this<pg_database_interface> {
-    std::string                       schema = {};
-    std::unique_ptr<const pg::config> config = {};
+    std::string                       schema           = {};
+    std::unique_ptr<const pg::config> config           = {};
+    uint32_t                          shards           = 0; // pieces a long block range scan is split into; 0 or 1 disables it
+    uint32_t                          shard_min_blocks = 1; // shortest block range a piece gets
+    uint32_t                          max_connections  = 0; // open connections, idle or borrowed; 0 is no limit
+
+    // idle connections; each request thread borrows at most one, and shards of a split query take only what's left over
+    std::mutex                                      connections_mutex   = {};
+    std::condition_variable                         connections_changed = {};
+    std::vector<std::unique_ptr<pooled_connection>> connections         = {};
+    uint32_t                                        num_connections     = 0; // open, including borrowed ones
 
     virtual ~pg_database_interface() {}
 
     virtual std::unique_ptr<query_session> create_query_session();
+
+    /// takes an idle connection or opens one; once max_connections are open, waits for one to come back
+    std::unique_ptr<pooled_connection> borrow_connection() {
+        std::unique_lock<std::mutex> lock{connections_mutex};
+        connections_changed.wait(lock, [&] { return !connections.empty() || !max_connections || num_connections < max_connections; });
+        return take_connection(lock);
+    }
+
+    /// like borrow_connection, but returns null instead of waiting
+    std::unique_ptr<pooled_connection> try_borrow_connection() {
+        std::unique_lock<std::mutex> lock{connections_mutex};
+        if (connections.empty() && max_connections && num_connections >= max_connections)
+            return nullptr;
+        return take_connection(lock);
+    }
+
+    std::unique_ptr<pooled_connection> take_connection(std::unique_lock<std::mutex>& lock) {
+        while (!connections.empty()) {
+            auto result = std::move(connections.back());
+            connections.pop_back();
+            if (result->sql_connection.is_open())
+                return result;
+            --num_connections;
+        }
+        ++num_connections;
+        lock.unlock();
+        try {
+            return std::make_unique<pooled_connection>();
+        } catch (...) {
+            release_connection_slot();
+            throw;
+        }
+    }
+
+    void release_connection_slot() {
+        {
+            std::lock_guard<std::mutex> lock{connections_mutex};
+            --num_connections;
+        }
+        connections_changed.notify_one();
+    }
+
+    /// connections which have closed are dropped
+    void return_connection(std::unique_ptr<pooled_connection> connection) {
+        if (!connection->sql_connection.is_open())
+            return release_connection_slot();
+        {
+            std::lock_guard<std::mutex> lock{connections_mutex};
+            connections.push_back(std::move(connection));
+        }
+        connections_changed.notify_one();
+    }
+
+    /// prepares "select * from schema.function($1, ...)" the first time this connection runs the query
+    std::string prepare_query(pooled_connection& connection, const pg::query& query) {
+        auto name = "wql_" + (std::string)query.short_name;
+        if (connection.prepared.insert(query.short_name.value).second) {
+            auto num_params = (query.has_block_snapshot ? 1 : 0) + query.arg_types.size() + 2 * query.index_obj->range_types.size() + 1;
+            auto sql        = "select * from \"" + schema + "\"." + query.function + "(";
+            for (size_t i = 0; i < num_params; ++i)
+                sql += (i ? ", $" : "$") + std::to_string(i + 1);
+            sql += ")";
+            try {
+                connection.sql_connection.prepare(name, sql);
+            } catch (...) {
+                connection.prepared.erase(query.short_name.value);
+                throw;
+            }
+        }
+        return name;
+    }
+
+    /// runs a query function on a borrowed connection, reading the snapshot another transaction exported
+    pqxx::result run_in_snapshot(
+        pooled_connection& connection, const pg::query& query, const std::string& snapshot, const std::vector<std::string>& params) {
+        read_transaction t{connection.sql_connection};
+        t.exec("set transaction snapshot " + t.quote(snapshot));
+        return t.exec_prepared(prepare_query(connection, query), pqxx::prepare::make_dynamic_params(params));
+    }
 };
 
+/// Runs a whole request in one read-only REPEATABLE READ transaction on a pooled connection. fill_status, the query results
+/// and the fork check all see the same snapshot.
 struct pg_query_session : query_session {
-    virtual ~pg_query_session() {}
+    using transaction_t = read_transaction;
 
-    std::shared_ptr<pg_database_interface> db_iface;
-    pqxx::connection                       sql_connection = {};
+    std::shared_ptr<pg_database_interface>    db_iface;
+    std::unique_ptr<pooled_connection>        connection;
+    pqxx::connection&                         sql_connection;
+    std::optional<transaction_t>              t;
+    std::optional<state_history::fill_status> status      = {}; // as read in this session's snapshot
+    std::vector<std::string>                  params      = {};
+    std::vector<char>                         row_bin     = {};
+    uint32_t                                  num_cursors = 0;
+    std::optional<std::string>                snapshot_id = {}; // exported for shards; empty if this server can't export one
+
+    pg_query_session(const std::shared_ptr<pg_database_interface>& db_iface)
+        : db_iface(db_iface)
+        , connection(db_iface->borrow_connection())
+        , sql_connection(connection->sql_connection) {
+        try {
+            t.emplace(sql_connection);
+        } catch (...) {
+            db_iface->return_connection(std::move(connection));
+            throw;
+        }
+    }
+
+    virtual ~pg_query_session() {
+        t.reset();
+        db_iface->return_connection(std::move(connection));
+    }
 
     virtual state_history::fill_status get_fill_status() override {
-        pqxx::work t(sql_connection);
-        auto row = t.exec("select head, head_id, irreversible, irreversible_id, first from \"" + db_iface->schema + "\".fill_status")[0];
+        auto row = t->exec("select head, head_id, irreversible, irreversible_id, first from \"" + db_iface->schema + "\".fill_status")[0];
 
         state_history::fill_status result;
         result.head            = row[0].as<uint32_t>();
@@ -39,20 +166,21 @@ struct pg_query_session : query_session {
         return result;
     }
 
-    virtual std::optional<abieos::checksum256> get_block_id(uint32_t block_num) override {
-        pqxx::work t(sql_connection);
-        auto       result =
-            t.exec("select block_id from \"" + db_iface->schema + "\".block_info where block_num=" + pg::sql_str(false, block_num));
+    virtual std::optional<eosio::checksum256> get_block_id(uint32_t block_num) override {
+        // fill-pg commits fill_status apart from the block_info rows its COPY streams write, so even within one snapshot the
+        // head's row may be missing or from another fork; did_fork relies on this lookup to notice
+        auto result =
+            t->exec("select block_id from \"" + db_iface->schema + "\".block_info where block_num=" + pg::sql_str(block_num));
         if (result.empty())
             return {};
         return pg::sql_to_checksum256(result[0][0].c_str());
     }
 
-    virtual std::vector<char> query_database(abieos::input_buffer query_bin, uint32_t head) override {
-        abieos::name query_name;
-        abieos::bin_to_native(query_name, query_bin);
+    /// looks up the query named at the front of query_bin and fills params with its arguments
+    const pg::query& bind_query(eosio::input_stream& query_bin, uint32_t head) {
+        auto query_name = eosio::from_bin<eosio::name>(query_bin);
 
-        // todo: check for false positives in secondary indexes
+        // the query functions skip stale secondary index hits; see create-init-sql.js
         auto it = db_iface->config->query_map.find(query_name);
         if (it == db_iface->config->query_map.end())
             throw std::runtime_error("query_database: unknown query: " + (std::string)query_name);
@@ -60,64 +188,234 @@ struct pg_query_session : query_session {
 
         uint32_t snapshot_block_num = 0;
         if (query.has_block_snapshot)
-            snapshot_block_num = std::min(head, abieos::bin_to_native<uint32_t>(query_bin));
-        std::string query_str = "select * from \"" + db_iface->schema + "\"." + query.function + "(";
-        bool        need_sep  = false;
-        if (query.has_block_snapshot) {
-            query_str += pg::sql_str(false, snapshot_block_num);
-            need_sep = true;
-        }
+            snapshot_block_num = std::min(head, eosio::from_bin<uint32_t>(query_bin));
+        newest_block_read = std::max(newest_block_read, query.has_block_snapshot ? snapshot_block_num : head);
+        params.clear();
+        if (query.has_block_snapshot)
+            params.push_back(pg::sql_str(snapshot_block_num));
         auto add_args = [&](auto& args) {
-            for (auto& arg : args) {
-                if (need_sep)
-                    query_str += pg::sep(false);
-                query_str += arg.bin_to_sql(sql_connection, false, query_bin);
-                need_sep = true;
-            }
+            for (auto& arg : args)
+                params.push_back(arg.bin_to_param(query_bin));
         };
         add_args(query.arg_types);
         add_args(query.index_obj->range_types);
         add_args(query.index_obj->range_types);
-        auto max_results = abieos::read_raw<uint32_t>(query_bin);
-        query_str += pg::sep(false) + pg::sql_str(false, std::min(max_results, query.max_results));
-        query_str += ")";
+        auto max_results = eosio::from_bin<uint32_t>(query_bin);
+        params.push_back(pg::sql_str(std::min(max_results, query.max_results)));
+        return query;
+    }
 
-        pqxx::work        t(sql_connection);
-        auto              exec_result = t.exec(query_str);
-        std::vector<char> result;
-        std::vector<char> row_bin;
-        abieos::push_varuint32(result, exec_result.size());
-        for (const auto& r : exec_result) {
-            row_bin.clear();
-            int i = 0;
-            for (size_t field_index = 0; field_index < query.result_fields.size();) {
-                auto& field = query.result_fields[field_index++];
-                field.type_obj->sql_to_bin(row_bin, r[i++]);
-                if (field.begin_optional && !r[i - 1].as<bool>()) {
-                    while (field_index < query.result_fields.size()) {
-                        ++field_index;
-                        ++i;
-                        if (query.result_fields[field_index - 1].end_optional)
-                            break;
-                    }
+    /// appends the row count, then each row's size and binary form
+    void append_rows(std::vector<char>& result, const pg::query& query, const pqxx::result& exec_result) {
+        eosio::convert_to_bin(eosio::varuint32{uint32_t(exec_result.size())}, result);
+        for (const auto& r : exec_result)
+            append_row(result, query, r);
+        if ((uint32_t)result.size() != result.size())
+            throw std::runtime_error("query_database: result is too big");
+    }
+
+    /// appends a row's size and binary form
+    void append_row(std::vector<char>& result, const pg::query& query, const pqxx::row& r) {
+        row_bin.clear();
+        int i = 0;
+        for (size_t field_index = 0; field_index < query.result_fields.size();) {
+            auto& field = query.result_fields[field_index++];
+            auto  value = r[i++];
+            field.type_obj->sql_to_bin(row_bin, value.is_null() ? nullptr : value.c_str());
+            if (field.begin_optional && !value.as<bool>()) {
+                while (field_index < query.result_fields.size()) {
+                    ++field_index;
+                    ++i;
+                    if (query.result_fields[field_index - 1].end_optional)
+                        break;
                 }
             }
-            if ((uint32_t)row_bin.size() != row_bin.size())
-                throw std::runtime_error("query_database: row is too big");
-            abieos::push_varuint32(result, row_bin.size());
-            result.insert(result.end(), row_bin.begin(), row_bin.end());
         }
-        t.commit();
+        if ((uint32_t)row_bin.size() != row_bin.size())
+            throw std::runtime_error("query_database: row is too big");
+        eosio::convert_to_bin(eosio::varuint32{uint32_t(row_bin.size())}, result);
+        result.insert(result.end(), row_bin.begin(), row_bin.end());
+    }
+
+    /// exports this session's snapshot so other connections can read what it reads. Standbys can't export snapshots.
+    const std::string& exported_snapshot() {
+        if (!snapshot_id)
+            snapshot_id = t->exec("select case when pg_is_in_recovery() then '' else pg_export_snapshot() end")[0][0].c_str();
+        return *snapshot_id;
+    }
+
+    /// One shard of a split query. Whichever thread claims it first runs it: a query thread with an idle connection to spare,
+    /// or the session's own thread, in its own transaction, once it has run the shards before it.
+    struct shard_piece {
+        std::vector<std::string>   params  = {};
+        std::atomic<bool>          claimed = false;
+        std::promise<pqxx::result> result  = {};
+    };
+
+    /// Splits a scan of one key prefix over a long block range into shards, which run at once on the query threads in this
+    /// session's snapshot. Neighboring shards both include the key where they meet, so a row which both return is kept
+    /// once. The results stop at the first shard which hits max_results, since rows after it may be missing.
+    std::optional<std::vector<char>> query_shards(const pg::query& query) {
+        auto& sort_keys = query.index_obj->sort_keys;
+        auto  num_keys  = sort_keys.size();
+        auto  block_key = std::find_if(sort_keys.begin(), sort_keys.end(), [](auto& k) { return k.name == "block_num"; }) -
+                         sort_keys.begin();
+        auto  num       = db_iface->shards;
+        if (num < 2 || (size_t)block_key == num_keys)
+            return {};
+
+        // params: [snapshot block], args, first key, last key, max_results
+        auto first = (query.has_block_snapshot ? 1 : 0) + query.arg_types.size();
+        auto last  = first + num_keys;
+        for (auto i = 0; i < block_key; ++i)
+            if (params[first + i] != params[last + i])
+                return {};
+        uint64_t begin = std::stoull(params[first + block_key]);
+        uint64_t end   = std::stoull(params[last + block_key]);
+        if (query.has_block_snapshot)
+            end = std::min<uint64_t>(end, std::stoull(params[0]));
+        if (end <= begin || (end - begin) / num < std::max<uint32_t>(db_iface->shard_min_blocks, 1))
+            return {};
+        auto& snapshot = exported_snapshot();
+        if (snapshot.empty())
+            return {};
+
+        // a query thread may only get to a piece after this request is done with it, so the pieces outlive the request
+        auto pieces = std::make_shared<std::vector<shard_piece>>(num);
+        for (uint32_t i = 0; i < num; ++i) {
+            auto& p = (*pieces)[i].params = params;
+            if (i)
+                p[first + block_key] = std::to_string(begin + (end - begin) * i / num);
+            if (i + 1 < num) {
+                p[last + block_key] = std::to_string(begin + (end - begin) * (i + 1) / num);
+                for (auto j = block_key + 1; j < (ptrdiff_t)num_keys; ++j)
+                    p[last + j] = params[first + j];
+            }
+        }
+        if (db_iface->post_query_work) {
+            for (uint32_t i = 1; i < num; ++i) {
+                db_iface->post_query_work([db_iface = db_iface, query = &query, snapshot, pieces, i] {
+                    auto& piece      = (*pieces)[i];
+                    auto  connection = piece.claimed ? nullptr : db_iface->try_borrow_connection();
+                    if (!connection)
+                        return;
+                    if (!piece.claimed.exchange(true)) {
+                        try {
+                            piece.result.set_value(db_iface->run_in_snapshot(*connection, *query, snapshot, piece.params));
+                        } catch (...) {
+                            piece.result.set_exception(std::current_exception());
+                        }
+                    }
+                    db_iface->return_connection(std::move(connection));
+                });
+            }
+        }
+        std::vector<std::future<pqxx::result>> futures;
+        try {
+            for (auto& piece : *pieces) {
+                futures.push_back(piece.result.get_future());
+                if (!piece.claimed.exchange(true))
+                    piece.result.set_value(t->exec_prepared(db_iface->prepare_query(*connection, query), //
+                                                            pqxx::prepare::make_dynamic_params(piece.params)));
+            }
+        } catch (...) {
+            // the snapshot goes away with this transaction, so the rest mustn't start
+            for (auto& piece : *pieces)
+                piece.claimed = true;
+            throw;
+        }
+        std::vector<pqxx::result> shards;
+        for (auto& f : futures)
+            shards.push_back(f.get());
+
+        auto              max_results = std::stoul(params.back());
+        uint32_t          num_rows    = 0;
+        std::vector<char> rows;
+        for (size_t i = 0; i < shards.size() && num_rows < max_results; ++i) {
+            size_t row = 0;
+            if (i && !shards[i].empty() && !shards[i - 1].empty() && shards[i][0] == shards[i - 1][shards[i - 1].size() - 1])
+                row = 1;
+            for (; row < shards[i].size() && num_rows < max_results; ++row, ++num_rows)
+                append_row(rows, query, shards[i][row]);
+            if (shards[i].size() >= max_results)
+                break;
+        }
+        std::vector<char> result;
+        eosio::convert_to_bin(eosio::varuint32{num_rows}, result);
+        result.insert(result.end(), rows.begin(), rows.end());
         if ((uint32_t)result.size() != result.size())
             throw std::runtime_error("query_database: result is too big");
         return result;
     }
+
+    virtual std::vector<char> query_database(eosio::input_stream query_bin, uint32_t head) override {
+        auto& query = bind_query(query_bin, head);
+        if (auto result = query_shards(query))
+            return std::move(*result);
+        auto              statement   = db_iface->prepare_query(*connection, query);
+        auto              exec_result = t->exec_prepared(statement, pqxx::prepare::make_dynamic_params(params));
+        std::vector<char> result;
+        append_rows(result, query, exec_result);
+        return result;
+    }
+
+    virtual std::unique_ptr<query_cursor> open_query(eosio::input_stream query_bin, uint32_t head) override;
+
+    // contract_row's primary key starts with block_num, so this is a range scan
+    virtual std::vector<table_change> get_table_changes(uint32_t first, uint32_t last) override {
+        auto rows = t->exec(
+            "select distinct block_num, code, \"table\", scope from \"" + db_iface->schema + "\".contract_row where block_num > " +
+            pg::sql_str(first) + " and block_num <= " + pg::sql_str(last) + " order by block_num, code, \"table\", scope");
+        std::vector<table_change> result;
+        result.reserve(rows.size());
+        for (const auto& r : rows)
+            result.push_back({r[0].as<uint32_t>(), eosio::name{r[1].c_str()}, eosio::name{r[2].c_str()}, eosio::name{r[3].c_str()}});
+        return result;
+    }
 }; // pg_query_session
 
+/// A server-side cursor over a query function's rows, declared inside the session's transaction. Each batch is a FETCH.
+struct pg_query_cursor : query_cursor {
+    pg_query_session& session;
+    const pg::query&  query;
+    std::string       name;
+    bool              done = false;
+
+    pg_query_cursor(pg_query_session& session, const pg::query& query)
+        : session(session)
+        , query(query)
+        , name("wql_cursor_" + std::to_string(session.num_cursors++)) {
+        std::string sql =
+            "declare " + name + " no scroll cursor for select * from \"" + session.db_iface->schema + "\"." + query.function + "(";
+        for (size_t i = 0; i < session.params.size(); ++i)
+            sql += (i ? ", $" : "$") + std::to_string(i + 1);
+        sql += ")";
+        session.t->exec_params(sql, pqxx::prepare::make_dynamic_params(session.params));
+    }
+
+    virtual ~pg_query_cursor() {
+        try {
+            session.t->exec("close " + name);
+        } catch (...) {
+        }
+    }
+
+    virtual void next_batch(std::vector<char>& batch, uint32_t max_rows) override {
+        if (done || !max_rows)
+            return eosio::convert_to_bin(eosio::varuint32{0}, batch);
+        auto exec_result = session.t->exec("fetch forward " + std::to_string(max_rows) + " from " + name);
+        done             = exec_result.size() < max_rows;
+        session.append_rows(batch, query, exec_result);
+    }
+};
+
+std::unique_ptr<query_cursor> pg_query_session::open_query(eosio::input_stream query_bin, uint32_t head) {
+    auto& query = bind_query(query_bin, head);
+    return std::make_unique<pg_query_cursor>(*this, query);
+}
+
 std::unique_ptr<query_session> pg_database_interface::create_query_session() {
-    auto session      = std::make_unique<pg_query_session>();
-    session->db_iface = shared_from_this();
-    return session;
+    return std::make_unique<pg_query_session>(shared_from_this());
 }
 
 struct wasm_ql_pg_plugin_impl {
@@ -129,16 +427,28 @@ wasm_ql_pg_plugin::wasm_ql_pg_plugin()
 
 wasm_ql_pg_plugin::~wasm_ql_pg_plugin() {}
 
-void wasm_ql_pg_plugin::set_program_options(options_description& cli, options_description& cfg) {}
+void wasm_ql_pg_plugin::set_program_options(options_description& cli, options_description& cfg) {
+    auto op = cfg.add_options();
+    op("wql-pg-shards", bpo::value<uint32_t>()->default_value(0),
+       "Split long block range scans into this many pieces, run at once on idle query threads and connections (0: disabled)");
+    op("wql-pg-shard-blocks", bpo::value<uint32_t>()->default_value(1000000),
+       "Only split scans whose pieces span at least this many blocks");
+    op("wql-pg-max-connections", bpo::value<uint32_t>()->default_value(16),
+       "Most connections to keep open; requests wait for one beyond that, and split scans run fewer pieces at once (0: no limit)");
+}
 
 void wasm_ql_pg_plugin::plugin_initialize(const variables_map& options) {
     try {
-        my->interface         = std::make_shared<pg_database_interface>();
-        my->interface->schema = options["pg-schema"].as<std::string>();
-        auto x                = read_string(options["query-config"].as<std::string>().c_str());
-        auto config           = std::make_unique<pg::config>();
+        my->interface                   = std::make_shared<pg_database_interface>();
+        my->interface->schema           = options["pg-schema"].as<std::string>();
+        my->interface->shards           = options["wql-pg-shards"].as<uint32_t>();
+        my->interface->shard_min_blocks = options["wql-pg-shard-blocks"].as<uint32_t>();
+        my->interface->max_connections  = options["wql-pg-max-connections"].as<uint32_t>();
+        auto x                          = read_string(options["query-config"].as<std::string>().c_str());
+        auto config                     = std::make_unique<pg::config>();
         try {
-            abieos::json_to_native(*config, x);
+            auto is = eosio::json_token_stream{x.data()};
+            from_json(*config, is);
         } catch (const std::exception& e) {
             throw std::runtime_error("error processing " + options["query-config"].as<std::string>() + ": " + e.what());
         }
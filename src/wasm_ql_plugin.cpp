@@ -56,11 +56,30 @@ wasm_ql_plugin::~wasm_ql_plugin() {
 void wasm_ql_plugin::set_program_options(options_description& cli, options_description& cfg) {
     auto op = cfg.add_options();
     op("wql-threads", bpo::value<int>()->default_value(8), "Number of threads to process requests");
+    op("wql-io-threads", bpo::value<int>()->default_value(2), "Number of threads to accept connections and read and write HTTP");
+    op("wql-max-queue", bpo::value<uint32_t>()->default_value(1000), "Number of requests which may wait for a thread; more get 503");
+    op("wql-queue-timeout-ms", bpo::value<uint32_t>()->default_value(5000),
+       "Milliseconds a request may wait for a thread before it gets 503");
+    op("wql-pipeline-depth", bpo::value<uint32_t>()->default_value(8),
+       "Number of requests a connection may have in progress; queries among them run at once, and reply in order");
+    op("wql-idle-timeout-ms", bpo::value<uint32_t>()->default_value(30000),
+       "Close connections which send nothing for this long while no replies are pending; also limits each write");
+    op("wql-max-request-size", bpo::value<uint32_t>()->default_value(10000), "Largest request body, in bytes");
     op("wql-listen", bpo::value<std::string>()->default_value("127.0.0.1:8880"), "Endpoint to listen on");
     op("wql-allow-origin", bpo::value<std::string>(), "Access-Control-Allow-Origin header. Use \"*\" to allow any.");
     op("wql-wasm-dir", bpo::value<std::string>()->default_value("."), "Directory to fetch WASMs from");
     op("wql-static-dir", bpo::value<std::string>(), "Directory to serve static files from (default: disabled)");
     op("wql-console", "Show console output");
+    op("wql-vm", bpo::value<std::string>()->default_value("interpreter"), "How to run server WASMs: interpreter or jit");
+    op("wql-cache-size", bpo::value<uint32_t>()->default_value(0),
+       "Number of responses to cache which only depend on irreversible blocks (0: disabled)");
+    op("wql-compress-min-size", bpo::value<uint32_t>()->default_value(1024),
+       "Compress replies of at least this many bytes when the client accepts gzip or deflate (0: disabled)");
+    op("wql-subscribe-poll-ms", bpo::value<uint32_t>()->default_value(500),
+       "How often websocket subscriptions check the database for new blocks (0: subscriptions disabled)");
+    op("wql-abi-cache-size", bpo::value<uint32_t>()->default_value(1000),
+       "Number of contract ABIs to keep parsed for contract_row_to_json (0: disabled)");
+    op("wql-request-log", bpo::value<std::string>(), "Append query requests to [arg], for wasm-ql-load to replay (default: disabled)");
 }
 
 void wasm_ql_plugin::plugin_initialize(const variables_map& options) {
@@ -75,10 +94,28 @@ void wasm_ql_plugin::plugin_initialize(const variables_map& options) {
         my->endpoint_port    = ip_port.substr(ip_port.find(':') + 1, ip_port.size());
         my->endpoint_address = ip_port.substr(0, ip_port.find(':'));
         my->state->wasm_dir  = options.at("wql-wasm-dir").as<std::string>();
+        auto vm              = options.at("wql-vm").as<std::string>();
+        if (vm != "interpreter" && vm != "jit")
+            throw std::runtime_error("invalid --wql-vm value: " + vm);
+        my->state->jit                    = vm == "jit";
+        my->state->cache_size             = options.at("wql-cache-size").as<uint32_t>();
+        my->state->compress_min_size      = options.at("wql-compress-min-size").as<uint32_t>();
+        my->state->io_threads             = options.at("wql-io-threads").as<int>();
+        my->state->max_queued             = options.at("wql-max-queue").as<uint32_t>();
+        my->state->queue_timeout          = std::chrono::milliseconds(options.at("wql-queue-timeout-ms").as<uint32_t>());
+        my->state->subscribe_poll         = std::chrono::milliseconds(options.at("wql-subscribe-poll-ms").as<uint32_t>());
+        my->state->pipeline_depth         = options.at("wql-pipeline-depth").as<uint32_t>();
+        my->state->idle_timeout           = std::chrono::milliseconds(options.at("wql-idle-timeout-ms").as<uint32_t>());
+        my->state->max_request_size       = options.at("wql-max-request-size").as<uint32_t>();
+        my->state->abi_cache->max_entries = options.at("wql-abi-cache-size").as<uint32_t>();
+        if (!my->state->pipeline_depth)
+            throw std::runtime_error("--wql-pipeline-depth must be at least 1");
         if (options.count("wql-allow-origin"))
             my->state->allow_origin = options.at("wql-allow-origin").as<std::string>();
         if (options.count("wql-static-dir"))
             my->state->static_dir = options.at("wql-static-dir").as<std::string>();
+        if (options.count("wql-request-log"))
+            my->state->request_log = std::make_shared<request_log::writer>(options.at("wql-request-log").as<std::string>());
 
         register_callbacks();
     }
@@ -3,26 +3,82 @@
 #pragma once
 #include <appbase/application.hpp>
 
+#include "metrics_plugin.hpp"
 #include "query_config.hpp"
 #include "state_history.hpp"
 
+#include <eosio/from_bin.hpp>
+#include <eosio/to_bin.hpp>
+#include <functional>
+
+/// Delivers a query's rows in batches. Each batch has query_database's format; an empty batch ends the results.
+struct query_cursor {
+    virtual ~query_cursor() {}
+
+    virtual void next_batch(std::vector<char>& batch, uint32_t max_rows) = 0;
+};
+
+/// serves batches from a result which query_database already produced
+struct materialized_query_cursor : query_cursor {
+    std::vector<char>   result;
+    eosio::input_stream bin;
+    uint32_t            remaining_rows;
+
+    materialized_query_cursor(std::vector<char> r)
+        : result(std::move(r))
+        , bin{result.data(), result.data() + result.size()}
+        , remaining_rows(eosio::from_bin<eosio::varuint32>(bin).value) {}
+
+    virtual void next_batch(std::vector<char>& batch, uint32_t max_rows) override {
+        auto n = std::min(max_rows, remaining_rows);
+        eosio::convert_to_bin(eosio::varuint32{n}, batch);
+        auto begin = bin.pos;
+        for (uint32_t i = 0; i < n; ++i)
+            eosio::from_bin<eosio::input_stream>(bin);
+        batch.insert(batch.end(), begin, bin.pos);
+        remaining_rows -= n;
+    }
+};
+
+/// a (code, table, scope) with contract_row deltas in a block
+struct table_change {
+    uint32_t    block_num = {};
+    eosio::name code      = {};
+    eosio::name table     = {};
+    eosio::name scope     = {};
+};
+
 struct query_session {
     virtual ~query_session() {}
 
-    virtual state_history::fill_status         get_fill_status()                                         = 0;
-    virtual std::optional<abieos::checksum256> get_block_id(uint32_t block_num)                          = 0;
-    virtual std::vector<char>                  query_database(abieos::input_buffer query, uint32_t head) = 0;
+    uint32_t newest_block_read = 0;     // newest state any query has read: its snapshot block, or head if it has none
+    bool     consistent_reads  = false; // every read sees the database as of session creation, so a fork can't show up midway
+
+    virtual state_history::fill_status        get_fill_status()                                        = 0;
+    virtual std::optional<eosio::checksum256> get_block_id(uint32_t block_num)                         = 0;
+    virtual std::vector<char>                 query_database(eosio::input_stream query, uint32_t head) = 0;
+
+    /// each (code, table, scope) with deltas in blocks (first, last], by block then code, table and scope
+    virtual std::vector<table_change> get_table_changes(uint32_t first, uint32_t last) = 0;
+
+    /// the default cursor runs query_database and hands out its rows in batches
+    virtual std::unique_ptr<query_cursor> open_query(eosio::input_stream query, uint32_t head) {
+        return std::make_unique<materialized_query_cursor>(query_database(query, head));
+    }
 };
 
 struct database_interface {
     virtual ~database_interface() {}
 
+    /// runs work on a query thread; set by the http server. Work posted once the server has stopped is dropped.
+    std::function<void(std::function<void()>)> post_query_work = {};
+
     virtual std::unique_ptr<query_session> create_query_session() = 0;
 };
 
 class wasm_ql_plugin : public appbase::plugin<wasm_ql_plugin> {
   public:
-    APPBASE_PLUGIN_REQUIRES((wasm_ql_plugin))
+    APPBASE_PLUGIN_REQUIRES((metrics_plugin))
 
     wasm_ql_plugin();
     virtual ~wasm_ql_plugin();
@@ -3,9 +3,13 @@
 #include "wasm_ql_rocksdb_plugin.hpp"
 #include "util.hpp"
 
+#include <algorithm>
 #include <fc/exception/exception.hpp>
+#include <map>
+#include <tuple>
 
 using namespace appbase;
+using namespace eosio::literals;
 namespace kv  = state_history::kv;
 namespace rdb = state_history::rdb;
 
@@ -22,32 +26,51 @@ struct rocksdb_database_interface : database_interface, std::enable_shared_from_
 struct rocksdb_query_session : query_session {
     std::shared_ptr<rocksdb_database_interface> db_iface;
     state_history::fill_status                  fill_status;
+    const rocksdb::Snapshot*                    snapshot;
     std::unique_ptr<rocksdb::Iterator>          it_for_get;
     std::unique_ptr<rocksdb::Iterator>          it0;
     std::unique_ptr<rocksdb::Iterator>          it1;
     std::unique_ptr<rocksdb::Iterator>          it2;
-    std::unique_ptr<rocksdb::Iterator>          it3;
-    std::unique_ptr<rocksdb::Iterator>          it4;
 
     rocksdb_query_session(const std::shared_ptr<rocksdb_database_interface>& db_iface)
         : db_iface(db_iface)
-        , it_for_get{db_iface->rocksdb_inst->database.db->NewIterator(rocksdb::ReadOptions())}
-        , it0{db_iface->rocksdb_inst->database.db->NewIterator(rocksdb::ReadOptions())}
-        , it1{db_iface->rocksdb_inst->database.db->NewIterator(rocksdb::ReadOptions())}
-        , it2{db_iface->rocksdb_inst->database.db->NewIterator(rocksdb::ReadOptions())}
-        , it3{db_iface->rocksdb_inst->database.db->NewIterator(rocksdb::ReadOptions())}
-        , it4{db_iface->rocksdb_inst->database.db->NewIterator(rocksdb::ReadOptions())} {
+        , snapshot(db_iface->rocksdb_inst->database.db->GetSnapshot())
+        , it_for_get{new_iterator(db_iface->rocksdb_inst->database.content())}
+        , it0{new_iterator(db_iface->rocksdb_inst->database.index())}
+        , it1{new_iterator(db_iface->rocksdb_inst->database.index())}
+        , it2{new_iterator(db_iface->rocksdb_inst->database.index())} {
 
         auto f = rdb::get<state_history::fill_status>(*it_for_get, kv::make_fill_status_key(), false);
         if (f)
             fill_status = *f;
+        consistent_reads = snapshot != nullptr; // a secondary instance may not hand out snapshots
     }
 
-    virtual ~rocksdb_query_session() {}
+    virtual ~rocksdb_query_session() {
+        it_for_get.reset();
+        it0.reset();
+        it1.reset();
+        it2.reset();
+        if (snapshot)
+            db_iface->rocksdb_inst->database.db->ReleaseSnapshot(snapshot);
+    }
+
+    rocksdb::ReadOptions read_options() {
+        rocksdb::ReadOptions opt;
+        opt.snapshot = snapshot;
+        return opt;
+    }
+
+    // index scans stay within one table and index, so they can use the index family's prefix bloom filter
+    std::unique_ptr<rocksdb::Iterator> new_iterator(rocksdb::ColumnFamilyHandle* family) {
+        auto opt                 = read_options();
+        opt.prefix_same_as_start = family == db_iface->rocksdb_inst->database.index();
+        return std::unique_ptr<rocksdb::Iterator>{db_iface->rocksdb_inst->database.db->NewIterator(opt, family)};
+    }
 
     virtual state_history::fill_status get_fill_status() override { return fill_status; }
 
-    virtual std::optional<abieos::checksum256> get_block_id(uint32_t block_num) override {
+    virtual std::optional<eosio::checksum256> get_block_id(uint32_t block_num) override {
         auto rb = rdb::get<kv::received_block>(*it_for_get, kv::make_received_block_key(block_num), false);
         if (rb)
             return rb->block_id;
@@ -55,7 +78,7 @@ struct rocksdb_query_session : query_session {
     }
 
     void append_fields(
-        std::vector<char>& dest, abieos::input_buffer src, const std::vector<kv::key>& keys,
+        std::vector<char>& dest, eosio::input_stream src, const std::vector<kv::key>& keys,
         std::vector<std::optional<uint32_t>>& positions, bool xform_key) {
 
         for (auto& key : keys) {
@@ -64,7 +87,7 @@ struct rocksdb_query_session : query_session {
                 throw std::runtime_error("key " + key.name + " has unknown position");
             if (*pos > src.end - src.pos)
                 throw std::runtime_error("key position is out of range");
-            abieos::input_buffer key_pos{src.pos + *pos, src.end};
+            eosio::input_stream key_pos{src.pos + *pos, src.end};
             if (xform_key)
                 key.field->type_obj->bin_to_key(dest, key_pos);
             else
@@ -72,11 +95,106 @@ struct rocksdb_query_session : query_session {
         }
     }
 
-    virtual std::vector<char> query_database(abieos::input_buffer query_bin, uint32_t head) override {
-        abieos::name query_name;
-        abieos::bin_to_native(query_name, query_bin);
+    /// fetches content rows with a single MultiGet; every key must exist
+    std::vector<rocksdb::PinnableSlice> get_rows(const std::vector<std::vector<char>>& keys) {
+        auto&                               database = db_iface->rocksdb_inst->database;
+        std::vector<rocksdb::Slice>         slices;
+        std::vector<rocksdb::PinnableSlice> values(keys.size());
+        std::vector<rocksdb::Status>        statuses(keys.size());
+        for (auto& key : keys)
+            slices.push_back(rdb::to_slice(key));
+        database.db->MultiGet(read_options(), database.content(), keys.size(), slices.data(), values.data(), statuses.data());
+        for (auto& status : statuses)
+            rdb::check(status, "query_database: ");
+        return values;
+    }
+
+    /// Appends each row's fields from its joined row, or empty fields if it has none. Rows often join to the same target, so
+    /// the index is scanned once per distinct join key and each joined row is fetched and decoded once.
+    void add_joins(const kv::query& query, uint32_t snapshot_block_num, std::vector<std::vector<char>>& rows) {
+        std::vector<std::vector<char>>                     join_pks;
+        std::vector<std::optional<size_t>>                 row_join(rows.size()); // index into join_pks
+        std::map<std::vector<char>, std::optional<size_t>> joins_by_key;          // join key to index into join_pks
+        std::vector<std::optional<uint32_t>>               table_positions;
+        for (size_t i = 0; i < rows.size(); ++i) {
+            eosio::input_stream delta_value{rows[i].data(), rows[i].data() + rows[i].size()};
+            auto                join_key = kv::make_index_key(query.join_table->short_name, query.join_query_short_name);
+            kv::init_positions(table_positions, query.table_obj->fields.size());
+            fill_positions(delta_value, query.table_obj->fields, table_positions);
+            if (!keys_have_positions(query.join_key_values, table_positions))
+                continue;
+            append_fields(join_key, delta_value, query.join_key_values, table_positions, true);
+            auto [memo, inserted] = joins_by_key.try_emplace(join_key);
+            if (inserted) {
+                auto join_key_limit_block = join_key;
+                if (query.join_query->table_obj->is_delta)
+                    kv::append_index_suffix(join_key_limit_block, snapshot_block_num);
+                rdb::for_each(*it2, join_key_limit_block, join_key, [&](auto join_index_value, auto) {
+                    memo->second = join_pks.size();
+                    join_pks.push_back(extract_pk_from_index(join_index_value, *query.join_table, query.join_query->index_obj->sort_keys));
+                    return false;
+                });
+            }
+            row_join[i] = memo->second;
+        }
+
+        auto                                              join_values = get_rows(join_pks);
+        std::vector<std::vector<std::optional<uint32_t>>> join_positions(join_values.size()); // filled when first used
+        for (size_t i = 0; i < rows.size(); ++i) {
+            if (!row_join[i]) {
+                for (auto& field : query.join_table->fields)
+                    field.type_obj->fill_empty(rows[i]);
+                continue;
+            }
+            auto  join_delta_value = rdb::to_input_stream(join_values[*row_join[i]]);
+            auto& positions        = join_positions[*row_join[i]];
+            if (positions.empty()) {
+                kv::init_positions(positions, query.join_table->fields.size());
+                fill_positions(join_delta_value, query.join_table->fields, positions);
+            }
+            append_fields(rows[i], join_delta_value, query.fields_from_join, positions, false);
+        }
+    }
+
+    /// An index hit on a delta table is stale if its row has a newer version at or before snapshot_block_num; the newer version
+    /// moved the index's non-key fields (e.g. a secondary key). The table's trim index, which sorts by the table's keys, finds it.
+    bool is_stale(const kv::index& index, eosio::input_stream index_value, uint32_t snapshot_block_num) {
+        auto& table = *index.table_obj;
+        auto* trim  = table.trim_index_obj;
+        if (!table.is_delta || !trim || trim == &index || index.sort_keys.size() <= trim->sort_keys.size())
+            return false;
+
+        std::vector<std::optional<uint32_t>> positions;
+        kv::init_positions(positions, table.fields.size());
+        uint32_t block;
+        bool     present_k;
+        kv::fill_positions_from_index(index_value, index.sort_keys, block, present_k, positions);
+        if (!kv::keys_have_positions(trim->sort_keys, positions))
+            return false;
+
+        auto row_key = kv::make_index_key(table.short_name, trim->short_name);
+        for (auto& k : trim->sort_keys) {
+            eosio::input_stream b = {index_value.pos + *positions[k.field->field_index], index_value.end};
+            k.field->type_obj->key_to_key(row_key, b);
+        }
+        auto row_key_limit_block = row_key;
+        kv::append_index_suffix(row_key_limit_block, snapshot_block_num);
+
+        bool stale = false;
+        rdb::for_each(*it2, row_key_limit_block, row_key, [&](auto newest, auto) {
+            eosio::input_stream suffix{newest.end - 5, newest.end}; // ~block_num, !present_k
+            uint32_t            newest_block;
+            bool                newest_present_k;
+            kv::read_index_suffix(suffix, newest_block, newest_present_k);
+            stale = newest_block != block || newest_present_k != present_k;
+            return false;
+        });
+        return stale;
+    }
+
+    virtual std::vector<char> query_database(eosio::input_stream query_bin, uint32_t head) override {
+        auto query_name = eosio::from_bin<eosio::name>(query_bin);
 
-        // todo: check for false positives in secondary indexes
         // todo: check if index is populated in rdb
         // todo: clamp snapshot_block_num to first?
         auto it = db_iface->rocksdb_inst->query_config->query_map.find(query_name);
@@ -88,7 +206,8 @@ struct rocksdb_query_session : query_session {
 
         uint32_t snapshot_block_num = 0;
         if (query.has_block_snapshot)
-            snapshot_block_num = std::min(head, abieos::bin_to_native<uint32_t>(query_bin));
+            snapshot_block_num = std::min(head, eosio::from_bin<uint32_t>(query_bin));
+        newest_block_read = std::max(newest_block_read, query.has_block_snapshot ? snapshot_block_num : head);
 
         auto first = kv::make_index_key(query.table_obj->short_name, query.index_obj->short_name);
         auto last  = first;
@@ -100,57 +219,63 @@ struct rocksdb_query_session : query_session {
         add_fields(first, query.index_obj->range_types);
         add_fields(last, query.index_obj->range_types);
 
-        auto max_results = std::min(abieos::read_raw<uint32_t>(query_bin), query.max_results);
+        auto max_results = std::min(eosio::from_bin<uint32_t>(query_bin), query.max_results);
 
-        std::vector<std::vector<char>> rows;
+        // collect the page's primary keys first, then fetch the rows together
+        std::vector<std::vector<char>> pks;
         uint32_t                       num_results = 0;
         rdb::for_each_subkey(*it0, first, last, [&](const auto& index_key, auto, auto) {
             std::vector index_key_limit_block = index_key;
             if (query.table_obj->is_delta)
                 kv::append_index_suffix(index_key_limit_block, snapshot_block_num);
             // todo: unify rdb's and pg's handling of negative result because of snapshot_block_num
+            bool stale = false;
             rdb::for_each(*it1, index_key_limit_block, index_key, [&](auto index_value, auto) {
-                auto delta_value =
-                    *rdb::get_raw(*it2, extract_pk_from_index(index_value, *query.table_obj, query.index_obj->sort_keys), true);
-                rows.emplace_back(delta_value.pos, delta_value.end);
-                if (query.join_table) {
-                    auto join_key = kv::make_index_key(query.join_table->short_name, query.join_query_short_name);
-                    std::vector<std::optional<uint32_t>> table_positions;
-                    kv::init_positions(table_positions, query.table_obj->fields.size());
-                    fill_positions(delta_value, query.table_obj->fields, table_positions);
-                    bool found_join = false;
-                    if (keys_have_positions(query.join_key_values, table_positions)) {
-                        append_fields(join_key, delta_value, query.join_key_values, table_positions, true);
-                        auto join_key_limit_block = join_key;
-                        if (query.join_query->table_obj->is_delta)
-                            kv::append_index_suffix(join_key_limit_block, snapshot_block_num);
-                        auto& row = rows.back();
-                        rdb::for_each(*it3, join_key_limit_block, join_key, [&](auto join_index_value, auto) {
-                            found_join            = true;
-                            auto join_delta_value = *rdb::get_raw(
-                                *it4, extract_pk_from_index(join_index_value, *query.join_table, query.join_query->index_obj->sort_keys),
-                                true);
-                            std::vector<std::optional<uint32_t>> join_positions;
-                            kv::init_positions(join_positions, query.join_table->fields.size());
-                            fill_positions(join_delta_value, query.join_table->fields, join_positions);
-                            append_fields(row, join_delta_value, query.fields_from_join, join_positions, false);
-                            return false;
-                        });
-                    }
-                    if (!found_join)
-                        for (auto& field : query.join_table->fields)
-                            field.type_obj->fill_empty(rows.back());
-                }
+                stale = is_stale(*query.index_obj, index_value, snapshot_block_num);
+                if (!stale)
+                    pks.push_back(extract_pk_from_index(index_value, *query.table_obj, query.index_obj->sort_keys));
                 return false;
             });
-            return ++num_results < max_results;
+            return stale || ++num_results < max_results;
         });
 
-        auto result = abieos::native_to_bin(rows);
+        std::vector<std::vector<char>> rows;
+        rows.reserve(pks.size());
+        for (auto& value : get_rows(pks))
+            rows.emplace_back(value.data(), value.data() + value.size());
+        if (query.join_table)
+            add_joins(query, snapshot_block_num, rows);
+
+        auto result = eosio::convert_to_bin(rows);
         if ((uint32_t)result.size() != result.size())
             throw std::runtime_error("query_database: result is too big");
         return result;
     }
+
+    // a block's contract_row keys start with its number, so each block is one short scan per present_k
+    virtual std::vector<table_change> get_table_changes(uint32_t first, uint32_t last) override {
+        std::vector<table_change> result;
+        for (uint32_t block = first + 1; block && block <= last; ++block) {
+            auto block_begin = result.size();
+            for (bool present_k : {false, true}) {
+                auto prefix = kv::make_table_key(block, present_k, "c.row"_n);
+                rdb::for_each(*it_for_get, prefix, prefix, [&](auto key, auto) {
+                    table_change change{block};
+                    key.pos += prefix.size();
+                    change.code  = kv::key_to_native<eosio::name>(key);
+                    change.scope = kv::key_to_native<eosio::name>(key);
+                    change.table = kv::key_to_native<eosio::name>(key);
+                    result.push_back(change);
+                    return true;
+                });
+            }
+            auto key = [](const table_change& c) { return std::make_tuple(c.code.value, c.table.value, c.scope.value); };
+            std::sort(result.begin() + block_begin, result.end(), [&](auto& a, auto& b) { return key(a) < key(b); });
+            result.erase(
+                std::unique(result.begin() + block_begin, result.end(), [&](auto& a, auto& b) { return key(a) == key(b); }), result.end());
+        }
+        return result;
+    }
 }; // rocksdb_query_session
 
 std::unique_ptr<query_session> rocksdb_database_interface::create_query_session() {
@@ -1,88 +1,7 @@
 #define BOOST_TEST_MODULE ship_sql
-#include "test_protocol.hpp"
+#include "test_fixture.hpp"
 #include <boost/test/included/unit_test.hpp>
 
-namespace state_history {
-namespace pg {
-std::string        sql_str(test_protocol::transaction_status v) { return to_string(v); }
-std::string        sql_str(const test_protocol::recurse_transaction_trace& v);
-} // namespace pg
-} // namespace state_history
-
-#include <abieos_sql_converter.hpp>
-
-namespace test_protocol {
-    constexpr const char* get_type_name(transaction_status*) { return "transaction_status"; }
-}
-
-namespace eosio {
-template <>
-inline constexpr bool is_basic_abi_type<input_stream> = true;
-template <>
-constexpr bool is_basic_abi_type<test_protocol::transaction_status> = true;
-
-template <>
-inline abi_type* add_type(abi& a, test_protocol::transaction_status*) {
-    return std::addressof(a.abi_types.try_emplace("transaction_status", "transaction_status", abi_type::builtin{}, nullptr).first->second);
-}
-
-inline abi_type* add_type(abi& a, std::vector<test_protocol::recurse_transaction_trace>*) {
-    abi_type& element_type =
-        a.abi_types.try_emplace("recurse_transaction_trace", "recurse_transaction_trace", abi_type::builtin{}, nullptr).first->second;
-    std::string name      = "recurse_transaction_trace?";
-    auto [iter, inserted] = a.abi_types.try_emplace(name, name, abi_type::optional{&element_type}, optional_abi_serializer);
-    return &iter->second;
-}
-} // namespace eosio
-
-
-bool operator==(const abieos_sql_converter::field_def& lhs, const abieos_sql_converter::field_def& rhs) {
-    return lhs.name == rhs.name && lhs.type == rhs.type;
-}
-
-std::ostream& operator<<(std::ostream& os, const abieos_sql_converter::field_def& f) {
-    return os << "{ " << f.name << " , " << f.type << "}";
-}
-
-namespace state_history {
-namespace pg {
-std::string sql_str(const test_protocol::recurse_transaction_trace& v) {
-    return sql_str(std::visit([](auto& x) { return x.id; }, v.recurse));
-}
-template<> inline constexpr type_names names_for<test_protocol::transaction_status>        = type_names{"transaction_status","transaction_status_type"};
-template<> inline constexpr type_names names_for<test_protocol::recurse_transaction_trace> = type_names{"recurse_transaction_trace","varchar"};
-
-} // namespace pg
-} // namespace state_history
-
-struct test_fixture_t {
-    eosio::abi abi;
-    abieos_sql_converter converter;
-
-    test_fixture_t() {
-        eosio::abi_def empty_def;
-        eosio::convert(empty_def, abi);
-        converter.schema_name     = R"("test")";
-
-        eosio::add_type(abi, (std::vector<test_protocol::recurse_transaction_trace>*)nullptr);
-
-        using basic_types = std::tuple<
-            bool, uint8_t, int8_t, uint16_t, int16_t, uint32_t, int32_t, uint64_t, int64_t, double, std::string, unsigned __int128,
-            __int128, eosio::float128, eosio::varuint32, eosio::varint32, eosio::name, eosio::checksum256, eosio::time_point,
-            eosio::time_point_sec, eosio::block_timestamp, eosio::public_key, eosio::signature, eosio::bytes, eosio::symbol,
-            test_protocol::transaction_status, test_protocol::recurse_transaction_trace>;
-
-        converter.register_basic_types<basic_types>();
-    }
-
-    template <typename T> 
-    abieos_sql_converter::union_fields_t
-    get_union_fields() {
-        std::string type_name = get_type_name((T*)nullptr);
-        return abieos_sql_converter::union_fields_t(converter.schema_name, *abi.get_type(type_name)->as_variant(), converter.basic_converters);
-    }
-};
-
 namespace tt = boost::test_tools;
 
 BOOST_TEST_SPECIALIZED_COLLECTION_COMPARE(std::vector<abieos_sql_converter::field_def>)
@@ -221,6 +140,29 @@ std::vector<std::string> to_sql_values(abieos_sql_converter& converter, const eo
     return values;
 }
 
+BOOST_FIXTURE_TEST_CASE(create_partitioned_table_test, test_fixture_t) {
+    std::vector<std::string> statements;
+    auto  exec           = [&statements](std::string stmt) { statements.push_back(stmt); };
+    auto& permission_abi = *abi.add_type<test_protocol::permission>();
+
+    converter.partitioned = true;
+    converter.create_table("permission", permission_abi, "block_num bigint, present smallint", {"block_num", "present"}, exec);
+    BOOST_TEST(statements.back().substr(statements.back().size() - 32) == ") partition by range (block_num)");
+}
+
+BOOST_FIXTURE_TEST_CASE(table_fields_test, test_fixture_t) {
+    auto& permission_abi = *abi.add_type<test_protocol::permission>();
+
+    auto result   = converter.table_fields(permission_abi);
+    auto expected = std::vector<abieos_sql_converter::field_def>{
+        {"owner", "varchar(13)"},
+        {"name", "varchar(13)"},
+        {"parent", "varchar(13)"},
+        {"last_updated", "timestamp"},
+        {"auth", "\"test\".authority"}};
+    BOOST_TEST(result == expected);
+}
+
 BOOST_FIXTURE_TEST_CASE(to_sql_values_test, test_fixture_t) {
     
     abi.add_type<test_protocol::global_property>();
@@ -304,4 +246,118 @@ BOOST_FIXTURE_TEST_CASE(to_sql_values_test, test_fixture_t) {
     }
 }
 
-BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
+template <typename T>
+std::string append_sql_values(abieos_sql_converter& converter, const eosio::abi_type& abi, const T& v) {
+    std::string         out;
+    auto                buf = eosio::convert_to_bin(v);
+    eosio::input_stream bin{buf};
+    if (abi.as_struct()) {
+        converter.append_sql_values(out, bin, *abi.as_struct());
+    } else if (abi.as_variant()) {
+        converter.append_sql_values(out, bin, abi.name, *abi.as_variant());
+    }
+    return out;
+}
+
+template <typename T>
+std::string joined_sql_values(abieos_sql_converter& converter, const eosio::abi_type& abi, const T& v) {
+    std::string result;
+    for (auto& value : to_sql_values(converter, abi, v))
+        result += "\t" + value;
+    return result;
+}
+
+BOOST_FIXTURE_TEST_CASE(append_sql_values_test, test_fixture_t) {
+    abi.add_type<test_protocol::global_property>();
+    using namespace eosio::literals;
+
+    auto& chain_config_abi = *abi.get_type(get_type_name((test_protocol::chain_config*)nullptr));
+    {
+        test_protocol::chain_config config_v0 = test_protocol::chain_config_v0{1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17};
+        BOOST_TEST(append_sql_values(converter, chain_config_abi, config_v0) == joined_sql_values(converter, chain_config_abi, config_v0));
+    }
+    {
+        test_protocol::authority auth{1,
+                                      {{eosio::public_key_from_string("PUB_K1_6Uaww2itj2Ne7ADEdyqpHbsg42rtNQGSNyomEoREdxAHvShLZq"), 1}},
+                                      {{{"eosio.prods"_n, "active"_n}, 1}},
+                                      {}};
+
+        test_protocol::permission perm{test_protocol::permission_v0{"eosio"_n, "active"_n, ""_n, eosio::time_point{}, auth}};
+        auto&                     permission_abi = *abi.add_type<test_protocol::permission>();
+        BOOST_TEST(append_sql_values(converter, permission_abi, perm) == joined_sql_values(converter, permission_abi, perm));
+    }
+    {
+        test_protocol::transaction_trace_v0   transaction;
+        test_protocol::partial_transaction_v1 pt_v1;
+        pt_v1.prunable_data.emplace();
+        transaction.partial.emplace(pt_v1);
+        test_protocol::transaction_trace trace{transaction};
+        auto&                            transaction_trace_abi = *abi.add_type<test_protocol::transaction_trace>();
+        BOOST_TEST(append_sql_values(converter, transaction_trace_abi, trace) == joined_sql_values(converter, transaction_trace_abi, trace));
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(append_pg_binary_values_test, test_fixture_t) {
+    abi.add_type<test_protocol::global_property>();
+
+    auto& chain_config_abi  = *abi.get_type(get_type_name((test_protocol::chain_config*)nullptr));
+    converter.binary_format = true;
+
+    test_protocol::chain_config config_v0 =
+        test_protocol::chain_config_v0{10001, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17};
+    auto                buf = eosio::convert_to_bin(config_v0);
+    eosio::input_stream bin{buf};
+    std::string         out;
+    BOOST_TEST(converter.append_sql_values(out, bin, chain_config_abi.name, *chain_config_abi.as_variant()) == 18u);
+
+    // max_block_net_usage is decimal: length, ndigits, weight, sign, dscale, then base-10000 digits
+    BOOST_TEST(out.substr(0, 16) == std::string("\0\0\0\x0c" "\0\x02" "\0\x01" "\0\0" "\0\0" "\0\x01" "\0\x01", 16));
+    // target_block_net_usage_pct is bigint
+    BOOST_TEST(out.substr(16, 12) == std::string("\0\0\0\x08" "\0\0\0\0\0\0\0\x02", 12));
+    // max_action_return_value_size is missing from chain_config_v0, so it's null
+    BOOST_TEST(out.substr(out.size() - 4) == std::string("\xff\xff\xff\xff", 4));
+}
+
+BOOST_FIXTURE_TEST_CASE(row_encoder_test, test_fixture_t) {
+    abi.add_type<test_protocol::global_property>();
+    using namespace eosio::literals;
+
+    auto& chain_config_abi = *abi.get_type(get_type_name((test_protocol::chain_config*)nullptr));
+    test_protocol::chain_config config_v0 = test_protocol::chain_config_v0{10001, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17};
+
+    test_protocol::authority auth{1,
+                                  {{eosio::public_key_from_string("PUB_K1_6Uaww2itj2Ne7ADEdyqpHbsg42rtNQGSNyomEoREdxAHvShLZq"), 1}},
+                                  {{{"eosio.prods"_n, "active"_n}, 1}},
+                                  {}};
+    test_protocol::permission perm{test_protocol::permission_v0{"eosio"_n, "active"_n, ""_n, eosio::time_point{}, auth}};
+    auto&                     permission_abi = *abi.add_type<test_protocol::permission>();
+
+    test_protocol::transaction_trace_v0   transaction;
+    test_protocol::partial_transaction_v1 pt_v1;
+    pt_v1.prunable_data.emplace();
+    transaction.partial.emplace(pt_v1);
+    test_protocol::transaction_trace trace{transaction};
+    auto&                            transaction_trace_abi = *abi.add_type<test_protocol::transaction_trace>();
+
+    auto config_text = append_sql_values(converter, chain_config_abi, config_v0);
+    auto perm_text   = append_sql_values(converter, permission_abi, perm);
+    auto trace_text  = append_sql_values(converter, transaction_trace_abi, trace);
+    converter.binary_format = true;
+    auto config_binary      = append_sql_values(converter, chain_config_abi, config_v0);
+    converter.binary_format = false;
+
+    converter.compile_row_encoder(chain_config_abi);
+    converter.compile_row_encoder(permission_abi);
+    converter.compile_row_encoder(transaction_trace_abi);
+    BOOST_TEST(converter.row_encoders.size() == 3u);
+    BOOST_TEST(append_sql_values(converter, chain_config_abi, config_v0) == config_text);
+    BOOST_TEST(append_sql_values(converter, permission_abi, perm) == perm_text);
+    BOOST_TEST(append_sql_values(converter, transaction_trace_abi, trace) == trace_text);
+
+    converter.binary_format = true;
+    converter.reset_row_encoders();
+    converter.compile_row_encoder(chain_config_abi);
+    BOOST_TEST(append_sql_values(converter, chain_config_abi, config_v0) == config_binary);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,62 @@
+#define BOOST_TEST_MODULE response_cache
+#include <response_cache.hpp>
+#include <boost/test/included/unit_test.hpp>
+
+#include <cstring>
+
+using wasm_ql::response_cache;
+
+BOOST_AUTO_TEST_SUITE(response_cache_test_suite)
+
+namespace {
+
+std::vector<char> reply(const char* s) { return {s, s + strlen(s)}; }
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(caches_immutable_replies) {
+    response_cache cache{2};
+    auto           key = response_cache::make_key("/wasmql/v1/query", reply("balance at block 100"));
+
+    // a token query at absolute block 100, with irreversible at 200, which didn't read the status
+    cache.update(key, reply("10.0000 EOS"), 1, wasm_ql::is_immutable_reply(false, 100, 200));
+    auto cached = cache.get(key);
+    BOOST_REQUIRE(cached);
+    BOOST_TEST(*cached == reply("10.0000 EOS"));
+    BOOST_TEST(!cache.get(response_cache::make_key("/wasmql/v1/query", reply("balance at block 101"))));
+    BOOST_TEST(!cache.get(response_cache::make_key("/v1/chain/get_abi", reply("balance at block 100"))));
+}
+
+BOOST_AUTO_TEST_CASE(skips_mutable_replies) {
+    response_cache cache{2};
+    auto           reversible = response_cache::make_key("/q", reply("reversible"));
+    auto           saw_status = response_cache::make_key("/q", reply("saw status"));
+    cache.update(reversible, reply("r"), 1, wasm_ql::is_immutable_reply(false, 201, 200));
+    cache.update(saw_status, reply("s"), 1, wasm_ql::is_immutable_reply(true, 100, 200));
+    BOOST_TEST(!cache.get(reversible));
+    BOOST_TEST(!cache.get(saw_status));
+}
+
+BOOST_AUTO_TEST_CASE(evicts_least_recently_used) {
+    response_cache cache{2};
+    auto           a = response_cache::make_key("/q", reply("a"));
+    auto           b = response_cache::make_key("/q", reply("b"));
+    auto           c = response_cache::make_key("/q", reply("c"));
+    cache.update(a, reply("A"), 1, true);
+    cache.update(b, reply("B"), 1, true);
+    BOOST_TEST(!!cache.get(a));
+    cache.update(c, reply("C"), 1, true);
+    BOOST_TEST(!!cache.get(a));
+    BOOST_TEST(!cache.get(b));
+    BOOST_TEST(!!cache.get(c));
+}
+
+BOOST_AUTO_TEST_CASE(trim_empties_cache) {
+    response_cache cache{2};
+    auto           a = response_cache::make_key("/q", reply("a"));
+    cache.update(a, reply("A"), 1, true);
+    cache.update(response_cache::make_key("/q", reply("b")), reply("B"), 50, false);
+    BOOST_TEST(!cache.get(a));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
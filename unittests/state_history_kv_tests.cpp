@@ -0,0 +1,251 @@
+#define BOOST_TEST_MODULE state_history_kv
+#include <state_history_kv.hpp>
+#include <boost/test/included/unit_test.hpp>
+
+namespace kv = state_history::kv;
+using namespace eosio::literals;
+
+BOOST_AUTO_TEST_SUITE(state_history_kv_test_suite)
+
+namespace {
+
+// The encoder keys used before the constant-size reversal: serialize the value, then reverse what was appended
+template <typename T>
+std::vector<char> old_key(const T& obj) {
+    std::vector<char> result;
+    kv::reverse_bin(result, [&] { eosio::convert_to_bin(obj, result); });
+    return result;
+}
+
+// keys are compared as unsigned bytes, as rocksdb's default comparator does
+std::string as_string(const std::vector<char>& v) { return {v.begin(), v.end()}; }
+
+template <typename T>
+void check_key(const T& obj) {
+    auto expected = old_key(obj);
+    auto bin      = eosio::convert_to_bin(obj);
+
+    std::vector<char> from_native;
+    kv::native_to_key(from_native, obj);
+    BOOST_TEST(from_native == expected);
+
+    std::vector<char>   from_bin;
+    eosio::input_stream bin_stream{bin};
+    kv::bin_to_key<T>(from_bin, bin_stream);
+    BOOST_TEST(from_bin == expected);
+    BOOST_TEST((bin_stream.pos == bin_stream.end));
+
+    std::vector<char>   from_query;
+    eosio::input_stream query_stream{bin};
+    kv::query_to_key<T>(from_query, query_stream);
+    BOOST_TEST(from_query == expected);
+
+    eosio::input_stream key_stream{expected};
+    BOOST_TEST(eosio::convert_to_bin(kv::key_to_native<T>(key_stream)) == bin);
+    BOOST_TEST((key_stream.pos == key_stream.end));
+}
+
+eosio::checksum256 make_checksum(uint8_t first) {
+    std::vector<char> bin;
+    for (int i = 0; i < 32; ++i)
+        bin.push_back(char(first + i * 7));
+    eosio::input_stream s{bin};
+    return eosio::from_bin<eosio::checksum256>(s);
+}
+
+kv::field make_field(const char* name, const char* type, bool begin_optional = false, bool end_optional = false) {
+    kv::field f;
+    f.name           = name;
+    f.type           = type;
+    f.begin_optional = begin_optional;
+    f.end_optional   = end_optional;
+    return f;
+}
+
+// positions as fill_positions found them before static offsets: walk every field from the start of the row
+std::vector<std::optional<uint32_t>> generic_positions(const std::vector<char>& row, const std::vector<kv::field>& fields) {
+    std::vector<std::optional<uint32_t>> positions;
+    kv::init_positions(positions, fields.size());
+    eosio::input_stream src{row};
+    kv::fill_positions_impl(src.pos, src, false, positions, [&](auto f) {
+        for (auto& field : fields)
+            if (!f(field))
+                break;
+    });
+    return positions;
+}
+
+std::vector<std::optional<uint32_t>> static_positions(const std::vector<char>& row, const std::vector<kv::field>& fields) {
+    std::vector<std::optional<uint32_t>> positions;
+    kv::init_positions(positions, fields.size());
+    kv::fill_positions(eosio::input_stream{row}, fields, positions);
+    return positions;
+}
+
+// block_num, present, receiver, transaction_id, status, ordinal, optional receipt, then a string
+kv::config make_trace_config() {
+    kv::config config;
+    kv::table  table;
+    table.name       = "trace";
+    table.short_name = "trace"_n;
+    table.fields     = {
+        make_field("block_num", "uint32"),
+        make_field("present", "bool"),
+        make_field("receiver", "name"),
+        make_field("transaction_id", "checksum256"),
+        make_field("transaction_status", "transaction_status"),
+        make_field("action_ordinal", "varuint32"),
+        make_field("receipt_present", "bool", true),
+        make_field("receipt_receiver", "name"),
+        make_field("receipt_global_sequence", "uint64", false, true),
+        make_field("console", "string"),
+    };
+    config.tables.push_back(std::move(table));
+    config.prepare(kv::abi_type_to_kv_type);
+    return config;
+}
+
+std::vector<char> make_trace_row(uint32_t ordinal, bool receipt) {
+    std::vector<char> row;
+    eosio::convert_to_bin(uint32_t(1234), row);
+    eosio::convert_to_bin(true, row);
+    eosio::convert_to_bin("eosio.token"_n, row);
+    eosio::convert_to_bin(make_checksum(3), row);
+    eosio::convert_to_bin(uint8_t(0), row);
+    eosio::convert_to_bin(eosio::varuint32{ordinal}, row);
+    eosio::convert_to_bin(receipt, row);
+    if (receipt) {
+        eosio::convert_to_bin("alice"_n, row);
+        eosio::convert_to_bin(uint64_t(99), row);
+    }
+    eosio::convert_to_bin(std::string("hello"), row);
+    return row;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(fixed_width_keys_match_old_encoder) {
+    for (uint8_t v : {0, 1, 0x7f, 0x80, 0xff})
+        check_key(v);
+    for (uint16_t v : {0, 1, 0x1234, 0xffff})
+        check_key(v);
+    for (uint32_t v : {0u, 1u, 0x12345678u, 0x80000000u, 0xffffffffu})
+        check_key(v);
+    for (uint64_t v : {0ull, 1ull, 0x0123456789abcdefull, 0xffffffffffffffffull})
+        check_key(v);
+    check_key((unsigned __int128)0);
+    check_key(((unsigned __int128)0x0123456789abcdefull << 64) | 0xfedcba9876543210ull);
+    check_key(true);
+    check_key(false);
+    check_key(eosio::name{});
+    check_key("eosio.token"_n);
+    check_key("fill.status"_n);
+    check_key(make_checksum(0));
+    check_key(make_checksum(0xf0));
+}
+
+BOOST_AUTO_TEST_CASE(varuint32_keys_match_old_encoder) {
+    for (uint32_t v : {0u, 1u, 127u, 128u, 0x12345678u, 0xffffffffu}) {
+        auto expected = old_key(v);
+
+        auto                bin = eosio::convert_to_bin(eosio::varuint32{v});
+        std::vector<char>   from_bin;
+        eosio::input_stream bin_stream{bin};
+        kv::bin_to_key<eosio::varuint32>(from_bin, bin_stream);
+        BOOST_TEST(from_bin == expected);
+
+        // queries pass varuint32 key fields as uint32
+        auto                query = eosio::convert_to_bin(v);
+        std::vector<char>   from_query;
+        eosio::input_stream query_stream{query};
+        kv::query_to_key<eosio::varuint32>(from_query, query_stream);
+        BOOST_TEST(from_query == expected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(keys_sort_like_values) {
+    std::vector<uint64_t> values = {0, 1, 0xff, 0x100, 0xffff'ffff, 0x1'0000'0000, 0xffff'ffff'ffff'ffff};
+    for (size_t i = 0; i + 1 < values.size(); ++i) {
+        std::vector<char> a, b;
+        kv::native_to_key(a, values[i]);
+        kv::native_to_key(b, values[i + 1]);
+        BOOST_TEST(as_string(a) < as_string(b));
+    }
+    std::vector<char> a, b;
+    kv::native_to_key(a, "alice"_n);
+    kv::native_to_key(b, "bob"_n);
+    BOOST_TEST(as_string(a) < as_string(b));
+}
+
+BOOST_AUTO_TEST_CASE(table_key_round_trip) {
+    auto key = kv::make_table_key(12345, true, "ttrace"_n);
+
+    std::vector<char> expected;
+    expected.push_back((char)kv::key_tag::table);
+    auto block = old_key(uint32_t(12345));
+    auto name  = old_key("ttrace"_n);
+    expected.insert(expected.end(), block.begin(), block.end());
+    expected.insert(expected.end(), name.begin(), name.end());
+    expected.push_back(1);
+    BOOST_TEST(key == expected);
+
+    eosio::input_stream s{key};
+    BOOST_TEST((kv::bin_to_key_tag(s) == kv::key_tag::table));
+    uint32_t    block_num;
+    eosio::name table_name;
+    bool        present_k;
+    kv::read_table_prefix(s, block_num, table_name, present_k);
+    BOOST_TEST(block_num == 12345u);
+    BOOST_TEST(table_name.value == "ttrace"_n.value);
+    BOOST_TEST(present_k);
+}
+
+BOOST_AUTO_TEST_CASE(static_positions_cover_fixed_prefix) {
+    auto  config = make_trace_config();
+    auto& fields = config.tables[0].fields;
+
+    std::vector<std::optional<uint32_t>> expected = {0, 4, 5, 13, 45, 46, {}, {}, {}, {}};
+    for (size_t i = 0; i < fields.size(); ++i)
+        BOOST_TEST((fields[i].static_position == expected[i]));
+    BOOST_TEST(fields[4].fixed);
+    BOOST_TEST(!fields[5].fixed);
+    BOOST_TEST(!fields[6].fixed);
+}
+
+BOOST_AUTO_TEST_CASE(static_positions_match_generic_path) {
+    auto  config = make_trace_config();
+    auto& fields = config.tables[0].fields;
+    for (uint32_t ordinal : {1u, 300u, 0x12345678u}) {
+        for (bool receipt : {true, false}) {
+            auto row = make_trace_row(ordinal, receipt);
+            BOOST_TEST((static_positions(row, fields) == generic_positions(row, fields)));
+        }
+    }
+
+    // a row that ends inside the fixed prefix fails either way
+    auto row = make_trace_row(1, true);
+    row.resize(20);
+    BOOST_CHECK_THROW(static_positions(row, fields), std::runtime_error);
+    BOOST_CHECK_THROW(generic_positions(row, fields), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(static_positions_stop_at_leading_variable_field) {
+    kv::config config;
+    kv::table  table;
+    table.name       = "account";
+    table.short_name = "account"_n;
+    table.fields     = {make_field("ordinal", "varuint32"), make_field("name", "name"), make_field("memo", "string")};
+    config.tables.push_back(std::move(table));
+    config.prepare(kv::abi_type_to_kv_type);
+    auto& fields = config.tables[0].fields;
+    BOOST_TEST((fields[0].static_position == 0u));
+    BOOST_TEST(!fields[1].static_position);
+
+    std::vector<char> row;
+    eosio::convert_to_bin(eosio::varuint32{200}, row);
+    eosio::convert_to_bin("bob"_n, row);
+    eosio::convert_to_bin(std::string("memo"), row);
+    BOOST_TEST((static_positions(row, fields) == generic_positions(row, fields)));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,109 @@
+#define BOOST_TEST_MODULE state_history_pg
+#include <state_history_pg.hpp>
+#include <boost/test/included/unit_test.hpp>
+
+using namespace eosio::literals;
+namespace pg = state_history::pg;
+
+BOOST_AUTO_TEST_SUITE(state_history_pg_test_suite)
+
+namespace {
+
+template <typename T>
+std::string param(const T& v) {
+    auto                bin = eosio::convert_to_bin(v);
+    eosio::input_stream stream{bin.data(), bin.data() + bin.size()};
+    auto                result = pg::bin_to_param<T>(stream);
+    BOOST_TEST(stream.pos == stream.end);
+    return result;
+}
+
+template <typename T>
+std::vector<char> column(const char* s) {
+    std::vector<char> bin;
+    pg::sql_to_bin<T>(bin, s);
+    return bin;
+}
+
+/// a value survives being bound as a parameter and read back from a column holding that text
+template <typename T>
+void check_round_trip(const T& v) {
+    BOOST_TEST(column<T>(param(v).c_str()) == eosio::convert_to_bin(v));
+}
+
+} // namespace
+
+// a parameter is the value itself; a literal's quotes, E'' escapes or ::type casts would end up in the data
+BOOST_AUTO_TEST_CASE(params_are_unquoted) {
+    BOOST_TEST(param(std::string{"it's"}) == "it's");
+    BOOST_TEST(param(std::string{"a\\b"}) == "a\\b");
+    BOOST_TEST(param(std::string{"E'x'::varchar"}) == "E'x'::varchar");
+    BOOST_TEST(param("alice"_n) == "alice");
+    BOOST_TEST(param(true) == "true");
+    BOOST_TEST(param(uint32_t{4000000000}) == "4000000000");
+    BOOST_TEST(param(unsigned __int128(1) << 100) == "1267650600228229401496703205376");
+    BOOST_TEST(param(eosio::bytes{{1, char(0xab)}}) == "\\x01AB");
+    BOOST_TEST(param(eosio::bytes{}) == "\\x");
+    BOOST_TEST(param(eosio::time_point{eosio::microseconds{1577934245500000}}) == "2020-01-02T03:04:05.500");
+    BOOST_TEST(param(eosio::time_point{}) == "1970-01-01T00:00:00.000");
+
+    std::string hex;
+    for (int i = 0; i < 32; ++i)
+        hex += "5A";
+    BOOST_TEST(param(pg::sql_to_checksum256(hex.c_str())) == hex);
+    BOOST_TEST(param(eosio::checksum256{}) == "");
+}
+
+BOOST_AUTO_TEST_CASE(columns_to_bin) {
+    BOOST_TEST(column<bool>("t") == eosio::convert_to_bin(true));
+    BOOST_TEST(column<bool>("f") == eosio::convert_to_bin(false));
+    BOOST_TEST(column<uint16_t>("65535") == eosio::convert_to_bin(uint16_t{65535}));
+    BOOST_TEST(column<int64_t>("-5") == eosio::convert_to_bin(int64_t{-5}));
+    BOOST_TEST(column<__int128>("-170141183460469231731687303715884105728") ==
+               eosio::convert_to_bin(__int128(unsigned __int128(1) << 127)));
+    BOOST_TEST(column<eosio::name>("eosio.token") == eosio::convert_to_bin("eosio.token"_n));
+    BOOST_TEST(column<std::string>("it's") == eosio::convert_to_bin(std::string{"it's"}));
+    BOOST_TEST(column<eosio::bytes>("\\x01ab") == eosio::convert_to_bin(eosio::bytes{{1, char(0xab)}}));
+    BOOST_TEST(column<eosio::time_point>("2020-01-02 03:04:05.5") ==
+               eosio::convert_to_bin(eosio::time_point{eosio::microseconds{1577934245500000}}));
+    BOOST_TEST(column<eosio::ship_protocol::transaction_status>("hard_fail") == std::vector<char>{2});
+    BOOST_CHECK_THROW(column<uint32_t>("12x"), std::runtime_error);
+    BOOST_CHECK_THROW(column<eosio::time_point>("yesterday"), std::runtime_error);
+
+    // null columns read as the type's default
+    BOOST_TEST(column<uint32_t>(nullptr) == eosio::convert_to_bin(uint32_t{0}));
+    BOOST_TEST(column<eosio::checksum256>(nullptr) == eosio::convert_to_bin(eosio::checksum256{}));
+    BOOST_TEST(column<eosio::time_point>(nullptr) == eosio::convert_to_bin(eosio::time_point{}));
+    BOOST_TEST(column<std::optional<uint32_t>>(nullptr) == std::vector<char>{0});
+    BOOST_TEST(column<std::optional<uint32_t>>("5") == (std::vector<char>{1, 5, 0, 0, 0}));
+}
+
+BOOST_AUTO_TEST_CASE(params_round_trip) {
+    check_round_trip(std::string{"it's a \\ back'slash"});
+    check_round_trip("alice"_n);
+    check_round_trip(eosio::name{});
+    check_round_trip(false);
+    check_round_trip(uint8_t{255});
+    check_round_trip(int16_t{-32768});
+    check_round_trip(uint64_t{18446744073709551615ull});
+    check_round_trip(unsigned __int128(1) << 127);
+    check_round_trip(-__int128(12345));
+    check_round_trip(eosio::varuint32{70000});
+    check_round_trip(0.1);
+    check_round_trip(eosio::bytes{{0, char(0xff), '\'', '\\'}});
+    check_round_trip(eosio::time_point{eosio::microseconds{1577934245500000}});
+    check_round_trip(eosio::time_point_sec{1577934245});
+    check_round_trip(eosio::block_timestamp{eosio::time_point{eosio::microseconds{1577934245500000}}});
+    check_round_trip(eosio::ship_protocol::transaction_status::soft_fail);
+    check_round_trip(pg::sql_to_checksum256("000102030405060708090A0B0C0D0E0F101112131415161718191A1B1C1D1E1F"));
+    check_round_trip(eosio::checksum256{});
+}
+
+BOOST_AUTO_TEST_CASE(config_types_are_known) {
+    for (auto* name : {"bool", "uint8", "uint16", "uint32", "uint32?", "uint64", "int64", "uint128", "varuint32", "float64",
+                       "float128", "name", "checksum256", "string", "bytes", "time_point", "block_timestamp_type",
+                       "transaction_status"})
+        BOOST_TEST(pg::abi_type_to_sql_type.count(name) == 1u, name);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
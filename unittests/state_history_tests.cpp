@@ -0,0 +1,156 @@
+#define BOOST_TEST_MODULE state_history
+#include <state_history.hpp>
+#include <boost/test/included/unit_test.hpp>
+
+#include <random>
+
+using namespace eosio::literals;
+namespace ship = eosio::ship_protocol;
+
+BOOST_AUTO_TEST_SUITE(state_history_test_suite)
+
+namespace {
+
+std::vector<char> action_data = {1, 2, 3};
+
+template <typename T>
+T make_action(eosio::name receiver, eosio::name account, eosio::name act_name, bool with_receipt) {
+    T atrace;
+    if (with_receipt) {
+        ship::action_receipt_v0 receipt;
+        receipt.receiver        = receiver;
+        receipt.global_sequence = 7;
+        receipt.auth_sequence.push_back({account, 3});
+        atrace.receipt.emplace(receipt);
+    }
+    atrace.receiver    = receiver;
+    atrace.act.account = account;
+    atrace.act.name    = act_name;
+    atrace.act.authorization.push_back({account, "active"_n});
+    atrace.act.data = eosio::input_stream{action_data};
+    atrace.console  = "console";
+    atrace.account_ram_deltas.push_back({receiver, -12});
+    atrace.except     = "except";
+    atrace.error_code = 5;
+    return atrace;
+}
+
+ship::transaction_trace_v0 make_trace(ship::transaction_status status, std::vector<ship::action_trace> actions) {
+    ship::transaction_trace_v0 trace;
+    trace.status        = status;
+    trace.cpu_usage_us  = 100;
+    trace.action_traces = std::move(actions);
+    return trace;
+}
+
+/// v0 and v1 actions, failed_dtrx_traces and a partial transaction
+std::vector<ship::transaction_trace> sample_traces() {
+    std::vector<ship::transaction_trace> result;
+    result.push_back(make_trace(ship::transaction_status::executed, {}));
+    result.push_back(make_trace(
+        ship::transaction_status::executed,
+        {make_action<ship::action_trace_v0>("alice"_n, "eosio.token"_n, "transfer"_n, true),
+         make_action<ship::action_trace_v0>("bob"_n, "eosio.token"_n, "transfer"_n, false)}));
+
+    auto v1            = make_action<ship::action_trace_v1>("carol"_n, "game"_n, "play"_n, true);
+    v1.return_value    = eosio::input_stream{action_data};
+    auto with_v1       = make_trace(ship::transaction_status::soft_fail, {v1});
+    with_v1.except     = "failed";
+    with_v1.error_code = 9;
+    with_v1.account_ram_delta.emplace(ship::account_delta{"carol"_n, 4});
+    result.push_back(with_v1);
+
+    auto failed      = make_trace(ship::transaction_status::hard_fail, //
+                                  {make_action<ship::action_trace_v0>("game"_n, "game"_n, "fail"_n, true)});
+    auto with_failed = make_trace(ship::transaction_status::executed, //
+                                  {make_action<ship::action_trace_v1>("dave"_n, "eosio"_n, "onerror"_n, true)});
+    with_failed.failed_dtrx_trace.push_back(ship::recurse_transaction_trace{ship::transaction_trace{failed}});
+    result.push_back(with_failed);
+
+    // ship sends at most one; a second one must not replace the first in the parts
+    auto second   = make_trace(ship::transaction_status::expired, {make_action<ship::action_trace_v0>("erin"_n, "eosio"_n, "nop"_n, true)});
+    auto with_two = with_failed;
+    with_two.failed_dtrx_trace.push_back(ship::recurse_transaction_trace{ship::transaction_trace{second}});
+    ship::partial_transaction_v0 partial;
+    partial.ref_block_num = 12;
+    partial.transaction_extensions.push_back({1, eosio::input_stream{action_data}});
+    partial.signatures.emplace_back();
+    partial.context_free_data.push_back(eosio::input_stream{action_data});
+    with_two.partial.emplace(partial);
+    result.push_back(with_two);
+    return result;
+}
+
+std::vector<std::vector<state_history::trx_filter>> sample_filters() {
+    using state_history::trx_filter;
+    return {
+        {{true}},
+        {{true, ship::transaction_status::executed}},
+        {{false, {}, {}, "eosio.token"_n}, {true}},
+        {{true, {}, "carol"_n}},
+        {{true, {}, {}, "game"_n, "fail"_n}},
+        {{false, ship::transaction_status::hard_fail}, {true, {}, {}, "game"_n}},
+    };
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(filter_trace_bin_test) {
+    for (auto& filters : sample_filters()) {
+        state_history::trx_filter_set filter_set{filters};
+        for (auto& trace : sample_traces()) {
+            auto bin = eosio::convert_to_bin(trace);
+            bin.push_back(42); // a following trace must not be read
+            eosio::input_stream            stream{bin.data(), bin.data() + bin.size()};
+            state_history::trace_bin_parts parts;
+            bool                           keep = state_history::filter_trace_bin(filter_set, stream, parts);
+            BOOST_TEST(keep == state_history::filter(filters, trace));
+            BOOST_TEST(stream.pos == bin.data() + bin.size() - 1);
+
+            auto& ttrace  = std::get<ship::transaction_trace_v0>(trace);
+            auto  actions = eosio::convert_to_bin(ttrace.action_traces);
+            BOOST_TEST(std::vector<char>(parts.action_traces.pos, parts.action_traces.end) == actions);
+
+            if (ttrace.failed_dtrx_trace.empty()) {
+                BOOST_TEST(parts.failed.pos == parts.failed.end);
+                continue;
+            }
+            auto& failed = ttrace.failed_dtrx_trace[0].recurse;
+            BOOST_TEST(std::vector<char>(parts.failed.pos, parts.failed.end) == eosio::convert_to_bin(failed));
+            BOOST_TEST(parts.failed_kept == state_history::filter(filters, failed));
+            BOOST_REQUIRE(parts.failed_parts);
+            auto failed_actions = eosio::convert_to_bin(std::get<ship::transaction_trace_v0>(failed).action_traces);
+            BOOST_TEST(std::vector<char>(parts.failed_parts->action_traces.pos, parts.failed_parts->action_traces.end) == failed_actions);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(trx_filter_set_test) {
+    using state_history::trx_filter;
+    std::vector<ship::transaction_status> statuses = {ship::transaction_status::executed, ship::transaction_status::soft_fail,
+                                                      ship::transaction_status::hard_fail};
+    std::vector<eosio::name>              names    = {"alice"_n, "bob"_n, "eosio"_n};
+
+    // rule sets of up to 4 rules from a fixed seed, mixing include and exclude rules whose fields are wildcards or a few values
+    std::mt19937 rng{1};
+    auto         pick = [&](auto& values) -> std::optional<std::decay_t<decltype(values[0])>> {
+        auto i = rng() % (values.size() + 1);
+        if (i == values.size())
+            return {};
+        return values[i];
+    };
+    for (int round = 0; round < 2000; ++round) {
+        std::vector<trx_filter> filters(rng() % 5);
+        for (auto& f : filters)
+            f = {bool(rng() % 2), pick(statuses), pick(names), pick(names), pick(names)};
+        state_history::trx_filter_set filter_set{filters};
+        for (auto status : statuses)
+            for (auto receiver : names)
+                for (auto account : names)
+                    for (auto act_name : names)
+                        BOOST_TEST(filter_set.match(status, receiver, account, act_name) ==
+                                   state_history::filter(filters, status, receiver, account, act_name));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,88 @@
+// copyright defined in LICENSE.txt
+
+// The test_protocol types registered with an abieos_sql_converter, shared by the unit tests and the benchmarks
+
+#pragma once
+#include "test_protocol.hpp"
+#include <ostream>
+
+namespace state_history {
+namespace pg {
+inline std::string sql_str(test_protocol::transaction_status v) { return to_string(v); }
+inline std::string sql_str(const test_protocol::recurse_transaction_trace& v);
+} // namespace pg
+} // namespace state_history
+
+#include <abieos_sql_converter.hpp>
+
+namespace test_protocol {
+    constexpr const char* get_type_name(transaction_status*) { return "transaction_status"; }
+}
+
+namespace eosio {
+template <>
+inline constexpr bool is_basic_abi_type<input_stream> = true;
+template <>
+constexpr bool is_basic_abi_type<test_protocol::transaction_status> = true;
+
+template <>
+inline abi_type* add_type(abi& a, test_protocol::transaction_status*) {
+    return std::addressof(a.abi_types.try_emplace("transaction_status", "transaction_status", abi_type::builtin{}, nullptr).first->second);
+}
+
+inline abi_type* add_type(abi& a, std::vector<test_protocol::recurse_transaction_trace>*) {
+    abi_type& element_type =
+        a.abi_types.try_emplace("recurse_transaction_trace", "recurse_transaction_trace", abi_type::builtin{}, nullptr).first->second;
+    std::string name      = "recurse_transaction_trace?";
+    auto [iter, inserted] = a.abi_types.try_emplace(name, name, abi_type::optional{&element_type}, optional_abi_serializer);
+    return &iter->second;
+}
+} // namespace eosio
+
+
+inline bool operator==(const abieos_sql_converter::field_def& lhs, const abieos_sql_converter::field_def& rhs) {
+    return lhs.name == rhs.name && lhs.type == rhs.type;
+}
+
+inline std::ostream& operator<<(std::ostream& os, const abieos_sql_converter::field_def& f) {
+    return os << "{ " << f.name << " , " << f.type << "}";
+}
+
+namespace state_history {
+namespace pg {
+inline std::string sql_str(const test_protocol::recurse_transaction_trace& v) {
+    return sql_str(std::visit([](auto& x) { return x.id; }, v.recurse));
+}
+template<> inline constexpr type_names names_for<test_protocol::transaction_status>        = type_names{"transaction_status","transaction_status_type"};
+template<> inline constexpr type_names names_for<test_protocol::recurse_transaction_trace> = type_names{"recurse_transaction_trace","varchar"};
+
+} // namespace pg
+} // namespace state_history
+
+struct test_fixture_t {
+    eosio::abi abi;
+    abieos_sql_converter converter;
+
+    test_fixture_t() {
+        eosio::abi_def empty_def;
+        eosio::convert(empty_def, abi);
+        converter.schema_name     = R"("test")";
+
+        eosio::add_type(abi, (std::vector<test_protocol::recurse_transaction_trace>*)nullptr);
+
+        using basic_types = std::tuple<
+            bool, uint8_t, int8_t, uint16_t, int16_t, uint32_t, int32_t, uint64_t, int64_t, double, std::string, unsigned __int128,
+            __int128, eosio::float128, eosio::varuint32, eosio::varint32, eosio::name, eosio::checksum256, eosio::time_point,
+            eosio::time_point_sec, eosio::block_timestamp, eosio::public_key, eosio::signature, eosio::bytes, eosio::symbol,
+            test_protocol::transaction_status, test_protocol::recurse_transaction_trace>;
+
+        converter.register_basic_types<basic_types>();
+    }
+
+    template <typename T> 
+    abieos_sql_converter::union_fields_t
+    get_union_fields() {
+        std::string type_name = get_type_name((T*)nullptr);
+        return abieos_sql_converter::union_fields_t(converter.schema_name, *abi.get_type(type_name)->as_variant(), converter.basic_converters);
+    }
+};
@@ -4,10 +4,10 @@
 #include <eosio/database.hpp>
 #include <eosio/input_output.hpp>
 
-void process(block_info_request& req, const eosio::database_status& status) {
+void process(block_info_request& req) {
     auto s = query_database(eosio::query_block_info_range_index{
-        .first       = get_block_num(req.first, status),
-        .last        = get_block_num(req.last, status),
+        .first       = get_block_num(req.first),
+        .last        = get_block_num(req.last),
         .max_results = req.max_results,
     });
 
@@ -20,10 +20,10 @@ void process(block_info_request& req, const eosio::database_status& status) {
     eosio::set_output_data(pack(chain_query_response{std::move(response)}));
 }
 
-void process(tapos_request& req, const eosio::database_status& status) {
+void process(tapos_request& req) {
     auto s = query_database(eosio::query_block_info_range_index{
-        .first       = get_block_num(req.ref_block, status),
-        .last        = get_block_num(req.ref_block, status),
+        .first       = get_block_num(req.ref_block),
+        .last        = get_block_num(req.ref_block),
         .max_results = 1,
     });
 
@@ -40,9 +40,9 @@ void process(tapos_request& req, const eosio::database_status& status) {
     eosio::set_output_data(pack(chain_query_response{std::move(response)}));
 }
 
-void process(account_request& req, const eosio::database_status& status) {
+void process(account_request& req) {
     auto s = query_database(eosio::query_acctmeta_range_name{
-        .snapshot_block = get_block_num(req.snapshot_block, status),
+        .snapshot_block = get_block_num(req.snapshot_block),
         .first          = req.first,
         .last           = req.last,
         .max_results    = req.max_results,
@@ -61,11 +61,11 @@ void process(account_request& req, const eosio::database_status& status) {
     eosio::set_output_data(pack(chain_query_response{std::move(response)}));
 }
 
-void process(abi_request& req, const eosio::database_status& status) {
+void process(abi_request& req) {
     abi_response response;
     for (auto name : req.names) {
         auto s     = query_database(eosio::query_account_range_name{
-            .snapshot_block = get_block_num(req.snapshot_block, status),
+            .snapshot_block = get_block_num(req.snapshot_block),
             .first          = name,
             .last           = name,
             .max_results    = 1,
@@ -84,11 +84,11 @@ void process(abi_request& req, const eosio::database_status& status) {
     eosio::set_output_data(pack(chain_query_response{std::move(response)}));
 }
 
-void process(code_request& req, const eosio::database_status& status) {
+void process(code_request& req) {
     code_response response;
     for (auto name : req.names) {
         auto s     = query_database(eosio::query_code_range_name{
-            .snapshot_block = get_block_num(req.snapshot_block, status),
+            .snapshot_block = get_block_num(req.snapshot_block),
             .first          = name,
             .last           = name,
             .max_results    = 1,
@@ -111,5 +111,5 @@ extern "C" __attribute__((eosio_wasm_entry)) void initialize() {}
 
 extern "C" void run_query() {
     auto request = eosio::unpack<chain_query_request>(eosio::get_input_data());
-    std::visit([](auto& x) { process(x, eosio::get_database_status()); }, request.value);
+    std::visit([](auto& x) { process(x); }, request.value);
 }
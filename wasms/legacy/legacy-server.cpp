@@ -37,56 +37,31 @@ eosio::checksum256 checksum256_max() {
 
 } // namespace eosio
 
-eosio::datastream<const char*> get_raw_abi(eosio::name name, uint32_t snapshot_block) {
-    eosio::datastream<const char*> result = {nullptr, 0};
-    auto                           s      = query_database(eosio::query_account_range_name{
+/// A contract's serialized ABI and the block of the account row it came from
+struct raw_abi {
+    eosio::name                    account   = {};
+    uint32_t                       abi_block = {};
+    eosio::datastream<const char*> abi       = {nullptr, 0};
+};
+
+raw_abi get_raw_abi(eosio::name name, uint32_t snapshot_block) {
+    raw_abi result{.account = name};
+    auto    s = query_database(eosio::query_account_range_name{
         .snapshot_block = snapshot_block,
         .first          = name,
         .last           = name,
         .max_results    = 1,
     });
     eosio::for_each_query_result<eosio::account>(s, [&](eosio::account& a) {
-        if (a.present)
-            result = *a.abi;
+        if (a.present) {
+            result.abi_block = a.block_num;
+            result.abi       = *a.abi;
+        }
         return true;
     });
     return result;
 }
 
-struct abi {
-    abieos::abi_def  def{};
-    abieos::contract contract{};
-};
-
-std::unique_ptr<abi> get_abi(eosio::name name, uint32_t snapshot_block) {
-    auto result = std::make_unique<abi>();
-    auto raw    = get_raw_abi(name, snapshot_block);
-    if (!raw.remaining())
-        return {};
-    std::string error;
-    if (!abieos::check_abi_version(abieos::input_buffer{raw.pos(), raw.pos() + raw.remaining()}, error))
-        return {};
-    abieos::input_buffer buf{raw.pos(), raw.pos() + raw.remaining()};
-    if (!abieos::bin_to_native(result->def, error, buf))
-        return {};
-    if (!fill_contract(result->contract, error, result->def))
-        return {};
-    return result;
-}
-
-abieos::abi_type* get_table_type(::abi* abi, abieos::name table) {
-    if (!abi)
-        return nullptr;
-    for (auto& table_def : abi->def.tables) {
-        if (table_def.name == table) {
-            auto it = abi->contract.abi_types.find(table_def.type);
-            if (it != abi->contract.abi_types.end())
-                return &it->second;
-        }
-    }
-    return nullptr;
-}
-
 struct get_code_result {
     get_code_result(eosio::account a)
         : account_name(a.name)
@@ -328,144 +303,190 @@ eosio::name get_table_index_name(const get_table_rows_params& p, bool& primary)
     return eosio::name{index};
 } // get_table_index_name
 
-void get_table_rows_primary(
-    const get_table_rows_params& params, const eosio::database_status& status, uint64_t scope, abieos::abi_type* table_type) {
+/// Rows per query_database call. The server caps each query at its query config's max_results (100 by default).
+static const uint32_t max_query_rows = 100;
+
+/// Most rows one get_table_rows reply holds; clients continue from `next_key`
+static const uint32_t max_table_rows = 10'000;
+
+/// Most rows one export_table_rows reply holds
+static const uint32_t max_export_rows = 100'000;
+
+/// Run `query` in batches of `max_query_rows`, each continuing after the previous batch's last key, and call `f(view)`
+/// until it returns false or the range runs out. `View` is the record's view type.
+template <typename View, typename Q, typename F>
+void for_each_query_result_batched(Q query, F f) {
+    query.max_results = max_query_rows;
+    while (true) {
+        bool            empty    = true;
+        typename Q::key last_key = {};
+        auto            s        = query_database(query);
+        bool            more     = eosio::for_each_query_result_view<View>(s, [&](const View& r) {
+            empty    = false;
+            last_key = Q::key::from_data(r);
+            return f(r);
+        });
+        if (!more || empty || increment_key(last_key))
+            return;
+        query.first = last_key;
+    }
+}
 
-    auto lower_bound = convert_key(*params.key_type, *params.lower_bound, (uint64_t)0);
-    auto upper_bound = convert_key(*params.key_type, *params.upper_bound, (uint64_t)0xffff'ffff'ffff'ffff);
+std::string key_to_string(std::string_view key_type, uint64_t key) {
+    if (key_type == "name")
+        return eosio::name{key}.to_string();
+    return std::to_string(key);
+}
 
-    auto s = query_database(eosio::query_contract_row_range_code_table_scope_pk{
-        .snapshot_block = status.head,
-        .first =
-            {
-                .code        = params.code,
-                .table       = params.table,
-                .scope       = eosio::name{scope},
-                .primary_key = lower_bound,
-            },
-        .last =
-            {
-                .code        = params.code,
-                .table       = params.table,
-                .scope       = eosio::name{scope},
-                .primary_key = upper_bound,
-            },
-        .max_results = std::min((uint32_t)100, params.limit),
-    });
+/// Builds a get_table_rows reply: `{"rows":[...],"more":...,"next_key":"..."}`
+struct table_rows_writer {
+    const get_table_rows_params& params;
+    const raw_abi*               abi;
+    uint32_t                     limit;
+    uint32_t                     num_rows = 0;
+    bool                         more     = false;
+    std::string                  next_key = {};
+    eosio::output_pieces         result   = {};
+
+    table_rows_writer(const get_table_rows_params& params, const raw_abi* abi, uint32_t max_rows)
+        : params{params}
+        , abi{abi}
+        , limit{std::min(params.limit, max_rows)} {
+        result += "{\"rows\":[";
+    }
 
-    // todo: rope
-    std::string result = "{\"rows\":[";
-    bool        found  = false;
-    eosio::for_each_query_result<eosio::contract_row>(s, [&](eosio::contract_row& r) {
-        if (!r.present)
-            return true;
-        if (found)
-            result += ',';
-        found = true;
+    /// Returns false once a row past the limit shows up; its key becomes next_key
+    bool add(const eosio::datastream<const char*>& value, eosio::name payer, uint64_t key) {
+        if (num_rows >= limit) {
+            more     = true;
+            next_key = key_to_string(*params.key_type, key);
+            return false;
+        }
+        if (num_rows++)
+            result += ",";
         if (params.show_payer)
             result += "{\"data\":";
-        bool decoded = false;
-        if (table_type) {
-            abieos::input_buffer bin{r.value->pos(), r.value->pos() + r.value->remaining()};
-            std::string          error;
-            std::string          json_row;
-            if (bin_to_json(bin, error, table_type, json_row)) {
-                result += json_row;
-                decoded = true;
-            }
-        }
-        if (!decoded) {
-            result += '"';
-            abieos::hex(r.value->pos(), r.value->pos() + r.value->remaining(), std::back_inserter(result));
-            result += '"';
+        std::string json_row;
+        if (!abi || !abi->abi.remaining() ||
+            !eosio::contract_row_to_json(abi->account, abi->abi_block, abi->abi, params.table, value, json_row)) {
+            json_row.clear();
+            json_row.reserve(value.remaining() * 2 + 2);
+            json_row += '"';
+            abieos::hex(value.pos(), value.pos() + value.remaining(), std::back_inserter(json_row));
+            json_row += '"';
         }
+        result += std::move(json_row);
         if (params.show_payer)
-            result += ",\"payer\":\"" + r.payer.to_string() + "\"}";
+            result += ",\"payer\":\"" + payer.to_string() + "\"}";
         return true;
-    });
-    result += "]}";
-    eosio::set_output_data(result);
+    }
+
+    void finish() {
+        result += more ? "],\"more\":true,\"next_key\":\"" : "],\"more\":false,\"next_key\":\"";
+        result += std::move(next_key);
+        result += "\"}";
+        eosio::set_output_data(result);
+    }
+};
+
+void get_table_rows_primary(
+    const get_table_rows_params& params, const eosio::database_status& status, uint64_t scope, const raw_abi* abi, uint32_t max_rows) {
+
+    auto lower_bound = convert_key(*params.key_type, *params.lower_bound, (uint64_t)0);
+    auto upper_bound = convert_key(*params.key_type, *params.upper_bound, (uint64_t)0xffff'ffff'ffff'ffff);
+
+    table_rows_writer writer{params, abi, max_rows};
+    for_each_query_result_batched<eosio::contract_row_view>(
+        eosio::query_contract_row_range_code_table_scope_pk{
+            .snapshot_block = status.head,
+            .first =
+                {
+                    .code        = params.code,
+                    .table       = params.table,
+                    .scope       = eosio::name{scope},
+                    .primary_key = lower_bound,
+                },
+            .last =
+                {
+                    .code        = params.code,
+                    .table       = params.table,
+                    .scope       = eosio::name{scope},
+                    .primary_key = upper_bound,
+                },
+        },
+        [&](const eosio::contract_row_view& r) { return !r.present() || writer.add(r.value(), r.payer(), r.primary_key()); });
+    writer.finish();
 } // get_table_rows_primary
 
 template <typename T>
 void get_table_rows_secondary(
-    const get_table_rows_params& params, const eosio::database_status& status, uint64_t scope, abieos::abi_type* table_type) {
+    const get_table_rows_params& params, const eosio::database_status& status, uint64_t scope, const raw_abi* abi, uint32_t max_rows) {
 
     auto lower_bound = convert_key(*params.key_type, *params.lower_bound, (T)0);
     auto upper_bound = convert_key(*params.key_type, *params.upper_bound, (T)0xffff'ffff'ffff'ffff);
 
-    auto s = query_database(eosio::query_contract_index64_range_code_table_scope_sk_pk{
-        .snapshot_block = status.head,
-        .first =
-            {
-                .code          = params.code,
-                .table         = params.table,
-                .scope         = eosio::name{scope},
-                .secondary_key = lower_bound,
-                .primary_key   = 0,
-            },
-        .last =
-            {
-                .code          = params.code,
-                .table         = params.table,
-                .scope         = eosio::name{scope},
-                .secondary_key = upper_bound,
-                .primary_key   = 0xffff'ffff'ffff'ffff,
-            },
-        .max_results = std::min((uint32_t)100, params.limit),
-    });
-
-    // todo: rope
-    std::string result = "{\"rows\":[";
-    bool        found  = false;
-    eosio::for_each_query_result<eosio::contract_secondary_index_with_row<T>>(s, [&](eosio::contract_secondary_index_with_row<T>& r) {
-        if (!r.present || !r.row_present)
-            return true;
-        if (found)
-            result += ',';
-        found = true;
-        if (params.show_payer)
-            result += "{\"data\":";
-        bool decoded = false;
-        if (table_type) {
-            abieos::input_buffer bin{r.row_value->pos(), r.row_value->pos() + r.row_value->remaining()};
-            std::string          error;
-            std::string          json_row;
-            if (bin_to_json(bin, error, table_type, json_row)) {
-                result += json_row;
-                decoded = true;
-            }
-        }
-        if (!decoded) {
-            result += '"';
-            abieos::hex(r.row_value->pos(), r.row_value->pos() + r.row_value->remaining(), std::back_inserter(result));
-            result += '"';
-        }
-        if (params.show_payer)
-            result += ",\"payer\":\"" + r.payer.to_string() + "\"}";
-        return true;
-    });
-    result += "]}";
-    eosio::set_output_data(result);
+    table_rows_writer writer{params, abi, max_rows};
+    for_each_query_result_batched<eosio::contract_secondary_index_with_row_view<T>>(
+        eosio::query_contract_index64_range_code_table_scope_sk_pk{
+            .snapshot_block = status.head,
+            .first =
+                {
+                    .code          = params.code,
+                    .table         = params.table,
+                    .scope         = eosio::name{scope},
+                    .secondary_key = lower_bound,
+                    .primary_key   = 0,
+                },
+            .last =
+                {
+                    .code          = params.code,
+                    .table         = params.table,
+                    .scope         = eosio::name{scope},
+                    .secondary_key = upper_bound,
+                    .primary_key   = 0xffff'ffff'ffff'ffff,
+                },
+        },
+        [&](const eosio::contract_secondary_index_with_row_view<T>& r) {
+            return !r.present() || !r.row_present() || writer.add(r.row_value(), r.payer(), r.secondary_key());
+        });
+    writer.finish();
 } // get_table_rows_secondary
 
-void get_table_rows(std::string_view request, const eosio::database_status& status) {
+void get_table_rows(std::string_view request) {
+    auto status = eosio::get_database_status();
     auto                   params           = eosio::parse_json<get_table_rows_params>(request);
     bool                   primary          = false;
     auto                   table_with_index = get_table_index_name(params, primary);
-    std::unique_ptr<::abi> abi              = params.json ? get_abi(params.code, status.head) : nullptr;
-    auto                   table_type       = get_table_type(abi.get(), abieos::name{params.table.value});
-    auto                   scope            = guess_uint64(*params.scope, "scope");
+    std::optional<raw_abi> abi;
+    if (params.json)
+        abi = get_raw_abi(params.code, status.head);
+    auto scope = guess_uint64(*params.scope, "scope");
 
     if (primary)
-        get_table_rows_primary(params, status, scope, table_type);
+        get_table_rows_primary(params, status, scope, abi ? &*abi : nullptr, max_table_rows);
     else if (*params.key_type == "i64" || *params.key_type == "name")
-        get_table_rows_secondary<uint64_t>(params, status, scope, table_type);
+        get_table_rows_secondary<uint64_t>(params, status, scope, abi ? &*abi : nullptr, max_table_rows);
     else
         eosio::check(false, ("unsupported key_type: " + (std::string)(*params.key_type)).c_str());
 }
 
-void get_producer_schedule(std::string_view /*request*/, const eosio::database_status& status) {
+/// Like get_table_rows, but scans the primary index in one reply of up to max_export_rows rows; `limit` is ignored
+void export_table_rows(std::string_view request) {
+    auto                   status           = eosio::get_database_status();
+    auto                   params           = eosio::parse_json<get_table_rows_params>(request);
+    bool                   primary          = false;
+    auto                   table_with_index = get_table_index_name(params, primary);
+    std::optional<raw_abi> abi;
+    if (!primary)
+        eosio::check(false, "export_table_rows only supports the primary index");
+    if (params.json)
+        abi = get_raw_abi(params.code, status.head);
+    params.limit = max_export_rows;
+    get_table_rows_primary(params, status, guess_uint64(*params.scope, "scope"), abi ? &*abi : nullptr, max_export_rows);
+}
+
+void get_producer_schedule(std::string_view /*request*/) {
+    auto status = eosio::get_database_status();
     get_table_rows_params params{
         .code     = "eosio"_n,
         .table    = "producers"_n,
@@ -510,7 +531,8 @@ void get_producer_schedule(std::string_view /*request*/, const eosio::database_s
     eosio::set_output_data(result);
 }
 
-void get_currency_balance(std::string_view request, const eosio::database_status& status) {
+void get_currency_balance(std::string_view request) {
+    auto status = eosio::get_database_status();
     auto                  user_params = eosio::parse_json<get_currency_balance_params>(request);
     get_table_rows_params params{
         .code     = user_params.code,
@@ -519,10 +541,8 @@ void get_currency_balance(std::string_view request, const eosio::database_status
         .json     = true,
         .limit    = 10,
     };
-    bool                   primary          = false;
-    auto                   table_with_index = get_table_index_name(params, primary);
-    std::unique_ptr<::abi> abi              = params.json ? get_abi(params.code, status.head) : nullptr;
-    auto                   table_type       = get_table_type(abi.get(), abieos::name{params.table.value});
+    bool primary          = false;
+    auto table_with_index = get_table_index_name(params, primary);
 
     if (!primary)
         eosio::check(false, ("accounts table missing or missing primary index"));
@@ -559,7 +579,7 @@ void get_currency_balance(std::string_view request, const eosio::database_status
     eosio::set_output_data(result);
 }
 
-void get_transaction(std::string_view request, const eosio::database_status& /*status*/) {
+void get_transaction(std::string_view request) {
     auto params = eosio::parse_json<get_transaction_params>(request);
 
     auto s = query_database(eosio::query_transaction_receipt{
@@ -587,7 +607,7 @@ void get_transaction(std::string_view request, const eosio::database_status& /*s
     eosio::set_output_data(result);
 }
 
-void get_actions(std::string_view request, const eosio::database_status& /*status*/) {
+void get_actions(std::string_view request) {
     auto params = eosio::parse_json<get_actions_params>(request);
     auto s      = query_database(eosio::query_action_trace_receipt_receiver{
         .snapshot_block = std::numeric_limits<uint32_t>::max(),
@@ -609,16 +629,14 @@ void get_actions(std::string_view request, const eosio::database_status& /*statu
     });
 
     std::vector<eosio::action_trace> actions;
-    std::string                      result;
     eosio::for_each_query_result<eosio::action_trace>(s, [&](eosio::action_trace& r) {
         actions.emplace_back(r);
         return true;
     });
-    result += eosio::to_json(actions).sv();
-    eosio::set_output_data(result);
+    eosio::set_output_data(eosio::to_json(actions));
 }
 
-void get_block(std::string_view request, const eosio::database_status& /*status*/) {
+void get_block(std::string_view request) {
     auto        params = eosio::parse_json<get_block_params>(request);
     std::string error;
     uint32_t    block_num_or_id;
@@ -640,7 +658,7 @@ void get_block(std::string_view request, const eosio::database_status& /*status*
     eosio::set_output_data(result);
 }
 
-void get_account(std::string_view request, const eosio::database_status& /*status*/) {
+void get_account(std::string_view request) {
     auto params = eosio::parse_json<get_account_params>(request);
 
     auto s = query_database(eosio::query_account_range_name{
@@ -658,7 +676,7 @@ void get_account(std::string_view request, const eosio::database_status& /*statu
     eosio::set_output_data(result);
 }
 
-void get_code(std::string_view request, const eosio::database_status& /*status*/) {
+void get_code(std::string_view request) {
     auto params = eosio::parse_json<get_account_params>(request);
 
     auto s = query_database(eosio::query_account_range_name{
@@ -677,7 +695,7 @@ void get_code(std::string_view request, const eosio::database_status& /*status*/
     eosio::set_output_data(result);
 }
 
-void get_abi(std::string_view request, const eosio::database_status& /*status*/) {
+void get_abi(std::string_view request) {
     auto params = eosio::parse_json<get_account_params>(request);
 
     auto s = query_database(eosio::query_account_range_name{
@@ -703,26 +721,28 @@ struct request_data {
 extern "C" __attribute__((eosio_wasm_entry)) void initialize() {}
 
 extern "C" void run_query() {
+    // only the handlers which work at head read the status; wasm-ql may cache the others' replies
     auto request = eosio::unpack<request_data>(eosio::get_input_data());
-    auto status  = eosio::get_database_status();
     if (*request.target == "/v1/chain/get_table_rows")
-        get_table_rows(*request.request, status);
+        get_table_rows(*request.request);
+    else if (*request.target == "/v1/chain/export_table_rows")
+        export_table_rows(*request.request);
     else if (*request.target == "/v1/history/get_transaction")
-        get_transaction(*request.request, status);
+        get_transaction(*request.request);
     else if (*request.target == "/v1/history/get_actions")
-        get_actions(*request.request, status);
+        get_actions(*request.request);
     else if (*request.target == "/v1/chain/get_block")
-        get_block(*request.request, status);
+        get_block(*request.request);
     else if (*request.target == "/v1/chain/get_account")
-        get_account(*request.request, status);
+        get_account(*request.request);
     else if (*request.target == "/v1/chain/get_code")
-        get_code(*request.request, status);
+        get_code(*request.request);
     else if (*request.target == "/v1/chain/get_abi")
-        get_abi(*request.request, status);
+        get_abi(*request.request);
     else if (*request.target == "/v1/chain/get_producer_schedule")
-        get_producer_schedule(*request.request, status);
+        get_producer_schedule(*request.request);
     else if (*request.target == "/v1/chain/get_currency_balance")
-        get_currency_balance(*request.request, status);
+        get_currency_balance(*request.request);
     else
         eosio::check(false, "not found");
 }
@@ -12,16 +12,16 @@ struct transfer {
     eosio::shared_memory<std::string_view> memo     = {};
 };
 
-void process(token_transfer_request& req, const eosio::database_status& status) {
+void process(token_transfer_request& req) {
     using query_type = eosio::query_action_trace_range_name_receiver_account_block_trans_action;
     auto s           = query_database(query_type{
-        .snapshot_block = get_block_num(req.snapshot_block, status),
+        .snapshot_block = get_block_num(req.snapshot_block),
         .first =
             {
                 .name           = "transfer"_n,
                 .receiver       = req.first_key.receiver,
                 .account        = req.first_key.account,
-                .block_num      = get_block_num(req.first_key.block, status),
+                .block_num      = get_block_num(req.first_key.block),
                 .transaction_id = req.first_key.transaction_id,
                 .action_ordinal = req.first_key.action_ordinal,
             },
@@ -30,7 +30,7 @@ void process(token_transfer_request& req, const eosio::database_status& status)
                 .name           = "transfer"_n,
                 .receiver       = req.last_key.receiver,
                 .account        = req.last_key.account,
-                .block_num      = get_block_num(req.last_key.block, status),
+                .block_num      = get_block_num(req.last_key.block),
                 .transaction_id = req.last_key.transaction_id,
                 .action_ordinal = req.last_key.action_ordinal,
             },
@@ -82,9 +82,9 @@ void process(token_transfer_request& req, const eosio::database_status& status)
     eosio::set_output_data(pack(token_query_response{std::move(response)}));
 }
 
-void process(balances_for_multiple_accounts_request& req, const eosio::database_status& status) {
+void process(balances_for_multiple_accounts_request& req) {
     auto s = query_database(eosio::query_contract_row_range_code_table_pk_scope{
-        .snapshot_block = get_block_num(req.snapshot_block, status),
+        .snapshot_block = get_block_num(req.snapshot_block),
         .first =
             {
                 .code        = req.code,
@@ -112,9 +112,9 @@ void process(balances_for_multiple_accounts_request& req, const eosio::database_
     eosio::set_output_data(pack(token_query_response{std::move(response)}));
 }
 
-void process(balances_for_multiple_tokens_request& req, const eosio::database_status& status) {
+void process(balances_for_multiple_tokens_request& req) {
     auto s = query_database(eosio::query_contract_row_range_scope_table_pk_code{
-        .snapshot_block = get_block_num(req.snapshot_block, status),
+        .snapshot_block = get_block_num(req.snapshot_block),
         .first =
             {
                 .scope       = req.account,
@@ -154,5 +154,5 @@ extern "C" __attribute__((eosio_wasm_entry)) void initialize() {}
 
 extern "C" void run_query() {
     auto request = eosio::unpack<token_query_request>(eosio::get_input_data());
-    std::visit([](auto& x) { process(x, eosio::get_database_status()); }, request.value);
+    std::visit([](auto& x) { process(x); }, request.value);
 }